@@ -37,6 +37,7 @@
 #include "openmm/NonbondedForce.h"
 #include <map>
 #include <set>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 #include "internal/windowsExportNativeNonbonded.h"
@@ -75,10 +76,29 @@ namespace NativeNonbondedPlugin {
  * to specify the distance at which the interaction should begin to decrease.  The switching distance must be
  * less than the cutoff distance.
  *
+ * By default the same cutoff is used for Coulomb and Lennard-Jones interactions.  Call setLJCutoffDistance() to give
+ * the Lennard-Jones interaction its own cutoff.  The value returned by getCutoffDistance() then applies only to the
+ * direct space Coulomb interaction, which makes it a free parameter for methods such as PME: a shorter Coulomb cutoff
+ * moves work from direct space to the reciprocal space grid.  The neighbor list is built with the larger of the two
+ * cutoffs, and each interaction is truncated at its own.
+ *
+ * For multiple time step integrators, the direct space interactions can be divided into an inner and an outer
+ * shell by calling setInnerCutoffDistance() and setInnerSwitchingDistance().  Every pair interaction is multiplied
+ * by a splitting function that goes smoothly from 1 at the inner switching distance to 0 at the inner cutoff.
+ * That part is included in the force group of this object, and the remainder in the group specified with
+ * setOuterShellForceGroup().  Both parts are computed from the same neighbor list.
+ *
+ * For interfaces and other systems that are periodic in only two dimensions, place the system in a box that is
+ * padded with vacuum along the z axis and call setUseSlabCorrection().  With PME, the system is then treated as a
+ * slab that is periodic along x and y.  The reciprocal space grid only spans the particles plus a gap of one cutoff,
+ * however much vacuum the box contains, and corrections are added for the dipole moment of the slab and its
+ * interaction with its periodic copies.
+ *
  * Another optional feature of this class (enabled by default) is to add a contribution to the energy which approximates
  * the effect of all Lennard-Jones interactions beyond the cutoff in a periodic system.  When running a simulation
  * at constant pressure, this can improve the quality of the result.  Call setUseDispersionCorrection() to set whether
- * this should be used.
+ * this should be used.  The correction is computed from the current values of any Context parameters that offset
+ * sigma or epsilon (see below).
  * 
  * In some applications, it is useful to be able to inexpensively change the parameters of small groups of particles.
  * Usually this is done to interpolate between two sets of parameters.  For nativenonbonded, a titratable group might have
@@ -109,6 +129,14 @@ namespace NativeNonbondedPlugin {
  * of the Context parameter.  A single Context parameter can apply offsets to multiple particles,
  * and multiple parameters can be used to apply offsets to the same particle.  Parameters can also be used
  * to modify exceptions in exactly the same way by calling addExceptionParameterOffset().
+ *
+ * Instead of giving every particle its own sigma and epsilon, you can describe the Lennard-Jones interaction with
+ * a table of atom types.  Call addLJType() to define each type, then setParticleLJType() to assign one to every
+ * particle.  Two types interact using the Lorentz-Berthelot combining rule, unless you call addLJTypePair() to
+ * specify different parameters for that pair of types (as done by the NBFIX terms of the CHARMM force field).
+ * Once any type has been defined, the sigma and epsilon passed to addParticle() are ignored.  Exceptions still
+ * specify their own parameters.  Atom types cannot be used with LJPME, or with parameter offsets that change sigma
+ * or epsilon.
  */
 
 class OPENMM_EXPORT_NATIVENONBONDED NativeNonbondedForce : public Force {
@@ -147,7 +175,69 @@ public:
          * Periodic boundary conditions are used, and Particle-Mesh Ewald (PME) summation is used to compute the interaction of each particle
          * with all periodic copies of every other particle for both Coulomb and Lennard-Jones.  No switching is used for either interaction.
          */
-        LJPME = 5
+        LJPME = 5,
+        /**
+         * Periodic boundary conditions are used, and the multilevel summation method (MSM) is used to compute the Coulomb
+         * interaction of each particle with all periodic copies of every other particle.  The long range part is computed
+         * on a hierarchy of grids with purely local operations, so the cost scales linearly with the number of particles
+         * and no FFTs are needed.  Lennard-Jones interactions are truncated at the cutoff as with PME.
+         */
+        MSM = 6,
+        /**
+         * Periodic boundary conditions are used, and Coulomb interactions are computed with the damped shifted force (DSF)
+         * method of Fennell and Gezelter.  The interaction is damped with erfc(alpha*r)/r, and both it and its derivative
+         * are shifted to go to zero at the cutoff distance.  This gives energies and forces close to those of Ewald
+         * summation for condensed phase systems, but involves no reciprocal space calculation.
+         */
+        DampedShiftedForce = 7,
+        /**
+         * Periodic boundary conditions are used, and the Coulomb interaction is computed with Random Batch Ewald (RBE).
+         * The direct space part is the same as for Ewald summation, but instead of summing over all wave vectors,
+         * each evaluation samples a small batch of them from the distribution defined by the Gaussian factor
+         * exp(-k^2/4alpha^2).  This gives unbiased estimates of the reciprocal space forces and energy at a cost that
+         * scales linearly with the number of particles and the batch size.  Like Ewald, it requires a rectangular box.
+         */
+        RandomBatchEwald = 8,
+        /**
+         * Periodic boundary conditions are used, and the Coulomb interaction is computed with the particle-particle
+         * particle-mesh (P3M) method.  Charges are spread and forces interpolated exactly as for PME, but the convolution
+         * uses the influence function of Hockney and Eastwood that is optimal for the B-spline assignment function.  This
+         * gives the same accuracy as PME on a noticeably coarser grid.  The grid is specified with setPMEParameters(),
+         * and when it is chosen automatically a P3M specific error estimate is used.
+         */
+        P3M = 9,
+        /**
+         * No periodic boundary conditions are used, and the Coulomb interaction between every pair of particles is
+         * computed with the fast multipole method (FMM).  Particles are sorted into an octree, nearby pairs are
+         * computed directly, and all others through multipole expansions, so the cost scales linearly with the number
+         * of particles.  Lennard-Jones interactions are truncated at the cutoff distance as with CutoffNonPeriodic,
+         * but no reaction field approximation is applied to the Coulomb interaction.
+         */
+        FMM = 10,
+        /**
+         * Periodic boundary conditions are used, and long range Coulomb and dispersion interactions are computed with
+         * the isotropic periodic sum (IPS) method of Wu and Brooks.  The region beyond the cutoff is approximated by
+         * isotropically distributed images of the region inside it, which adds a polynomial in r to the Coulomb and
+         * r^-6 potentials of every pair within the cutoff, so the cost is the same as for CutoffPeriodic.  Both
+         * potentials and their forces go smoothly to zero at the cutoff.  Excluded pairs within the cutoff interact
+         * through the Coulomb polynomial alone, and every particle has a Coulomb self energy.  The r^-12 term of the
+         * Lennard-Jones interaction is truncated at the cutoff.  The switching function and the dispersion correction
+         * are not used with this method.
+         */
+        IPS = 11,
+        /**
+         * Periodic boundary conditions are used, and the Coulomb interaction is computed with the u-series method of
+         * Predescu et al.  1/r is approximated by a sum of Gaussians whose widths form a geometric series.  The narrow
+         * ones, which vanish beyond the cutoff, make up the direct space interaction, and the wide ones are computed on
+         * grids with the same spreading and interpolation as PME.  Because even the narrowest long range Gaussian is
+         * wider than the Ewald one giving the same direct space error, the finest grid can be coarser than for PME.
+         * Each doubling of the width moves the Gaussians to a grid that is twice as coarse, and the widest ones,
+         * which need only a few wave vectors, are summed directly.  The parameters are specified with
+         * setPMEParameters(), where alpha is the inverse width of the narrowest long range Gaussian and the grid
+         * dimensions are those of the finest grid, and the spacing of the series is chosen based on the Ewald error
+         * tolerance.
+         */
+        USeries = 12
     };
     /**
      * Create a NativeNonbondedForce.
@@ -184,6 +274,24 @@ public:
     int getNumExceptionParameterOffsets() const {
         return exceptionOffsets.size();
     }
+    /**
+     * Get the number of Lennard-Jones atom types that have been added.
+     */
+    int getNumLJTypes() const {
+        return ljTypes.size();
+    }
+    /**
+     * Get the number of pairs of atom types whose Lennard-Jones parameters override the combining rule.
+     */
+    int getNumLJTypePairs() const {
+        return ljTypePairs.size();
+    }
+    /**
+     * Get whether the Lennard-Jones interaction is described by atom types.  This is true if any type has been added.
+     */
+    bool getUseLJTypes() const {
+        return ljTypes.size() > 0;
+    }
     /**
      * Get the method used for handling long range nonbonded interactions.
      */
@@ -206,6 +314,22 @@ public:
      * @param distance    the cutoff distance, measured in nm
      */
     void setCutoffDistance(double distance);
+    /**
+     * Get the cutoff distance (in nm) being used for Lennard-Jones interactions.  If this is 0 (the default), the
+     * value returned by getCutoffDistance() is used for both Coulomb and Lennard-Jones interactions.
+     *
+     * @return the Lennard-Jones cutoff distance, measured in nm
+     */
+    double getLJCutoffDistance() const;
+    /**
+     * Set the cutoff distance (in nm) being used for Lennard-Jones interactions.  If this is 0 (the default), the
+     * value returned by getCutoffDistance() is used for both Coulomb and Lennard-Jones interactions.  Otherwise,
+     * getCutoffDistance() only applies to Coulomb interactions.  A separate Lennard-Jones cutoff cannot be used
+     * with the LJPME or FMM methods.
+     *
+     * @param distance    the Lennard-Jones cutoff distance, measured in nm
+     */
+    void setLJCutoffDistance(double distance);
     /**
      * Get whether a switching function is applied to the Lennard-Jones interaction.  If the nonbonded method is set
      * to NoCutoff, this option is ignored.
@@ -218,14 +342,36 @@ public:
     void setUseSwitchingFunction(bool use);
     /**
      * Get the distance at which the switching function begins to reduce the Lennard-Jones interaction.  This must be
-     * less than the cutoff distance.
+     * less than the Lennard-Jones cutoff distance.
      */
     double getSwitchingDistance() const;
     /**
      * Set the distance at which the switching function begins to reduce the Lennard-Jones interaction.  This must be
-     * less than the cutoff distance.
+     * less than the Lennard-Jones cutoff distance.
      */
     void setSwitchingDistance(double distance);
+    /**
+     * Get the inner cutoff distance (in nm), which divides direct space interactions into an inner and an outer
+     * shell.  If this is 0 (the default), direct space is not divided.
+     */
+    double getInnerCutoffDistance() const;
+    /**
+     * Set the inner cutoff distance (in nm), which divides direct space interactions into an inner and an outer
+     * shell.  If this is 0 (the default), direct space is not divided.  Otherwise it must be less than the cutoff
+     * distance, and the nonbonded method must truncate all direct space interactions at the cutoff, which excludes
+     * NoCutoff and FMM.
+     */
+    void setInnerCutoffDistance(double distance);
+    /**
+     * Get the distance (in nm) at which the splitting function begins to move pair interactions from the inner to
+     * the outer shell.  It must be less than the inner cutoff distance.
+     */
+    double getInnerSwitchingDistance() const;
+    /**
+     * Set the distance (in nm) at which the splitting function begins to move pair interactions from the inner to
+     * the outer shell.  It must be less than the inner cutoff distance.
+     */
+    void setInnerSwitchingDistance(double distance);
     /**
      * Get the dielectric constant to use for the solvent in the reaction field approximation.
      */
@@ -295,7 +441,7 @@ public:
      */
     void setLJPMEParameters(double alpha, int nx, int ny, int nz);
     /**
-     * Get the parameters being used for PME in a particular Context.  Because some platforms have restrictions
+     * Get the parameters being used for PME, P3M, or USeries in a particular Context.  Because some platforms have restrictions
      * on the allowed grid sizes, the values that are actually used may be slightly different from those
      * specified with setPMEParameters(), or the standard values calculated based on the Ewald error tolerance.
      * See the manual for details.
@@ -320,6 +466,134 @@ public:
      * @param[out] nz      the number of grid points along the Z axis
      */
     void getLJPMEParametersInContext(const Context& context, double& alpha, int& nx, int& ny, int& nz) const;
+    /**
+     * Get the fractional change in the periodic box volume that causes the PME grid dimensions to be recomputed.
+     * See setPMEGridResizeThreshold() for details.
+     */
+    double getPMEGridResizeThreshold() const;
+    /**
+     * Set the fractional change in the periodic box volume that causes the PME grid dimensions to be recomputed.
+     * Normally the grid dimensions are selected once, when a Context is created, based on the default periodic
+     * box vectors of the System.  In a constant pressure simulation the box may later grow or shrink enough that
+     * the grid becomes either too coarse for the requested accuracy or needlessly fine.  If this is set to a value
+     * greater than 0, each Context keeps track of the box volume for which its grid was chosen.  Whenever the current
+     * volume differs from it by more than this fraction, the grid dimensions are recomputed from the error tolerance
+     * and the current box, without needing to reinitialize the Context.
+     *
+     * This only affects grids whose parameters are chosen automatically.  If setPMEParameters() or setLJPMEParameters()
+     * has been used to set alpha to something other than 0, the corresponding grid never changes.  The default value
+     * is 0, which means the grid dimensions are never recomputed.
+     *
+     * @param threshold   the fractional change in volume that triggers a new choice of grid dimensions
+     */
+    void setPMEGridResizeThreshold(double threshold);
+    /**
+     * Get whether the system is treated as a slab that is periodic only along the x and y axes.  See
+     * setUseSlabCorrection() for details.
+     */
+    bool getUseSlabCorrection() const;
+    /**
+     * Set whether the system is treated as a slab that is periodic only along the x and y axes.  This may only be
+     * used with PME, and the third periodic box vector must be parallel to the z axis.  The box should be padded with
+     * vacuum along z.  Each time forces are computed, the largest gap between particles along z is located, and the
+     * reciprocal space calculation uses a box whose height is that of the slab plus one cutoff, with the same grid
+     * spacing along z as the full box.  The Yeh-Berkowitz dipole correction and the electrostatic layer correction
+     * (ELC) are then added, so the energy equals that of a slab periodic in two dimensions to within the Ewald error
+     * tolerance, independent of how much vacuum there is.  A system with a net charge also includes the energy of a
+     * neutralizing background.
+     *
+     * The dispersion correction assumes a uniform density, so it is usually not appropriate for a slab.
+     *
+     * @param use    true to treat the system as a slab
+     */
+    void setUseSlabCorrection(bool use);
+    /**
+     * Get the parameters to use for MSM calculations.
+     *
+     * @param[out] numLevels   the number of grid levels, or 0 if it is chosen automatically
+     * @param[out] order       the interpolation order (4 for cubic or 6 for quintic basis functions)
+     */
+    void getMSMParameters(int& numLevels, int& order) const;
+    /**
+     * Set the parameters to use for MSM calculations.  The spacing of the finest grid is always chosen based on
+     * the Ewald error tolerance and the cutoff distance.  Each additional level doubles the grid spacing.  If
+     * numLevels is 0 (the default), levels are added until the coarsest grid has at most 8 points along each axis.
+     * Order 6 (the default) is more accurate for a given grid spacing than order 4, at the cost of larger stencils.
+     *
+     * @param numLevels   the number of grid levels, or 0 to choose it automatically
+     * @param order       the interpolation order (4 or 6)
+     */
+    void setMSMParameters(int numLevels, int order);
+    /**
+     * Get the parameters being used for MSM in a particular Context.
+     *
+     * @param context          the Context for which to get the parameters
+     * @param[out] numLevels   the number of grid levels
+     * @param[out] nx          the number of points along the X axis of the finest grid
+     * @param[out] ny          the number of points along the Y axis of the finest grid
+     * @param[out] nz          the number of points along the Z axis of the finest grid
+     */
+    void getMSMParametersInContext(const Context& context, int& numLevels, int& nx, int& ny, int& nz) const;
+    /**
+     * Get the parameters to use for FMM calculations.
+     *
+     * @param[out] order       the order of the multipole and local expansions
+     * @param[out] treeDepth   the number of times the cube enclosing the particles is subdivided, or 0 if it is chosen automatically
+     */
+    void getFMMParameters(int& order, int& treeDepth) const;
+    /**
+     * Set the parameters to use for FMM calculations.  Higher orders are more accurate but more expensive.  The
+     * default order of 8 gives relative force errors of a few times 1e-4.  Each level of the tree divides every cell
+     * into eight.  If treeDepth is 0 (the default), it is chosen so that the smallest cells hold a few dozen particles
+     * on average.
+     *
+     * @param order       the order of the multipole and local expansions
+     * @param treeDepth   the number of times the cube enclosing the particles is subdivided, or 0 to choose it automatically
+     */
+    void setFMMParameters(int order, int treeDepth);
+    /**
+     * Get the damping parameter alpha used by the DampedShiftedForce method, measured in inverse nm.
+     */
+    double getDSFAlpha() const;
+    /**
+     * Set the damping parameter alpha used by the DampedShiftedForce method, measured in inverse nm.  The default value
+     * of 2.0 (0.2 inverse Angstroms) is the one recommended by Fennell and Gezelter for a cutoff of about 1.2 nm.  A value
+     * of 0 gives an undamped shifted force potential.
+     *
+     * @param alpha    the damping parameter
+     */
+    void setDSFAlpha(double alpha);
+    /**
+     * Get the number of wave vectors sampled in each evaluation of the RandomBatchEwald method.
+     */
+    int getRBEBatchSize() const;
+    /**
+     * Set the number of wave vectors sampled in each evaluation of the RandomBatchEwald method.  Larger batches
+     * reduce the variance of the reciprocal space forces at a proportionally higher cost.  The default is 100.
+     *
+     * @param size    the number of wave vectors in each batch
+     */
+    void setRBEBatchSize(int size);
+    /**
+     * Get the random number seed used to sample wave vectors for the RandomBatchEwald method.  See setRandomNumberSeed()
+     * for details.
+     */
+    int getRandomNumberSeed() const;
+    /**
+     * Set the random number seed used to sample wave vectors for the RandomBatchEwald method.  The precise meaning of
+     * this parameter is undefined, and is left up to each Platform to interpret in an appropriate way.  It is
+     * guaranteed that if two simulations are run with different random number seeds, the sequence of batches will
+     * be different.  On the other hand, no guarantees are made about the behavior of simulations that use the same
+     * seed.  In particular, Platforms are permitted to use non-deterministic algorithms which produce different
+     * results on successive runs, even if those runs were initialized identically.
+     *
+     * If seed is set to 0 (which is the default value assigned), a unique seed is chosen when a Context is created
+     * from this Force.  This is done to ensure that each Context receives unique random seeds without you needing
+     * to set them explicitly.
+     *
+     * @param seed    the random number seed
+     */
+    void setRandomNumberSeed(int seed);
     /**
      * Add the nonbonded force parameters for a particle.  This should be called once for each particle
      * in the System.  When it is called for the i'th time, it specifies the parameters for the i'th particle.
@@ -405,7 +679,8 @@ public:
     /**
      * Identify exceptions based on the molecular topology.  Particles which are separated by one or two bonds are set
      * to not interact at all, while pairs of particles separated by three bonds (known as "1-4 interactions") have
-     * their Coulomb and Lennard-Jones interactions reduced by a fixed factor.
+     * their Coulomb and Lennard-Jones interactions reduced by a fixed factor.  If atom types are used, the
+     * Lennard-Jones parameters of each 1-4 interaction are taken from the types of the two particles.
      *
      * @param bonds           the set of bonds based on which to construct exceptions.  Each element specifies the indices of
      *                        two particles that are bonded to each other.
@@ -415,6 +690,70 @@ public:
      *                        multiplied by this factor
      */
     void createExceptionsFromBonds(const std::vector<std::pair<int, int> >& bonds, double coulomb14Scale, double lj14Scale);
+    /**
+     * Add many particles at once.  This is equivalent to calling addParticle() for each element of the arrays,
+     * but is much faster for large systems.
+     *
+     * @param charges    the charge of each particle, measured in units of the proton charge
+     * @param sigmas     the sigma parameter of each particle, measured in nm
+     * @param epsilons   the epsilon parameter of each particle, measured in kJ/mol
+     * @return the index of the first particle that was added
+     */
+    int addParticles(const std::vector<double>& charges, const std::vector<double>& sigmas, const std::vector<double>& epsilons);
+    /**
+     * Get the nonbonded force parameters of all particles.
+     *
+     * @param[out] charges    the charge of each particle, measured in units of the proton charge
+     * @param[out] sigmas     the sigma parameter of each particle, measured in nm
+     * @param[out] epsilons   the epsilon parameter of each particle, measured in kJ/mol
+     */
+    void getAllParticleParameters(std::vector<double>& charges, std::vector<double>& sigmas, std::vector<double>& epsilons) const;
+    /**
+     * Set the nonbonded force parameters of all particles.  Each array must have one element for every particle.
+     *
+     * @param charges    the charge of each particle, measured in units of the proton charge
+     * @param sigmas     the sigma parameter of each particle, measured in nm
+     * @param epsilons   the epsilon parameter of each particle, measured in kJ/mol
+     */
+    void setAllParticleParameters(const std::vector<double>& charges, const std::vector<double>& sigmas, const std::vector<double>& epsilons);
+    /**
+     * Add many exceptions at once.  This is equivalent to calling addException() for each element of the arrays,
+     * but is much faster for large systems.
+     *
+     * @param particles1   the index of the first particle involved in each interaction
+     * @param particles2   the index of the second particle involved in each interaction
+     * @param chargeProds  the scaled product of the atomic charges for each interaction, measured in units of the proton charge squared
+     * @param sigmas       the sigma parameter of each interaction, measured in nm
+     * @param epsilons     the epsilon parameter of each interaction, measured in kJ/mol
+     * @param replace      determines the behavior if there is already an exception for the same two particles.  If true, the existing one is replaced.
+     *                     If false, an exception is thrown.
+     * @return the index of the first exception that was added.  If replace is true, some of the exceptions may instead have
+     *         replaced existing ones.
+     */
+    int addExceptions(const std::vector<int>& particles1, const std::vector<int>& particles2, const std::vector<double>& chargeProds,
+                      const std::vector<double>& sigmas, const std::vector<double>& epsilons, bool replace = false);
+    /**
+     * Get the force field parameters of all exceptions.
+     *
+     * @param[out] particles1   the index of the first particle involved in each interaction
+     * @param[out] particles2   the index of the second particle involved in each interaction
+     * @param[out] chargeProds  the scaled product of the atomic charges for each interaction, measured in units of the proton charge squared
+     * @param[out] sigmas       the sigma parameter of each interaction, measured in nm
+     * @param[out] epsilons     the epsilon parameter of each interaction, measured in kJ/mol
+     */
+    void getAllExceptionParameters(std::vector<int>& particles1, std::vector<int>& particles2, std::vector<double>& chargeProds,
+                                   std::vector<double>& sigmas, std::vector<double>& epsilons) const;
+    /**
+     * Set the force field parameters of all exceptions.  Each array must have one element for every exception.
+     *
+     * @param particles1   the index of the first particle involved in each interaction
+     * @param particles2   the index of the second particle involved in each interaction
+     * @param chargeProds  the scaled product of the atomic charges for each interaction, measured in units of the proton charge squared
+     * @param sigmas       the sigma parameter of each interaction, measured in nm
+     * @param epsilons     the epsilon parameter of each interaction, measured in kJ/mol
+     */
+    void setAllExceptionParameters(const std::vector<int>& particles1, const std::vector<int>& particles2, const std::vector<double>& chargeProds,
+                                   const std::vector<double>& sigmas, const std::vector<double>& epsilons);
     /**
      * Add a new global parameter that parameter offsets may depend on.  The default value provided to
      * this method is the initial value of the parameter in newly created Contexts.  You can change
@@ -523,6 +862,76 @@ public:
      * @param epsilonScale    this value multiplied by the parameter value is added to the exception's epsilon
      */
     void setExceptionParameterOffset(int index, const std::string& parameter, int exceptionIndex, double chargeProdScale, double sigmaScale, double epsilonScale);
+    /**
+     * Add a Lennard-Jones atom type.  Once any type has been added, every particle must be assigned one with
+     * setParticleLJType(), and its type is used in place of its own sigma and epsilon.
+     *
+     * @param sigma     the sigma parameter of the Lennard-Jones potential for this type, measured in nm
+     * @param epsilon   the epsilon parameter of the Lennard-Jones potential for this type, measured in kJ/mol
+     * @return the index of the type that was added
+     */
+    int addLJType(double sigma, double epsilon);
+    /**
+     * Get the parameters of a Lennard-Jones atom type.
+     *
+     * @param index          the index of the type for which to get parameters
+     * @param[out] sigma     the sigma parameter of the Lennard-Jones potential for this type, measured in nm
+     * @param[out] epsilon   the epsilon parameter of the Lennard-Jones potential for this type, measured in kJ/mol
+     */
+    void getLJTypeParameters(int index, double& sigma, double& epsilon) const;
+    /**
+     * Set the parameters of a Lennard-Jones atom type.
+     *
+     * @param index     the index of the type for which to set parameters
+     * @param sigma     the sigma parameter of the Lennard-Jones potential for this type, measured in nm
+     * @param epsilon   the epsilon parameter of the Lennard-Jones potential for this type, measured in kJ/mol
+     */
+    void setLJTypeParameters(int index, double sigma, double epsilon);
+    /**
+     * Get the Lennard-Jones atom type of a particle.
+     *
+     * @param index     the index of the particle
+     * @return the index of its type, or -1 if none has been assigned
+     */
+    int getParticleLJType(int index) const;
+    /**
+     * Set the Lennard-Jones atom type of a particle.
+     *
+     * @param index     the index of the particle
+     * @param type      the index of its type, as returned by addLJType(), or -1 to remove it
+     */
+    void setParticleLJType(int index, int type);
+    /**
+     * Specify the Lennard-Jones parameters for the interaction between two atom types, overriding the ones given
+     * by the combining rule.
+     *
+     * @param type1     the index of the first type
+     * @param type2     the index of the second type
+     * @param sigma     the sigma parameter of the interaction, measured in nm
+     * @param epsilon   the epsilon parameter of the interaction, measured in kJ/mol
+     * @return the index of the pair that was added
+     */
+    int addLJTypePair(int type1, int type2, double sigma, double epsilon);
+    /**
+     * Get the Lennard-Jones parameters for the interaction between two atom types.
+     *
+     * @param index          the index of the pair for which to get parameters, as returned by addLJTypePair()
+     * @param[out] type1     the index of the first type
+     * @param[out] type2     the index of the second type
+     * @param[out] sigma     the sigma parameter of the interaction, measured in nm
+     * @param[out] epsilon   the epsilon parameter of the interaction, measured in kJ/mol
+     */
+    void getLJTypePairParameters(int index, int& type1, int& type2, double& sigma, double& epsilon) const;
+    /**
+     * Set the Lennard-Jones parameters for the interaction between two atom types.
+     *
+     * @param index     the index of the pair for which to set parameters, as returned by addLJTypePair()
+     * @param type1     the index of the first type
+     * @param type2     the index of the second type
+     * @param sigma     the sigma parameter of the interaction, measured in nm
+     * @param epsilon   the epsilon parameter of the interaction, measured in kJ/mol
+     */
+    void setLJTypePairParameters(int index, int type1, int type2, double sigma, double epsilon);
     /**
      * Get whether to add a contribution to the energy that approximately represents the effect of Lennard-Jones
      * interactions beyond the cutoff distance.  The energy depends on the volume of the periodic box, and is only
@@ -558,6 +967,21 @@ public:
      *                 that is specified for direct space.
      */
     void setReciprocalSpaceForceGroup(int group);
+    /**
+     * Get the force group that the outer shell of direct space interactions is included in when an inner cutoff
+     * is used.  The inner shell, exceptions, and all other direct space terms are included in getForceGroup().
+     * If this is -1 (the default value), the same force group is used for both shells.
+     */
+    int getOuterShellForceGroup() const;
+    /**
+     * Set the force group that the outer shell of direct space interactions is included in when an inner cutoff
+     * is used.  The inner shell, exceptions, and all other direct space terms are included in getForceGroup().
+     * If this is -1 (the default value), the same force group is used for both shells.
+     *
+     * @param group    the group index.  Legal values are between 0 and 31 (inclusive), or -1 to use the same force group
+     *                 that is specified for the inner shell.
+     */
+    void setOuterShellForceGroup(int group);
     /**
      * Get whether to include direct space interactions when calculating forces and energies.  This is useful if you want
      * to completely replace the direct space calculation, typically with a CustomNativeNonbondedForce that computes it in a
@@ -576,13 +1000,33 @@ public:
      * Simply call setParticleParameters() and setExceptionParameters() to modify this object's parameters, then call
      * updateParametersInContext() to copy them over to the Context.
      *
-     * This method has several limitations.  The only information it updates is the parameters of particles and exceptions.
-     * All other aspects of the Force (the nonbonded method, the cutoff distance, etc.) are unaffected and can only be
-     * changed by reinitializing the Context.  Furthermore, only the chargeProd, sigma, and epsilon values of an exception
-     * can be changed; the pair of particles involved in the exception cannot change.  Finally, this method cannot be used
-     * to add new particles or exceptions, only to change the parameters of existing ones.
+     * This method has several limitations.  The only information it updates is the parameters of particles and exceptions,
+     * including the atom type of each particle and the parameters of the types and pairs of types.  All other aspects of the Force (the nonbonded method, the cutoff distance, etc.) are unaffected and can only be
+     * changed by reinitializing the Context.  This method cannot be used to add new particles.
+     *
+     * On the Reference platform, exceptions may be added, may change which pair of particles they involve, and may switch
+     * between being excluded (chargeProd and epsilon both 0) and being computed.  The exclusions and neighbor list are
+     * rebuilt to match.  Other platforms compile the exceptions into their kernels, so only the chargeProd, sigma, and
+     * epsilon values of the existing non-excluded exceptions can be changed, and any other change throws an exception.
+     * Likewise, only the Reference platform allows the number of atom types to change.
+     *
+     * This object keeps track of which particles and exceptions have been modified since the last call to this method.
+     * If it is called repeatedly for the same Context, only those are copied.
      */
     void updateParametersInContext(Context& context);
+    /**
+     * Set the particle positions in a Context and compute the forces and energy of the force groups this Force
+     * belongs to (its own group, the reciprocal space group, and the outer shell group).  This is equivalent to
+     * calling setPositions() and then getState() with those groups, but avoids the cost of building a State,
+     * which matters when a small system is evaluated many times in a tight loop.  Other forces in the same groups
+     * are included, just as they would be by getState().
+     *
+     * @param context        the Context in which to compute the forces and energy
+     * @param positions      the positions of all particles, measured in nm
+     * @param[out] forces    on exit, the force on each particle, measured in kJ/mol/nm
+     * @return the potential energy, measured in kJ/mol
+     */
+    double computeForcesAndEnergyInContext(Context& context, const std::vector<Vec3>& positions, std::vector<Vec3>& forces) const;
     /**
      * Returns whether or not this force makes use of periodic boundary
      * conditions.
@@ -593,7 +1037,13 @@ public:
         return nonbondedMethod == NativeNonbondedForce::CutoffPeriodic ||
                nonbondedMethod == NativeNonbondedForce::Ewald ||
                nonbondedMethod == NativeNonbondedForce::PME ||
-               nonbondedMethod == NativeNonbondedForce::LJPME;
+               nonbondedMethod == NativeNonbondedForce::LJPME ||
+               nonbondedMethod == NativeNonbondedForce::MSM ||
+               nonbondedMethod == NativeNonbondedForce::DampedShiftedForce ||
+               nonbondedMethod == NativeNonbondedForce::RandomBatchEwald ||
+               nonbondedMethod == NativeNonbondedForce::P3M ||
+               nonbondedMethod == NativeNonbondedForce::IPS ||
+               nonbondedMethod == NativeNonbondedForce::USeries;
     }
     /**
      * Get whether periodic boundary conditions should be applied to exceptions.  Usually this is not
@@ -629,18 +1079,26 @@ private:
     class GlobalParameterInfo;
     class ParticleOffsetInfo;
     class ExceptionOffsetInfo;
+    class LJTypeInfo;
+    class LJTypePairInfo;
     NonbondedMethod nonbondedMethod;
-    double cutoffDistance, switchingDistance, rfDielectric, ewaldErrorTol, alpha, dalpha;
-    bool useSwitchingFunction, useDispersionCorrection, exceptionsUsePeriodic, includeDirectSpace;
-    int recipForceGroup, nx, ny, nz, dnx, dny, dnz;
-    void addExclusionsToSet(const std::vector<std::set<int> >& bonded12, std::set<int>& exclusions, int baseParticle, int fromParticle, int currentLevel) const;
+    double cutoffDistance, switchingDistance, rfDielectric, ewaldErrorTol, alpha, dalpha, pmeGridResizeThreshold, dsfAlpha;
+    double ljCutoffDistance, innerCutoffDistance, innerSwitchingDistance;
+    bool useSwitchingFunction, useDispersionCorrection, exceptionsUsePeriodic, includeDirectSpace, useSlabCorrection;
+    int recipForceGroup, outerShellForceGroup, nx, ny, nz, dnx, dny, dnz, msmLevels, msmOrder, rbeBatchSize, randomNumberSeed, fmmOrder, fmmTreeDepth;
     int getGlobalParameterIndex(const std::string& parameter) const;
+    void markParticlesChanged(int first, int last);
+    void markExceptionsChanged(int first, int last);
     std::vector<ParticleInfo> particles;
     std::vector<ExceptionInfo> exceptions;
     std::vector<GlobalParameterInfo> globalParameters;
     std::vector<ParticleOffsetInfo> particleOffsets;
     std::vector<ExceptionOffsetInfo> exceptionOffsets;
-    std::map<std::pair<int, int>, int> exceptionMap;
+    std::vector<LJTypeInfo> ljTypes;
+    std::vector<LJTypePairInfo> ljTypePairs;
+    std::unordered_map<long long, int> exceptionMap;
+    int firstChangedParticle, lastChangedParticle, firstChangedException, lastChangedException;
+    const ContextImpl* lastUpdatedContext;
 };
 
 /**
@@ -650,11 +1108,13 @@ private:
 class NativeNonbondedForce::ParticleInfo {
 public:
     double charge, sigma, epsilon;
+    int ljType;
     ParticleInfo() {
         charge = sigma = epsilon = 0.0;
+        ljType = -1;
     }
     ParticleInfo(double charge, double sigma, double epsilon) :
-        charge(charge), sigma(sigma), epsilon(epsilon) {
+        charge(charge), sigma(sigma), epsilon(epsilon), ljType(-1) {
     }
 };
 
@@ -723,6 +1183,36 @@ public:
     }
 };
 
+/**
+ * This is an internal class used to record information about a Lennard-Jones atom type.
+ * @private
+ */
+class NativeNonbondedForce::LJTypeInfo {
+public:
+    double sigma, epsilon;
+    LJTypeInfo() {
+        sigma = epsilon = 0.0;
+    }
+    LJTypeInfo(double sigma, double epsilon) : sigma(sigma), epsilon(epsilon) {
+    }
+};
+
+/**
+ * This is an internal class used to record the Lennard-Jones parameters for a pair of atom types.
+ * @private
+ */
+class NativeNonbondedForce::LJTypePairInfo {
+public:
+    int type1, type2;
+    double sigma, epsilon;
+    LJTypePairInfo() {
+        type1 = type2 = -1;
+        sigma = epsilon = 0.0;
+    }
+    LJTypePairInfo(int type1, int type2, double sigma, double epsilon) : type1(type1), type2(type2), sigma(sigma), epsilon(epsilon) {
+    }
+};
+
 } // namespace OpenMM
 
 #endif /*OPENMM_NONBONDEDFORCE_H_*/
@@ -37,6 +37,7 @@
 #include "openmm/Platform.h"
 #include "openmm/System.h"
 #include <string>
+#include <vector>
 
 using namespace OpenMM;
 
@@ -53,7 +54,14 @@ public:
         CutoffPeriodic = 2,
         Ewald = 3,
         PME = 4,
-        LJPME = 5
+        LJPME = 5,
+        MSM = 6,
+        DampedShiftedForce = 7,
+        RandomBatchEwald = 8,
+        P3M = 9,
+        FMM = 10,
+        IPS = 11,
+        USeries = 12
     };
     static std::string Name() {
         return "CalcNativeNonbondedForce";
@@ -63,10 +71,12 @@ public:
     /**
      * Initialize the kernel.
      * 
-     * @param system     the System this kernel will be applied to
-     * @param force      the NativeNonbondedForce this kernel will be used for
+     * @param system      the System this kernel will be applied to
+     * @param force       the NativeNonbondedForce this kernel will be used for
+     * @param exclusions  exclusions[i] contains the particles excluded from particle i in increasing order, as
+     *                    computed by NativeNonbondedForceImpl::findExclusions()
      */
-    virtual void initialize(const System& system, const NativeNonbondedForce& force) = 0;
+    virtual void initialize(const System& system, const NativeNonbondedForce& force, const std::vector<std::vector<int> >& exclusions) = 0;
     /**
      * Execute the kernel to calculate the forces and/or energy.
      *
@@ -75,16 +85,22 @@ public:
      * @param includeEnergy  true if the energy should be calculated
      * @param includeDirect  true if direct space interactions should be included
      * @param includeReciprocal  true if reciprocal space interactions should be included
+     * @param includeOuterShell  true if the outer shell of direct space interactions should be included.  This is only
+     *                           used when an inner cutoff is set, in which case includeDirect refers to the inner shell.
      * @return the potential energy due to the force
      */
-    virtual double execute(ContextImpl& context, bool includeForces, bool includeEnergy, bool includeDirect, bool includeReciprocal) = 0;
+    virtual double execute(ContextImpl& context, bool includeForces, bool includeEnergy, bool includeDirect, bool includeReciprocal, bool includeOuterShell) = 0;
     /**
      * Copy changed parameters over to a context.
      *
-     * @param context    the context to copy parameters to
-     * @param force      the NativeNonbondedForce to copy the parameters from
+     * @param context         the context to copy parameters to
+     * @param force           the NativeNonbondedForce to copy the parameters from
+     * @param firstParticle   the index of the first particle whose parameters might have changed
+     * @param lastParticle    the index of the last particle whose parameters might have changed
+     * @param firstException  the index of the first exception whose parameters might have changed
+     * @param lastException   the index of the last exception whose parameters might have changed
      */
-    virtual void copyParametersToContext(ContextImpl& context, const NativeNonbondedForce& force) = 0;
+    virtual void copyParametersToContext(ContextImpl& context, const NativeNonbondedForce& force, int firstParticle, int lastParticle, int firstException, int lastException) = 0;
     /**
      * Get the parameters being used for PME.
      *
@@ -103,6 +119,15 @@ public:
      * @param nz      the number of grid points along the Z axis
      */
     virtual void getLJPMEParameters(double& alpha, int& nx, int& ny, int& nz) const = 0;
+    /**
+     * Get the parameters being used for MSM.
+     *
+     * @param numLevels  the number of grid levels
+     * @param nx         the number of points along the X axis of the finest grid
+     * @param ny         the number of points along the Y axis of the finest grid
+     * @param nz         the number of points along the Z axis of the finest grid
+     */
+    virtual void getMSMParameters(int& numLevels, int& nx, int& ny, int& nz) const = 0;
 };
 
 /**
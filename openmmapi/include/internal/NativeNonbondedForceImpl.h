@@ -36,9 +36,13 @@
 #include "openmm/internal/ForceImpl.h"
 #include "openmm/Kernel.h"
 #include "openmm/System.h"
+#include "openmm/internal/ThreadPool.h"
+#include <functional>
+#include <map>
 #include <utility>
 #include <set>
 #include <string>
+#include <vector>
 
 using namespace OpenMM;
 
@@ -50,6 +54,7 @@ namespace NativeNonbondedPlugin {
 
 class OPENMM_EXPORT_NATIVENONBONDED NativeNonbondedForceImpl : public ForceImpl {
 public:
+    class DispersionCorrection;
     NativeNonbondedForceImpl(const NativeNonbondedForce& owner);
     ~NativeNonbondedForceImpl();
     void initialize(ContextImpl& context);
@@ -62,9 +67,10 @@ public:
     double calcForcesAndEnergy(ContextImpl& context, bool includeForces, bool includeEnergy, int groups);
     std::map<std::string, double> getDefaultParameters();
     std::vector<std::string> getKernelNames();
-    void updateParametersInContext(ContextImpl& context);
+    void updateParametersInContext(ContextImpl& context, int firstParticle, int lastParticle, int firstException, int lastException);
     void getPMEParameters(double& alpha, int& nx, int& ny, int& nz) const;
     void getLJPMEParameters(double& alpha, int& nx, int& ny, int& nz) const;
+    void getMSMParameters(int& numLevels, int& nx, int& ny, int& nz) const;
     /**
      * This is a utility routine that calculates the values to use for alpha and kmax when using
      * Ewald summation.
@@ -75,20 +81,163 @@ public:
      * Particle Mesh Ewald.
      */
     static void calcPMEParameters(const System& system, const NativeNonbondedForce& force, double& alpha, int& xsize, int& ysize, int& zsize, bool lj);
+    /**
+     * This is a utility routine that calculates the values to use for alpha and grid size when using
+     * Particle Mesh Ewald with a particular set of periodic box vectors.  Unlike the version above, it
+     * ignores any explicitly specified parameters and always selects them based on the error tolerance.
+     */
+    static void calcPMEParameters(const Vec3* boxVectors, double cutoff, double ewaldErrorTol, double& alpha, int& xsize, int& ysize, int& zsize, bool lj);
+    /**
+     * This is a utility routine that calculates the values to use for alpha and grid size when using
+     * the P3M method.
+     */
+    static void calcP3MParameters(const System& system, const NativeNonbondedForce& force, double& alpha, int& xsize, int& ysize, int& zsize);
+    /**
+     * This is a utility routine that calculates the values to use for alpha and grid size when using
+     * the P3M method with a particular set of periodic box vectors.  Unlike the version above, it
+     * ignores any explicitly specified parameters and always selects them based on the error tolerance.
+     */
+    static void calcP3MParameters(const Vec3* boxVectors, double cutoff, double ewaldErrorTol, double& alpha, int& xsize, int& ysize, int& zsize);
+    /**
+     * This is a utility routine that calculates the values to use for alpha and grid size when using
+     * the u-series method.  alpha is the inverse width of the narrowest Gaussian computed on a grid, and the
+     * grid size is that of the finest grid, which holds the narrowest band of Gaussians.
+     */
+    static void calcUSeriesParameters(const System& system, const NativeNonbondedForce& force, double& alpha, int& xsize, int& ysize, int& zsize);
+    /**
+     * This is a utility routine that calculates the values to use for alpha and grid size when using
+     * the u-series method with a particular set of periodic box vectors.  Unlike the version above, it
+     * ignores any explicitly specified parameters and always selects them based on the error tolerance.
+     */
+    static void calcUSeriesParameters(const Vec3* boxVectors, double cutoff, double ewaldErrorTol, double& alpha, int& xsize, int& ysize, int& zsize);
+    /**
+     * This is a utility routine that calculates the logarithmic spacing between the widths of successive
+     * Gaussians in the u-series decomposition of 1/r.  The relative error of the decomposition in the force
+     * is roughly one hundredth of the error tolerance.
+     */
+    static double calcUSeriesSpacing(double ewaldErrorTol);
+    /**
+     * This is a utility routine that calculates the number of levels and the size of the finest grid
+     * when using the multilevel summation method.
+     */
+    static void calcMSMParameters(const System& system, const NativeNonbondedForce& force, int& numLevels, int& xsize, int& ysize, int& zsize);
+    /**
+     * Get the cutoff distance that is actually applied to Lennard-Jones interactions.  This is the Lennard-Jones
+     * cutoff if one has been set, and the Coulomb cutoff otherwise.
+     */
+    static double getEffectiveLJCutoff(const NativeNonbondedForce& force);
     /**
      * Compute the coefficient which, when divided by the periodic box volume, gives the
-     * long range dispersion correction to the energy.
+     * long range dispersion correction to the energy.  Global parameters are assumed to
+     * have their default values.  Use DispersionCorrection to follow changes to them.
      */
     static double calcDispersionCorrection(const System& system, const NativeNonbondedForce& force);
+    /**
+     * Find the particles each particle is excluded from interacting with directly because of an exception.  This
+     * also checks that every exception refers to valid particles and that no pair has more than one exception, and
+     * throws an exception if not.
+     *
+     * @param force       the force whose exceptions to process
+     * @param exclusions  on exit, exclusions[i] contains the particles excluded from particle i in increasing order
+     * @param threads     a thread pool to use, or NULL.  See runInParallel().
+     */
+    static void findExclusions(const NativeNonbondedForce& force, std::vector<std::vector<int> >& exclusions, ThreadPool* threads=NULL);
+    /**
+     * Run a task that processes particles in parallel.  If no thread pool is given, a temporary one is created only
+     * for systems with at least MinParallelParticles particles, since starting the threads costs more than the work
+     * for small ones, and otherwise the task runs on the calling thread.
+     *
+     * @param numParticles  the number of particles being processed
+     * @param threads       a thread pool to use, or NULL
+     * @param task          called as task(threadIndex, numThreads) by each thread
+     */
+    static void runInParallel(int numParticles, ThreadPool* threads, const std::function<void(int, int)>& task);
+    static const int MinParallelParticles = 20000;
+    /**
+     * Build the table of Lennard-Jones parameters for every pair of atom types.  Each pair uses the Lorentz-Berthelot
+     * combining rule unless it has been overridden with addLJTypePair().  This throws an exception if a pair refers
+     * to a type that does not exist.
+     *
+     * @param force    the force whose atom types to process
+     * @param sigma    on exit, sigma[i*n+j] is the sigma parameter for types i and j, where n is the number of types
+     * @param epsilon  on exit, epsilon[i*n+j] is the epsilon parameter for types i and j
+     */
+    static void getLJTypeTable(const NativeNonbondedForce& force, std::vector<double>& sigma, std::vector<double>& epsilon);
+    /**
+     * If a force uses atom types, check that every particle has a valid type, that no type has negative parameters,
+     * and that the force does not combine them with LJPME or with offsets to sigma or epsilon.  This throws an
+     * exception if any check fails.
+     */
+    static void checkLJTypes(const NativeNonbondedForce& force);
 private:
     class ErrorFunction;
     class EwaldErrorFunction;
+    class P3MErrorFunction;
     static int findZero(const ErrorFunction& f, int initialGuess);
     static double evalIntegral(double r, double rs, double rc, double sigma);
     const NativeNonbondedForce& owner;
     Kernel kernel;
 };
 
+/**
+ * This class computes the coefficient for the long range dispersion correction and keeps it up to date as
+ * particle parameters and global parameters change, without repeating the full calculation.
+ *
+ * Particles whose sigma and epsilon do not depend on any global parameter are grouped into classes with identical
+ * values, and the sum over pairs of those classes is stored.  Changing the parameters of one such particle moves it
+ * between classes, which costs time proportional to the number of classes.  Particles with parameter offsets are
+ * handled separately, so changing a global parameter only requires summing over pairs that involve one of them.
+ * When the force uses atom types, each type is a class and the parameters for each pair of classes come from the
+ * table of types.
+ */
+class OPENMM_EXPORT_NATIVENONBONDED NativeNonbondedForceImpl::DispersionCorrection {
+public:
+    /**
+     * Create a DispersionCorrection.  Global parameters initially have their default values.
+     *
+     * @param force    the NativeNonbondedForce to compute the correction for
+     */
+    DispersionCorrection(const NativeNonbondedForce& force);
+    /**
+     * Update the parameters of a range of particles to match a NativeNonbondedForce.  If the table of atom types
+     * has changed, all particles are updated.
+     *
+     * @param force    the force to copy the parameters from
+     * @param first    the index of the first particle whose parameters might have changed
+     * @param last     the index of the last particle whose parameters might have changed
+     */
+    void updateParticles(const NativeNonbondedForce& force, int first, int last);
+    /**
+     * Set the value of a global parameter.  Parameters that do not affect sigma or epsilon of any particle are
+     * ignored.
+     */
+    void setParameter(const std::string& name, double value);
+    /**
+     * Get the coefficient which, when divided by the periodic box volume, gives the energy.
+     */
+    double getCoefficient();
+private:
+    typedef std::pair<double, double> ParticleClass;
+    ParticleClass getParticleClass(const NativeNonbondedForce& force, int index) const;
+    void addPairTerms(const ParticleClass& class1, const ParticleClass& class2, double count, double* sums) const;
+    void addStaticParticle(const ParticleClass& particleClass);
+    void removeStaticParticle(const ParticleClass& particleClass);
+    void computeStaticSums();
+    bool periodic, useSwitch, dynamicSumsValid;
+    int numParticles, numTypes;
+    double cutoff, switchDist;
+    std::vector<double> typeSigma, typeEpsilon;
+    std::vector<ParticleClass> baseParams;
+    std::vector<bool> isDynamic;
+    std::vector<int> dynamicParticles;
+    std::map<std::string, int> parameterIndex;
+    std::vector<double> parameterValues;
+    std::vector<int> offsetParameter, offsetParticle;
+    std::vector<ParticleClass> offsetScales;
+    std::map<ParticleClass, int> staticCounts;
+    double staticSums[3], dynamicSums[3];
+};
+
 } // namespace OpenMM
 
 #endif /*OPENMM_NONBONDEDFORCEIMPL_H_*/
@@ -34,6 +34,8 @@
 #include "openmm/Force.h"
 #include "openmm/OpenMMException.h"
 #include "openmm/internal/AssertionUtilities.h"
+#include "openmm/internal/ContextImpl.h"
+#include <algorithm>
 #include <cmath>
 #include <map>
 #include <sstream>
@@ -48,9 +50,20 @@ using std::string;
 using std::stringstream;
 using std::vector;
 
+/**
+ * Get the key that identifies the exception between two particles in exceptionMap.  It does not depend on the order
+ * of the particles.
+ */
+static long long getExceptionKey(int particle1, int particle2) {
+    if (particle1 > particle2)
+        std::swap(particle1, particle2);
+    return (((long long) particle1) << 32) | (unsigned int) particle2;
+}
+
 NativeNonbondedForce::NativeNonbondedForce() : nonbondedMethod(NoCutoff), cutoffDistance(1.0), switchingDistance(-1.0), rfDielectric(78.3),
-        ewaldErrorTol(5e-4), alpha(0.0), dalpha(0.0), useSwitchingFunction(false), useDispersionCorrection(true), exceptionsUsePeriodic(false), recipForceGroup(-1),
-        includeDirectSpace(true), nx(0), ny(0), nz(0), dnx(0), dny(0), dnz(0) {
+        ewaldErrorTol(5e-4), alpha(0.0), dalpha(0.0), pmeGridResizeThreshold(0.0), dsfAlpha(2.0), ljCutoffDistance(0.0), innerCutoffDistance(0.0), innerSwitchingDistance(0.0), useSwitchingFunction(false), useDispersionCorrection(true), exceptionsUsePeriodic(false), recipForceGroup(-1), outerShellForceGroup(-1),
+        includeDirectSpace(true), useSlabCorrection(false), nx(0), ny(0), nz(0), dnx(0), dny(0), dnz(0), msmLevels(0), msmOrder(6), rbeBatchSize(100), randomNumberSeed(0), fmmOrder(8), fmmTreeDepth(0),
+        firstChangedParticle(0), lastChangedParticle(-1), firstChangedException(0), lastChangedException(-1), lastUpdatedContext(NULL) {
 }
 
 NativeNonbondedForce::NativeNonbondedForce(const NonbondedForce& force) {
@@ -61,43 +74,83 @@ NativeNonbondedForce::NativeNonbondedForce(const NonbondedForce& force) {
     ewaldErrorTol = force.getEwaldErrorTolerance();
     force.getPMEParameters(alpha, nx, ny, nz);
     force.getLJPMEParameters(dalpha, dnx, dny, dnz);
+    pmeGridResizeThreshold = 0.0;
+    msmLevels = 0;
+    msmOrder = 6;
+    dsfAlpha = 2.0;
+    rbeBatchSize = 100;
+    randomNumberSeed = 0;
+    fmmOrder = 8;
+    fmmTreeDepth = 0;
+    ljCutoffDistance = 0.0;
+    innerCutoffDistance = 0.0;
+    innerSwitchingDistance = 0.0;
+    outerShellForceGroup = -1;
+    useSlabCorrection = false;
+    firstChangedParticle = 0;
+    lastChangedParticle = -1;
+    firstChangedException = 0;
+    lastChangedException = -1;
+    lastUpdatedContext = NULL;
     useSwitchingFunction = force.getUseSwitchingFunction();
     useDispersionCorrection = force.getUseDispersionCorrection();
     exceptionsUsePeriodic = force.getExceptionsUsePeriodicBoundaryConditions();
     recipForceGroup = force.getReciprocalSpaceForceGroup();
     includeDirectSpace = force.getIncludeDirectSpace();
 
-    for (int index = 0; index < force.getNumParticles(); index++) {
-        double charge, sigma, epsilon;
-        force.getParticleParameters(index, charge, sigma, epsilon);
-        addParticle(charge, sigma, epsilon);
-    }
+    // Copy the particles, exceptions, and offsets directly into presized arrays.  Global parameter names are
+    // looked up in a map instead of searching the list for every offset.
 
-    for (int index = 0; index < force.getNumExceptions(); index++) {
-        int particle1, particle2;
-        double chargeProd, sigma, epsilon;
-        force.getExceptionParameters(index, particle1, particle2, chargeProd, sigma, epsilon);
-        addException(particle1, particle2, chargeProd, sigma, epsilon);
+    int numParticles = force.getNumParticles();
+    particles.resize(numParticles);
+    for (int index = 0; index < numParticles; index++) {
+        ParticleInfo& particle = particles[index];
+        force.getParticleParameters(index, particle.charge, particle.sigma, particle.epsilon);
     }
 
-    for (int index = 0; index < force.getNumGlobalParameters(); index++)
-        addGlobalParameter(force.getGlobalParameterName(index),
-                           force.getGlobalParameterDefaultValue(index));
+    int numExceptions = force.getNumExceptions();
+    exceptions.resize(numExceptions);
+    exceptionMap.reserve(numExceptions);
+    for (int index = 0; index < numExceptions; index++) {
+        ExceptionInfo& exception = exceptions[index];
+        force.getExceptionParameters(index, exception.particle1, exception.particle2, exception.chargeProd, exception.sigma, exception.epsilon);
+        if (!exceptionMap.insert(std::make_pair(getExceptionKey(exception.particle1, exception.particle2), index)).second) {
+            stringstream msg;
+            msg << "NativeNonbondedForce: There is already an exception for particles ";
+            msg << exception.particle1;
+            msg << " and ";
+            msg << exception.particle2;
+            throw OpenMMException(msg.str());
+        }
+    }
 
-    for (int index = 0; index < force.getNumParticleParameterOffsets(); index++) {
-        std::string parameter;
-        int particleIndex;
-        double chargeScale, sigmaScale, epsilonScale;
-        force.getParticleParameterOffset(index, parameter, particleIndex, chargeScale, sigmaScale, epsilonScale);
-        addParticleParameterOffset(parameter, particleIndex, chargeScale, sigmaScale, epsilonScale);
+    map<string, int> parameterIndex;
+    globalParameters.resize(force.getNumGlobalParameters());
+    for (int index = 0; index < globalParameters.size(); index++) {
+        globalParameters[index] = GlobalParameterInfo(force.getGlobalParameterName(index), force.getGlobalParameterDefaultValue(index));
+        parameterIndex.emplace(globalParameters[index].name, index);
+    }
+    auto findParameter = [&] (const string& parameter) {
+        map<string, int>::const_iterator iter = parameterIndex.find(parameter);
+        if (iter == parameterIndex.end())
+            throw OpenMMException("NativeNonbondedForce: There is no global parameter called '"+parameter+"'");
+        return iter->second;
+    };
+
+    particleOffsets.resize(force.getNumParticleParameterOffsets());
+    for (int index = 0; index < particleOffsets.size(); index++) {
+        string parameter;
+        ParticleOffsetInfo& offset = particleOffsets[index];
+        force.getParticleParameterOffset(index, parameter, offset.particle, offset.chargeScale, offset.sigmaScale, offset.epsilonScale);
+        offset.parameter = findParameter(parameter);
     }
 
-    for (int index = 0; index < force.getNumExceptionParameterOffsets(); index++) {
-        std::string parameter;
-        int exceptionIndex;
-        double chargeProdScale, sigmaScale, epsilonScale;
-        force.getExceptionParameterOffset(index, parameter, exceptionIndex, chargeProdScale, sigmaScale, epsilonScale);
-        addExceptionParameterOffset(parameter, exceptionIndex, chargeProdScale, sigmaScale, epsilonScale);
+    exceptionOffsets.resize(force.getNumExceptionParameterOffsets());
+    for (int index = 0; index < exceptionOffsets.size(); index++) {
+        string parameter;
+        ExceptionOffsetInfo& offset = exceptionOffsets[index];
+        force.getExceptionParameterOffset(index, parameter, offset.exception, offset.chargeProdScale, offset.sigmaScale, offset.epsilonScale);
+        offset.parameter = findParameter(parameter);
     }
 }
 
@@ -106,7 +159,7 @@ NativeNonbondedForce::NonbondedMethod NativeNonbondedForce::getNonbondedMethod()
 }
 
 void NativeNonbondedForce::setNonbondedMethod(NonbondedMethod method) {
-    if (method < 0 || method > 5)
+    if (method < 0 || method > 12)
         throw OpenMMException("NativeNonbondedForce: Illegal value for nonbonded method");
     nonbondedMethod = method;
 }
@@ -119,6 +172,14 @@ void NativeNonbondedForce::setCutoffDistance(double distance) {
     cutoffDistance = distance;
 }
 
+double NativeNonbondedForce::getLJCutoffDistance() const {
+    return ljCutoffDistance;
+}
+
+void NativeNonbondedForce::setLJCutoffDistance(double distance) {
+    ljCutoffDistance = distance;
+}
+
 bool NativeNonbondedForce::getUseSwitchingFunction() const {
     return useSwitchingFunction;
 }
@@ -135,6 +196,22 @@ void NativeNonbondedForce::setSwitchingDistance(double distance) {
     switchingDistance = distance;
 }
 
+double NativeNonbondedForce::getInnerCutoffDistance() const {
+    return innerCutoffDistance;
+}
+
+void NativeNonbondedForce::setInnerCutoffDistance(double distance) {
+    innerCutoffDistance = distance;
+}
+
+double NativeNonbondedForce::getInnerSwitchingDistance() const {
+    return innerSwitchingDistance;
+}
+
+void NativeNonbondedForce::setInnerSwitchingDistance(double distance) {
+    innerSwitchingDistance = distance;
+}
+
 double NativeNonbondedForce::getReactionFieldDielectric() const {
     return rfDielectric;
 }
@@ -187,6 +264,84 @@ void NativeNonbondedForce::getLJPMEParametersInContext(const Context& context, d
     dynamic_cast<const NativeNonbondedForceImpl&>(getImplInContext(context)).getLJPMEParameters(alpha, nx, ny, nz);
 }
 
+double NativeNonbondedForce::getPMEGridResizeThreshold() const {
+    return pmeGridResizeThreshold;
+}
+
+void NativeNonbondedForce::setPMEGridResizeThreshold(double threshold) {
+    if (threshold < 0)
+        throw OpenMMException("NativeNonbondedForce: The PME grid resize threshold cannot be negative");
+    pmeGridResizeThreshold = threshold;
+}
+
+bool NativeNonbondedForce::getUseSlabCorrection() const {
+    return useSlabCorrection;
+}
+
+void NativeNonbondedForce::setUseSlabCorrection(bool use) {
+    useSlabCorrection = use;
+}
+
+void NativeNonbondedForce::getMSMParameters(int& numLevels, int& order) const {
+    numLevels = msmLevels;
+    order = msmOrder;
+}
+
+void NativeNonbondedForce::setMSMParameters(int numLevels, int order) {
+    if (numLevels < 0)
+        throw OpenMMException("NativeNonbondedForce: The number of MSM levels cannot be negative");
+    if (order != 4 && order != 6)
+        throw OpenMMException("NativeNonbondedForce: The MSM interpolation order must be 4 or 6");
+    msmLevels = numLevels;
+    msmOrder = order;
+}
+
+void NativeNonbondedForce::getMSMParametersInContext(const Context& context, int& numLevels, int& nx, int& ny, int& nz) const {
+    dynamic_cast<const NativeNonbondedForceImpl&>(getImplInContext(context)).getMSMParameters(numLevels, nx, ny, nz);
+}
+
+void NativeNonbondedForce::getFMMParameters(int& order, int& treeDepth) const {
+    order = fmmOrder;
+    treeDepth = fmmTreeDepth;
+}
+
+void NativeNonbondedForce::setFMMParameters(int order, int treeDepth) {
+    if (order < 1)
+        throw OpenMMException("NativeNonbondedForce: The FMM expansion order must be at least 1");
+    if (treeDepth < 0)
+        throw OpenMMException("NativeNonbondedForce: The FMM tree depth cannot be negative");
+    fmmOrder = order;
+    fmmTreeDepth = treeDepth;
+}
+
+double NativeNonbondedForce::getDSFAlpha() const {
+    return dsfAlpha;
+}
+
+void NativeNonbondedForce::setDSFAlpha(double alpha) {
+    if (alpha < 0)
+        throw OpenMMException("NativeNonbondedForce: The DSF damping parameter cannot be negative");
+    dsfAlpha = alpha;
+}
+
+int NativeNonbondedForce::getRBEBatchSize() const {
+    return rbeBatchSize;
+}
+
+void NativeNonbondedForce::setRBEBatchSize(int size) {
+    if (size < 1)
+        throw OpenMMException("NativeNonbondedForce: The RBE batch size must be at least 1");
+    rbeBatchSize = size;
+}
+
+int NativeNonbondedForce::getRandomNumberSeed() const {
+    return randomNumberSeed;
+}
+
+void NativeNonbondedForce::setRandomNumberSeed(int seed) {
+    randomNumberSeed = seed;
+}
+
 int NativeNonbondedForce::addParticle(double charge, double sigma, double epsilon) {
     particles.push_back(ParticleInfo(charge, sigma, epsilon));
     return particles.size()-1;
@@ -201,17 +356,16 @@ void NativeNonbondedForce::getParticleParameters(int index, double& charge, doub
 
 void NativeNonbondedForce::setParticleParameters(int index, double charge, double sigma, double epsilon) {
     ASSERT_VALID_INDEX(index, particles);
+    markParticlesChanged(index, index);
     particles[index].charge = charge;
     particles[index].sigma = sigma;
     particles[index].epsilon = epsilon;
 }
 
 int NativeNonbondedForce::addException(int particle1, int particle2, double chargeProd, double sigma, double epsilon, bool replace) {
-    map<pair<int, int>, int>::iterator iter = exceptionMap.find(pair<int, int>(particle1, particle2));
-    int newIndex;
-    if (iter == exceptionMap.end())
-        iter = exceptionMap.find(pair<int, int>(particle2, particle1));
-    if (iter != exceptionMap.end()) {
+    auto result = exceptionMap.insert(std::make_pair(getExceptionKey(particle1, particle2), (int) exceptions.size()));
+    int newIndex = result.first->second;
+    if (!result.second) {
         if (!replace) {
             stringstream msg;
             msg << "NativeNonbondedForce: There is already an exception for particles ";
@@ -220,15 +374,11 @@ int NativeNonbondedForce::addException(int particle1, int particle2, double char
             msg << particle2;
             throw OpenMMException(msg.str());
         }
-        exceptions[iter->second] = ExceptionInfo(particle1, particle2, chargeProd, sigma, epsilon);
-        newIndex = iter->second;
-        exceptionMap.erase(iter->first);
+        exceptions[newIndex] = ExceptionInfo(particle1, particle2, chargeProd, sigma, epsilon);
     }
-    else {
+    else
         exceptions.push_back(ExceptionInfo(particle1, particle2, chargeProd, sigma, epsilon));
-        newIndex = exceptions.size()-1;
-    }
-    exceptionMap[pair<int, int>(particle1, particle2)] = newIndex;
+    markExceptionsChanged(newIndex, newIndex);
     return newIndex;
 }
 void NativeNonbondedForce::getExceptionParameters(int index, int& particle1, int& particle2, double& chargeProd, double& sigma, double& epsilon) const {
@@ -242,6 +392,7 @@ void NativeNonbondedForce::getExceptionParameters(int index, int& particle1, int
 
 void NativeNonbondedForce::setExceptionParameters(int index, int particle1, int particle2, double chargeProd, double sigma, double epsilon) {
     ASSERT_VALID_INDEX(index, exceptions);
+    markExceptionsChanged(index, index);
     exceptions[index].particle1 = particle1;
     exceptions[index].particle2 = particle2;
     exceptions[index].chargeProd = chargeProd;
@@ -249,62 +400,205 @@ void NativeNonbondedForce::setExceptionParameters(int index, int particle1, int
     exceptions[index].epsilon = epsilon;
 }
 
+int NativeNonbondedForce::addParticles(const vector<double>& charges, const vector<double>& sigmas, const vector<double>& epsilons) {
+    if (sigmas.size() != charges.size() || epsilons.size() != charges.size())
+        throw OpenMMException("NativeNonbondedForce: The parameter arrays passed to addParticles() have different lengths");
+    int firstIndex = particles.size();
+    particles.reserve(particles.size()+charges.size());
+    for (int i = 0; i < charges.size(); i++)
+        particles.push_back(ParticleInfo(charges[i], sigmas[i], epsilons[i]));
+    return firstIndex;
+}
+
+void NativeNonbondedForce::getAllParticleParameters(vector<double>& charges, vector<double>& sigmas, vector<double>& epsilons) const {
+    int numParticles = particles.size();
+    charges.resize(numParticles);
+    sigmas.resize(numParticles);
+    epsilons.resize(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        charges[i] = particles[i].charge;
+        sigmas[i] = particles[i].sigma;
+        epsilons[i] = particles[i].epsilon;
+    }
+}
+
+void NativeNonbondedForce::setAllParticleParameters(const vector<double>& charges, const vector<double>& sigmas, const vector<double>& epsilons) {
+    if (charges.size() != particles.size() || sigmas.size() != particles.size() || epsilons.size() != particles.size())
+        throw OpenMMException("NativeNonbondedForce: The parameter arrays passed to setAllParticleParameters() must have one element for every particle");
+    markParticlesChanged(0, particles.size()-1);
+    for (int i = 0; i < particles.size(); i++) {
+        particles[i].charge = charges[i];
+        particles[i].sigma = sigmas[i];
+        particles[i].epsilon = epsilons[i];
+    }
+}
+
+int NativeNonbondedForce::addExceptions(const vector<int>& particles1, const vector<int>& particles2, const vector<double>& chargeProds,
+                                        const vector<double>& sigmas, const vector<double>& epsilons, bool replace) {
+    int numExceptions = particles1.size();
+    if (particles2.size() != numExceptions || chargeProds.size() != numExceptions || sigmas.size() != numExceptions || epsilons.size() != numExceptions)
+        throw OpenMMException("NativeNonbondedForce: The parameter arrays passed to addExceptions() have different lengths");
+    int firstIndex = exceptions.size();
+    exceptions.reserve(exceptions.size()+numExceptions);
+    exceptionMap.reserve(exceptions.size()+numExceptions);
+    for (int i = 0; i < numExceptions; i++)
+        addException(particles1[i], particles2[i], chargeProds[i], sigmas[i], epsilons[i], replace);
+    return firstIndex;
+}
+
+void NativeNonbondedForce::getAllExceptionParameters(vector<int>& particles1, vector<int>& particles2, vector<double>& chargeProds,
+                                                     vector<double>& sigmas, vector<double>& epsilons) const {
+    int numExceptions = exceptions.size();
+    particles1.resize(numExceptions);
+    particles2.resize(numExceptions);
+    chargeProds.resize(numExceptions);
+    sigmas.resize(numExceptions);
+    epsilons.resize(numExceptions);
+    for (int i = 0; i < numExceptions; i++) {
+        particles1[i] = exceptions[i].particle1;
+        particles2[i] = exceptions[i].particle2;
+        chargeProds[i] = exceptions[i].chargeProd;
+        sigmas[i] = exceptions[i].sigma;
+        epsilons[i] = exceptions[i].epsilon;
+    }
+}
+
+void NativeNonbondedForce::setAllExceptionParameters(const vector<int>& particles1, const vector<int>& particles2, const vector<double>& chargeProds,
+                                                     const vector<double>& sigmas, const vector<double>& epsilons) {
+    int numExceptions = exceptions.size();
+    if (particles1.size() != numExceptions || particles2.size() != numExceptions || chargeProds.size() != numExceptions || sigmas.size() != numExceptions || epsilons.size() != numExceptions)
+        throw OpenMMException("NativeNonbondedForce: The parameter arrays passed to setAllExceptionParameters() must have one element for every exception");
+    markExceptionsChanged(0, numExceptions-1);
+    for (int i = 0; i < numExceptions; i++) {
+        exceptions[i].particle1 = particles1[i];
+        exceptions[i].particle2 = particles2[i];
+        exceptions[i].chargeProd = chargeProds[i];
+        exceptions[i].sigma = sigmas[i];
+        exceptions[i].epsilon = epsilons[i];
+    }
+}
+
 ForceImpl* NativeNonbondedForce::createImpl() const {
     return new NativeNonbondedForceImpl(*this);
 }
 
 void NativeNonbondedForce::createExceptionsFromBonds(const vector<pair<int, int> >& bonds, double coulomb14Scale, double lj14Scale) {
+    int numParticles = particles.size();
     for (auto& bond : bonds)
-        if (bond.first < 0 || bond.second < 0 || bond.first >= particles.size() || bond.second >= particles.size())
+        if (bond.first < 0 || bond.second < 0 || bond.first >= numParticles || bond.second >= numParticles)
             throw OpenMMException("createExceptionsFromBonds: Illegal particle index in list of bonds");
 
-    // Find particles separated by 1, 2, or 3 bonds.
+    // Build the bond graph in compressed sparse row form.  The particles bonded to particle i are
+    // bondedTo[bondStart[i]] through bondedTo[bondStart[i+1]-1].
 
-    vector<set<int> > exclusions(particles.size());
-    vector<set<int> > bonded12(exclusions.size());
+    vector<int> bondStart(numParticles+1, 0);
+    for (auto& bond : bonds) {
+        bondStart[bond.first+1]++;
+        bondStart[bond.second+1]++;
+    }
+    for (int i = 0; i < numParticles; i++)
+        bondStart[i+1] += bondStart[i];
+    vector<int> bondedTo(bondStart[numParticles]);
+    vector<int> nextSlot(bondStart.begin(), bondStart.end()-1);
     for (auto& bond : bonds) {
-        bonded12[bond.first].insert(bond.second);
-        bonded12[bond.second].insert(bond.first);
+        bondedTo[nextSlot[bond.first]++] = bond.second;
+        bondedTo[nextSlot[bond.second]++] = bond.first;
+    }
+
+    // Find the lower numbered particles separated from each one by 1, 2, or 3 bonds with a breadth first search.
+    // The particles are divided into fixed size blocks, which the threads process in turn.  For each block this
+    // records (i, j, number of bonds) for every pair it finds, sorted by i and then j, so concatenating the blocks
+    // gives the pairs in a fixed order regardless of the number of threads.  Small systems are processed on the
+    // calling thread, since starting a thread pool would cost more than the search.
+
+    const int blockSize = 1024;
+    int numBlocks = (numParticles+blockSize-1)/blockSize;
+    vector<vector<int> > blockPairs(numBlocks);
+    NativeNonbondedForceImpl::runInParallel(numParticles, NULL, [&] (int threadIndex, int numThreads) {
+        vector<int> separation(numParticles, 0);
+        vector<int> visited, lower;
+        for (int block = threadIndex; block < numBlocks; block += numThreads) {
+            vector<int>& pairs = blockPairs[block];
+            int start = block*blockSize;
+            int end = std::min(start+blockSize, numParticles);
+            for (int i = start; i < end; i++) {
+                separation[i] = -1;
+                visited.assign(1, i);
+                int levelStart = 0;
+                for (int level = 1; level <= 3; level++) {
+                    int levelEnd = visited.size();
+                    for (int k = levelStart; k < levelEnd; k++)
+                        for (int b = bondStart[visited[k]]; b < bondStart[visited[k]+1]; b++) {
+                            int j = bondedTo[b];
+                            if (separation[j] == 0) {
+                                separation[j] = level;
+                                visited.push_back(j);
+                            }
+                        }
+                    levelStart = levelEnd;
+                }
+                lower.clear();
+                for (int k = 1; k < visited.size(); k++)
+                    if (visited[k] < i)
+                        lower.push_back(visited[k]);
+                std::sort(lower.begin(), lower.end());
+                for (int j : lower) {
+                    pairs.push_back(i);
+                    pairs.push_back(j);
+                    pairs.push_back(separation[j]);
+                }
+                for (int j : visited)
+                    separation[j] = 0;
+            }
+        }
+    });
+
+    // When atom types are used, 1-4 interactions take their Lennard-Jones parameters from the table of types.
+
+    int numTypes = ljTypes.size();
+    vector<double> typeSigma, typeEpsilon;
+    if (numTypes > 0) {
+        NativeNonbondedForceImpl::getLJTypeTable(*this, typeSigma, typeEpsilon);
+        for (auto& particle : particles)
+            if (particle.ljType < 0 || particle.ljType >= numTypes)
+                throw OpenMMException("createExceptionsFromBonds: Every particle must be assigned a valid LJ type");
     }
-    for (int i = 0; i < (int) exclusions.size(); ++i)
-        addExclusionsToSet(bonded12, exclusions[i], i, i, 2);
-
-    // Find particles separated by 1 or 2 bonds and create the exceptions.
-
-    for (int i = 0; i < (int) exclusions.size(); ++i) {
-        set<int> bonded13;
-        addExclusionsToSet(bonded12, bonded13, i, i, 1);
-        for (int j : exclusions[i]) {
-            if (j < i) {
-                if (bonded13.find(j) == bonded13.end()) {
-                    // This is a 1-4 interaction.
-
-                    const ParticleInfo& particle1 = particles[j];
-                    const ParticleInfo& particle2 = particles[i];
-                    const double chargeProd = coulomb14Scale*particle1.charge*particle2.charge;
+
+    // Create the exceptions.
+
+    int numNewExceptions = 0;
+    for (auto& pairs : blockPairs)
+        numNewExceptions += pairs.size()/3;
+    exceptions.reserve(exceptions.size()+numNewExceptions);
+    exceptionMap.reserve(exceptions.size()+numNewExceptions);
+    for (auto& pairs : blockPairs) {
+        for (int k = 0; k < pairs.size(); k += 3) {
+            int i = pairs[k], j = pairs[k+1];
+            if (pairs[k+2] == 3) {
+                // This is a 1-4 interaction.
+
+                const ParticleInfo& particle1 = particles[j];
+                const ParticleInfo& particle2 = particles[i];
+                const double chargeProd = coulomb14Scale*particle1.charge*particle2.charge;
+                if (numTypes > 0) {
+                    int pairIndex = particle1.ljType*numTypes+particle2.ljType;
+                    addException(j, i, chargeProd, typeSigma[pairIndex], lj14Scale*typeEpsilon[pairIndex]);
+                }
+                else {
                     const double sigma = 0.5*(particle1.sigma+particle2.sigma);
                     const double epsilon = lj14Scale*std::sqrt(particle1.epsilon*particle2.epsilon);
                     addException(j, i, chargeProd, sigma, epsilon);
                 }
-                else {
-                    // This interaction should be completely excluded.
+            }
+            else {
+                // This interaction should be completely excluded.
 
-                    addException(j, i, 0.0, 1.0, 0.0);
-                }
+                addException(j, i, 0.0, 1.0, 0.0);
             }
         }
     }
 }
 
-void NativeNonbondedForce::addExclusionsToSet(const vector<set<int> >& bonded12, set<int>& exclusions, int baseParticle, int fromParticle, int currentLevel) const {
-    for (int i : bonded12[fromParticle]) {
-        if (i != baseParticle)
-            exclusions.insert(i);
-        if (currentLevel > 0)
-            addExclusionsToSet(bonded12, exclusions, baseParticle, i, currentLevel-1);
-    }
-}
-
 int NativeNonbondedForce::addGlobalParameter(const string& name, double defaultValue) {
     globalParameters.push_back(GlobalParameterInfo(name, defaultValue));
     return globalParameters.size()-1;
@@ -383,6 +677,55 @@ void NativeNonbondedForce::setExceptionParameterOffset(int index, const std::str
     exceptionOffsets[index].epsilonScale = epsilonScale;
 }
 
+int NativeNonbondedForce::addLJType(double sigma, double epsilon) {
+    ljTypes.push_back(LJTypeInfo(sigma, epsilon));
+    return ljTypes.size()-1;
+}
+
+void NativeNonbondedForce::getLJTypeParameters(int index, double& sigma, double& epsilon) const {
+    ASSERT_VALID_INDEX(index, ljTypes);
+    sigma = ljTypes[index].sigma;
+    epsilon = ljTypes[index].epsilon;
+}
+
+void NativeNonbondedForce::setLJTypeParameters(int index, double sigma, double epsilon) {
+    ASSERT_VALID_INDEX(index, ljTypes);
+    ljTypes[index].sigma = sigma;
+    ljTypes[index].epsilon = epsilon;
+}
+
+int NativeNonbondedForce::getParticleLJType(int index) const {
+    ASSERT_VALID_INDEX(index, particles);
+    return particles[index].ljType;
+}
+
+void NativeNonbondedForce::setParticleLJType(int index, int type) {
+    ASSERT_VALID_INDEX(index, particles);
+    markParticlesChanged(index, index);
+    particles[index].ljType = type;
+}
+
+int NativeNonbondedForce::addLJTypePair(int type1, int type2, double sigma, double epsilon) {
+    ljTypePairs.push_back(LJTypePairInfo(type1, type2, sigma, epsilon));
+    return ljTypePairs.size()-1;
+}
+
+void NativeNonbondedForce::getLJTypePairParameters(int index, int& type1, int& type2, double& sigma, double& epsilon) const {
+    ASSERT_VALID_INDEX(index, ljTypePairs);
+    type1 = ljTypePairs[index].type1;
+    type2 = ljTypePairs[index].type2;
+    sigma = ljTypePairs[index].sigma;
+    epsilon = ljTypePairs[index].epsilon;
+}
+
+void NativeNonbondedForce::setLJTypePairParameters(int index, int type1, int type2, double sigma, double epsilon) {
+    ASSERT_VALID_INDEX(index, ljTypePairs);
+    ljTypePairs[index].type1 = type1;
+    ljTypePairs[index].type2 = type2;
+    ljTypePairs[index].sigma = sigma;
+    ljTypePairs[index].epsilon = epsilon;
+}
+
 int NativeNonbondedForce::getReciprocalSpaceForceGroup() const {
     return recipForceGroup;
 }
@@ -393,6 +736,16 @@ void NativeNonbondedForce::setReciprocalSpaceForceGroup(int group) {
     recipForceGroup = group;
 }
 
+int NativeNonbondedForce::getOuterShellForceGroup() const {
+    return outerShellForceGroup;
+}
+
+void NativeNonbondedForce::setOuterShellForceGroup(int group) {
+    if (group < -1 || group > 31)
+        throw OpenMMException("Force group must be between -1 and 31");
+    outerShellForceGroup = group;
+}
+
 bool NativeNonbondedForce::getIncludeDirectSpace() const {
     return includeDirectSpace;
 }
@@ -402,7 +755,60 @@ void NativeNonbondedForce::setIncludeDirectSpace(bool include) {
 }
 
 void NativeNonbondedForce::updateParametersInContext(Context& context) {
-    dynamic_cast<NativeNonbondedForceImpl&>(getImplInContext(context)).updateParametersInContext(getContextImpl(context));
+    // The recorded changes are relative to the last Context that was updated.  Any other Context may be missing
+    // earlier changes, so it gets all parameters.
+
+    ContextImpl& contextImpl = getContextImpl(context);
+    if (&contextImpl != lastUpdatedContext) {
+        markParticlesChanged(0, particles.size()-1);
+        markExceptionsChanged(0, exceptions.size()-1);
+    }
+    dynamic_cast<NativeNonbondedForceImpl&>(getImplInContext(context)).updateParametersInContext(contextImpl,
+            firstChangedParticle, lastChangedParticle, firstChangedException, lastChangedException);
+    lastUpdatedContext = &contextImpl;
+    firstChangedParticle = 0;
+    lastChangedParticle = -1;
+    firstChangedException = 0;
+    lastChangedException = -1;
+}
+
+void NativeNonbondedForce::markParticlesChanged(int first, int last) {
+    if (first > last)
+        return;
+    if (lastChangedParticle < firstChangedParticle) {
+        firstChangedParticle = first;
+        lastChangedParticle = last;
+    }
+    else {
+        firstChangedParticle = std::min(firstChangedParticle, first);
+        lastChangedParticle = std::max(lastChangedParticle, last);
+    }
+}
+
+void NativeNonbondedForce::markExceptionsChanged(int first, int last) {
+    if (first > last)
+        return;
+    if (lastChangedException < firstChangedException) {
+        firstChangedException = first;
+        lastChangedException = last;
+    }
+    else {
+        firstChangedException = std::min(firstChangedException, first);
+        lastChangedException = std::max(lastChangedException, last);
+    }
+}
+
+double NativeNonbondedForce::computeForcesAndEnergyInContext(Context& context, const vector<Vec3>& positions, vector<Vec3>& forces) const {
+    int groups = 1<<getForceGroup();
+    if (recipForceGroup >= 0)
+        groups |= 1<<recipForceGroup;
+    if (outerShellForceGroup >= 0)
+        groups |= 1<<outerShellForceGroup;
+    ContextImpl& impl = getContextImpl(context);
+    impl.setPositions(positions);
+    double energy = impl.calcForcesAndEnergy(true, true, groups);
+    impl.getForces(forces);
+    return energy;
 }
 
 bool NativeNonbondedForce::getExceptionsUsePeriodicBoundaryConditions() const {
@@ -36,12 +36,17 @@
 #include "openmm/OpenMMException.h"
 #include "openmm/System.h"
 #include "openmm/internal/ContextImpl.h"
+#include "openmm/internal/ThreadPool.h"
 #include "NativeNonbondedKernels.h"
 #include <cmath>
 #include <map>
 #include <sstream>
 #include <algorithm>
 
+// In case we're using some primitive version of Visual Studio this will
+// make sure that erf() and erfc() are defined.
+#include "openmm/internal/MSVC_erfc.h"
+
 using namespace NativeNonbondedPlugin;
 using namespace OpenMM;
 using namespace std;
@@ -60,10 +65,27 @@ void NativeNonbondedForceImpl::initialize(ContextImpl& context) {
     const System& system = context.getSystem();
     if (owner.getNumParticles() != system.getNumParticles())
         throw OpenMMException("NativeNonbondedForce must have exactly as many particles as the System it belongs to.");
+    if (owner.getLJCutoffDistance() != 0.0) {
+        if (owner.getLJCutoffDistance() < 0)
+            throw OpenMMException("NativeNonbondedForce: The Lennard-Jones cutoff distance cannot be negative");
+        if (owner.getNonbondedMethod() == NativeNonbondedForce::LJPME || owner.getNonbondedMethod() == NativeNonbondedForce::FMM)
+            throw OpenMMException("NativeNonbondedForce: A separate Lennard-Jones cutoff cannot be used with LJPME or FMM");
+    }
+    double ljCutoff = getEffectiveLJCutoff(owner);
     if (owner.getUseSwitchingFunction()) {
-        if (owner.getSwitchingDistance() < 0 || owner.getSwitchingDistance() >= owner.getCutoffDistance())
+        if (owner.getSwitchingDistance() < 0 || owner.getSwitchingDistance() >= ljCutoff)
             throw OpenMMException("NativeNonbondedForce: Switching distance must satisfy 0 <= r_switch < r_cutoff");
     }
+    if (owner.getInnerCutoffDistance() != 0.0) {
+        if (owner.getNonbondedMethod() == NativeNonbondedForce::NoCutoff || owner.getNonbondedMethod() == NativeNonbondedForce::FMM)
+            throw OpenMMException("NativeNonbondedForce: An inner cutoff cannot be used with NoCutoff or FMM");
+        if (owner.getInnerCutoffDistance() < 0 || owner.getInnerCutoffDistance() >= max(owner.getCutoffDistance(), ljCutoff))
+            throw OpenMMException("NativeNonbondedForce: Inner cutoff distance must satisfy 0 < r_inner < r_cutoff");
+        if (owner.getInnerSwitchingDistance() < 0 || owner.getInnerSwitchingDistance() >= owner.getInnerCutoffDistance())
+            throw OpenMMException("NativeNonbondedForce: Inner switching distance must satisfy 0 <= r_inner_switch < r_inner");
+    }
+    if (owner.getUseSlabCorrection() && owner.getNonbondedMethod() != NativeNonbondedForce::PME)
+        throw OpenMMException("NativeNonbondedForce: The slab correction can only be used with PME");
     for (int i = 0; i < owner.getNumParticles(); i++) {
         double charge, sigma, epsilon;
         owner.getParticleParameters(i, charge, sigma, epsilon);
@@ -72,29 +94,13 @@ void NativeNonbondedForceImpl::initialize(ContextImpl& context) {
         if (epsilon < 0)
             throw OpenMMException("NativeNonbondedForce: epsilon for a particle cannot be negative");
     }
-    vector<set<int> > exceptions(owner.getNumParticles());
+    checkLJTypes(owner);
+    vector<vector<int> > exclusions;
+    findExclusions(owner, exclusions);
     for (int i = 0; i < owner.getNumExceptions(); i++) {
-        int particle[2];
+        int particle1, particle2;
         double chargeProd, sigma, epsilon;
-        owner.getExceptionParameters(i, particle[0], particle[1], chargeProd, sigma, epsilon);
-        for (int j = 0; j < 2; j++) {
-            if (particle[j] < 0 || particle[j] >= owner.getNumParticles()) {
-                stringstream msg;
-                msg << "NativeNonbondedForce: Illegal particle index for an exception: ";
-                msg << particle[j];
-                throw OpenMMException(msg.str());
-            }
-        }
-        if (exceptions[particle[0]].count(particle[1]) > 0 || exceptions[particle[1]].count(particle[0]) > 0) {
-            stringstream msg;
-            msg << "NativeNonbondedForce: Multiple exceptions are specified for particles ";
-            msg << particle[0];
-            msg << " and ";
-            msg << particle[1];
-            throw OpenMMException(msg.str());
-        }
-        exceptions[particle[0]].insert(particle[1]);
-        exceptions[particle[1]].insert(particle[0]);
+        owner.getExceptionParameters(i, particle1, particle2, chargeProd, sigma, epsilon);
         if (sigma < 0)
             throw OpenMMException("NativeNonbondedForce: sigma for an exception cannot be negative");
         if (epsilon < 0)
@@ -124,16 +130,18 @@ void NativeNonbondedForceImpl::initialize(ContextImpl& context) {
             throw OpenMMException(msg.str());
         }
     }
-    if (owner.getNonbondedMethod() != NativeNonbondedForce::NoCutoff && owner.getNonbondedMethod() != NativeNonbondedForce::CutoffNonPeriodic) {
+    if (owner.usesPeriodicBoundaryConditions()) {
         Vec3 boxVectors[3];
         system.getDefaultPeriodicBoxVectors(boxVectors[0], boxVectors[1], boxVectors[2]);
-        double cutoff = owner.getCutoffDistance();
+        double cutoff = max(owner.getCutoffDistance(), ljCutoff);
         if (cutoff > 0.5*boxVectors[0][0] || cutoff > 0.5*boxVectors[1][1] || cutoff > 0.5*boxVectors[2][2])
             throw OpenMMException("NativeNonbondedForce: The cutoff distance cannot be greater than half the periodic box size.");
         if (owner.getNonbondedMethod() == NativeNonbondedForce::Ewald && (boxVectors[1][0] != 0.0 || boxVectors[2][0] != 0.0 || boxVectors[2][1] != 0))
             throw OpenMMException("NativeNonbondedForce: Ewald is not supported with non-rectangular boxes.  Use PME instead.");
+        if (owner.getNonbondedMethod() == NativeNonbondedForce::RandomBatchEwald && (boxVectors[1][0] != 0.0 || boxVectors[2][0] != 0.0 || boxVectors[2][1] != 0))
+            throw OpenMMException("NativeNonbondedForce: RandomBatchEwald is not supported with non-rectangular boxes.  Use PME instead.");
     }
-    kernel.getAs<CalcNativeNonbondedForceKernel>().initialize(context.getSystem(), owner);
+    kernel.getAs<CalcNativeNonbondedForceKernel>().initialize(context.getSystem(), owner, exclusions);
 }
 
 double NativeNonbondedForceImpl::calcForcesAndEnergy(ContextImpl& context, bool includeForces, bool includeEnergy, int groups) {
@@ -142,7 +150,11 @@ double NativeNonbondedForceImpl::calcForcesAndEnergy(ContextImpl& context, bool
     if (reciprocalGroup < 0)
         reciprocalGroup = owner.getForceGroup();
     bool includeReciprocal = ((groups&(1<<reciprocalGroup)) != 0);
-    return kernel.getAs<CalcNativeNonbondedForceKernel>().execute(context, includeForces, includeEnergy, includeDirect, includeReciprocal);
+    int outerShellGroup = owner.getOuterShellForceGroup();
+    if (outerShellGroup < 0)
+        outerShellGroup = owner.getForceGroup();
+    bool includeOuterShell = (owner.getIncludeDirectSpace() && (groups&(1<<outerShellGroup)) != 0);
+    return kernel.getAs<CalcNativeNonbondedForceKernel>().execute(context, includeForces, includeEnergy, includeDirect, includeReciprocal, includeOuterShell);
 }
 
 map<string, double> NativeNonbondedForceImpl::getDefaultParameters() {
@@ -175,6 +187,27 @@ private:
     double width, alpha, target;
 };
 
+class NativeNonbondedForceImpl::P3MErrorFunction : public ErrorFunction {
+public:
+    P3MErrorFunction(double width, double alpha, double target) : width(width), alpha(alpha), target(target) {
+    }
+    double getValue(int arg) const {
+        // RMS force error estimate of Deserno and Holm for the optimal influence function and order 5 assignment.
+        // It assumes ik differentiation, so it is scaled by a factor fit to the error of analytical differentiation.
+
+        static const double coeff[] = {1.0/23232.0, 7601.0/13628160.0, 143.0/69120.0, 517231.0/106536960.0, 106640677.0/11737571328.0};
+        if (arg == 0)
+            return -1.0;
+        double ha = alpha*width/arg;
+        double sum = 0.0;
+        for (int m = 4; m >= 0; m--)
+            sum = sum*ha*ha + coeff[m];
+        return target-3.0*pow(ha, 5)*sqrt(alpha*width*sqrt(2*M_PI)*sum)/(width*width);
+    }
+private:
+    double width, alpha, target;
+};
+
 void NativeNonbondedForceImpl::calcEwaldParameters(const System& system, const NativeNonbondedForce& force, double& alpha, int& kmaxx, int& kmaxy, int& kmaxz) {
     Vec3 boxVectors[3];
     system.getDefaultPeriodicBoxVectors(boxVectors[0], boxVectors[1], boxVectors[2]);
@@ -199,22 +232,132 @@ void NativeNonbondedForceImpl::calcPMEParameters(const System& system, const Nat
     if (alpha == 0.0) {
         Vec3 boxVectors[3];
         system.getDefaultPeriodicBoxVectors(boxVectors[0], boxVectors[1], boxVectors[2]);
-        double tol = force.getEwaldErrorTolerance();
-        alpha = (1.0/force.getCutoffDistance())*std::sqrt(-log(2.0*tol));
-        if (lj) {
-            xsize = (int) ceil(alpha*boxVectors[0][0]/(3*pow(tol, 0.2)));
-            ysize = (int) ceil(alpha*boxVectors[1][1]/(3*pow(tol, 0.2)));
-            zsize = (int) ceil(alpha*boxVectors[2][2]/(3*pow(tol, 0.2)));
-        }
-        else {
-            xsize = (int) ceil(2*alpha*boxVectors[0][0]/(3*pow(tol, 0.2)));
-            ysize = (int) ceil(2*alpha*boxVectors[1][1]/(3*pow(tol, 0.2)));
-            zsize = (int) ceil(2*alpha*boxVectors[2][2]/(3*pow(tol, 0.2)));
-        }
-        xsize = max(xsize, 6);
-        ysize = max(ysize, 6);
-        zsize = max(zsize, 6);
+        calcPMEParameters(boxVectors, force.getCutoffDistance(), force.getEwaldErrorTolerance(), alpha, xsize, ysize, zsize, lj);
+    }
+}
+
+void NativeNonbondedForceImpl::calcPMEParameters(const Vec3* boxVectors, double cutoff, double ewaldErrorTol, double& alpha, int& xsize, int& ysize, int& zsize, bool lj) {
+    double tol = ewaldErrorTol;
+    alpha = (1.0/cutoff)*std::sqrt(-log(2.0*tol));
+    if (lj) {
+        xsize = (int) ceil(alpha*boxVectors[0][0]/(3*pow(tol, 0.2)));
+        ysize = (int) ceil(alpha*boxVectors[1][1]/(3*pow(tol, 0.2)));
+        zsize = (int) ceil(alpha*boxVectors[2][2]/(3*pow(tol, 0.2)));
+    }
+    else {
+        xsize = (int) ceil(2*alpha*boxVectors[0][0]/(3*pow(tol, 0.2)));
+        ysize = (int) ceil(2*alpha*boxVectors[1][1]/(3*pow(tol, 0.2)));
+        zsize = (int) ceil(2*alpha*boxVectors[2][2]/(3*pow(tol, 0.2)));
     }
+    xsize = max(xsize, 6);
+    ysize = max(ysize, 6);
+    zsize = max(zsize, 6);
+}
+
+void NativeNonbondedForceImpl::calcP3MParameters(const System& system, const NativeNonbondedForce& force, double& alpha, int& xsize, int& ysize, int& zsize) {
+    force.getPMEParameters(alpha, xsize, ysize, zsize);
+    if (alpha == 0.0) {
+        Vec3 boxVectors[3];
+        system.getDefaultPeriodicBoxVectors(boxVectors[0], boxVectors[1], boxVectors[2]);
+        calcP3MParameters(boxVectors, force.getCutoffDistance(), force.getEwaldErrorTolerance(), alpha, xsize, ysize, zsize);
+    }
+}
+
+void NativeNonbondedForceImpl::calcP3MParameters(const Vec3* boxVectors, double cutoff, double ewaldErrorTol, double& alpha, int& xsize, int& ysize, int& zsize) {
+    // Use the smallest grid whose reciprocal space error does not exceed the real space error estimate of
+    // Kolafa and Perram.  Both scale in the same way with the charges and the number of particles, so those cancel.
+
+    double tol = ewaldErrorTol;
+    alpha = (1.0/cutoff)*std::sqrt(-log(2.0*tol));
+    double volume = boxVectors[0][0]*boxVectors[1][1]*boxVectors[2][2];
+    double target = 2*exp(-alpha*alpha*cutoff*cutoff)/sqrt(cutoff*volume);
+    xsize = findZero(P3MErrorFunction(boxVectors[0][0], alpha, target), (int) ceil(alpha*boxVectors[0][0]));
+    ysize = findZero(P3MErrorFunction(boxVectors[1][1], alpha, target), (int) ceil(alpha*boxVectors[1][1]));
+    zsize = findZero(P3MErrorFunction(boxVectors[2][2], alpha, target), (int) ceil(alpha*boxVectors[2][2]));
+    xsize = max(xsize, 6);
+    ysize = max(ysize, 6);
+    zsize = max(zsize, 6);
+}
+
+void NativeNonbondedForceImpl::calcUSeriesParameters(const System& system, const NativeNonbondedForce& force, double& alpha, int& xsize, int& ysize, int& zsize) {
+    force.getPMEParameters(alpha, xsize, ysize, zsize);
+    if (alpha == 0.0) {
+        Vec3 boxVectors[3];
+        system.getDefaultPeriodicBoxVectors(boxVectors[0], boxVectors[1], boxVectors[2]);
+        calcUSeriesParameters(boxVectors, force.getCutoffDistance(), force.getEwaldErrorTolerance(), alpha, xsize, ysize, zsize);
+    }
+}
+
+void NativeNonbondedForceImpl::calcUSeriesParameters(const Vec3* boxVectors, double cutoff, double ewaldErrorTol, double& alpha, int& xsize, int& ysize, int& zsize) {
+    // Choose the width sigma of the narrowest long range Gaussian so that the direct space interaction, which is the
+    // sum of all narrower Gaussians, has the same value at the cutoff as erfc(alpha*r)/r does for PME.  That sum
+    // increases monotonically with sigma, so it can be found by bisection.
+
+    double tol = ewaldErrorTol;
+    double h = calcUSeriesSpacing(tol);
+    double ewaldAlpha = (1.0/cutoff)*std::sqrt(-log(2.0*tol));
+    double target = erfc(ewaldAlpha*cutoff)/cutoff;
+    double minSigma = 0.05*cutoff, maxSigma = 2.0*cutoff;
+    for (int iteration = 0; iteration < 60; iteration++) {
+        double sigma0 = 0.5*(minSigma+maxSigma);
+        double sum = 0.0;
+        for (double sigma = sigma0*exp(-h); sigma > cutoff/8; sigma *= exp(-h))
+            sum += 2*h/(sqrt(M_PI)*sigma)*exp(-cutoff*cutoff/(sigma*sigma));
+        if (sum < target)
+            minSigma = sigma0;
+        else
+            maxSigma = sigma0;
+    }
+    alpha = 2.0/(minSigma+maxSigma);
+
+    // The finest grid must resolve the narrowest long range Gaussian, which decays in reciprocal space like the Ewald
+    // kernel with the same alpha, so use the PME formula.  Wider Gaussians go on grids that are coarser by the same
+    // factor as they are wider, which the platforms derive from this one.
+
+    xsize = max((int) ceil(2*alpha*boxVectors[0][0]/(3*pow(tol, 0.2))), 6);
+    ysize = max((int) ceil(2*alpha*boxVectors[1][1]/(3*pow(tol, 0.2))), 6);
+    zsize = max((int) ceil(2*alpha*boxVectors[2][2]/(3*pow(tol, 0.2))), 6);
+}
+
+double NativeNonbondedForceImpl::calcUSeriesSpacing(double ewaldErrorTol) {
+    // The trapezoidal rule for the integral representation of 1/r converges exponentially, with a relative error
+    // of about 3*exp(-pi^2/(2h)) in the energy.  The error oscillates with log(r), so the error in the force is
+    // larger by a factor 2*pi/h.  It affects every pair, not just those near the cutoff, so it is kept about 100
+    // times smaller than the tolerance.
+
+    return M_PI*M_PI/(2*log(7000/ewaldErrorTol));
+}
+
+void NativeNonbondedForceImpl::calcMSMParameters(const System& system, const NativeNonbondedForce& force, int& numLevels, int& xsize, int& ysize, int& zsize) {
+    int order;
+    force.getMSMParameters(numLevels, order);
+    Vec3 boxVectors[3];
+    system.getDefaultPeriodicBoxVectors(boxVectors[0], boxVectors[1], boxVectors[2]);
+
+    // The relative force error scales as (h/a)^(order-2), where h is the grid spacing and a the cutoff.
+    // The prefactors were fit to comparisons against Ewald summation.
+
+    double tol = force.getEwaldErrorTolerance();
+    double cutoff = force.getCutoffDistance();
+    double spacing = (order == 6 ? cutoff*pow(tol, 0.25) : cutoff*sqrt(tol/0.11));
+    int size[3];
+    for (int i = 0; i < 3; i++)
+        size[i] = max((int) ceil(boxVectors[i][i]/spacing), 6);
+
+    // Add levels until the top level grid is small enough to be handled directly, then round the finest
+    // grid up so that it can be coarsened the required number of times.
+
+    if (numLevels == 0) {
+        numLevels = 1;
+        while (max(size[0], max(size[1], size[2])) > 8*(1<<(numLevels-1)))
+            numLevels++;
+    }
+    int factor = 1<<(numLevels-1);
+    for (int i = 0; i < 3; i++)
+        size[i] = factor*((size[i]+factor-1)/factor);
+    xsize = size[0];
+    ysize = size[1];
+    zsize = size[2];
 }
 
 int NativeNonbondedForceImpl::findZero(const NativeNonbondedForceImpl::ErrorFunction& f, int initialGuess) {
@@ -268,83 +411,364 @@ double NativeNonbondedForceImpl::evalIntegral(double r, double rs, double rc, do
 }
 
 double NativeNonbondedForceImpl::calcDispersionCorrection(const System& system, const NativeNonbondedForce& force) {
-    if (force.getNonbondedMethod() == NativeNonbondedForce::NoCutoff || force.getNonbondedMethod() == NativeNonbondedForce::CutoffNonPeriodic)
-        return 0.0;
+    return DispersionCorrection(force).getCoefficient();
+}
 
-    // Record sigma and epsilon for every particle, including the default value
-    // for every offset parameter.
+NativeNonbondedForceImpl::DispersionCorrection::DispersionCorrection(const NativeNonbondedForce& force) : dynamicSumsValid(false), numTypes(0) {
+    periodic = force.usesPeriodicBoundaryConditions();
+    useSwitch = force.getUseSwitchingFunction();
+    cutoff = getEffectiveLJCutoff(force);
+    switchDist = force.getSwitchingDistance();
+    numParticles = force.getNumParticles();
+    for (int i = 0; i < 3; i++)
+        staticSums[i] = dynamicSums[i] = 0.0;
+    if (!periodic)
+        return;
 
-    vector<double> sigma(force.getNumParticles()), epsilon(force.getNumParticles());
-    for (int i = 0; i < force.getNumParticles(); i++) {
-        double charge;
-        force.getParticleParameters(i, charge, sigma[i], epsilon[i]);
+    // Record sigma and epsilon (or the atom type) for every particle, and the offsets that can change them.
+
+    if (force.getUseLJTypes()) {
+        numTypes = force.getNumLJTypes();
+        getLJTypeTable(force, typeSigma, typeEpsilon);
     }
-    map<string, double> param;
-    for (int i = 0; i < force.getNumGlobalParameters(); i++)
-        param[force.getGlobalParameterName(i)] = force.getGlobalParameterDefaultValue(i);
+    baseParams.resize(numParticles);
+    for (int i = 0; i < numParticles; i++)
+        baseParams[i] = getParticleClass(force, i);
+    for (int i = 0; i < force.getNumGlobalParameters(); i++) {
+        parameterIndex[force.getGlobalParameterName(i)] = i;
+        parameterValues.push_back(force.getGlobalParameterDefaultValue(i));
+    }
+    isDynamic.resize(numParticles, false);
     for (int i = 0; i < force.getNumParticleParameterOffsets(); i++) {
         string parameter;
         int index;
         double chargeScale, sigmaScale, epsilonScale;
         force.getParticleParameterOffset(i, parameter, index, chargeScale, sigmaScale, epsilonScale);
-        sigma[index] += param[parameter]*sigmaScale;
-        epsilon[index] += param[parameter]*epsilonScale;
+        if (sigmaScale == 0.0 && epsilonScale == 0.0)
+            continue;
+        offsetParameter.push_back(parameterIndex[parameter]);
+        offsetParticle.push_back(index);
+        offsetScales.push_back(make_pair(sigmaScale, epsilonScale));
+        isDynamic[index] = true;
     }
+    for (int i = 0; i < numParticles; i++)
+        if (isDynamic[i])
+            dynamicParticles.push_back(i);
+    computeStaticSums();
+}
 
-    // Identify all particle classes (defined by sigma and epsilon), and count the number of
-    // particles in each class.
+void NativeNonbondedForceImpl::DispersionCorrection::updateParticles(const NativeNonbondedForce& force, int first, int last) {
+    if (!periodic)
+        return;
+    if (numTypes > 0 || force.getUseLJTypes()) {
+        // If the table of types has changed, every pair of classes is affected, so start over.
 
-    map<pair<double, double>, int> classCounts;
-    for (int i = 0; i < force.getNumParticles(); i++) {
-        pair<double, double> key = make_pair(sigma[i], epsilon[i]);
-        map<pair<double, double>, int>::iterator entry = classCounts.find(key);
-        if (entry == classCounts.end())
-            classCounts[key] = 1;
+        vector<double> sigma, epsilon;
+        if (force.getUseLJTypes())
+            getLJTypeTable(force, sigma, epsilon);
+        if (sigma != typeSigma || epsilon != typeEpsilon) {
+            numTypes = force.getNumLJTypes();
+            typeSigma = sigma;
+            typeEpsilon = epsilon;
+            for (int i = 0; i < numParticles; i++)
+                baseParams[i] = getParticleClass(force, i);
+            computeStaticSums();
+            return;
+        }
+    }
+    vector<pair<ParticleClass, ParticleClass> > moved;
+    for (int i = first; i <= last; i++) {
+        ParticleClass params = getParticleClass(force, i);
+        if (params == baseParams[i])
+            continue;
+        if (isDynamic[i])
+            dynamicSumsValid = false;
         else
-            entry->second++;
+            moved.push_back(make_pair(baseParams[i], params));
+        baseParams[i] = params;
     }
 
-    // Loop over all pairs of classes to compute the coefficient.
+    // Moving a particle costs time proportional to the number of classes, so if many particles have changed,
+    // it is faster to start over.
 
-    double sum1 = 0, sum2 = 0, sum3 = 0;
-    bool useSwitch = force.getUseSwitchingFunction();
-    double cutoff = force.getCutoffDistance();
-    double switchDist = force.getSwitchingDistance();
-    for (map<pair<double, double>, int>::const_iterator entry = classCounts.begin(); entry != classCounts.end(); ++entry) {
-        double sigma = entry->first.first;
-        double epsilon = entry->first.second;
-        double count = (double) entry->second;
-        count *= (count + 1) / 2;
-        double sigma2 = sigma*sigma;
-        double sigma6 = sigma2*sigma2*sigma2;
-        sum1 += count*epsilon*sigma6*sigma6;
-        sum2 += count*epsilon*sigma6;
-        if (useSwitch)
-            sum3 += count*epsilon*(evalIntegral(cutoff, switchDist, cutoff, sigma)-evalIntegral(switchDist, switchDist, cutoff, sigma));
-    }
-    for (map<pair<double, double>, int>::const_iterator class1 = classCounts.begin(); class1 != classCounts.end(); ++class1)
-        for (map<pair<double, double>, int>::const_iterator class2 = classCounts.begin(); class2 != class1; ++class2) {
-            double sigma = 0.5*(class1->first.first+class2->first.first);
-            double epsilon = sqrt(class1->first.second*class2->first.second);
+    if (moved.size() > staticCounts.size())
+        computeStaticSums();
+    else {
+        for (auto& change : moved) {
+            removeStaticParticle(change.first);
+            addStaticParticle(change.second);
+        }
+    }
+}
+
+void NativeNonbondedForceImpl::DispersionCorrection::setParameter(const string& name, double value) {
+    map<string, int>::const_iterator index = parameterIndex.find(name);
+    if (index == parameterIndex.end() || parameterValues[index->second] == value)
+        return;
+    parameterValues[index->second] = value;
+    if (find(offsetParameter.begin(), offsetParameter.end(), index->second) != offsetParameter.end())
+        dynamicSumsValid = false;
+}
+
+double NativeNonbondedForceImpl::DispersionCorrection::getCoefficient() {
+    if (!periodic)
+        return 0.0;
+    if (!dynamicSumsValid) {
+        // Compute the current parameters of particles that have offsets, group them into classes, and sum over all
+        // pairs that involve at least one of them.
+
+        map<int, ParticleClass> params;
+        for (int i : dynamicParticles)
+            params[i] = baseParams[i];
+        for (int i = 0; i < offsetParticle.size(); i++) {
+            ParticleClass& p = params[offsetParticle[i]];
+            double value = parameterValues[offsetParameter[i]];
+            p.first += value*offsetScales[i].first;
+            p.second += value*offsetScales[i].second;
+        }
+        map<ParticleClass, int> dynamicCounts;
+        for (auto& p : params)
+            dynamicCounts[p.second]++;
+        for (int i = 0; i < 3; i++)
+            dynamicSums[i] = 0.0;
+        for (map<ParticleClass, int>::const_iterator class1 = dynamicCounts.begin(); class1 != dynamicCounts.end(); ++class1) {
             double count = (double) class1->second;
-            count *= (double) class2->second;
-            double sigma2 = sigma*sigma;
-            double sigma6 = sigma2*sigma2*sigma2;
-            sum1 += count*epsilon*sigma6*sigma6;
-            sum2 += count*epsilon*sigma6;
-            if (useSwitch)
-                sum3 += count*epsilon*(evalIntegral(cutoff, switchDist, cutoff, sigma)-evalIntegral(switchDist, switchDist, cutoff, sigma));
+            addPairTerms(class1->first, class1->first, count*(count+1)/2, dynamicSums);
+            for (map<ParticleClass, int>::const_iterator class2 = dynamicCounts.begin(); class2 != class1; ++class2)
+                addPairTerms(class1->first, class2->first, count*class2->second, dynamicSums);
+            for (auto& staticClass : staticCounts)
+                addPairTerms(class1->first, staticClass.first, count*staticClass.second, dynamicSums);
+        }
+        dynamicSumsValid = true;
+    }
+    double n = (double) numParticles;
+    double numInteractions = (n*(n+1))/2;
+    double sum1 = (staticSums[0]+dynamicSums[0])/numInteractions;
+    double sum2 = (staticSums[1]+dynamicSums[1])/numInteractions;
+    double sum3 = (staticSums[2]+dynamicSums[2])/numInteractions;
+    return 8*n*n*M_PI*(sum1/(9*pow(cutoff, 9))-sum2/(3*pow(cutoff, 3))+sum3);
+}
+
+NativeNonbondedForceImpl::DispersionCorrection::ParticleClass NativeNonbondedForceImpl::DispersionCorrection::getParticleClass(const NativeNonbondedForce& force, int index) const {
+    // With atom types, a class is identified by the type alone.
+
+    if (numTypes > 0)
+        return make_pair((double) force.getParticleLJType(index), 0.0);
+    double charge;
+    ParticleClass params;
+    force.getParticleParameters(index, charge, params.first, params.second);
+    return params;
+}
+
+void NativeNonbondedForceImpl::DispersionCorrection::addPairTerms(const ParticleClass& class1, const ParticleClass& class2, double count, double* sums) const {
+    double sigma, epsilon;
+    if (numTypes > 0) {
+        int index = ((int) class1.first)*numTypes + (int) class2.first;
+        sigma = typeSigma[index];
+        epsilon = typeEpsilon[index];
+    }
+    else if (class1 == class2) {
+        sigma = class1.first;
+        epsilon = class1.second;
+    }
+    else {
+        sigma = 0.5*(class1.first+class2.first);
+        epsilon = sqrt(class1.second*class2.second);
+    }
+    double sigma2 = sigma*sigma;
+    double sigma6 = sigma2*sigma2*sigma2;
+    sums[0] += count*epsilon*sigma6*sigma6;
+    sums[1] += count*epsilon*sigma6;
+    if (useSwitch)
+        sums[2] += count*epsilon*(evalIntegral(cutoff, switchDist, cutoff, sigma)-evalIntegral(switchDist, switchDist, cutoff, sigma));
+}
+
+void NativeNonbondedForceImpl::DispersionCorrection::addStaticParticle(const ParticleClass& particleClass) {
+    // The new particle interacts with every particle already present, and with itself.
+
+    addPairTerms(particleClass, particleClass, 1.0, staticSums);
+    for (auto& entry : staticCounts)
+        addPairTerms(particleClass, entry.first, entry.second, staticSums);
+    staticCounts[particleClass]++;
+    dynamicSumsValid = false;
+}
+
+void NativeNonbondedForceImpl::DispersionCorrection::removeStaticParticle(const ParticleClass& particleClass) {
+    map<ParticleClass, int>::iterator existing = staticCounts.find(particleClass);
+    if (--existing->second == 0)
+        staticCounts.erase(existing);
+    addPairTerms(particleClass, particleClass, -1.0, staticSums);
+    for (auto& entry : staticCounts)
+        addPairTerms(particleClass, entry.first, -entry.second, staticSums);
+    dynamicSumsValid = false;
+}
+
+void NativeNonbondedForceImpl::DispersionCorrection::computeStaticSums() {
+    // Identify all classes of particles without offsets (defined by sigma and epsilon), count the number of
+    // particles in each class, and loop over all pairs of classes.
+
+    staticCounts.clear();
+    for (int i = 0; i < numParticles; i++)
+        if (!isDynamic[i])
+            staticCounts[baseParams[i]]++;
+    for (int i = 0; i < 3; i++)
+        staticSums[i] = 0.0;
+    for (map<ParticleClass, int>::const_iterator class1 = staticCounts.begin(); class1 != staticCounts.end(); ++class1) {
+        double count = (double) class1->second;
+        addPairTerms(class1->first, class1->first, count*(count+1)/2, staticSums);
+        for (map<ParticleClass, int>::const_iterator class2 = staticCounts.begin(); class2 != class1; ++class2)
+            addPairTerms(class1->first, class2->first, count*class2->second, staticSums);
+    }
+    dynamicSumsValid = false;
+}
+
+double NativeNonbondedForceImpl::getEffectiveLJCutoff(const NativeNonbondedForce& force) {
+    if (force.getLJCutoffDistance() > 0.0)
+        return force.getLJCutoffDistance();
+    return force.getCutoffDistance();
+}
+
+void NativeNonbondedForceImpl::getLJTypeTable(const NativeNonbondedForce& force, vector<double>& sigma, vector<double>& epsilon) {
+    int numTypes = force.getNumLJTypes();
+    sigma.resize(numTypes*numTypes);
+    epsilon.resize(numTypes*numTypes);
+    for (int i = 0; i < numTypes; i++) {
+        double sigma1, epsilon1;
+        force.getLJTypeParameters(i, sigma1, epsilon1);
+        for (int j = 0; j < numTypes; j++) {
+            double sigma2, epsilon2;
+            force.getLJTypeParameters(j, sigma2, epsilon2);
+            sigma[i*numTypes+j] = 0.5*(sigma1+sigma2);
+            epsilon[i*numTypes+j] = sqrt(epsilon1*epsilon2);
+        }
+    }
+    for (int i = 0; i < force.getNumLJTypePairs(); i++) {
+        int type1, type2;
+        double pairSigma, pairEpsilon;
+        force.getLJTypePairParameters(i, type1, type2, pairSigma, pairEpsilon);
+        if (type1 < 0 || type2 < 0 || type1 >= numTypes || type2 >= numTypes) {
+            stringstream msg;
+            msg << "NativeNonbondedForce: Illegal type index for a pair of LJ types: ";
+            msg << type1 << ", " << type2;
+            throw OpenMMException(msg.str());
+        }
+        sigma[type1*numTypes+type2] = sigma[type2*numTypes+type1] = pairSigma;
+        epsilon[type1*numTypes+type2] = epsilon[type2*numTypes+type1] = pairEpsilon;
+    }
+}
+
+void NativeNonbondedForceImpl::checkLJTypes(const NativeNonbondedForce& force) {
+    if (!force.getUseLJTypes())
+        return;
+    if (force.getNonbondedMethod() == NativeNonbondedForce::LJPME)
+        throw OpenMMException("NativeNonbondedForce: LJ types cannot be used with LJPME");
+    vector<double> sigma, epsilon;
+    getLJTypeTable(force, sigma, epsilon);
+    for (int i = 0; i < sigma.size(); i++) {
+        if (sigma[i] < 0)
+            throw OpenMMException("NativeNonbondedForce: sigma for an LJ type cannot be negative");
+        if (epsilon[i] < 0)
+            throw OpenMMException("NativeNonbondedForce: epsilon for an LJ type cannot be negative");
+    }
+    for (int i = 0; i < force.getNumParticles(); i++) {
+        int type = force.getParticleLJType(i);
+        if (type < 0 || type >= force.getNumLJTypes()) {
+            stringstream msg;
+            msg << "NativeNonbondedForce: Particle " << i << " does not have a valid LJ type";
+            throw OpenMMException(msg.str());
         }
-    double numParticles = (double) system.getNumParticles();
-    double numInteractions = (numParticles*(numParticles+1))/2;
-    sum1 /= numInteractions;
-    sum2 /= numInteractions;
-    sum3 /= numInteractions;
-    return 8*numParticles*numParticles*M_PI*(sum1/(9*pow(cutoff, 9))-sum2/(3*pow(cutoff, 3))+sum3);
+    }
+    for (int i = 0; i < force.getNumParticleParameterOffsets(); i++) {
+        string parameter;
+        int particleIndex;
+        double chargeScale, sigmaScale, epsilonScale;
+        force.getParticleParameterOffset(i, parameter, particleIndex, chargeScale, sigmaScale, epsilonScale);
+        if (sigmaScale != 0.0 || epsilonScale != 0.0)
+            throw OpenMMException("NativeNonbondedForce: Parameter offsets cannot change sigma or epsilon when LJ types are used");
+    }
 }
 
-void NativeNonbondedForceImpl::updateParametersInContext(ContextImpl& context) {
-    kernel.getAs<CalcNativeNonbondedForceKernel>().copyParametersToContext(context, owner);
+void NativeNonbondedForceImpl::runInParallel(int numParticles, ThreadPool* threads, const function<void(int, int)>& task) {
+    if (threads == NULL && numParticles < MinParallelParticles) {
+        task(0, 1);
+        return;
+    }
+    auto run = [&] (ThreadPool& pool) {
+        int numThreads = pool.getNumThreads();
+        pool.execute([&] (ThreadPool& pool, int threadIndex) {
+            task(threadIndex, numThreads);
+        });
+        pool.waitForThreads();
+    };
+    if (threads != NULL)
+        run(*threads);
+    else {
+        ThreadPool localThreads;
+        run(localThreads);
+    }
+}
+
+void NativeNonbondedForceImpl::findExclusions(const NativeNonbondedForce& force, vector<vector<int> >& exclusions, ThreadPool* threads) {
+    int numParticles = force.getNumParticles();
+    vector<pair<int, int> > pairs(force.getNumExceptions());
+    vector<int> numExclusions(numParticles, 0);
+    for (int i = 0; i < force.getNumExceptions(); i++) {
+        int particle[2];
+        double chargeProd, sigma, epsilon;
+        force.getExceptionParameters(i, particle[0], particle[1], chargeProd, sigma, epsilon);
+        for (int j = 0; j < 2; j++) {
+            if (particle[j] < 0 || particle[j] >= numParticles) {
+                stringstream msg;
+                msg << "NativeNonbondedForce: Illegal particle index for an exception: ";
+                msg << particle[j];
+                throw OpenMMException(msg.str());
+            }
+        }
+        pairs[i] = make_pair(particle[0], particle[1]);
+        numExclusions[particle[0]]++;
+        if (particle[1] != particle[0])
+            numExclusions[particle[1]]++;
+    }
+    exclusions.resize(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        exclusions[i].clear();
+        exclusions[i].reserve(numExclusions[i]);
+    }
+    for (auto& p : pairs) {
+        exclusions[p.first].push_back(p.second);
+        if (p.second != p.first)
+            exclusions[p.second].push_back(p.first);
+    }
+
+    // Sort each particle's list in parallel.  A repeated entry means two exceptions involve the same pair.  The
+    // repeated particle is recorded for each list, and the lowest numbered particle is reported.
+
+    vector<int> repeatedParticle(numParticles, -1);
+    runInParallel(numParticles, threads, [&] (int threadIndex, int numThreads) {
+        for (int i = threadIndex; i < numParticles; i += numThreads) {
+            vector<int>& list = exclusions[i];
+            sort(list.begin(), list.end());
+            vector<int>::iterator repeated = adjacent_find(list.begin(), list.end());
+            if (repeated != list.end())
+                repeatedParticle[i] = *repeated;
+        }
+    });
+    pair<int, int> duplicate = make_pair(numParticles, 0);
+    for (int i = 0; i < numParticles && duplicate.first == numParticles; i++)
+        if (repeatedParticle[i] != -1)
+            duplicate = make_pair(i, repeatedParticle[i]);
+    if (duplicate.first < numParticles) {
+        stringstream msg;
+        msg << "NativeNonbondedForce: Multiple exceptions are specified for particles ";
+        msg << min(duplicate.first, duplicate.second);
+        msg << " and ";
+        msg << max(duplicate.first, duplicate.second);
+        throw OpenMMException(msg.str());
+    }
+}
+
+void NativeNonbondedForceImpl::updateParametersInContext(ContextImpl& context, int firstParticle, int lastParticle, int firstException, int lastException) {
+    kernel.getAs<CalcNativeNonbondedForceKernel>().copyParametersToContext(context, owner, firstParticle, lastParticle, firstException, lastException);
     context.systemChanged();
 }
 
@@ -355,3 +779,7 @@ void NativeNonbondedForceImpl::getPMEParameters(double& alpha, int& nx, int& ny,
 void NativeNonbondedForceImpl::getLJPMEParameters(double& alpha, int& nx, int& ny, int& nz) const {
     kernel.getAs<CalcNativeNonbondedForceKernel>().getLJPMEParameters(alpha, nx, ny, nz);
 }
+
+void NativeNonbondedForceImpl::getMSMParameters(int& numLevels, int& nx, int& ny, int& nz) const {
+    kernel.getAs<CalcNativeNonbondedForceKernel>().getMSMParameters(numLevels, nx, ny, nz);
+}
@@ -3,7 +3,9 @@
     unsigned int includeInteraction = (!isExcluded && r2 < CUTOFF_SQUARED);
     const real alphaR = EWALD_ALPHA*r;
     const real expAlphaRSqr = EXP(-alphaR*alphaR);
-#if HAS_COULOMB
+#if HAS_COULOMB && USE_SEPARATE_CUTOFFS
+    const real prefactor = (r2 < COULOMB_CUTOFF_SQUARED ? ONE_4PI_EPS0*CHARGE1*CHARGE2*invR : 0.0f);
+#elif HAS_COULOMB
     const real prefactor = ONE_4PI_EPS0*CHARGE1*CHARGE2*invR;
 #else
     const real prefactor = 0.0f;
@@ -21,11 +23,17 @@
 #endif
     real tempForce = 0.0f;
 #if HAS_LENNARD_JONES
+  #if USE_LJ_TYPES
+    const float2 ljParams = LJ_TYPE_TABLE[LJ_TYPE1*NUM_LJ_TYPES+LJ_TYPE2];
+    real sig = ljParams.x;
+    real eps = ljParams.y;
+  #else
     real sig = SIGMA_EPSILON1.x + SIGMA_EPSILON2.x;
+    real eps = SIGMA_EPSILON1.y*SIGMA_EPSILON2.y;
+  #endif
     real sig2 = invR*sig;
     sig2 *= sig2;
     real sig6 = sig2*sig2*sig2;
-    real eps = SIGMA_EPSILON1.y*SIGMA_EPSILON2.y;
     real epssig6 = sig6*eps;
     tempForce = epssig6*(12.0f*sig6 - 6.0f);
     real ljEnergy = epssig6*(sig6 - 1.0f);
@@ -38,6 +46,12 @@
         ljEnergy *= switchValue;
     }
     #endif
+    #if USE_SEPARATE_CUTOFFS
+    if (r2 >= LJ_CUTOFF_SQUARED) {
+        tempForce = 0.0f;
+        ljEnergy = 0.0f;
+    }
+    #endif
 #if DO_LJPME
     // The multiplicative term to correct for the multiplicative terms that are always
     // present in reciprocal space.
@@ -82,11 +96,18 @@
 #endif
     real tempForce = 0.0f;
 #if HAS_LENNARD_JONES
+  #if USE_LJ_TYPES
+    const float2 ljParams = LJ_TYPE_TABLE[LJ_TYPE1*NUM_LJ_TYPES+LJ_TYPE2];
+    real sig = ljParams.x;
+    real eps = ljParams.y;
+  #else
     real sig = SIGMA_EPSILON1.x + SIGMA_EPSILON2.x;
+    real eps = SIGMA_EPSILON1.y*SIGMA_EPSILON2.y;
+  #endif
     real sig2 = invR*sig;
     sig2 *= sig2;
     real sig6 = sig2*sig2*sig2;
-    real epssig6 = sig6*(SIGMA_EPSILON1.y*SIGMA_EPSILON2.y);
+    real epssig6 = sig6*eps;
     tempForce = epssig6*(12.0f*sig6 - 6.0f);
     real ljEnergy = includeInteraction ? epssig6*(sig6 - 1) : 0;
     #if USE_LJ_SWITCH
@@ -98,15 +119,50 @@
         ljEnergy *= switchValue;
     }
     #endif
+    #if USE_IPS
+    // Add the IPS polynomial for the r^-6 term, which makes its energy and force go to zero at the cutoff.
+
+    real c6 = sig*sig;
+    c6 = c6*c6*c6*eps;
+    tempForce += c6*r2*(2.0f*IPS_DISPERSION_2 + r2*(4.0f*IPS_DISPERSION_4 + r2*6.0f*IPS_DISPERSION_6));
+    ljEnergy += includeInteraction ? c6*(IPS_DISPERSION_0 - r2*(IPS_DISPERSION_2 + r2*(IPS_DISPERSION_4 + r2*IPS_DISPERSION_6))) : 0;
+    #endif
+    #if USE_SEPARATE_CUTOFFS
+    if (r2 >= LJ_CUTOFF_SQUARED) {
+        tempForce = 0.0f;
+        ljEnergy = 0.0f;
+    }
+    #endif
     tempEnergy += ljEnergy;
 #endif
 #if HAS_COULOMB
-  #ifdef USE_CUTOFF
-    const real prefactor = ONE_4PI_EPS0*CHARGE1*CHARGE2;
+  #if USE_SEPARATE_CUTOFFS
+    const real chargeProd = (r2 < COULOMB_CUTOFF_SQUARED ? CHARGE1*CHARGE2 : 0.0f);
+  #else
+    const real chargeProd = CHARGE1*CHARGE2;
+  #endif
+  #if USE_IPS
+    const real prefactor = ONE_4PI_EPS0*chargeProd;
+    tempForce += prefactor*(invR - r2*(2.0f*IPS_COULOMB_2 + r2*(4.0f*IPS_COULOMB_4 + r2*6.0f*IPS_COULOMB_6)));
+    tempEnergy += includeInteraction ? prefactor*(invR + IPS_COULOMB_0 + r2*(IPS_COULOMB_2 + r2*(IPS_COULOMB_4 + r2*IPS_COULOMB_6))) : 0;
+  #elif USE_DSF
+    const real prefactor = ONE_4PI_EPS0*chargeProd;
+    const real alphaR = DSF_ALPHA*r;
+    const real expAlphaRSqr = EXP(-alphaR*alphaR);
+    #ifdef USE_DOUBLE_PRECISION
+    const real erfcAlphaR = erfc(alphaR);
+    #else
+    const real t = RECIP(1.0f+0.3275911f*alphaR);
+    const real erfcAlphaR = (0.254829592f+(-0.284496736f+(1.421413741f+(-1.453152027f+1.061405429f*t)*t)*t)*t)*t*expAlphaRSqr;
+    #endif
+    tempForce += prefactor*((erfcAlphaR+alphaR*expAlphaRSqr*TWO_OVER_SQRT_PI)*invR - DSF_FORCE_SHIFT*r);
+    tempEnergy += includeInteraction ? prefactor*(erfcAlphaR*invR - DSF_ENERGY_SHIFT + DSF_FORCE_SHIFT*r) : 0;
+  #elif defined(USE_CUTOFF)
+    const real prefactor = ONE_4PI_EPS0*chargeProd;
     tempForce += prefactor*(invR - 2.0f*REACTION_FIELD_K*r2);
     tempEnergy += includeInteraction ? prefactor*(invR + REACTION_FIELD_K*r2 - REACTION_FIELD_C) : 0;
   #else
-    const real prefactor = ONE_4PI_EPS0*CHARGE1*CHARGE2*invR;
+    const real prefactor = ONE_4PI_EPS0*chargeProd*invR;
     tempForce += prefactor;
     tempEnergy += includeInteraction ? prefactor : 0;
   #endif
@@ -0,0 +1,26 @@
+const float4 exclusionParams = PARAMS[index];
+real3 delta = make_real3(pos2.x-pos1.x, pos2.y-pos1.y, pos2.z-pos1.z);
+#if USE_PERIODIC
+    APPLY_PERIODIC_TO_DELTA(delta)
+#endif
+const real r2 = delta.x*delta.x + delta.y*delta.y + delta.z*delta.z;
+real forceScale = 0.0f;
+if (r2 < CUTOFF_SQUARED) {
+    // Excluded pairs interact through the damped shifted potential minus the bare Coulomb interaction.
+
+    const real r = SQRT(r2);
+    const real invR = RECIP(r);
+    const real alphaR = DSF_ALPHA*r;
+    const real expAlphaRSqr = EXP(-alphaR*alphaR);
+    if (alphaR > 1e-6f) {
+        const real erfAlphaR = ERF(alphaR);
+        const real tempForce = exclusionParams.x*(-(erfAlphaR-alphaR*expAlphaRSqr*TWO_OVER_SQRT_PI)*invR - DSF_FORCE_SHIFT*r);
+        energy += exclusionParams.x*(-erfAlphaR*invR - DSF_ENERGY_SHIFT + DSF_FORCE_SHIFT*r);
+        forceScale = tempForce*invR*invR;
+    }
+    else
+        energy -= exclusionParams.x*(TWO_OVER_SQRT_PI*DSF_ALPHA + DSF_ENERGY_SHIFT);
+}
+delta *= forceScale;
+real3 force1 = -delta;
+real3 force2 = delta;
@@ -0,0 +1,16 @@
+const float4 exclusionParams = PARAMS[index];
+real3 delta = make_real3(pos2.x-pos1.x, pos2.y-pos1.y, pos2.z-pos1.z);
+#if USE_PERIODIC
+    APPLY_PERIODIC_TO_DELTA(delta)
+#endif
+const real r2 = delta.x*delta.x + delta.y*delta.y + delta.z*delta.z;
+real forceScale = 0.0f;
+if (r2 < CUTOFF_SQUARED) {
+    // Excluded pairs interact through the IPS polynomial without the bare Coulomb interaction.
+
+    energy += exclusionParams.x*(IPS_COULOMB_0 + r2*(IPS_COULOMB_2 + r2*(IPS_COULOMB_4 + r2*IPS_COULOMB_6)));
+    forceScale = -exclusionParams.x*(2.0f*IPS_COULOMB_2 + r2*(4.0f*IPS_COULOMB_4 + r2*6.0f*IPS_COULOMB_6));
+}
+delta *= forceScale;
+real3 force1 = -delta;
+real3 force2 = delta;
@@ -38,7 +38,9 @@
 #include "openmm/cuda/CudaForceInfo.h"
 #include "openmm/reference/SimTKOpenMMRealType.h"
 #include "openmm/common/ContextSelector.h"
+#include <cmath>
 #include <cstring>
+#include <limits>
 #include <algorithm>
 
 #define CHECK_RESULT(result, prefix) \
@@ -59,6 +61,8 @@ public:
         double charge1, charge2, sigma1, sigma2, epsilon1, epsilon2;
         force.getParticleParameters(particle1, charge1, sigma1, epsilon1);
         force.getParticleParameters(particle2, charge2, sigma2, epsilon2);
+        if (force.getUseLJTypes() && force.getParticleLJType(particle1) != force.getParticleLJType(particle2))
+            return false;
         return (charge1 == charge2 && sigma1 == sigma2 && epsilon1 == epsilon2);
     }
     int getNumParticleGroups() {
@@ -182,6 +186,8 @@ CudaCalcNativeNonbondedForceKernel::~CudaCalcNativeNonbondedForceKernel() {
         delete dispersionFft;
     if (pmeio != NULL)
         delete pmeio;
+    if (dispersionCorrection != NULL)
+        delete dispersionCorrection;
     if (hasInitializedFFT) {
         if (useCudaFFT) {
             cufftDestroy(fftForward);
@@ -199,7 +205,7 @@ CudaCalcNativeNonbondedForceKernel::~CudaCalcNativeNonbondedForceKernel() {
     }
 }
 
-void CudaCalcNativeNonbondedForceKernel::initialize(const System& system, const NativeNonbondedForce& force) {
+void CudaCalcNativeNonbondedForceKernel::initialize(const System& system, const NativeNonbondedForce& force, const vector<vector<int> >& exclusions) {
     ContextSelector selector(cu);
     int forceIndex;
     for (forceIndex = 0; forceIndex < system.getNumForces() && &system.getForce(forceIndex) != &force; ++forceIndex)
@@ -216,25 +222,26 @@ void CudaCalcNativeNonbondedForceKernel::initialize(const System& system, const
         force.getExceptionParameterOffset(i, param, exception, charge, sigma, epsilon);
         exceptionsWithOffsets.insert(exception);
     }
-    vector<pair<int, int> > exclusions;
+    vector<pair<int, int> > exclusionPairs;
     vector<int> exceptions;
-    map<int, int> exceptionIndex;
+    exceptionIndex.assign(force.getNumExceptions(), -1);
     for (int i = 0; i < force.getNumExceptions(); i++) {
         int particle1, particle2;
         double chargeProd, sigma, epsilon;
         force.getExceptionParameters(i, particle1, particle2, chargeProd, sigma, epsilon);
-        exclusions.push_back(pair<int, int>(particle1, particle2));
+        exclusionPairs.push_back(pair<int, int>(particle1, particle2));
         if (chargeProd != 0.0 || epsilon != 0.0 || exceptionsWithOffsets.find(i) != exceptionsWithOffsets.end()) {
             exceptionIndex[i] = exceptions.size();
             exceptions.push_back(i);
         }
     }
+    numNonExcludedExceptions = exceptions.size();
 
     // Initialize nonbonded interactions.
 
     int numParticles = force.getNumParticles();
     vector<float4> baseParticleParamVec(cu.getPaddedNumAtoms(), make_float4(0, 0, 0, 0));
-    vector<vector<int> > exclusionList(numParticles);
+    vector<vector<int> > exclusionList(exclusions);
     hasCoulomb = false;
     hasLJ = false;
     for (int i = 0; i < numParticles; i++) {
@@ -257,11 +264,32 @@ void CudaCalcNativeNonbondedForceKernel::initialize(const System& system, const
         if (epsilon != 0.0)
             hasLJ = true;
     }
-    for (auto exclusion : exclusions) {
-        exclusionList[exclusion.first].push_back(exclusion.second);
-        exclusionList[exclusion.second].push_back(exclusion.first);
+    numLJTypes = force.getNumLJTypes();
+    if (numLJTypes > 0) {
+        // The epsilons of the particles are ignored, so the table of types decides whether there are any
+        // Lennard-Jones interactions.
+
+        getLJTypeTable(force, hostLJTypeTable);
+        hasLJ = false;
+        for (auto& params : hostLJTypeTable)
+            if (params.y != 0.0f)
+                hasLJ = true;
     }
     nonbondedMethod = CalcNativeNonbondedForceKernel::NonbondedMethod(force.getNonbondedMethod());
+    if (nonbondedMethod == MSM)
+        throw OpenMMException("NativeNonbondedForce: MSM is not supported on the Cuda platform");
+    if (nonbondedMethod == RandomBatchEwald)
+        throw OpenMMException("NativeNonbondedForce: RandomBatchEwald is not supported on the Cuda platform");
+    if (nonbondedMethod == P3M)
+        throw OpenMMException("NativeNonbondedForce: P3M is not supported on the Cuda platform");
+    if (nonbondedMethod == FMM)
+        throw OpenMMException("NativeNonbondedForce: FMM is not supported on the Cuda platform");
+    if (nonbondedMethod == USeries)
+        throw OpenMMException("NativeNonbondedForce: USeries is not supported on the Cuda platform");
+    if (force.getInnerCutoffDistance() != 0.0)
+        throw OpenMMException("NativeNonbondedForce: An inner cutoff is not supported on the Cuda platform");
+    if (force.getUseSlabCorrection())
+        throw OpenMMException("NativeNonbondedForce: The slab correction is not supported on the Cuda platform");
     bool useCutoff = (nonbondedMethod != NoCutoff);
     bool usePeriodic = (nonbondedMethod != NoCutoff && nonbondedMethod != CutoffNonPeriodic);
     doLJPME = (nonbondedMethod == LJPME && hasLJ);
@@ -270,7 +298,16 @@ void CudaCalcNativeNonbondedForceKernel::initialize(const System& system, const
     map<string, string> defines;
     defines["HAS_COULOMB"] = (hasCoulomb ? "1" : "0");
     defines["HAS_LENNARD_JONES"] = (hasLJ ? "1" : "0");
-    defines["USE_LJ_SWITCH"] = (useCutoff && force.getUseSwitchingFunction() ? "1" : "0");
+    defines["USE_LJ_TYPES"] = (numLJTypes > 0 ? "1" : "0");
+    defines["NUM_LJ_TYPES"] = cu.intToString(numLJTypes);
+    defines["USE_LJ_SWITCH"] = (useCutoff && force.getUseSwitchingFunction() && nonbondedMethod != IPS ? "1" : "0");
+    double ljCutoff = NativeNonbondedForceImpl::getEffectiveLJCutoff(force);
+    bool useSeparateCutoffs = (useCutoff && ljCutoff != force.getCutoffDistance());
+    defines["USE_SEPARATE_CUTOFFS"] = (useSeparateCutoffs ? "1" : "0");
+    if (useSeparateCutoffs) {
+        defines["COULOMB_CUTOFF_SQUARED"] = cu.doubleToString(force.getCutoffDistance()*force.getCutoffDistance());
+        defines["LJ_CUTOFF_SQUARED"] = cu.doubleToString(ljCutoff*ljCutoff);
+    }
     if (useCutoff) {
         // Compute the reaction field constants.
 
@@ -283,17 +320,22 @@ void CudaCalcNativeNonbondedForceKernel::initialize(const System& system, const
         
         if (force.getUseSwitchingFunction()) {
             defines["LJ_SWITCH_CUTOFF"] = cu.doubleToString(force.getSwitchingDistance());
-            defines["LJ_SWITCH_C3"] = cu.doubleToString(10/pow(force.getSwitchingDistance()-force.getCutoffDistance(), 3.0));
-            defines["LJ_SWITCH_C4"] = cu.doubleToString(15/pow(force.getSwitchingDistance()-force.getCutoffDistance(), 4.0));
-            defines["LJ_SWITCH_C5"] = cu.doubleToString(6/pow(force.getSwitchingDistance()-force.getCutoffDistance(), 5.0));
+            defines["LJ_SWITCH_C3"] = cu.doubleToString(10/pow(force.getSwitchingDistance()-ljCutoff, 3.0));
+            defines["LJ_SWITCH_C4"] = cu.doubleToString(15/pow(force.getSwitchingDistance()-ljCutoff, 4.0));
+            defines["LJ_SWITCH_C5"] = cu.doubleToString(6/pow(force.getSwitchingDistance()-ljCutoff, 5.0));
         }
     }
-    if (force.getUseDispersionCorrection() && cu.getContextIndex() == 0 && !doLJPME)
-        dispersionCoefficient = NativeNonbondedForceImpl::calcDispersionCorrection(system, force);
+    if (force.getUseDispersionCorrection() && cu.getContextIndex() == 0 && !doLJPME && nonbondedMethod != IPS) {
+        dispersionCorrection = new NativeNonbondedForceImpl::DispersionCorrection(force);
+        dispersionCoefficient = dispersionCorrection->getCoefficient();
+    }
     else
         dispersionCoefficient = 0.0;
     alpha = 0;
     ewaldSelfEnergy = 0.0;
+    cutoff = force.getCutoffDistance();
+    ewaldErrorTol = force.getEwaldErrorTolerance();
+    pmeGridResizeThreshold = 0.0;
     map<string, string> paramsDefines;
     paramsDefines["ONE_4PI_EPS0"] = cu.doubleToString(ONE_4PI_EPS0);
     hasOffsets = (force.getNumParticleParameterOffsets() > 0 || force.getNumExceptionParameterOffsets() > 0);
@@ -384,7 +426,6 @@ void CudaCalcNativeNonbondedForceKernel::initialize(const System& system, const
             char deviceName[100];
             cuDeviceGetName(deviceName, 100, cu.getDevice());
             usePmeStream = (!cu.getPlatformData().disablePmeStream && !cu.getPlatformData().useCpuPme && string(deviceName) != "GeForce GTX 980"); // Using a separate stream is slower on GTX 980
-            map<string, string> pmeDefines;
             pmeDefines["PME_ORDER"] = cu.intToString(PmeOrder);
             pmeDefines["NUM_ATOMS"] = cu.intToString(numParticles);
             pmeDefines["PADDED_NUM_ATOMS"] = cu.intToString(cu.getPaddedNumAtoms());
@@ -398,17 +439,17 @@ void CudaCalcNativeNonbondedForceKernel::initialize(const System& system, const
                 pmeDefines["USE_FIXED_POINT_CHARGE_SPREADING"] = "1";
             if (usePmeStream)
                 pmeDefines["USE_PME_STREAM"] = "1";
-            map<string, string> replacements;
-            replacements["CHARGE"] = (usePosqCharges ? "pos.w" : "charges[atom]");
-            CUmodule module = cu.createModule(CudaNativeNonbondedKernelSources::vectorOps+
-                                              CommonNativeNonbondedKernelSources::realtofixedpoint+
-                                              cu.replaceStrings(CommonNativeNonbondedKernelSources::pme, replacements), pmeDefines);
             if (cu.getPlatformData().useCpuPme && !doLJPME && usePosqCharges) {
                 // Create the CPU PME kernel.
 
                 try {
                     cpuPme = getPlatform().createKernel(CalcPmeReciprocalForceKernel::Name(), *cu.getPlatformData().context);
                     cpuPme.getAs<CalcPmeReciprocalForceKernel>().initialize(gridSizeX, gridSizeY, gridSizeZ, numParticles, alpha, cu.getPlatformData().deterministicForces);
+                    map<string, string> replacements;
+                    replacements["CHARGE"] = "pos.w";
+                    CUmodule module = cu.createModule(CudaNativeNonbondedKernelSources::vectorOps+
+                                                      CommonNativeNonbondedKernelSources::realtofixedpoint+
+                                                      cu.replaceStrings(CommonNativeNonbondedKernelSources::pme, replacements), pmeDefines);
                     CUfunction addForcesKernel = cu.getKernel(module, "addForces");
                     pmeio = new PmeIO(cu, addForcesKernel);
                     cu.addPreComputation(new PmePreComputation(cu, cpuPme, *pmeio));
@@ -419,56 +460,23 @@ void CudaCalcNativeNonbondedForceKernel::initialize(const System& system, const
                 }
             }
             if (pmeio == NULL) {
-                pmeGridIndexKernel = cu.getKernel(module, "findAtomGridIndex");
-                pmeSpreadChargeKernel = cu.getKernel(module, "gridSpreadCharge");
-                pmeConvolutionKernel = cu.getKernel(module, "reciprocalConvolution");
-                pmeInterpolateForceKernel = cu.getKernel(module, "gridInterpolateForce");
-                pmeEvalEnergyKernel = cu.getKernel(module, "gridEvaluateEnergy");
-                pmeFinishSpreadChargeKernel = cu.getKernel(module, "finishSpreadCharge");
-                cuFuncSetCacheConfig(pmeSpreadChargeKernel, CU_FUNC_CACHE_PREFER_SHARED);
-                cuFuncSetCacheConfig(pmeInterpolateForceKernel, CU_FUNC_CACHE_PREFER_L1);
-                if (doLJPME) {
-                    pmeDefines["EWALD_ALPHA"] = cu.doubleToString(dispersionAlpha);
-                    pmeDefines["GRID_SIZE_X"] = cu.intToString(dispersionGridSizeX);
-                    pmeDefines["GRID_SIZE_Y"] = cu.intToString(dispersionGridSizeY);
-                    pmeDefines["GRID_SIZE_Z"] = cu.intToString(dispersionGridSizeZ);
-                    pmeDefines["RECIP_EXP_FACTOR"] = cu.doubleToString(M_PI*M_PI/(dispersionAlpha*dispersionAlpha));
-                    pmeDefines["USE_LJPME"] = "1";
-                    pmeDefines["CHARGE_FROM_SIGEPS"] = "1";
-                    if (cu.getUseDoublePrecision() || cu.getPlatformData().deterministicForces)
-                        pmeDefines["USE_FIXED_POINT_CHARGE_SPREADING"] = "1";
-                    module = cu.createModule(CudaNativeNonbondedKernelSources::vectorOps+
-                                             CommonNativeNonbondedKernelSources::realtofixedpoint+
-                                             CommonNativeNonbondedKernelSources::pme, pmeDefines);
-                    pmeDispersionFinishSpreadChargeKernel = cu.getKernel(module, "finishSpreadCharge");
-                    pmeDispersionGridIndexKernel = cu.getKernel(module, "findAtomGridIndex");
-                    pmeDispersionSpreadChargeKernel = cu.getKernel(module, "gridSpreadCharge");
-                    pmeDispersionConvolutionKernel = cu.getKernel(module, "reciprocalConvolution");
-                    pmeEvalDispersionEnergyKernel = cu.getKernel(module, "gridEvaluateEnergy");
-                    pmeInterpolateDispersionForceKernel = cu.getKernel(module, "gridInterpolateForce");
-                    cuFuncSetCacheConfig(pmeDispersionSpreadChargeKernel, CU_FUNC_CACHE_PREFER_L1);
-                }
+                // Decide whether the grid dimensions should follow changes to the box volume.
+
+                double userAlpha;
+                int nx, ny, nz;
+                force.getPMEParameters(userAlpha, nx, ny, nz);
+                autoGridSize = (userAlpha == 0.0);
+                force.getLJPMEParameters(userAlpha, nx, ny, nz);
+                autoDispersionGridSize = (userAlpha == 0.0 && doLJPME);
+                if (autoGridSize || autoDispersionGridSize)
+                    pmeGridResizeThreshold = force.getPMEGridResizeThreshold();
+                Vec3 boxVectors[3];
+                system.getDefaultPeriodicBoxVectors(boxVectors[0], boxVectors[1], boxVectors[2]);
+                pmeGridVolume = boxVectors[0][0]*boxVectors[1][1]*boxVectors[2][2];
+                CUmodule module = createPmeKernels();
 
                 // Create required data structures.
 
-                int elementSize = (cu.getUseDoublePrecision() ? sizeof(double) : sizeof(float));
-                int roundedZSize = PmeOrder*(int) ceil(gridSizeZ/(double) PmeOrder);
-                int gridElements = gridSizeX*gridSizeY*roundedZSize;
-                if (doLJPME) {
-                    roundedZSize = PmeOrder*(int) ceil(dispersionGridSizeZ/(double) PmeOrder);
-                    gridElements = max(gridElements, dispersionGridSizeX*dispersionGridSizeY*roundedZSize);
-                }
-                pmeGrid1.initialize(cu, gridElements, 2*elementSize, "pmeGrid1");
-                pmeGrid2.initialize(cu, gridElements, 2*elementSize, "pmeGrid2");
-                cu.addAutoclearBuffer(pmeGrid2);
-                pmeBsplineModuliX.initialize(cu, gridSizeX, elementSize, "pmeBsplineModuliX");
-                pmeBsplineModuliY.initialize(cu, gridSizeY, elementSize, "pmeBsplineModuliY");
-                pmeBsplineModuliZ.initialize(cu, gridSizeZ, elementSize, "pmeBsplineModuliZ");
-                if (doLJPME) {
-                    pmeDispersionBsplineModuliX.initialize(cu, dispersionGridSizeX, elementSize, "pmeDispersionBsplineModuliX");
-                    pmeDispersionBsplineModuliY.initialize(cu, dispersionGridSizeY, elementSize, "pmeDispersionBsplineModuliY");
-                    pmeDispersionBsplineModuliZ.initialize(cu, dispersionGridSizeZ, elementSize, "pmeDispersionBsplineModuliZ");
-                }
                 pmeAtomGridIndex.initialize<int2>(cu, numParticles, "pmeAtomGridIndex");
                 int energyElementSize = (cu.getUseDoublePrecision() || cu.getUseMixedPrecision() ? sizeof(double) : sizeof(float));
                 pmeEnergyBuffer.initialize(cu, cu.getNumThreadBlocks()*CudaContext::ThreadBlockSize, energyElementSize, "pmeEnergyBuffer");
@@ -477,42 +485,11 @@ void CudaCalcNativeNonbondedForceKernel::initialize(const System& system, const
                 int cufftVersion;
                 cufftGetVersion(&cufftVersion);
                 useCudaFFT = (cufftVersion >= 7050); // There was a critical bug in version 7.0
-                if (useCudaFFT) {
-                    cufftResult result = cufftPlan3d(&fftForward, gridSizeX, gridSizeY, gridSizeZ, cu.getUseDoublePrecision() ? CUFFT_D2Z : CUFFT_R2C);
-                    if (result != CUFFT_SUCCESS)
-                        throw OpenMMException("Error initializing FFT: "+cu.intToString(result));
-                    result = cufftPlan3d(&fftBackward, gridSizeX, gridSizeY, gridSizeZ, cu.getUseDoublePrecision() ? CUFFT_Z2D : CUFFT_C2R);
-                    if (result != CUFFT_SUCCESS)
-                        throw OpenMMException("Error initializing FFT: "+cu.intToString(result));
-                    if (doLJPME) {
-                        result = cufftPlan3d(&dispersionFftForward, dispersionGridSizeX, dispersionGridSizeY, 
-                                                dispersionGridSizeZ, cu.getUseDoublePrecision() ? CUFFT_D2Z : CUFFT_R2C);
-                        if (result != CUFFT_SUCCESS)
-                            throw OpenMMException("Error initializing disperison FFT: "+cu.intToString(result));
-                        result = cufftPlan3d(&dispersionFftBackward, dispersionGridSizeX, dispersionGridSizeY,
-                                             dispersionGridSizeZ, cu.getUseDoublePrecision() ? CUFFT_Z2D : CUFFT_C2R);
-                        if (result != CUFFT_SUCCESS)
-                            throw OpenMMException("Error initializing disperison FFT: "+cu.intToString(result));
-                    }
-                }
-                else {
-                    fft = new CudaFFT3D(cu, gridSizeX, gridSizeY, gridSizeZ, true);
-                    if (doLJPME)
-                        dispersionFft = new CudaFFT3D(cu, dispersionGridSizeX, dispersionGridSizeY, dispersionGridSizeZ, true);
-                }
 
                 // Prepare for doing PME on its own stream.
 
                 if (usePmeStream) {
                     cuStreamCreate(&pmeStream, CU_STREAM_NON_BLOCKING);
-                    if (useCudaFFT) {
-                        cufftSetStream(fftForward, pmeStream);
-                        cufftSetStream(fftBackward, pmeStream);
-                        if (doLJPME) {
-                            cufftSetStream(dispersionFftForward, pmeStream);
-                            cufftSetStream(dispersionFftBackward, pmeStream);
-                        }
-                    }
                     CHECK_RESULT(cuEventCreate(&pmeSyncEvent, CU_EVENT_DISABLE_TIMING), "Error creating event for NonbondedForce");
                     CHECK_RESULT(cuEventCreate(&paramsSyncEvent, CU_EVENT_DISABLE_TIMING), "Error creating event for NonbondedForce");
                     int recipForceGroup = force.getReciprocalSpaceForceGroup();
@@ -521,94 +498,65 @@ void CudaCalcNativeNonbondedForceKernel::initialize(const System& system, const
                     cu.addPreComputation(new SyncStreamPreComputation(cu, pmeStream, pmeSyncEvent, recipForceGroup));
                     cu.addPostComputation(new SyncStreamPostComputation(cu, pmeSyncEvent, cu.getKernel(module, "addEnergy"), pmeEnergyBuffer, recipForceGroup));
                 }
-                hasInitializedFFT = true;
-
-                // Initialize the b-spline moduli.
-
-                for (int grid = 0; grid < 2; grid++) {
-                    int xsize, ysize, zsize;
-                    CudaArray *xmoduli, *ymoduli, *zmoduli;
-                    if (grid == 0) {
-                        xsize = gridSizeX;
-                        ysize = gridSizeY;
-                        zsize = gridSizeZ;
-                        xmoduli = &pmeBsplineModuliX;
-                        ymoduli = &pmeBsplineModuliY;
-                        zmoduli = &pmeBsplineModuliZ;
-                    }
-                    else {
-                        if (!doLJPME)
-                            continue;
-                        xsize = dispersionGridSizeX;
-                        ysize = dispersionGridSizeY;
-                        zsize = dispersionGridSizeZ;
-                        xmoduli = &pmeDispersionBsplineModuliX;
-                        ymoduli = &pmeDispersionBsplineModuliY;
-                        zmoduli = &pmeDispersionBsplineModuliZ;
-                    }
-                    int maxSize = max(max(xsize, ysize), zsize);
-                    vector<double> data(PmeOrder);
-                    vector<double> ddata(PmeOrder);
-                    vector<double> bsplines_data(maxSize);
-                    data[PmeOrder-1] = 0.0;
-                    data[1] = 0.0;
-                    data[0] = 1.0;
-                    for (int i = 3; i < PmeOrder; i++) {
-                        double div = 1.0/(i-1.0);
-                        data[i-1] = 0.0;
-                        for (int j = 1; j < (i-1); j++)
-                            data[i-j-1] = div*(j*data[i-j-2]+(i-j)*data[i-j-1]);
-                        data[0] = div*data[0];
-                    }
-
-                    // Differentiate.
-
-                    ddata[0] = -data[0];
-                    for (int i = 1; i < PmeOrder; i++)
-                        ddata[i] = data[i-1]-data[i];
-                    double div = 1.0/(PmeOrder-1);
-                    data[PmeOrder-1] = 0.0;
-                    for (int i = 1; i < (PmeOrder-1); i++)
-                        data[PmeOrder-i-1] = div*(i*data[PmeOrder-i-2]+(PmeOrder-i)*data[PmeOrder-i-1]);
-                    data[0] = div*data[0];
-                    for (int i = 0; i < maxSize; i++)
-                        bsplines_data[i] = 0.0;
-                    for (int i = 1; i <= PmeOrder; i++)
-                        bsplines_data[i] = data[i-1];
-
-                    // Evaluate the actual bspline moduli for X/Y/Z.
-
-                    for (int dim = 0; dim < 3; dim++) {
-                        int ndata = (dim == 0 ? xsize : dim == 1 ? ysize : zsize);
-                        vector<double> moduli(ndata);
-                        for (int i = 0; i < ndata; i++) {
-                            double sc = 0.0;
-                            double ss = 0.0;
-                            for (int j = 0; j < ndata; j++) {
-                                double arg = (2.0*M_PI*i*j)/ndata;
-                                sc += bsplines_data[j]*cos(arg);
-                                ss += bsplines_data[j]*sin(arg);
-                            }
-                            moduli[i] = sc*sc+ss*ss;
-                        }
-                        for (int i = 0; i < ndata; i++)
-                            if (moduli[i] < 1.0e-7)
-                                moduli[i] = (moduli[(i-1+ndata)%ndata]+moduli[(i+1)%ndata])*0.5;
-                        if (dim == 0)
-                            xmoduli->upload(moduli, true);
-                        else if (dim == 1)
-                            ymoduli->upload(moduli, true);
-                        else
-                            zmoduli->upload(moduli, true);
-                    }
-                }
+
+                // Create the grids, FFTs, and b-spline moduli.  If the grids may be reallocated, they
+                // get cleared explicitly in execute() instead of automatically.
+
+                initializePmeGrids();
+                if (pmeGridResizeThreshold == 0.0)
+                    cu.addAutoclearBuffer(pmeGrid2);
             }
         }
     }
+    else if (nonbondedMethod == DampedShiftedForce) {
+        // Compute the shifts that make the damped Coulomb energy and force go to zero at the cutoff.
+
+        alpha = force.getDSFAlpha();
+        double erfcAlphaCutoff = erfc(alpha*cutoff);
+        double forceShift = erfcAlphaCutoff/(cutoff*cutoff) + 2.0*alpha*exp(-alpha*alpha*cutoff*cutoff)/(sqrt(M_PI)*cutoff);
+        defines["USE_DSF"] = "1";
+        defines["DSF_ALPHA"] = cu.doubleToString(alpha);
+        defines["TWO_OVER_SQRT_PI"] = cu.doubleToString(2.0/sqrt(M_PI));
+        defines["DSF_FORCE_SHIFT"] = cu.doubleToString(forceShift);
+        defines["DSF_ENERGY_SHIFT"] = cu.doubleToString(erfcAlphaCutoff/cutoff+forceShift*cutoff);
+        if (cu.getContextIndex() == 0) {
+            // The self energy is handled the same way as for Ewald.
 
-    // Add code to subtract off the reciprocal part of excluded interactions.
+            double selfEnergyScale = ONE_4PI_EPS0*(0.5*erfcAlphaCutoff/cutoff+alpha/sqrt(M_PI));
+            paramsDefines["INCLUDE_EWALD"] = "1";
+            paramsDefines["EWALD_SELF_ENERGY_SCALE"] = cu.doubleToString(selfEnergyScale);
+            for (int i = 0; i < numParticles; i++)
+                ewaldSelfEnergy -= baseParticleParamVec[i].x*baseParticleParamVec[i].x*selfEnergyScale;
+        }
+    }
+    else if (nonbondedMethod == IPS) {
+        // Compute the coefficients of the IPS polynomials for Coulomb and dispersion interactions.
+
+        defines["USE_IPS"] = "1";
+        defines["IPS_COULOMB_0"] = cu.doubleToString(-35.0/16.0/cutoff);
+        defines["IPS_COULOMB_2"] = cu.doubleToString(35.0/16.0/pow(cutoff, 3.0));
+        defines["IPS_COULOMB_4"] = cu.doubleToString(-21.0/16.0/pow(cutoff, 5.0));
+        defines["IPS_COULOMB_6"] = cu.doubleToString(5.0/16.0/pow(cutoff, 7.0));
+        defines["IPS_DISPERSION_0"] = cu.doubleToString((1.0+9.0/14.0-3.0/28.0+6.0/7.0)/pow(ljCutoff, 6.0));
+        defines["IPS_DISPERSION_2"] = cu.doubleToString(9.0/14.0/pow(ljCutoff, 8.0));
+        defines["IPS_DISPERSION_4"] = cu.doubleToString(-3.0/28.0/pow(ljCutoff, 10.0));
+        defines["IPS_DISPERSION_6"] = cu.doubleToString(6.0/7.0/pow(ljCutoff, 12.0));
+        if (cu.getContextIndex() == 0) {
+            // The self energy is handled the same way as for Ewald.
+
+            double selfEnergyScale = ONE_4PI_EPS0*35.0/(32.0*cutoff);
+            paramsDefines["INCLUDE_EWALD"] = "1";
+            paramsDefines["EWALD_SELF_ENERGY_SCALE"] = cu.doubleToString(selfEnergyScale);
+            for (int i = 0; i < numParticles; i++)
+                ewaldSelfEnergy -= baseParticleParamVec[i].x*baseParticleParamVec[i].x*selfEnergyScale;
+        }
+    }
+
+    // Add code to subtract off the reciprocal part of excluded interactions.  With DSF, excluded pairs
+    // within the cutoff instead interact through the damped potential minus the bare Coulomb term, and
+    // with IPS through the Coulomb polynomial alone.
 
-    if ((nonbondedMethod == Ewald || nonbondedMethod == PME || nonbondedMethod == LJPME) && pmeio == NULL) {
+    if ((nonbondedMethod == Ewald || nonbondedMethod == PME || nonbondedMethod == LJPME || nonbondedMethod == DampedShiftedForce || nonbondedMethod == IPS) && pmeio == NULL) {
         int numContexts = cu.getPlatformData().contexts.size();
         int startIndex = cu.getContextIndex()*force.getNumExceptions()/numContexts;
         int endIndex = (cu.getContextIndex()+1)*force.getNumExceptions()/numContexts;
@@ -621,9 +569,9 @@ void CudaCalcNativeNonbondedForceKernel::initialize(const System& system, const
             vector<int2> exclusionAtomsVec(numExclusions);
             for (int i = 0; i < numExclusions; i++) {
                 int j = i+startIndex;
-                exclusionAtomsVec[i] = make_int2(exclusions[j].first, exclusions[j].second);
-                atoms[i][0] = exclusions[j].first;
-                atoms[i][1] = exclusions[j].second;
+                exclusionAtomsVec[i] = make_int2(exclusionPairs[j].first, exclusionPairs[j].second);
+                atoms[i][0] = exclusionPairs[j].first;
+                atoms[i][1] = exclusionPairs[j].second;
             }
             exclusionAtoms.upload(exclusionAtomsVec);
             map<string, string> replacements;
@@ -634,8 +582,22 @@ void CudaCalcNativeNonbondedForceKernel::initialize(const System& system, const
             replacements["USE_PERIODIC"] = force.getExceptionsUsePeriodicBoundaryConditions() ? "1" : "0";
             if (doLJPME)
                 replacements["EWALD_DISPERSION_ALPHA"] = cu.doubleToString(dispersionAlpha);
+            string exclusionSource = CommonNativeNonbondedKernelSources::pmeExclusions;
+            if (nonbondedMethod == DampedShiftedForce) {
+                replacements["DSF_ALPHA"] = defines["DSF_ALPHA"];
+                replacements["DSF_FORCE_SHIFT"] = defines["DSF_FORCE_SHIFT"];
+                replacements["DSF_ENERGY_SHIFT"] = defines["DSF_ENERGY_SHIFT"];
+                replacements["CUTOFF_SQUARED"] = cu.doubleToString(cutoff*cutoff);
+                exclusionSource = CommonNativeNonbondedKernelSources::dsfExclusions;
+            }
+            if (nonbondedMethod == IPS) {
+                for (string name : {"IPS_COULOMB_0", "IPS_COULOMB_2", "IPS_COULOMB_4", "IPS_COULOMB_6"})
+                    replacements[name] = defines[name];
+                replacements["CUTOFF_SQUARED"] = cu.doubleToString(cutoff*cutoff);
+                exclusionSource = CommonNativeNonbondedKernelSources::ipsExclusions;
+            }
             if (force.getIncludeDirectSpace())
-                cu.getBondedUtilities().addInteraction(atoms, cu.replaceStrings(CommonNativeNonbondedKernelSources::pmeExclusions, replacements), force.getForceGroup());
+                cu.getBondedUtilities().addInteraction(atoms, cu.replaceStrings(exclusionSource, replacements), force.getForceGroup());
         }
     }
 
@@ -645,6 +607,7 @@ void CudaCalcNativeNonbondedForceKernel::initialize(const System& system, const
     charges.initialize(cu, cu.getPaddedNumAtoms(), cu.getUseDoublePrecision() ? sizeof(double) : sizeof(float), "charges");
     baseParticleParams.initialize<float4>(cu, cu.getPaddedNumAtoms(), "baseParticleParams");
     baseParticleParams.upload(baseParticleParamVec);
+    hostParticleParams = baseParticleParamVec;
     map<string, string> replacements;
     replacements["ONE_4PI_EPS0"] = cu.doubleToString(ONE_4PI_EPS0);
     if (usePosqCharges) {
@@ -658,14 +621,30 @@ void CudaCalcNativeNonbondedForceKernel::initialize(const System& system, const
     if (hasCoulomb && !usePosqCharges)
         cu.getNonbondedUtilities().addParameter(CudaNonbondedUtilities::ParameterInfo(prefix+"charge", "real", 1, charges.getElementSize(), charges.getDevicePointer()));
     sigmaEpsilon.initialize<float2>(cu, cu.getPaddedNumAtoms(), "sigmaEpsilon");
-    if (hasLJ) {
+    if (hasLJ && numLJTypes > 0) {
+        // Each particle only needs its type.  The parameters for each pair of types are looked up in a table.
+
+        hostLJTypes.resize(cu.getPaddedNumAtoms(), 0);
+        for (int i = 0; i < numParticles; i++)
+            hostLJTypes[i] = force.getParticleLJType(i);
+        ljTypes.initialize<int>(cu, cu.getPaddedNumAtoms(), "ljTypes");
+        ljTypes.upload(hostLJTypes);
+        ljTypeTable.initialize<float2>(cu, hostLJTypeTable.size(), "ljTypeTable");
+        ljTypeTable.upload(hostLJTypeTable);
+        replacements["LJ_TYPE1"] = prefix+"ljTypes1";
+        replacements["LJ_TYPE2"] = prefix+"ljTypes2";
+        replacements["LJ_TYPE_TABLE"] = prefix+"ljTypeTable";
+        cu.getNonbondedUtilities().addParameter(CudaNonbondedUtilities::ParameterInfo(prefix+"ljTypes", "int", 1, sizeof(int), ljTypes.getDevicePointer()));
+        cu.getNonbondedUtilities().addArgument(CudaNonbondedUtilities::ParameterInfo(prefix+"ljTypeTable", "float", 2, sizeof(float2), ljTypeTable.getDevicePointer()));
+    }
+    else if (hasLJ) {
         replacements["SIGMA_EPSILON1"] = prefix+"sigmaEpsilon1";
         replacements["SIGMA_EPSILON2"] = prefix+"sigmaEpsilon2";
         cu.getNonbondedUtilities().addParameter(CudaNonbondedUtilities::ParameterInfo(prefix+"sigmaEpsilon", "float", 2, sizeof(float2), sigmaEpsilon.getDevicePointer()));
     }
     source = cu.replaceStrings(source, replacements);
     if (force.getIncludeDirectSpace())
-        cu.getNonbondedUtilities().addInteraction(useCutoff, usePeriodic, true, force.getCutoffDistance(), exclusionList, source, force.getForceGroup(), true);
+        cu.getNonbondedUtilities().addInteraction(useCutoff, usePeriodic, true, max(force.getCutoffDistance(), ljCutoff), exclusionList, source, force.getForceGroup(), true);
 
     // Initialize the exceptions.
 
@@ -731,7 +710,10 @@ void CudaCalcNativeNonbondedForceKernel::initialize(const System& system, const
             paramIndex = paramPos-paramNames.begin();
         exceptionOffsetVec[index-startIndex].push_back(make_float4(charge, sigma, epsilon, paramIndex));
     }
-    paramValues.resize(paramNames.size(), 0.0);
+    // The cached values start as NaN, so the first call to execute() uploads every value and passes it to the
+    // dispersion correction, which otherwise assumes the default values.
+
+    paramValues.resize(paramNames.size(), numeric_limits<double>::quiet_NaN());
     particleParamOffsets.initialize<float4>(cu, max(force.getNumParticleParameterOffsets(), 1), "particleParamOffsets");
     particleOffsetIndices.initialize<int>(cu, cu.getPaddedNumAtoms()+1, "particleOffsetIndices");
     vector<int> particleOffsetIndicesVec, exceptionOffsetIndicesVec;
@@ -760,8 +742,6 @@ void CudaCalcNativeNonbondedForceKernel::initialize(const System& system, const
         exceptionOffsetIndices.upload(exceptionOffsetIndicesVec);
     }
     globalParams.initialize(cu, max((int) paramValues.size(), 1), cu.getUseDoublePrecision() ? sizeof(double) : sizeof(float), "globalParams");
-    if (paramValues.size() > 0)
-        globalParams.upload(paramValues, true);
     recomputeParams = true;
     
     // Initialize the kernel for updating parameters.
@@ -773,25 +753,279 @@ void CudaCalcNativeNonbondedForceKernel::initialize(const System& system, const
     cu.addForce(info);
 }
 
-double CudaCalcNativeNonbondedForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy, bool includeDirect, bool includeReciprocal) {
+CUmodule CudaCalcNativeNonbondedForceKernel::createPmeKernels() {
+    map<string, string> replacements;
+    replacements["CHARGE"] = (usePosqCharges ? "pos.w" : "charges[atom]");
+    CUmodule module = cu.createModule(CudaNativeNonbondedKernelSources::vectorOps+
+                                      CommonNativeNonbondedKernelSources::realtofixedpoint+
+                                      cu.replaceStrings(CommonNativeNonbondedKernelSources::pme, replacements), pmeDefines);
+    pmeGridIndexKernel = cu.getKernel(module, "findAtomGridIndex");
+    pmeSpreadChargeKernel = cu.getKernel(module, "gridSpreadCharge");
+    pmeConvolutionKernel = cu.getKernel(module, "reciprocalConvolution");
+    pmeInterpolateForceKernel = cu.getKernel(module, "gridInterpolateForce");
+    pmeEvalEnergyKernel = cu.getKernel(module, "gridEvaluateEnergy");
+    pmeFinishSpreadChargeKernel = cu.getKernel(module, "finishSpreadCharge");
+    cuFuncSetCacheConfig(pmeSpreadChargeKernel, CU_FUNC_CACHE_PREFER_SHARED);
+    cuFuncSetCacheConfig(pmeInterpolateForceKernel, CU_FUNC_CACHE_PREFER_L1);
+    if (doLJPME) {
+        map<string, string> dispersionDefines = pmeDefines;
+        dispersionDefines["EWALD_ALPHA"] = cu.doubleToString(dispersionAlpha);
+        dispersionDefines["GRID_SIZE_X"] = cu.intToString(dispersionGridSizeX);
+        dispersionDefines["GRID_SIZE_Y"] = cu.intToString(dispersionGridSizeY);
+        dispersionDefines["GRID_SIZE_Z"] = cu.intToString(dispersionGridSizeZ);
+        dispersionDefines["RECIP_EXP_FACTOR"] = cu.doubleToString(M_PI*M_PI/(dispersionAlpha*dispersionAlpha));
+        dispersionDefines["USE_LJPME"] = "1";
+        dispersionDefines["CHARGE_FROM_SIGEPS"] = "1";
+        CUmodule dispersionModule = cu.createModule(CudaNativeNonbondedKernelSources::vectorOps+
+                                                    CommonNativeNonbondedKernelSources::realtofixedpoint+
+                                                    CommonNativeNonbondedKernelSources::pme, dispersionDefines);
+        pmeDispersionFinishSpreadChargeKernel = cu.getKernel(dispersionModule, "finishSpreadCharge");
+        pmeDispersionGridIndexKernel = cu.getKernel(dispersionModule, "findAtomGridIndex");
+        pmeDispersionSpreadChargeKernel = cu.getKernel(dispersionModule, "gridSpreadCharge");
+        pmeDispersionConvolutionKernel = cu.getKernel(dispersionModule, "reciprocalConvolution");
+        pmeEvalDispersionEnergyKernel = cu.getKernel(dispersionModule, "gridEvaluateEnergy");
+        pmeInterpolateDispersionForceKernel = cu.getKernel(dispersionModule, "gridInterpolateForce");
+        cuFuncSetCacheConfig(pmeDispersionSpreadChargeKernel, CU_FUNC_CACHE_PREFER_L1);
+    }
+    return module;
+}
+
+void CudaCalcNativeNonbondedForceKernel::initializePmeGrids() {
+    // Allocate the grids.  This is also called when the grid dimensions change, in which case
+    // the existing arrays and FFTs are replaced.
+
+    int elementSize = (cu.getUseDoublePrecision() ? sizeof(double) : sizeof(float));
+    int roundedZSize = PmeOrder*(int) ceil(gridSizeZ/(double) PmeOrder);
+    int gridElements = gridSizeX*gridSizeY*roundedZSize;
+    if (doLJPME) {
+        roundedZSize = PmeOrder*(int) ceil(dispersionGridSizeZ/(double) PmeOrder);
+        gridElements = max(gridElements, dispersionGridSizeX*dispersionGridSizeY*roundedZSize);
+    }
+    if (pmeGrid1.isInitialized()) {
+        pmeGrid1.resize(gridElements);
+        pmeGrid2.resize(gridElements);
+        pmeBsplineModuliX.resize(gridSizeX);
+        pmeBsplineModuliY.resize(gridSizeY);
+        pmeBsplineModuliZ.resize(gridSizeZ);
+        if (doLJPME) {
+            pmeDispersionBsplineModuliX.resize(dispersionGridSizeX);
+            pmeDispersionBsplineModuliY.resize(dispersionGridSizeY);
+            pmeDispersionBsplineModuliZ.resize(dispersionGridSizeZ);
+        }
+    }
+    else {
+        pmeGrid1.initialize(cu, gridElements, 2*elementSize, "pmeGrid1");
+        pmeGrid2.initialize(cu, gridElements, 2*elementSize, "pmeGrid2");
+        pmeBsplineModuliX.initialize(cu, gridSizeX, elementSize, "pmeBsplineModuliX");
+        pmeBsplineModuliY.initialize(cu, gridSizeY, elementSize, "pmeBsplineModuliY");
+        pmeBsplineModuliZ.initialize(cu, gridSizeZ, elementSize, "pmeBsplineModuliZ");
+        if (doLJPME) {
+            pmeDispersionBsplineModuliX.initialize(cu, dispersionGridSizeX, elementSize, "pmeDispersionBsplineModuliX");
+            pmeDispersionBsplineModuliY.initialize(cu, dispersionGridSizeY, elementSize, "pmeDispersionBsplineModuliY");
+            pmeDispersionBsplineModuliZ.initialize(cu, dispersionGridSizeZ, elementSize, "pmeDispersionBsplineModuliZ");
+        }
+    }
+    if (useCudaFFT) {
+        if (hasInitializedFFT) {
+            cufftDestroy(fftForward);
+            cufftDestroy(fftBackward);
+            if (doLJPME) {
+                cufftDestroy(dispersionFftForward);
+                cufftDestroy(dispersionFftBackward);
+            }
+        }
+        cufftResult result = cufftPlan3d(&fftForward, gridSizeX, gridSizeY, gridSizeZ, cu.getUseDoublePrecision() ? CUFFT_D2Z : CUFFT_R2C);
+        if (result != CUFFT_SUCCESS)
+            throw OpenMMException("Error initializing FFT: "+cu.intToString(result));
+        result = cufftPlan3d(&fftBackward, gridSizeX, gridSizeY, gridSizeZ, cu.getUseDoublePrecision() ? CUFFT_Z2D : CUFFT_C2R);
+        if (result != CUFFT_SUCCESS)
+            throw OpenMMException("Error initializing FFT: "+cu.intToString(result));
+        if (doLJPME) {
+            result = cufftPlan3d(&dispersionFftForward, dispersionGridSizeX, dispersionGridSizeY, 
+                                    dispersionGridSizeZ, cu.getUseDoublePrecision() ? CUFFT_D2Z : CUFFT_R2C);
+            if (result != CUFFT_SUCCESS)
+                throw OpenMMException("Error initializing disperison FFT: "+cu.intToString(result));
+            result = cufftPlan3d(&dispersionFftBackward, dispersionGridSizeX, dispersionGridSizeY,
+                                 dispersionGridSizeZ, cu.getUseDoublePrecision() ? CUFFT_Z2D : CUFFT_C2R);
+            if (result != CUFFT_SUCCESS)
+                throw OpenMMException("Error initializing disperison FFT: "+cu.intToString(result));
+        }
+        if (usePmeStream) {
+            cufftSetStream(fftForward, pmeStream);
+            cufftSetStream(fftBackward, pmeStream);
+            if (doLJPME) {
+                cufftSetStream(dispersionFftForward, pmeStream);
+                cufftSetStream(dispersionFftBackward, pmeStream);
+            }
+        }
+    }
+    else {
+        if (fft != NULL)
+            delete fft;
+        fft = new CudaFFT3D(cu, gridSizeX, gridSizeY, gridSizeZ, true);
+        if (doLJPME) {
+            if (dispersionFft != NULL)
+                delete dispersionFft;
+            dispersionFft = new CudaFFT3D(cu, dispersionGridSizeX, dispersionGridSizeY, dispersionGridSizeZ, true);
+        }
+    }
+    hasInitializedFFT = true;
+
+    // Initialize the b-spline moduli.
+
+    for (int grid = 0; grid < 2; grid++) {
+        int xsize, ysize, zsize;
+        CudaArray *xmoduli, *ymoduli, *zmoduli;
+        if (grid == 0) {
+            xsize = gridSizeX;
+            ysize = gridSizeY;
+            zsize = gridSizeZ;
+            xmoduli = &pmeBsplineModuliX;
+            ymoduli = &pmeBsplineModuliY;
+            zmoduli = &pmeBsplineModuliZ;
+        }
+        else {
+            if (!doLJPME)
+                continue;
+            xsize = dispersionGridSizeX;
+            ysize = dispersionGridSizeY;
+            zsize = dispersionGridSizeZ;
+            xmoduli = &pmeDispersionBsplineModuliX;
+            ymoduli = &pmeDispersionBsplineModuliY;
+            zmoduli = &pmeDispersionBsplineModuliZ;
+        }
+        int maxSize = max(max(xsize, ysize), zsize);
+        vector<double> data(PmeOrder);
+        vector<double> ddata(PmeOrder);
+        vector<double> bsplines_data(maxSize);
+        data[PmeOrder-1] = 0.0;
+        data[1] = 0.0;
+        data[0] = 1.0;
+        for (int i = 3; i < PmeOrder; i++) {
+            double div = 1.0/(i-1.0);
+            data[i-1] = 0.0;
+            for (int j = 1; j < (i-1); j++)
+                data[i-j-1] = div*(j*data[i-j-2]+(i-j)*data[i-j-1]);
+            data[0] = div*data[0];
+        }
+
+        // Differentiate.
+
+        ddata[0] = -data[0];
+        for (int i = 1; i < PmeOrder; i++)
+            ddata[i] = data[i-1]-data[i];
+        double div = 1.0/(PmeOrder-1);
+        data[PmeOrder-1] = 0.0;
+        for (int i = 1; i < (PmeOrder-1); i++)
+            data[PmeOrder-i-1] = div*(i*data[PmeOrder-i-2]+(PmeOrder-i)*data[PmeOrder-i-1]);
+        data[0] = div*data[0];
+        for (int i = 0; i < maxSize; i++)
+            bsplines_data[i] = 0.0;
+        for (int i = 1; i <= PmeOrder; i++)
+            bsplines_data[i] = data[i-1];
+
+        // Evaluate the actual bspline moduli for X/Y/Z.
+
+        for (int dim = 0; dim < 3; dim++) {
+            int ndata = (dim == 0 ? xsize : dim == 1 ? ysize : zsize);
+            vector<double> moduli(ndata);
+            for (int i = 0; i < ndata; i++) {
+                double sc = 0.0;
+                double ss = 0.0;
+                for (int j = 0; j < ndata; j++) {
+                    double arg = (2.0*M_PI*i*j)/ndata;
+                    sc += bsplines_data[j]*cos(arg);
+                    ss += bsplines_data[j]*sin(arg);
+                }
+                moduli[i] = sc*sc+ss*ss;
+            }
+            for (int i = 0; i < ndata; i++)
+                if (moduli[i] < 1.0e-7)
+                    moduli[i] = (moduli[(i-1+ndata)%ndata]+moduli[(i+1)%ndata])*0.5;
+            if (dim == 0)
+                xmoduli->upload(moduli, true);
+            else if (dim == 1)
+                ymoduli->upload(moduli, true);
+            else
+                zmoduli->upload(moduli, true);
+        }
+    }
+}
+
+void CudaCalcNativeNonbondedForceKernel::resizePmeGrids(const Vec3* boxVectors) {
+    pmeGridVolume = boxVectors[0][0]*boxVectors[1][1]*boxVectors[2][2];
+    int xsize = gridSizeX, ysize = gridSizeY, zsize = gridSizeZ;
+    int dxsize = 0, dysize = 0, dzsize = 0;
+    if (doLJPME) {
+        dxsize = dispersionGridSizeX;
+        dysize = dispersionGridSizeY;
+        dzsize = dispersionGridSizeZ;
+    }
+    double unusedAlpha;
+    if (autoGridSize) {
+        NativeNonbondedForceImpl::calcPMEParameters(boxVectors, cutoff, ewaldErrorTol, unusedAlpha, xsize, ysize, zsize, false);
+        xsize = CudaFFT3D::findLegalDimension(xsize);
+        ysize = CudaFFT3D::findLegalDimension(ysize);
+        zsize = CudaFFT3D::findLegalDimension(zsize);
+    }
+    if (autoDispersionGridSize) {
+        NativeNonbondedForceImpl::calcPMEParameters(boxVectors, cutoff, ewaldErrorTol, unusedAlpha, dxsize, dysize, dzsize, true);
+        dxsize = CudaFFT3D::findLegalDimension(dxsize);
+        dysize = CudaFFT3D::findLegalDimension(dysize);
+        dzsize = CudaFFT3D::findLegalDimension(dzsize);
+    }
+    bool changed = (xsize != gridSizeX || ysize != gridSizeY || zsize != gridSizeZ);
+    if (doLJPME)
+        changed |= (dxsize != dispersionGridSizeX || dysize != dispersionGridSizeY || dzsize != dispersionGridSizeZ);
+    if (!changed)
+        return;
+
+    // Reallocate the grids and rebuild the kernels, whose grid dimensions are compile time constants.
+
+    gridSizeX = xsize;
+    gridSizeY = ysize;
+    gridSizeZ = zsize;
+    dispersionGridSizeX = dxsize;
+    dispersionGridSizeY = dysize;
+    dispersionGridSizeZ = dzsize;
+    pmeDefines["GRID_SIZE_X"] = cu.intToString(gridSizeX);
+    pmeDefines["GRID_SIZE_Y"] = cu.intToString(gridSizeY);
+    pmeDefines["GRID_SIZE_Z"] = cu.intToString(gridSizeZ);
+    createPmeKernels();
+    initializePmeGrids();
+}
+
+double CudaCalcNativeNonbondedForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy, bool includeDirect, bool includeReciprocal, bool includeOuterShell) {
     // Update particle and exception parameters.
 
     ContextSelector selector(cu);
+    if (pmeGridResizeThreshold > 0.0 && includeReciprocal) {
+        Vec3 boxVectors[3];
+        cu.getPeriodicBoxVectors(boxVectors[0], boxVectors[1], boxVectors[2]);
+        double volume = boxVectors[0][0]*boxVectors[1][1]*boxVectors[2][2];
+        if (fabs(volume-pmeGridVolume) > pmeGridResizeThreshold*pmeGridVolume)
+            resizePmeGrids(boxVectors);
+    }
     bool paramChanged = false;
     for (int i = 0; i < paramNames.size(); i++) {
         double value = context.getParameter(paramNames[i]);
         if (value != paramValues[i]) {
             paramValues[i] = value;;
             paramChanged = true;
+            if (dispersionCorrection != NULL)
+                dispersionCorrection->setParameter(paramNames[i], value);
         }
     }
     if (paramChanged) {
+        if (dispersionCorrection != NULL)
+            dispersionCoefficient = dispersionCorrection->getCoefficient();
         recomputeParams = true;
         globalParams.upload(paramValues, true);
     }
-    double energy = (includeReciprocal ? ewaldSelfEnergy : 0.0);
+    bool includeSelfEnergy = (nonbondedMethod == DampedShiftedForce || nonbondedMethod == IPS ? includeDirect : includeReciprocal);
+    double energy = (includeSelfEnergy ? ewaldSelfEnergy : 0.0);
     if (recomputeParams || hasOffsets) {
-        int computeSelfEnergy = (includeEnergy && includeReciprocal);
+        int computeSelfEnergy = (includeEnergy && includeSelfEnergy);
         int numAtoms = cu.getPaddedNumAtoms();
         vector<void*> paramsArgs = {&cu.getEnergyBuffer().getDevicePointer(), &computeSelfEnergy, &globalParams.getDevicePointer(), &numAtoms,
                 &baseParticleParams.getDevicePointer(), &cu.getPosq().getDevicePointer(), &charges.getDevicePointer(), &sigmaEpsilon.getDevicePointer(),
@@ -869,6 +1103,8 @@ double CudaCalcNativeNonbondedForceKernel::execute(ContextImpl& context, bool in
 
             sort->sort(pmeAtomGridIndex);
 
+            if (pmeGridResizeThreshold > 0.0)
+                cu.clearBuffer(pmeGrid2);
             void* spreadArgs[] = {&cu.getPosq().getDevicePointer(), &pmeGrid2.getDevicePointer(), cu.getPeriodicBoxSizePointer(),
                     cu.getInvPeriodicBoxSizePointer(), cu.getPeriodicBoxVecXPointer(), cu.getPeriodicBoxVecYPointer(), cu.getPeriodicBoxVecZPointer(),
                     recipBoxVectorPointer[0], recipBoxVectorPointer[1], recipBoxVectorPointer[2], &pmeAtomGridIndex.getDevicePointer(),
@@ -1011,87 +1247,153 @@ double CudaCalcNativeNonbondedForceKernel::execute(ContextImpl& context, bool in
     return energy;
 }
 
-void CudaCalcNativeNonbondedForceKernel::copyParametersToContext(ContextImpl& context, const NativeNonbondedForce& force) {
+void CudaCalcNativeNonbondedForceKernel::copyParametersToContext(ContextImpl& context, const NativeNonbondedForce& force, int firstParticle, int lastParticle, int firstException, int lastException) {
     // Make sure the new parameters are acceptable.
     
     ContextSelector selector(cu);
     if (force.getNumParticles() != cu.getNumAtoms())
         throw OpenMMException("updateParametersInContext: The number of particles has changed");
+    if (force.getNumExceptions() != exceptionIndex.size())
+        throw OpenMMException("updateParametersInContext: The number of exceptions has changed");
     if (!hasCoulomb || !hasLJ) {
-        for (int i = 0; i < force.getNumParticles(); i++) {
+        for (int i = firstParticle; i <= lastParticle; i++) {
             double charge, sigma, epsilon;
             force.getParticleParameters(i, charge, sigma, epsilon);
             if (!hasCoulomb && charge != 0.0)
                 throw OpenMMException("updateParametersInContext: The nonbonded force kernel does not include Coulomb interactions, because all charges were originally 0");
-            if (!hasLJ && epsilon != 0.0)
+            if (!hasLJ && epsilon != 0.0 && numLJTypes == 0)
                 throw OpenMMException("updateParametersInContext: The nonbonded force kernel does not include Lennard-Jones interactions, because all epsilons were originally 0");
         }
     }
-    set<int> exceptionsWithOffsets;
-    for (int i = 0; i < force.getNumExceptionParameterOffsets(); i++) {
-        string param;
-        int exception;
-        double charge, sigma, epsilon;
-        force.getExceptionParameterOffset(i, param, exception, charge, sigma, epsilon);
-        exceptionsWithOffsets.insert(exception);
-    }
-    vector<int> exceptions;
-    for (int i = 0; i < force.getNumExceptions(); i++) {
-        int particle1, particle2;
-        double chargeProd, sigma, epsilon;
-        force.getExceptionParameters(i, particle1, particle2, chargeProd, sigma, epsilon);
-        if (chargeProd != 0.0 || epsilon != 0.0 || exceptionsWithOffsets.find(i) != exceptionsWithOffsets.end())
-            exceptions.push_back(i);
+    NativeNonbondedForceImpl::checkLJTypes(force);
+    if (force.getNumLJTypes() != numLJTypes)
+        throw OpenMMException("updateParametersInContext: The number of LJ types has changed");
+    vector<float2> ljTypeTableVec;
+    if (numLJTypes > 0) {
+        getLJTypeTable(force, ljTypeTableVec);
+        if (!hasLJ)
+            for (auto& params : ljTypeTableVec)
+                if (params.y != 0.0f)
+                    throw OpenMMException("updateParametersInContext: The nonbonded force kernel does not include Lennard-Jones interactions, because all epsilons were originally 0");
     }
-    int numContexts = cu.getPlatformData().contexts.size();
-    int startIndex = cu.getContextIndex()*exceptions.size()/numContexts;
-    int endIndex = (cu.getContextIndex()+1)*exceptions.size()/numContexts;
-    int numExceptions = endIndex-startIndex;
-    if (numExceptions != exceptionAtoms.size())
-        throw OpenMMException("updateParametersInContext: The set of non-excluded exceptions has changed");
     
-    // Record the per-particle parameters.
+    // Record the per-particle parameters that might have changed, and update the self energy to match.
     
-    vector<float4> baseParticleParamVec(cu.getPaddedNumAtoms(), make_float4(0, 0, 0, 0));
-    const vector<int>& order = cu.getAtomIndex();
-    for (int i = 0; i < force.getNumParticles(); i++) {
-        double charge, sigma, epsilon;
-        force.getParticleParameters(i, charge, sigma, epsilon);
-        baseParticleParamVec[i] = make_float4(charge, sigma, epsilon, 0);
+    bool ljChanged = false;
+    if (firstParticle <= lastParticle) {
+        vector<float4> baseParticleParamVec(lastParticle-firstParticle+1);
+        for (int i = firstParticle; i <= lastParticle; i++) {
+            double charge, sigma, epsilon;
+            force.getParticleParameters(i, charge, sigma, epsilon);
+            float4 params = make_float4(charge, sigma, epsilon, 0);
+            if (params.y != hostParticleParams[i].y || params.z != hostParticleParams[i].z)
+                ljChanged = true;
+            ewaldSelfEnergy += getSelfEnergy(params)-getSelfEnergy(hostParticleParams[i]);
+            hostParticleParams[i] = params;
+            baseParticleParamVec[i-firstParticle] = params;
+        }
+        baseParticleParams.uploadSubArray(&baseParticleParamVec[0], firstParticle, baseParticleParamVec.size());
+    }
+
+    // Record the atom types that might have changed, and the table of parameters for pairs of types.
+
+    if (numLJTypes > 0 && hasLJ) {
+        bool tableChanged = false;
+        for (int i = 0; i < ljTypeTableVec.size(); i++)
+            if (ljTypeTableVec[i].x != hostLJTypeTable[i].x || ljTypeTableVec[i].y != hostLJTypeTable[i].y)
+                tableChanged = true;
+        if (tableChanged) {
+            hostLJTypeTable = ljTypeTableVec;
+            ljTypeTable.upload(hostLJTypeTable);
+            ljChanged = true;
+        }
+        if (firstParticle <= lastParticle) {
+            bool typesChanged = false;
+            for (int i = firstParticle; i <= lastParticle; i++) {
+                int type = force.getParticleLJType(i);
+                if (type != hostLJTypes[i]) {
+                    hostLJTypes[i] = type;
+                    typesChanged = true;
+                }
+            }
+            if (typesChanged) {
+                ljTypes.uploadSubArray(&hostLJTypes[firstParticle], firstParticle, lastParticle-firstParticle+1);
+                ljChanged = true;
+            }
+        }
+    }
+    if (ljChanged && dispersionCorrection != NULL) {
+        dispersionCorrection->updateParticles(force, firstParticle, lastParticle);
+        dispersionCoefficient = dispersionCorrection->getCoefficient();
     }
-    baseParticleParams.upload(baseParticleParamVec);
     
-    // Record the exceptions.
+    // Record the exceptions that might have changed.  The non-excluded exceptions must be the same ones as before.
+    // They are numbered in the same order as all exceptions, so the ones handled by this context that lie in the
+    // range form a contiguous block.
     
-    if (numExceptions > 0) {
-        vector<float4> baseExceptionParamsVec(numExceptions);
-        for (int i = 0; i < numExceptions; i++) {
+    if (firstException <= lastException) {
+        set<int> exceptionsWithOffsets;
+        for (int i = 0; i < force.getNumExceptionParameterOffsets(); i++) {
+            string param;
+            int exception;
+            double charge, sigma, epsilon;
+            force.getExceptionParameterOffset(i, param, exception, charge, sigma, epsilon);
+            exceptionsWithOffsets.insert(exception);
+        }
+        int numContexts = cu.getPlatformData().contexts.size();
+        int startIndex = cu.getContextIndex()*numNonExcludedExceptions/numContexts;
+        int endIndex = (cu.getContextIndex()+1)*numNonExcludedExceptions/numContexts;
+        int firstLocalIndex = -1;
+        vector<float4> baseExceptionParamsVec;
+        for (int i = firstException; i <= lastException; i++) {
             int particle1, particle2;
             double chargeProd, sigma, epsilon;
-            force.getExceptionParameters(exceptions[startIndex+i], particle1, particle2, chargeProd, sigma, epsilon);
-            if (make_pair(particle1, particle2) != exceptionAtoms[i])
+            force.getExceptionParameters(i, particle1, particle2, chargeProd, sigma, epsilon);
+            bool include = (chargeProd != 0.0 || epsilon != 0.0 || exceptionsWithOffsets.find(i) != exceptionsWithOffsets.end());
+            int index = exceptionIndex[i];
+            if (include != (index >= 0))
                 throw OpenMMException("updateParametersInContext: The set of non-excluded exceptions has changed");
-            baseExceptionParamsVec[i] = make_float4(chargeProd, sigma, epsilon, 0);
+            if (index < startIndex || index >= endIndex)
+                continue;
+            if (make_pair(particle1, particle2) != exceptionAtoms[index-startIndex])
+                throw OpenMMException("updateParametersInContext: The set of non-excluded exceptions has changed");
+            if (firstLocalIndex == -1)
+                firstLocalIndex = index-startIndex;
+            baseExceptionParamsVec.push_back(make_float4(chargeProd, sigma, epsilon, 0));
         }
-        baseExceptionParams.upload(baseExceptionParamsVec);
+        if (baseExceptionParamsVec.size() > 0)
+            baseExceptionParams.uploadSubArray(&baseExceptionParamsVec[0], firstLocalIndex, baseExceptionParamsVec.size());
     }
-    
-    // Compute other values.
-    
-    ewaldSelfEnergy = 0.0;
+    if (firstParticle <= lastParticle || firstException <= lastException) {
+        cu.invalidateMolecules();
+        recomputeParams = true;
+    }
+}
+
+double CudaCalcNativeNonbondedForceKernel::getSelfEnergy(const float4& params) const {
+    if (cu.getContextIndex() != 0)
+        return 0.0;
     if (nonbondedMethod == Ewald || nonbondedMethod == PME || nonbondedMethod == LJPME) {
-        if (cu.getContextIndex() == 0) {
-            for (int i = 0; i < force.getNumParticles(); i++) {
-                ewaldSelfEnergy -= baseParticleParamVec[i].x*baseParticleParamVec[i].x*ONE_4PI_EPS0*alpha/sqrt(M_PI);
-                if (doLJPME)
-                    ewaldSelfEnergy += baseParticleParamVec[i].z*pow(baseParticleParamVec[i].y*dispersionAlpha, 6)/3.0;
-            }
-        }
+        double energy = -params.x*params.x*ONE_4PI_EPS0*alpha/sqrt(M_PI);
+        if (doLJPME)
+            energy += params.z*pow(params.y*dispersionAlpha, 6)/3.0;
+        return energy;
     }
-    if (force.getUseDispersionCorrection() && cu.getContextIndex() == 0 && (nonbondedMethod == CutoffPeriodic || nonbondedMethod == Ewald || nonbondedMethod == PME))
-        dispersionCoefficient = NativeNonbondedForceImpl::calcDispersionCorrection(context.getSystem(), force);
-    cu.invalidateMolecules();
-    recomputeParams = true;
+    if (nonbondedMethod == DampedShiftedForce)
+        return -params.x*params.x*ONE_4PI_EPS0*(0.5*erfc(alpha*cutoff)/cutoff+alpha/sqrt(M_PI));
+    if (nonbondedMethod == IPS)
+        return -params.x*params.x*ONE_4PI_EPS0*35.0/(32.0*cutoff);
+    return 0.0;
+}
+
+void CudaCalcNativeNonbondedForceKernel::getLJTypeTable(const NativeNonbondedForce& force, vector<float2>& table) const {
+    // The kernel expects sigma and 4*epsilon for each pair of types.
+
+    vector<double> sigma, epsilon;
+    NativeNonbondedForceImpl::getLJTypeTable(force, sigma, epsilon);
+    table.resize(sigma.size());
+    for (int i = 0; i < sigma.size(); i++)
+        table[i] = make_float2((float) sigma[i], (float) (4*epsilon[i]));
 }
 
 void CudaCalcNativeNonbondedForceKernel::getPMEParameters(double& alpha, int& nx, int& ny, int& nz) const {
@@ -1120,3 +1422,7 @@ void CudaCalcNativeNonbondedForceKernel::getLJPMEParameters(double& alpha, int&
         nz = dispersionGridSizeZ;
     }
 }
+
+void CudaCalcNativeNonbondedForceKernel::getMSMParameters(int& numLevels, int& nx, int& ny, int& nz) const {
+    throw OpenMMException("getMSMParametersInContext: This Context is not using MSM");
+}
@@ -35,16 +35,17 @@ using namespace std;
 class CudaParallelCalcNativeNonbondedForceKernel::Task : public CudaContext::WorkTask {
 public:
     Task(ContextImpl& context, CudaCalcNativeNonbondedForceKernel& kernel, bool includeForce,
-            bool includeEnergy, bool includeDirect, bool includeReciprocal, double& energy) : context(context), kernel(kernel),
-            includeForce(includeForce), includeEnergy(includeEnergy), includeDirect(includeDirect), includeReciprocal(includeReciprocal), energy(energy) {
+            bool includeEnergy, bool includeDirect, bool includeReciprocal, bool includeOuterShell, double& energy) : context(context), kernel(kernel),
+            includeForce(includeForce), includeEnergy(includeEnergy), includeDirect(includeDirect), includeReciprocal(includeReciprocal),
+            includeOuterShell(includeOuterShell), energy(energy) {
     }
     void execute() {
-        energy += kernel.execute(context, includeForce, includeEnergy, includeDirect, includeReciprocal);
+        energy += kernel.execute(context, includeForce, includeEnergy, includeDirect, includeReciprocal, includeOuterShell);
     }
 private:
     ContextImpl& context;
     CudaCalcNativeNonbondedForceKernel& kernel;
-    bool includeForce, includeEnergy, includeDirect, includeReciprocal;
+    bool includeForce, includeEnergy, includeDirect, includeReciprocal, includeOuterShell;
     double& energy;
 };
 
@@ -54,23 +55,23 @@ CudaParallelCalcNativeNonbondedForceKernel::CudaParallelCalcNativeNonbondedForce
         kernels.push_back(Kernel(new CudaCalcNativeNonbondedForceKernel(name, platform, *data.contexts[i], system)));
 }
 
-void CudaParallelCalcNativeNonbondedForceKernel::initialize(const System& system, const NativeNonbondedForce& force) {
+void CudaParallelCalcNativeNonbondedForceKernel::initialize(const System& system, const NativeNonbondedForce& force, const vector<vector<int> >& exclusions) {
     for (int i = 0; i < (int) kernels.size(); i++)
-        getKernel(i).initialize(system, force);
+        getKernel(i).initialize(system, force, exclusions);
 }
 
-double CudaParallelCalcNativeNonbondedForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy, bool includeDirect, bool includeReciprocal) {
+double CudaParallelCalcNativeNonbondedForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy, bool includeDirect, bool includeReciprocal, bool includeOuterShell) {
     for (int i = 0; i < (int) data.contexts.size(); i++) {
         CudaContext& cu = *data.contexts[i];
         ComputeContext::WorkThread& thread = cu.getWorkThread();
-        thread.addTask(new Task(context, getKernel(i), includeForces, includeEnergy, includeDirect, includeReciprocal, data.contextEnergy[i]));
+        thread.addTask(new Task(context, getKernel(i), includeForces, includeEnergy, includeDirect, includeReciprocal, includeOuterShell, data.contextEnergy[i]));
     }
     return 0.0;
 }
 
-void CudaParallelCalcNativeNonbondedForceKernel::copyParametersToContext(ContextImpl& context, const NativeNonbondedForce& force) {
+void CudaParallelCalcNativeNonbondedForceKernel::copyParametersToContext(ContextImpl& context, const NativeNonbondedForce& force, int firstParticle, int lastParticle, int firstException, int lastException) {
     for (int i = 0; i < (int) kernels.size(); i++)
-        getKernel(i).copyParametersToContext(context, force);
+        getKernel(i).copyParametersToContext(context, force, firstParticle, lastParticle, firstException, lastException);
 }
 
 void CudaParallelCalcNativeNonbondedForceKernel::getPMEParameters(double& alpha, int& nx, int& ny, int& nz) const {
@@ -80,3 +81,7 @@ void CudaParallelCalcNativeNonbondedForceKernel::getPMEParameters(double& alpha,
 void CudaParallelCalcNativeNonbondedForceKernel::getLJPMEParameters(double& alpha, int& nx, int& ny, int& nz) const {
     dynamic_cast<const CudaCalcNativeNonbondedForceKernel&>(kernels[0].getImpl()).getLJPMEParameters(alpha, nx, ny, nz);
 }
+
+void CudaParallelCalcNativeNonbondedForceKernel::getMSMParameters(int& numLevels, int& nx, int& ny, int& nz) const {
+    dynamic_cast<const CudaCalcNativeNonbondedForceKernel&>(kernels[0].getImpl()).getMSMParameters(numLevels, nx, ny, nz);
+}
@@ -46,10 +46,11 @@ public:
     /**
      * Initialize the kernel.
      *
-     * @param system     the System this kernel will be applied to
-     * @param force      the NativeNonbondedForce this kernel will be used for
+     * @param system      the System this kernel will be applied to
+     * @param force       the NativeNonbondedForce this kernel will be used for
+     * @param exclusions  exclusions[i] contains the particles excluded from particle i in increasing order
      */
-    void initialize(const System& system, const NativeNonbondedForce& force);
+    void initialize(const System& system, const NativeNonbondedForce& force, const std::vector<std::vector<int> >& exclusions);
     /**
      * Execute the kernel to calculate the forces and/or energy.
      *
@@ -58,16 +59,21 @@ public:
      * @param includeEnergy  true if the energy should be calculated
      * @param includeReciprocal  true if reciprocal space interactions should be included
      * @param includeReciprocal  true if reciprocal space interactions should be included
+     * @param includeOuterShell  true if the outer shell of direct space interactions should be included
      * @return the potential energy due to the force
      */
-    double execute(ContextImpl& context, bool includeForces, bool includeEnergy, bool includeDirect, bool includeReciprocal);
+    double execute(ContextImpl& context, bool includeForces, bool includeEnergy, bool includeDirect, bool includeReciprocal, bool includeOuterShell);
     /**
      * Copy changed parameters over to a context.
      *
-     * @param context    the context to copy parameters to
-     * @param force      the NativeNonbondedForce to copy the parameters from
+     * @param context         the context to copy parameters to
+     * @param force           the NativeNonbondedForce to copy the parameters from
+     * @param firstParticle   the index of the first particle whose parameters might have changed
+     * @param lastParticle    the index of the last particle whose parameters might have changed
+     * @param firstException  the index of the first exception whose parameters might have changed
+     * @param lastException   the index of the last exception whose parameters might have changed
      */
-    void copyParametersToContext(ContextImpl& context, const NativeNonbondedForce& force);
+    void copyParametersToContext(ContextImpl& context, const NativeNonbondedForce& force, int firstParticle, int lastParticle, int firstException, int lastException);
     /**
      * Get the parameters being used for PME.
      * 
@@ -86,6 +92,15 @@ public:
      * @param nz      the number of grid points along the Z axis
      */
     void getLJPMEParameters(double& alpha, int& nx, int& ny, int& nz) const;
+    /**
+     * Get the parameters being used for MSM.
+     *
+     * @param numLevels  the number of grid levels
+     * @param nx         the number of points along the X axis of the finest grid
+     * @param ny         the number of points along the Y axis of the finest grid
+     * @param nz         the number of points along the Z axis of the finest grid
+     */
+    void getMSMParameters(int& numLevels, int& nx, int& ny, int& nz) const;
 private:
     class Task;
     CudaPlatform::PlatformData& data;
@@ -38,7 +38,9 @@
 #include "openmm/opencl/OpenCLBondedUtilities.h"
 #include "openmm/opencl/OpenCLForceInfo.h"
 #include "openmm/reference/SimTKOpenMMRealType.h"
+#include <cmath>
 #include <cstring>
+#include <limits>
 #include <map>
 #include <algorithm>
 
@@ -78,6 +80,8 @@ public:
         double charge1, charge2, sigma1, sigma2, epsilon1, epsilon2;
         force.getParticleParameters(particle1, charge1, sigma1, epsilon1);
         force.getParticleParameters(particle2, charge2, sigma2, epsilon2);
+        if (force.getUseLJTypes() && force.getParticleLJType(particle1) != force.getParticleLJType(particle2))
+            return false;
         return (charge1 == charge2 && sigma1 == sigma2 && epsilon1 == epsilon2);
     }
     int getNumParticleGroups() {
@@ -206,9 +210,11 @@ OpenCLCalcNativeNonbondedForceKernel::~OpenCLCalcNativeNonbondedForceKernel() {
         delete dispersionFft;
     if (pmeio != NULL)
         delete pmeio;
+    if (dispersionCorrection != NULL)
+        delete dispersionCorrection;
 }
 
-void OpenCLCalcNativeNonbondedForceKernel::initialize(const System& system, const NativeNonbondedForce& force) {
+void OpenCLCalcNativeNonbondedForceKernel::initialize(const System& system, const NativeNonbondedForce& force, const vector<vector<int> >& exclusions) {
     int forceIndex;
     for (forceIndex = 0; forceIndex < system.getNumForces() && &system.getForce(forceIndex) != &force; ++forceIndex)
         ;
@@ -224,25 +230,26 @@ void OpenCLCalcNativeNonbondedForceKernel::initialize(const System& system, cons
         force.getExceptionParameterOffset(i, param, exception, charge, sigma, epsilon);
         exceptionsWithOffsets.insert(exception);
     }
-    vector<pair<int, int> > exclusions;
+    vector<pair<int, int> > exclusionPairs;
     vector<int> exceptions;
-    map<int, int> exceptionIndex;
+    exceptionIndex.assign(force.getNumExceptions(), -1);
     for (int i = 0; i < force.getNumExceptions(); i++) {
         int particle1, particle2;
         double chargeProd, sigma, epsilon;
         force.getExceptionParameters(i, particle1, particle2, chargeProd, sigma, epsilon);
-        exclusions.push_back(pair<int, int>(particle1, particle2));
+        exclusionPairs.push_back(pair<int, int>(particle1, particle2));
         if (chargeProd != 0.0 || epsilon != 0.0 || exceptionsWithOffsets.find(i) != exceptionsWithOffsets.end()) {
             exceptionIndex[i] = exceptions.size();
             exceptions.push_back(i);
         }
     }
+    numNonExcludedExceptions = exceptions.size();
 
     // Initialize nonbonded interactions.
 
     int numParticles = force.getNumParticles();
     vector<mm_float4> baseParticleParamVec(cl.getPaddedNumAtoms(), mm_float4(0, 0, 0, 0));
-    vector<vector<int> > exclusionList(numParticles);
+    vector<vector<int> > exclusionList(exclusions);
     hasCoulomb = false;
     hasLJ = false;
     for (int i = 0; i < numParticles; i++) {
@@ -265,11 +272,32 @@ void OpenCLCalcNativeNonbondedForceKernel::initialize(const System& system, cons
         if (epsilon != 0.0)
             hasLJ = true;
     }
-    for (auto exclusion : exclusions) {
-        exclusionList[exclusion.first].push_back(exclusion.second);
-        exclusionList[exclusion.second].push_back(exclusion.first);
+    numLJTypes = force.getNumLJTypes();
+    if (numLJTypes > 0) {
+        // The epsilons of the particles are ignored, so the table of types decides whether there are any
+        // Lennard-Jones interactions.
+
+        getLJTypeTable(force, hostLJTypeTable);
+        hasLJ = false;
+        for (auto& params : hostLJTypeTable)
+            if (params.y != 0.0f)
+                hasLJ = true;
     }
     nonbondedMethod = CalcNativeNonbondedForceKernel::NonbondedMethod(force.getNonbondedMethod());
+    if (nonbondedMethod == MSM)
+        throw OpenMMException("NativeNonbondedForce: MSM is not supported on the OpenCL platform");
+    if (nonbondedMethod == RandomBatchEwald)
+        throw OpenMMException("NativeNonbondedForce: RandomBatchEwald is not supported on the OpenCL platform");
+    if (nonbondedMethod == P3M)
+        throw OpenMMException("NativeNonbondedForce: P3M is not supported on the OpenCL platform");
+    if (nonbondedMethod == FMM)
+        throw OpenMMException("NativeNonbondedForce: FMM is not supported on the OpenCL platform");
+    if (nonbondedMethod == USeries)
+        throw OpenMMException("NativeNonbondedForce: USeries is not supported on the OpenCL platform");
+    if (force.getInnerCutoffDistance() != 0.0)
+        throw OpenMMException("NativeNonbondedForce: An inner cutoff is not supported on the OpenCL platform");
+    if (force.getUseSlabCorrection())
+        throw OpenMMException("NativeNonbondedForce: The slab correction is not supported on the OpenCL platform");
     bool useCutoff = (nonbondedMethod != NoCutoff);
     bool usePeriodic = (nonbondedMethod != NoCutoff && nonbondedMethod != CutoffNonPeriodic);
     doLJPME = (nonbondedMethod == LJPME && hasLJ);
@@ -277,7 +305,16 @@ void OpenCLCalcNativeNonbondedForceKernel::initialize(const System& system, cons
     map<string, string> defines;
     defines["HAS_COULOMB"] = (hasCoulomb ? "1" : "0");
     defines["HAS_LENNARD_JONES"] = (hasLJ ? "1" : "0");
-    defines["USE_LJ_SWITCH"] = (useCutoff && force.getUseSwitchingFunction() ? "1" : "0");
+    defines["USE_LJ_TYPES"] = (numLJTypes > 0 ? "1" : "0");
+    defines["NUM_LJ_TYPES"] = cl.intToString(numLJTypes);
+    defines["USE_LJ_SWITCH"] = (useCutoff && force.getUseSwitchingFunction() && nonbondedMethod != IPS ? "1" : "0");
+    double ljCutoff = NativeNonbondedForceImpl::getEffectiveLJCutoff(force);
+    bool useSeparateCutoffs = (useCutoff && ljCutoff != force.getCutoffDistance());
+    defines["USE_SEPARATE_CUTOFFS"] = (useSeparateCutoffs ? "1" : "0");
+    if (useSeparateCutoffs) {
+        defines["COULOMB_CUTOFF_SQUARED"] = cl.doubleToString(force.getCutoffDistance()*force.getCutoffDistance());
+        defines["LJ_CUTOFF_SQUARED"] = cl.doubleToString(ljCutoff*ljCutoff);
+    }
     if (useCutoff) {
         // Compute the reaction field constants.
 
@@ -290,17 +327,22 @@ void OpenCLCalcNativeNonbondedForceKernel::initialize(const System& system, cons
         
         if (force.getUseSwitchingFunction()) {
             defines["LJ_SWITCH_CUTOFF"] = cl.doubleToString(force.getSwitchingDistance());
-            defines["LJ_SWITCH_C3"] = cl.doubleToString(10/pow(force.getSwitchingDistance()-force.getCutoffDistance(), 3.0));
-            defines["LJ_SWITCH_C4"] = cl.doubleToString(15/pow(force.getSwitchingDistance()-force.getCutoffDistance(), 4.0));
-            defines["LJ_SWITCH_C5"] = cl.doubleToString(6/pow(force.getSwitchingDistance()-force.getCutoffDistance(), 5.0));
+            defines["LJ_SWITCH_C3"] = cl.doubleToString(10/pow(force.getSwitchingDistance()-ljCutoff, 3.0));
+            defines["LJ_SWITCH_C4"] = cl.doubleToString(15/pow(force.getSwitchingDistance()-ljCutoff, 4.0));
+            defines["LJ_SWITCH_C5"] = cl.doubleToString(6/pow(force.getSwitchingDistance()-ljCutoff, 5.0));
         }
     }
-    if (force.getUseDispersionCorrection() && cl.getContextIndex() == 0 && !doLJPME)
-        dispersionCoefficient = NativeNonbondedForceImpl::calcDispersionCorrection(system, force);
+    if (force.getUseDispersionCorrection() && cl.getContextIndex() == 0 && !doLJPME && nonbondedMethod != IPS) {
+        dispersionCorrection = new NativeNonbondedForceImpl::DispersionCorrection(force);
+        dispersionCoefficient = dispersionCorrection->getCoefficient();
+    }
     else
         dispersionCoefficient = 0.0;
     alpha = 0;
     ewaldSelfEnergy = 0.0;
+    cutoff = force.getCutoffDistance();
+    ewaldErrorTol = force.getEwaldErrorTolerance();
+    pmeGridResizeThreshold = 0.0;
     map<string, string> paramsDefines;
     paramsDefines["ONE_4PI_EPS0"] = cl.doubleToString(ONE_4PI_EPS0);
     hasOffsets = (force.getNumParticleParameterOffsets() > 0 || force.getNumExceptionParameterOffsets() > 0);
@@ -417,39 +459,38 @@ void OpenCLCalcNativeNonbondedForceKernel::initialize(const System& system, cons
                 }
             }
             if (pmeio == NULL) {
+                // Decide whether the grid dimensions should follow changes to the box volume.
+
+                double userAlpha;
+                int nx, ny, nz;
+                force.getPMEParameters(userAlpha, nx, ny, nz);
+                autoGridSize = (userAlpha == 0.0);
+                force.getLJPMEParameters(userAlpha, nx, ny, nz);
+                autoDispersionGridSize = (userAlpha == 0.0 && doLJPME);
+                if (autoGridSize || autoDispersionGridSize)
+                    pmeGridResizeThreshold = force.getPMEGridResizeThreshold();
+                Vec3 boxVectors[3];
+                system.getDefaultPeriodicBoxVectors(boxVectors[0], boxVectors[1], boxVectors[2]);
+                pmeGridVolume = boxVectors[0][0]*boxVectors[1][1]*boxVectors[2][2];
+
                 // Create required data structures.
 
                 int elementSize = (cl.getUseDoublePrecision() ? sizeof(double) : sizeof(float));
-                int roundedZSize = PmeOrder*(int) ceil(gridSizeZ/(double) PmeOrder);
-                int gridElements = gridSizeX*gridSizeY*roundedZSize;
-                if (doLJPME) {
-                    roundedZSize = PmeOrder*(int) ceil(dispersionGridSizeZ/(double) PmeOrder);
-                    gridElements = max(gridElements, dispersionGridSizeX*dispersionGridSizeY*roundedZSize);
-                }
-                pmeGrid1.initialize(cl, gridElements, 2*elementSize, "pmeGrid1");
-                pmeGrid2.initialize(cl, gridElements, 2*elementSize, "pmeGrid2");
-                if (cl.getSupports64BitGlobalAtomics())
-                    cl.addAutoclearBuffer(pmeGrid2);
-                else
-                    cl.addAutoclearBuffer(pmeGrid1);
-                pmeBsplineModuliX.initialize(cl, gridSizeX, elementSize, "pmeBsplineModuliX");
-                pmeBsplineModuliY.initialize(cl, gridSizeY, elementSize, "pmeBsplineModuliY");
-                pmeBsplineModuliZ.initialize(cl, gridSizeZ, elementSize, "pmeBsplineModuliZ");
-                if (doLJPME) {
-                    pmeDispersionBsplineModuliX.initialize(cl, dispersionGridSizeX, elementSize, "pmeDispersionBsplineModuliX");
-                    pmeDispersionBsplineModuliY.initialize(cl, dispersionGridSizeY, elementSize, "pmeDispersionBsplineModuliY");
-                    pmeDispersionBsplineModuliZ.initialize(cl, dispersionGridSizeZ, elementSize, "pmeDispersionBsplineModuliZ");
+                initializePmeGrids();
+                if (pmeGridResizeThreshold == 0.0) {
+                    // If the grids may be reallocated, they get cleared explicitly in execute() instead.
+
+                    if (cl.getSupports64BitGlobalAtomics())
+                        cl.addAutoclearBuffer(pmeGrid2);
+                    else
+                        cl.addAutoclearBuffer(pmeGrid1);
                 }
                 pmeBsplineTheta.initialize(cl, PmeOrder*numParticles, 4*elementSize, "pmeBsplineTheta");
-                pmeAtomRange.initialize<cl_int>(cl, gridSizeX*gridSizeY*gridSizeZ+1, "pmeAtomRange");
                 pmeAtomGridIndex.initialize<mm_int2>(cl, numParticles, "pmeAtomGridIndex");
                 int energyElementSize = (cl.getUseDoublePrecision() || cl.getUseMixedPrecision() ? sizeof(double) : sizeof(float));
                 pmeEnergyBuffer.initialize(cl, cl.getNumThreadBlocks()*OpenCLContext::ThreadBlockSize, energyElementSize, "pmeEnergyBuffer");
                 cl.clearBuffer(pmeEnergyBuffer);
                 sort = new OpenCLSort(cl, new SortTrait(), cl.getNumAtoms());
-                fft = new OpenCLFFT3D(cl, gridSizeX, gridSizeY, gridSizeZ, true);
-                if (doLJPME)
-                    dispersionFft = new OpenCLFFT3D(cl, dispersionGridSizeX, dispersionGridSizeY, dispersionGridSizeZ, true);
                 string vendor = cl.getDevice().getInfo<CL_DEVICE_VENDOR>();
                 bool isNvidia = (vendor.size() >= 6 && vendor.substr(0, 6) == "NVIDIA");
                 usePmeQueue = (!cl.getPlatformData().disablePmeStream && !cl.getPlatformData().useCpuPme && cl.getSupports64BitGlobalAtomics() && isNvidia);
@@ -462,95 +503,58 @@ void OpenCLCalcNativeNonbondedForceKernel::initialize(const System& system, cons
                     cl.addPreComputation(new SyncQueuePreComputation(cl, pmeQueue, recipForceGroup));
                     cl.addPostComputation(syncQueue = new SyncQueuePostComputation(cl, pmeSyncEvent, pmeEnergyBuffer, recipForceGroup));
                 }
+            }
+        }
+    }
+    else if (nonbondedMethod == DampedShiftedForce) {
+        // Compute the shifts that make the damped Coulomb energy and force go to zero at the cutoff.
 
-                // Initialize the b-spline moduli.
-
-                for (int grid = 0; grid < 2; grid++) {
-                    int xsize, ysize, zsize;
-                    OpenCLArray *xmoduli, *ymoduli, *zmoduli;
-                    if (grid == 0) {
-                        xsize = gridSizeX;
-                        ysize = gridSizeY;
-                        zsize = gridSizeZ;
-                        xmoduli = &pmeBsplineModuliX;
-                        ymoduli = &pmeBsplineModuliY;
-                        zmoduli = &pmeBsplineModuliZ;
-                    }
-                    else {
-                        if (!doLJPME)
-                            continue;
-                        xsize = dispersionGridSizeX;
-                        ysize = dispersionGridSizeY;
-                        zsize = dispersionGridSizeZ;
-                        xmoduli = &pmeDispersionBsplineModuliX;
-                        ymoduli = &pmeDispersionBsplineModuliY;
-                        zmoduli = &pmeDispersionBsplineModuliZ;
-                    }
-                    int maxSize = max(max(xsize, ysize), zsize);
-                    vector<double> data(PmeOrder);
-                    vector<double> ddata(PmeOrder);
-                    vector<double> bsplines_data(maxSize);
-                    data[PmeOrder-1] = 0.0;
-                    data[1] = 0.0;
-                    data[0] = 1.0;
-                    for (int i = 3; i < PmeOrder; i++) {
-                        double div = 1.0/(i-1.0);
-                        data[i-1] = 0.0;
-                        for (int j = 1; j < (i-1); j++)
-                            data[i-j-1] = div*(j*data[i-j-2]+(i-j)*data[i-j-1]);
-                        data[0] = div*data[0];
-                    }
+        alpha = force.getDSFAlpha();
+        double erfcAlphaCutoff = erfc(alpha*cutoff);
+        double forceShift = erfcAlphaCutoff/(cutoff*cutoff) + 2.0*alpha*exp(-alpha*alpha*cutoff*cutoff)/(sqrt(M_PI)*cutoff);
+        defines["USE_DSF"] = "1";
+        defines["DSF_ALPHA"] = cl.doubleToString(alpha);
+        defines["TWO_OVER_SQRT_PI"] = cl.doubleToString(2.0/sqrt(M_PI));
+        defines["DSF_FORCE_SHIFT"] = cl.doubleToString(forceShift);
+        defines["DSF_ENERGY_SHIFT"] = cl.doubleToString(erfcAlphaCutoff/cutoff+forceShift*cutoff);
+        if (cl.getContextIndex() == 0) {
+            // The self energy is handled the same way as for Ewald.
 
-                    // Differentiate.
-
-                    ddata[0] = -data[0];
-                    for (int i = 1; i < PmeOrder; i++)
-                        ddata[i] = data[i-1]-data[i];
-                    double div = 1.0/(PmeOrder-1);
-                    data[PmeOrder-1] = 0.0;
-                    for (int i = 1; i < (PmeOrder-1); i++)
-                        data[PmeOrder-i-1] = div*(i*data[PmeOrder-i-2]+(PmeOrder-i)*data[PmeOrder-i-1]);
-                    data[0] = div*data[0];
-                    for (int i = 0; i < maxSize; i++)
-                        bsplines_data[i] = 0.0;
-                    for (int i = 1; i <= PmeOrder; i++)
-                        bsplines_data[i] = data[i-1];
-
-                    // Evaluate the actual bspline moduli for X/Y/Z.
-
-                    for (int dim = 0; dim < 3; dim++) {
-                        int ndata = (dim == 0 ? xsize : dim == 1 ? ysize : zsize);
-                        vector<cl_double> moduli(ndata);
-                        for (int i = 0; i < ndata; i++) {
-                            double sc = 0.0;
-                            double ss = 0.0;
-                            for (int j = 0; j < ndata; j++) {
-                                double arg = (2.0*M_PI*i*j)/ndata;
-                                sc += bsplines_data[j]*cos(arg);
-                                ss += bsplines_data[j]*sin(arg);
-                            }
-                            moduli[i] = sc*sc+ss*ss;
-                        }
-                        for (int i = 0; i < ndata; i++)
-                        {
-                            if (moduli[i] < 1.0e-7)
-                                moduli[i] = (moduli[(i-1+ndata)%ndata]+moduli[(i+1)%ndata])*0.5;
-                        }
-                        if (dim == 0)
-                            xmoduli->upload(moduli, true);
-                        else if (dim == 1)
-                            ymoduli->upload(moduli, true);
-                        else
-                            zmoduli->upload(moduli, true);
-                    }
-                }
-            }
+            double selfEnergyScale = ONE_4PI_EPS0*(0.5*erfcAlphaCutoff/cutoff+alpha/sqrt(M_PI));
+            paramsDefines["INCLUDE_EWALD"] = "1";
+            paramsDefines["EWALD_SELF_ENERGY_SCALE"] = cl.doubleToString(selfEnergyScale);
+            for (int i = 0; i < numParticles; i++)
+                ewaldSelfEnergy -= baseParticleParamVec[i].x*baseParticleParamVec[i].x*selfEnergyScale;
+        }
+    }
+    else if (nonbondedMethod == IPS) {
+        // Compute the coefficients of the IPS polynomials for Coulomb and dispersion interactions.
+
+        defines["USE_IPS"] = "1";
+        defines["IPS_COULOMB_0"] = cl.doubleToString(-35.0/16.0/cutoff);
+        defines["IPS_COULOMB_2"] = cl.doubleToString(35.0/16.0/pow(cutoff, 3.0));
+        defines["IPS_COULOMB_4"] = cl.doubleToString(-21.0/16.0/pow(cutoff, 5.0));
+        defines["IPS_COULOMB_6"] = cl.doubleToString(5.0/16.0/pow(cutoff, 7.0));
+        defines["IPS_DISPERSION_0"] = cl.doubleToString((1.0+9.0/14.0-3.0/28.0+6.0/7.0)/pow(ljCutoff, 6.0));
+        defines["IPS_DISPERSION_2"] = cl.doubleToString(9.0/14.0/pow(ljCutoff, 8.0));
+        defines["IPS_DISPERSION_4"] = cl.doubleToString(-3.0/28.0/pow(ljCutoff, 10.0));
+        defines["IPS_DISPERSION_6"] = cl.doubleToString(6.0/7.0/pow(ljCutoff, 12.0));
+        if (cl.getContextIndex() == 0) {
+            // The self energy is handled the same way as for Ewald.
+
+            double selfEnergyScale = ONE_4PI_EPS0*35.0/(32.0*cutoff);
+            paramsDefines["INCLUDE_EWALD"] = "1";
+            paramsDefines["EWALD_SELF_ENERGY_SCALE"] = cl.doubleToString(selfEnergyScale);
+            for (int i = 0; i < numParticles; i++)
+                ewaldSelfEnergy -= baseParticleParamVec[i].x*baseParticleParamVec[i].x*selfEnergyScale;
         }
     }
 
-    // Add code to subtract off the reciprocal part of excluded interactions.
+    // Add code to subtract off the reciprocal part of excluded interactions.  With DSF, excluded pairs
+    // within the cutoff instead interact through the damped potential minus the bare Coulomb term, and
+    // with IPS through the Coulomb polynomial alone.
 
-    if ((nonbondedMethod == Ewald || nonbondedMethod == PME || nonbondedMethod == LJPME) && pmeio == NULL) {
+    if ((nonbondedMethod == Ewald || nonbondedMethod == PME || nonbondedMethod == LJPME || nonbondedMethod == DampedShiftedForce || nonbondedMethod == IPS) && pmeio == NULL) {
         int numContexts = cl.getPlatformData().contexts.size();
         int startIndex = cl.getContextIndex()*force.getNumExceptions()/numContexts;
         int endIndex = (cl.getContextIndex()+1)*force.getNumExceptions()/numContexts;
@@ -563,9 +567,9 @@ void OpenCLCalcNativeNonbondedForceKernel::initialize(const System& system, cons
             vector<mm_int2> exclusionAtomsVec(numExclusions);
             for (int i = 0; i < numExclusions; i++) {
                 int j = i+startIndex;
-                exclusionAtomsVec[i] = mm_int2(exclusions[j].first, exclusions[j].second);
-                atoms[i][0] = exclusions[j].first;
-                atoms[i][1] = exclusions[j].second;
+                exclusionAtomsVec[i] = mm_int2(exclusionPairs[j].first, exclusionPairs[j].second);
+                atoms[i][0] = exclusionPairs[j].first;
+                atoms[i][1] = exclusionPairs[j].second;
             }
             exclusionAtoms.upload(exclusionAtomsVec);
             map<string, string> replacements;
@@ -576,8 +580,22 @@ void OpenCLCalcNativeNonbondedForceKernel::initialize(const System& system, cons
             replacements["USE_PERIODIC"] = force.getExceptionsUsePeriodicBoundaryConditions() ? "1" : "0";
             if (doLJPME)
                 replacements["EWALD_DISPERSION_ALPHA"] = cl.doubleToString(dispersionAlpha);
+            string exclusionSource = CommonNativeNonbondedKernelSources::pmeExclusions;
+            if (nonbondedMethod == DampedShiftedForce) {
+                replacements["DSF_ALPHA"] = defines["DSF_ALPHA"];
+                replacements["DSF_FORCE_SHIFT"] = defines["DSF_FORCE_SHIFT"];
+                replacements["DSF_ENERGY_SHIFT"] = defines["DSF_ENERGY_SHIFT"];
+                replacements["CUTOFF_SQUARED"] = cl.doubleToString(cutoff*cutoff);
+                exclusionSource = CommonNativeNonbondedKernelSources::dsfExclusions;
+            }
+            if (nonbondedMethod == IPS) {
+                for (string name : {"IPS_COULOMB_0", "IPS_COULOMB_2", "IPS_COULOMB_4", "IPS_COULOMB_6"})
+                    replacements[name] = defines[name];
+                replacements["CUTOFF_SQUARED"] = cl.doubleToString(cutoff*cutoff);
+                exclusionSource = CommonNativeNonbondedKernelSources::ipsExclusions;
+            }
             if (force.getIncludeDirectSpace())
-                cl.getBondedUtilities().addInteraction(atoms, cl.replaceStrings(CommonNativeNonbondedKernelSources::pmeExclusions, replacements), force.getForceGroup());
+                cl.getBondedUtilities().addInteraction(atoms, cl.replaceStrings(exclusionSource, replacements), force.getForceGroup());
         }
     }
 
@@ -587,6 +605,7 @@ void OpenCLCalcNativeNonbondedForceKernel::initialize(const System& system, cons
     charges.initialize(cl, cl.getPaddedNumAtoms(), cl.getUseDoublePrecision() ? sizeof(double) : sizeof(float), "charges");
     baseParticleParams.initialize<mm_float4>(cl, cl.getPaddedNumAtoms(), "baseParticleParams");
     baseParticleParams.upload(baseParticleParamVec);
+    hostParticleParams = baseParticleParamVec;
     map<string, string> replacements;
     replacements["ONE_4PI_EPS0"] = cl.doubleToString(ONE_4PI_EPS0);
     if (usePosqCharges) {
@@ -600,14 +619,30 @@ void OpenCLCalcNativeNonbondedForceKernel::initialize(const System& system, cons
     if (hasCoulomb && !usePosqCharges)
         cl.getNonbondedUtilities().addParameter(OpenCLNonbondedUtilities::ParameterInfo(prefix+"charge", "real", 1, charges.getElementSize(), charges.getDeviceBuffer()));
     sigmaEpsilon.initialize<mm_float2>(cl, cl.getPaddedNumAtoms(), "sigmaEpsilon");
-    if (hasLJ) {
+    if (hasLJ && numLJTypes > 0) {
+        // Each particle only needs its type.  The parameters for each pair of types are looked up in a table.
+
+        hostLJTypes.resize(cl.getPaddedNumAtoms(), 0);
+        for (int i = 0; i < numParticles; i++)
+            hostLJTypes[i] = force.getParticleLJType(i);
+        ljTypes.initialize<int>(cl, cl.getPaddedNumAtoms(), "ljTypes");
+        ljTypes.upload(hostLJTypes);
+        ljTypeTable.initialize<mm_float2>(cl, hostLJTypeTable.size(), "ljTypeTable");
+        ljTypeTable.upload(hostLJTypeTable);
+        replacements["LJ_TYPE1"] = prefix+"ljTypes1";
+        replacements["LJ_TYPE2"] = prefix+"ljTypes2";
+        replacements["LJ_TYPE_TABLE"] = prefix+"ljTypeTable";
+        cl.getNonbondedUtilities().addParameter(OpenCLNonbondedUtilities::ParameterInfo(prefix+"ljTypes", "int", 1, sizeof(int), ljTypes.getDeviceBuffer()));
+        cl.getNonbondedUtilities().addArgument(OpenCLNonbondedUtilities::ParameterInfo(prefix+"ljTypeTable", "float", 2, sizeof(cl_float2), ljTypeTable.getDeviceBuffer()));
+    }
+    else if (hasLJ) {
         replacements["SIGMA_EPSILON1"] = prefix+"sigmaEpsilon1";
         replacements["SIGMA_EPSILON2"] = prefix+"sigmaEpsilon2";
         cl.getNonbondedUtilities().addParameter(OpenCLNonbondedUtilities::ParameterInfo(prefix+"sigmaEpsilon", "float", 2, sizeof(cl_float2), sigmaEpsilon.getDeviceBuffer()));
     }
     source = cl.replaceStrings(source, replacements);
     if (force.getIncludeDirectSpace())
-        cl.getNonbondedUtilities().addInteraction(useCutoff, usePeriodic, true, force.getCutoffDistance(), exclusionList, source, force.getForceGroup());
+        cl.getNonbondedUtilities().addInteraction(useCutoff, usePeriodic, true, max(force.getCutoffDistance(), ljCutoff), exclusionList, source, force.getForceGroup());
 
     // Initialize the exceptions.
 
@@ -673,7 +708,10 @@ void OpenCLCalcNativeNonbondedForceKernel::initialize(const System& system, cons
             paramIndex = paramPos-paramNames.begin();
         exceptionOffsetVec[index-startIndex].push_back(mm_float4(charge, sigma, epsilon, paramIndex));
     }
-    paramValues.resize(paramNames.size(), 0.0);
+    // The cached values start as NaN, so the first call to execute() uploads every value and passes it to the
+    // dispersion correction, which otherwise assumes the default values.
+
+    paramValues.resize(paramNames.size(), numeric_limits<double>::quiet_NaN());
     particleParamOffsets.initialize<mm_float4>(cl, max(force.getNumParticleParameterOffsets(), 1), "particleParamOffsets");
     particleOffsetIndices.initialize<cl_int>(cl, cl.getPaddedNumAtoms()+1, "particleOffsetIndices");
     vector<cl_int> particleOffsetIndicesVec, exceptionOffsetIndicesVec;
@@ -702,8 +740,6 @@ void OpenCLCalcNativeNonbondedForceKernel::initialize(const System& system, cons
         exceptionOffsetIndices.upload(exceptionOffsetIndicesVec);
     }
     globalParams.initialize(cl, max((int) paramValues.size(), 1), cl.getUseDoublePrecision() ? sizeof(double) : sizeof(float), "globalParams");
-    if (paramValues.size() > 0)
-        globalParams.upload(paramValues, true);
     recomputeParams = true;
     
     // Initialize the kernel for updating parameters.
@@ -715,8 +751,187 @@ void OpenCLCalcNativeNonbondedForceKernel::initialize(const System& system, cons
     cl.addForce(info);
 }
 
-double OpenCLCalcNativeNonbondedForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy, bool includeDirect, bool includeReciprocal) {
+void OpenCLCalcNativeNonbondedForceKernel::initializePmeGrids() {
+    // Allocate the grids.  This is also called when the grid dimensions change, in which case
+    // the existing arrays and FFTs are replaced.
+
+    int elementSize = (cl.getUseDoublePrecision() ? sizeof(double) : sizeof(float));
+    int roundedZSize = PmeOrder*(int) ceil(gridSizeZ/(double) PmeOrder);
+    int gridElements = gridSizeX*gridSizeY*roundedZSize;
+    if (doLJPME) {
+        roundedZSize = PmeOrder*(int) ceil(dispersionGridSizeZ/(double) PmeOrder);
+        gridElements = max(gridElements, dispersionGridSizeX*dispersionGridSizeY*roundedZSize);
+    }
+    if (pmeGrid1.isInitialized()) {
+        pmeGrid1.resize(gridElements);
+        pmeGrid2.resize(gridElements);
+        pmeBsplineModuliX.resize(gridSizeX);
+        pmeBsplineModuliY.resize(gridSizeY);
+        pmeBsplineModuliZ.resize(gridSizeZ);
+        pmeAtomRange.resize(gridSizeX*gridSizeY*gridSizeZ+1);
+        if (doLJPME) {
+            pmeDispersionBsplineModuliX.resize(dispersionGridSizeX);
+            pmeDispersionBsplineModuliY.resize(dispersionGridSizeY);
+            pmeDispersionBsplineModuliZ.resize(dispersionGridSizeZ);
+        }
+    }
+    else {
+        pmeGrid1.initialize(cl, gridElements, 2*elementSize, "pmeGrid1");
+        pmeGrid2.initialize(cl, gridElements, 2*elementSize, "pmeGrid2");
+        pmeBsplineModuliX.initialize(cl, gridSizeX, elementSize, "pmeBsplineModuliX");
+        pmeBsplineModuliY.initialize(cl, gridSizeY, elementSize, "pmeBsplineModuliY");
+        pmeBsplineModuliZ.initialize(cl, gridSizeZ, elementSize, "pmeBsplineModuliZ");
+        pmeAtomRange.initialize<cl_int>(cl, gridSizeX*gridSizeY*gridSizeZ+1, "pmeAtomRange");
+        if (doLJPME) {
+            pmeDispersionBsplineModuliX.initialize(cl, dispersionGridSizeX, elementSize, "pmeDispersionBsplineModuliX");
+            pmeDispersionBsplineModuliY.initialize(cl, dispersionGridSizeY, elementSize, "pmeDispersionBsplineModuliY");
+            pmeDispersionBsplineModuliZ.initialize(cl, dispersionGridSizeZ, elementSize, "pmeDispersionBsplineModuliZ");
+        }
+    }
+    if (fft != NULL)
+        delete fft;
+    fft = new OpenCLFFT3D(cl, gridSizeX, gridSizeY, gridSizeZ, true);
+    if (doLJPME) {
+        if (dispersionFft != NULL)
+            delete dispersionFft;
+        dispersionFft = new OpenCLFFT3D(cl, dispersionGridSizeX, dispersionGridSizeY, dispersionGridSizeZ, true);
+    }
+
+    // Initialize the b-spline moduli.
+
+    for (int grid = 0; grid < 2; grid++) {
+        int xsize, ysize, zsize;
+        OpenCLArray *xmoduli, *ymoduli, *zmoduli;
+        if (grid == 0) {
+            xsize = gridSizeX;
+            ysize = gridSizeY;
+            zsize = gridSizeZ;
+            xmoduli = &pmeBsplineModuliX;
+            ymoduli = &pmeBsplineModuliY;
+            zmoduli = &pmeBsplineModuliZ;
+        }
+        else {
+            if (!doLJPME)
+                continue;
+            xsize = dispersionGridSizeX;
+            ysize = dispersionGridSizeY;
+            zsize = dispersionGridSizeZ;
+            xmoduli = &pmeDispersionBsplineModuliX;
+            ymoduli = &pmeDispersionBsplineModuliY;
+            zmoduli = &pmeDispersionBsplineModuliZ;
+        }
+        int maxSize = max(max(xsize, ysize), zsize);
+        vector<double> data(PmeOrder);
+        vector<double> ddata(PmeOrder);
+        vector<double> bsplines_data(maxSize);
+        data[PmeOrder-1] = 0.0;
+        data[1] = 0.0;
+        data[0] = 1.0;
+        for (int i = 3; i < PmeOrder; i++) {
+            double div = 1.0/(i-1.0);
+            data[i-1] = 0.0;
+            for (int j = 1; j < (i-1); j++)
+                data[i-j-1] = div*(j*data[i-j-2]+(i-j)*data[i-j-1]);
+            data[0] = div*data[0];
+        }
+
+        // Differentiate.
+
+        ddata[0] = -data[0];
+        for (int i = 1; i < PmeOrder; i++)
+            ddata[i] = data[i-1]-data[i];
+        double div = 1.0/(PmeOrder-1);
+        data[PmeOrder-1] = 0.0;
+        for (int i = 1; i < (PmeOrder-1); i++)
+            data[PmeOrder-i-1] = div*(i*data[PmeOrder-i-2]+(PmeOrder-i)*data[PmeOrder-i-1]);
+        data[0] = div*data[0];
+        for (int i = 0; i < maxSize; i++)
+            bsplines_data[i] = 0.0;
+        for (int i = 1; i <= PmeOrder; i++)
+            bsplines_data[i] = data[i-1];
+
+        // Evaluate the actual bspline moduli for X/Y/Z.
+
+        for (int dim = 0; dim < 3; dim++) {
+            int ndata = (dim == 0 ? xsize : dim == 1 ? ysize : zsize);
+            vector<cl_double> moduli(ndata);
+            for (int i = 0; i < ndata; i++) {
+                double sc = 0.0;
+                double ss = 0.0;
+                for (int j = 0; j < ndata; j++) {
+                    double arg = (2.0*M_PI*i*j)/ndata;
+                    sc += bsplines_data[j]*cos(arg);
+                    ss += bsplines_data[j]*sin(arg);
+                }
+                moduli[i] = sc*sc+ss*ss;
+            }
+            for (int i = 0; i < ndata; i++)
+            {
+                if (moduli[i] < 1.0e-7)
+                    moduli[i] = (moduli[(i-1+ndata)%ndata]+moduli[(i+1)%ndata])*0.5;
+            }
+            if (dim == 0)
+                xmoduli->upload(moduli, true);
+            else if (dim == 1)
+                ymoduli->upload(moduli, true);
+            else
+                zmoduli->upload(moduli, true);
+        }
+    }
+}
+
+void OpenCLCalcNativeNonbondedForceKernel::resizePmeGrids(const Vec3* boxVectors) {
+    pmeGridVolume = boxVectors[0][0]*boxVectors[1][1]*boxVectors[2][2];
+    int xsize = gridSizeX, ysize = gridSizeY, zsize = gridSizeZ;
+    int dxsize = 0, dysize = 0, dzsize = 0;
+    if (doLJPME) {
+        dxsize = dispersionGridSizeX;
+        dysize = dispersionGridSizeY;
+        dzsize = dispersionGridSizeZ;
+    }
+    double unusedAlpha;
+    if (autoGridSize) {
+        NativeNonbondedForceImpl::calcPMEParameters(boxVectors, cutoff, ewaldErrorTol, unusedAlpha, xsize, ysize, zsize, false);
+        xsize = OpenCLFFT3D::findLegalDimension(xsize);
+        ysize = OpenCLFFT3D::findLegalDimension(ysize);
+        zsize = OpenCLFFT3D::findLegalDimension(zsize);
+    }
+    if (autoDispersionGridSize) {
+        NativeNonbondedForceImpl::calcPMEParameters(boxVectors, cutoff, ewaldErrorTol, unusedAlpha, dxsize, dysize, dzsize, true);
+        dxsize = OpenCLFFT3D::findLegalDimension(dxsize);
+        dysize = OpenCLFFT3D::findLegalDimension(dysize);
+        dzsize = OpenCLFFT3D::findLegalDimension(dzsize);
+    }
+    bool changed = (xsize != gridSizeX || ysize != gridSizeY || zsize != gridSizeZ);
+    if (doLJPME)
+        changed |= (dxsize != dispersionGridSizeX || dysize != dispersionGridSizeY || dzsize != dispersionGridSizeZ);
+    if (!changed)
+        return;
+
+    // Reallocate the grids and rebuild the kernels, whose grid dimensions are compile time constants.
+
+    gridSizeX = xsize;
+    gridSizeY = ysize;
+    gridSizeZ = zsize;
+    dispersionGridSizeX = dxsize;
+    dispersionGridSizeY = dysize;
+    dispersionGridSizeZ = dzsize;
+    pmeDefines["GRID_SIZE_X"] = cl.intToString(gridSizeX);
+    pmeDefines["GRID_SIZE_Y"] = cl.intToString(gridSizeY);
+    pmeDefines["GRID_SIZE_Z"] = cl.intToString(gridSizeZ);
+    initializePmeGrids();
+    hasInitializedKernel = false;
+}
+
+double OpenCLCalcNativeNonbondedForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy, bool includeDirect, bool includeReciprocal, bool includeOuterShell) {
     bool deviceIsCpu = (cl.getDevice().getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU);
+    if (pmeGridResizeThreshold > 0.0 && includeReciprocal) {
+        Vec3 boxVectors[3];
+        cl.getPeriodicBoxVectors(boxVectors[0], boxVectors[1], boxVectors[2]);
+        double volume = boxVectors[0][0]*boxVectors[1][1]*boxVectors[2][2];
+        if (fabs(volume-pmeGridVolume) > pmeGridResizeThreshold*pmeGridVolume)
+            resizePmeGrids(boxVectors);
+    }
     if (!hasInitializedKernel) {
         hasInitializedKernel = true;
         int index = 0;
@@ -820,18 +1035,20 @@ double OpenCLCalcNativeNonbondedForceKernel::execute(ContextImpl& context, bool
                 syncQueue->setKernel(cl::Kernel(program, "addEnergy"));
 
             if (doLJPME) {
-                // Create kernels for LJ PME.
-
-                pmeDefines["EWALD_ALPHA"] = cl.doubleToString(dispersionAlpha);
-                pmeDefines["GRID_SIZE_X"] = cl.intToString(dispersionGridSizeX);
-                pmeDefines["GRID_SIZE_Y"] = cl.intToString(dispersionGridSizeY);
-                pmeDefines["GRID_SIZE_Z"] = cl.intToString(dispersionGridSizeZ);
-                pmeDefines["EPSILON_FACTOR"] = "1";
-                pmeDefines["RECIP_EXP_FACTOR"] = cl.doubleToString(M_PI*M_PI/(dispersionAlpha*dispersionAlpha));
-                pmeDefines["USE_LJPME"] = "1";
-                pmeDefines["CHARGE_FROM_SIGEPS"] = "1";
+                // Create kernels for LJ PME.  The Coulomb defines are left untouched, since the kernels
+                // get rebuilt if the grid dimensions change.
+
+                map<string, string> dispersionDefines = pmeDefines;
+                dispersionDefines["EWALD_ALPHA"] = cl.doubleToString(dispersionAlpha);
+                dispersionDefines["GRID_SIZE_X"] = cl.intToString(dispersionGridSizeX);
+                dispersionDefines["GRID_SIZE_Y"] = cl.intToString(dispersionGridSizeY);
+                dispersionDefines["GRID_SIZE_Z"] = cl.intToString(dispersionGridSizeZ);
+                dispersionDefines["EPSILON_FACTOR"] = "1";
+                dispersionDefines["RECIP_EXP_FACTOR"] = cl.doubleToString(M_PI*M_PI/(dispersionAlpha*dispersionAlpha));
+                dispersionDefines["USE_LJPME"] = "1";
+                dispersionDefines["CHARGE_FROM_SIGEPS"] = "1";
                 program = cl.createProgram(CommonNativeNonbondedKernelSources::realtofixedpoint+
-                                           CommonNativeNonbondedKernelSources::pme, pmeDefines);
+                                           CommonNativeNonbondedKernelSources::pme, dispersionDefines);
                 pmeDispersionGridIndexKernel = cl::Kernel(program, "findAtomGridIndex");
                 pmeDispersionSpreadChargeKernel = cl::Kernel(program, "gridSpreadCharge");
                 pmeDispersionConvolutionKernel = cl::Kernel(program, "reciprocalConvolution");
@@ -900,15 +1117,20 @@ double OpenCLCalcNativeNonbondedForceKernel::execute(ContextImpl& context, bool
         if (value != paramValues[i]) {
             paramValues[i] = value;;
             paramChanged = true;
+            if (dispersionCorrection != NULL)
+                dispersionCorrection->setParameter(paramNames[i], value);
         }
     }
     if (paramChanged) {
+        if (dispersionCorrection != NULL)
+            dispersionCoefficient = dispersionCorrection->getCoefficient();
         recomputeParams = true;
         globalParams.upload(paramValues, true);
     }
-    double energy = (includeReciprocal ? ewaldSelfEnergy : 0.0);
+    bool includeSelfEnergy = (nonbondedMethod == DampedShiftedForce || nonbondedMethod == IPS ? includeDirect : includeReciprocal);
+    double energy = (includeSelfEnergy ? ewaldSelfEnergy : 0.0);
     if (recomputeParams || hasOffsets) {
-        computeParamsKernel.setArg<cl_int>(1, includeEnergy && includeReciprocal);
+        computeParamsKernel.setArg<cl_int>(1, includeEnergy && includeSelfEnergy);
         cl.executeKernel(computeParamsKernel, cl.getPaddedNumAtoms());
         if (exclusionParams.isInitialized())
             cl.executeKernel(computeExclusionParamsKernel, exclusionParams.getSize());
@@ -958,6 +1180,8 @@ double OpenCLCalcNativeNonbondedForceKernel::execute(ContextImpl& context, bool
         // Execute the reciprocal space kernels.
 
         if (hasCoulomb) {
+            if (pmeGridResizeThreshold > 0.0)
+                cl.clearBuffer(cl.getSupports64BitGlobalAtomics() ? pmeGrid2 : pmeGrid1);
             setPeriodicBoxArgs(cl, pmeGridIndexKernel, 2);
             if (cl.getUseDoublePrecision()) {
                 pmeGridIndexKernel.setArg<mm_double4>(7, recipBoxVectors[0]);
@@ -1162,85 +1386,152 @@ double OpenCLCalcNativeNonbondedForceKernel::execute(ContextImpl& context, bool
     return energy;
 }
 
-void OpenCLCalcNativeNonbondedForceKernel::copyParametersToContext(ContextImpl& context, const NativeNonbondedForce& force) {
+void OpenCLCalcNativeNonbondedForceKernel::copyParametersToContext(ContextImpl& context, const NativeNonbondedForce& force, int firstParticle, int lastParticle, int firstException, int lastException) {
     // Make sure the new parameters are acceptable.
-
+    
     if (force.getNumParticles() != cl.getNumAtoms())
         throw OpenMMException("updateParametersInContext: The number of particles has changed");
+    if (force.getNumExceptions() != exceptionIndex.size())
+        throw OpenMMException("updateParametersInContext: The number of exceptions has changed");
     if (!hasCoulomb || !hasLJ) {
-        for (int i = 0; i < force.getNumParticles(); i++) {
+        for (int i = firstParticle; i <= lastParticle; i++) {
             double charge, sigma, epsilon;
             force.getParticleParameters(i, charge, sigma, epsilon);
             if (!hasCoulomb && charge != 0.0)
                 throw OpenMMException("updateParametersInContext: The nonbonded force kernel does not include Coulomb interactions, because all charges were originally 0");
-            if (!hasLJ && epsilon != 0.0)
+            if (!hasLJ && epsilon != 0.0 && numLJTypes == 0)
                 throw OpenMMException("updateParametersInContext: The nonbonded force kernel does not include Lennard-Jones interactions, because all epsilons were originally 0");
         }
     }
-    set<int> exceptionsWithOffsets;
-    for (int i = 0; i < force.getNumExceptionParameterOffsets(); i++) {
-        string param;
-        int exception;
-        double charge, sigma, epsilon;
-        force.getExceptionParameterOffset(i, param, exception, charge, sigma, epsilon);
-        exceptionsWithOffsets.insert(exception);
+    NativeNonbondedForceImpl::checkLJTypes(force);
+    if (force.getNumLJTypes() != numLJTypes)
+        throw OpenMMException("updateParametersInContext: The number of LJ types has changed");
+    vector<mm_float2> ljTypeTableVec;
+    if (numLJTypes > 0) {
+        getLJTypeTable(force, ljTypeTableVec);
+        if (!hasLJ)
+            for (auto& params : ljTypeTableVec)
+                if (params.y != 0.0f)
+                    throw OpenMMException("updateParametersInContext: The nonbonded force kernel does not include Lennard-Jones interactions, because all epsilons were originally 0");
     }
-    vector<int> exceptions;
-    for (int i = 0; i < force.getNumExceptions(); i++) {
-        int particle1, particle2;
-        double chargeProd, sigma, epsilon;
-        force.getExceptionParameters(i, particle1, particle2, chargeProd, sigma, epsilon);
-        if (chargeProd != 0.0 || epsilon != 0.0 || exceptionsWithOffsets.find(i) != exceptionsWithOffsets.end())
-            exceptions.push_back(i);
+    
+    // Record the per-particle parameters that might have changed, and update the self energy to match.
+    
+    bool ljChanged = false;
+    if (firstParticle <= lastParticle) {
+        vector<mm_float4> baseParticleParamVec(lastParticle-firstParticle+1);
+        for (int i = firstParticle; i <= lastParticle; i++) {
+            double charge, sigma, epsilon;
+            force.getParticleParameters(i, charge, sigma, epsilon);
+            mm_float4 params = mm_float4(charge, sigma, epsilon, 0);
+            if (params.y != hostParticleParams[i].y || params.z != hostParticleParams[i].z)
+                ljChanged = true;
+            ewaldSelfEnergy += getSelfEnergy(params)-getSelfEnergy(hostParticleParams[i]);
+            hostParticleParams[i] = params;
+            baseParticleParamVec[i-firstParticle] = params;
+        }
+        baseParticleParams.uploadSubArray(&baseParticleParamVec[0], firstParticle, baseParticleParamVec.size());
     }
-    int numContexts = cl.getPlatformData().contexts.size();
-    int startIndex = cl.getContextIndex()*exceptions.size()/numContexts;
-    int endIndex = (cl.getContextIndex()+1)*exceptions.size()/numContexts;
-    int numExceptions = endIndex-startIndex;
-    if (numExceptions != exceptionAtoms.size())
-        throw OpenMMException("updateParametersInContext: The set of non-excluded exceptions has changed");
 
-    // Record the per-particle parameters.
+    // Record the atom types that might have changed, and the table of parameters for pairs of types.
 
-    vector<mm_float4> baseParticleParamVec(cl.getPaddedNumAtoms(), mm_float4(0, 0, 0, 0));
-    for (int i = 0; i < force.getNumParticles(); i++) {
-        double charge, sigma, epsilon;
-        force.getParticleParameters(i, charge, sigma, epsilon);
-        baseParticleParamVec[i] = mm_float4(charge, sigma, epsilon, 0);
+    if (numLJTypes > 0 && hasLJ) {
+        bool tableChanged = false;
+        for (int i = 0; i < ljTypeTableVec.size(); i++)
+            if (ljTypeTableVec[i].x != hostLJTypeTable[i].x || ljTypeTableVec[i].y != hostLJTypeTable[i].y)
+                tableChanged = true;
+        if (tableChanged) {
+            hostLJTypeTable = ljTypeTableVec;
+            ljTypeTable.upload(hostLJTypeTable);
+            ljChanged = true;
+        }
+        if (firstParticle <= lastParticle) {
+            bool typesChanged = false;
+            for (int i = firstParticle; i <= lastParticle; i++) {
+                int type = force.getParticleLJType(i);
+                if (type != hostLJTypes[i]) {
+                    hostLJTypes[i] = type;
+                    typesChanged = true;
+                }
+            }
+            if (typesChanged) {
+                ljTypes.uploadSubArray(&hostLJTypes[firstParticle], firstParticle, lastParticle-firstParticle+1);
+                ljChanged = true;
+            }
+        }
+    }
+    if (ljChanged && dispersionCorrection != NULL) {
+        dispersionCorrection->updateParticles(force, firstParticle, lastParticle);
+        dispersionCoefficient = dispersionCorrection->getCoefficient();
     }
-    baseParticleParams.upload(baseParticleParamVec);
     
-    // Record the exceptions.
+    // Record the exceptions that might have changed.  The non-excluded exceptions must be the same ones as before.
+    // They are numbered in the same order as all exceptions, so the ones handled by this context that lie in the
+    // range form a contiguous block.
     
-    if (numExceptions > 0) {
-        vector<mm_float4> baseExceptionParamsVec(numExceptions);
-        for (int i = 0; i < numExceptions; i++) {
+    if (firstException <= lastException) {
+        set<int> exceptionsWithOffsets;
+        for (int i = 0; i < force.getNumExceptionParameterOffsets(); i++) {
+            string param;
+            int exception;
+            double charge, sigma, epsilon;
+            force.getExceptionParameterOffset(i, param, exception, charge, sigma, epsilon);
+            exceptionsWithOffsets.insert(exception);
+        }
+        int numContexts = cl.getPlatformData().contexts.size();
+        int startIndex = cl.getContextIndex()*numNonExcludedExceptions/numContexts;
+        int endIndex = (cl.getContextIndex()+1)*numNonExcludedExceptions/numContexts;
+        int firstLocalIndex = -1;
+        vector<mm_float4> baseExceptionParamsVec;
+        for (int i = firstException; i <= lastException; i++) {
             int particle1, particle2;
             double chargeProd, sigma, epsilon;
-            force.getExceptionParameters(exceptions[startIndex+i], particle1, particle2, chargeProd, sigma, epsilon);
-            if (make_pair(particle1, particle2) != exceptionAtoms[i])
+            force.getExceptionParameters(i, particle1, particle2, chargeProd, sigma, epsilon);
+            bool include = (chargeProd != 0.0 || epsilon != 0.0 || exceptionsWithOffsets.find(i) != exceptionsWithOffsets.end());
+            int index = exceptionIndex[i];
+            if (include != (index >= 0))
                 throw OpenMMException("updateParametersInContext: The set of non-excluded exceptions has changed");
-            baseExceptionParamsVec[i] = mm_float4(chargeProd, sigma, epsilon, 0);
+            if (index < startIndex || index >= endIndex)
+                continue;
+            if (make_pair(particle1, particle2) != exceptionAtoms[index-startIndex])
+                throw OpenMMException("updateParametersInContext: The set of non-excluded exceptions has changed");
+            if (firstLocalIndex == -1)
+                firstLocalIndex = index-startIndex;
+            baseExceptionParamsVec.push_back(mm_float4(chargeProd, sigma, epsilon, 0));
         }
-        baseExceptionParams.upload(baseExceptionParamsVec);
+        if (baseExceptionParamsVec.size() > 0)
+            baseExceptionParams.uploadSubArray(&baseExceptionParamsVec[0], firstLocalIndex, baseExceptionParamsVec.size());
     }
-    
-    // Compute other values.
-    
-    ewaldSelfEnergy = 0.0;
+    if (firstParticle <= lastParticle || firstException <= lastException) {
+        cl.invalidateMolecules(info);
+        recomputeParams = true;
+    }
+}
+
+double OpenCLCalcNativeNonbondedForceKernel::getSelfEnergy(const mm_float4& params) const {
+    if (cl.getContextIndex() != 0)
+        return 0.0;
     if (nonbondedMethod == Ewald || nonbondedMethod == PME || nonbondedMethod == LJPME) {
-        if (cl.getContextIndex() == 0) {
-            for (int i = 0; i < force.getNumParticles(); i++) {
-                ewaldSelfEnergy -= baseParticleParamVec[i].x*baseParticleParamVec[i].x*ONE_4PI_EPS0*alpha/sqrt(M_PI);
-                if (doLJPME)
-                    ewaldSelfEnergy += baseParticleParamVec[i].z*pow(baseParticleParamVec[i].y*dispersionAlpha, 6)/3.0;
-            }
-        }
+        double energy = -params.x*params.x*ONE_4PI_EPS0*alpha/sqrt(M_PI);
+        if (doLJPME)
+            energy += params.z*pow(params.y*dispersionAlpha, 6)/3.0;
+        return energy;
     }
-    if (force.getUseDispersionCorrection() && cl.getContextIndex() == 0 && (nonbondedMethod == CutoffPeriodic || nonbondedMethod == Ewald || nonbondedMethod == PME))
-        dispersionCoefficient = NativeNonbondedForceImpl::calcDispersionCorrection(context.getSystem(), force);
-    cl.invalidateMolecules(info);
-    recomputeParams = true;
+    if (nonbondedMethod == DampedShiftedForce)
+        return -params.x*params.x*ONE_4PI_EPS0*(0.5*erfc(alpha*cutoff)/cutoff+alpha/sqrt(M_PI));
+    if (nonbondedMethod == IPS)
+        return -params.x*params.x*ONE_4PI_EPS0*35.0/(32.0*cutoff);
+    return 0.0;
+}
+
+void OpenCLCalcNativeNonbondedForceKernel::getLJTypeTable(const NativeNonbondedForce& force, vector<mm_float2>& table) const {
+    // The kernel expects sigma and 4*epsilon for each pair of types.
+
+    vector<double> sigma, epsilon;
+    NativeNonbondedForceImpl::getLJTypeTable(force, sigma, epsilon);
+    table.resize(sigma.size());
+    for (int i = 0; i < sigma.size(); i++)
+        table[i] = mm_float2((float) sigma[i], (float) (4*epsilon[i]));
 }
 
 void OpenCLCalcNativeNonbondedForceKernel::getPMEParameters(double& alpha, int& nx, int& ny, int& nz) const {
@@ -1269,3 +1560,7 @@ void OpenCLCalcNativeNonbondedForceKernel::getLJPMEParameters(double& alpha, int
         nz = dispersionGridSizeZ;
     }
 }
+
+void OpenCLCalcNativeNonbondedForceKernel::getMSMParameters(int& numLevels, int& nx, int& ny, int& nz) const {
+    throw OpenMMException("getMSMParametersInContext: This Context is not using MSM");
+}
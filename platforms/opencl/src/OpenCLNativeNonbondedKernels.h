@@ -33,6 +33,7 @@
  * -------------------------------------------------------------------------- */
 
 #include "NativeNonbondedKernels.h"
+#include "internal/NativeNonbondedForceImpl.h"
 #include "openmm/internal/ContextImpl.h"
 #include "openmm/opencl/OpenCLContext.h"
 #include "openmm/opencl/OpenCLArray.h"
@@ -48,16 +49,17 @@ namespace NativeNonbondedPlugin {
 class OpenCLCalcNativeNonbondedForceKernel : public CalcNativeNonbondedForceKernel {
 public:
     OpenCLCalcNativeNonbondedForceKernel(std::string name, const Platform& platform, OpenCLContext& cl, const System& system) : CalcNativeNonbondedForceKernel(name, platform),
-            hasInitializedKernel(false), cl(cl), sort(NULL), fft(NULL), dispersionFft(NULL), pmeio(NULL), usePmeQueue(false) {
+            hasInitializedKernel(false), cl(cl), sort(NULL), fft(NULL), dispersionFft(NULL), pmeio(NULL), usePmeQueue(false), dispersionCorrection(NULL) {
     }
     ~OpenCLCalcNativeNonbondedForceKernel();
     /**
      * Initialize the kernel.
      *
-     * @param system     the System this kernel will be applied to
-     * @param force      the NativeNonbondedForce this kernel will be used for
+     * @param system      the System this kernel will be applied to
+     * @param force       the NativeNonbondedForce this kernel will be used for
+     * @param exclusions  exclusions[i] contains the particles excluded from particle i in increasing order
      */
-    void initialize(const System& system, const NativeNonbondedForce& force);
+    void initialize(const System& system, const NativeNonbondedForce& force, const std::vector<std::vector<int> >& exclusions);
     /**
      * Execute the kernel to calculate the forces and/or energy.
      *
@@ -66,16 +68,21 @@ public:
      * @param includeEnergy  true if the energy should be calculated
      * @param includeDirect  true if direct space interactions should be included
      * @param includeReciprocal  true if reciprocal space interactions should be included
+     * @param includeOuterShell  true if the outer shell of direct space interactions should be included
      * @return the potential energy due to the force
      */
-    double execute(ContextImpl& context, bool includeForces, bool includeEnergy, bool includeDirect, bool includeReciprocal);
+    double execute(ContextImpl& context, bool includeForces, bool includeEnergy, bool includeDirect, bool includeReciprocal, bool includeOuterShell);
     /**
      * Copy changed parameters over to a context.
      *
-     * @param context    the context to copy parameters to
-     * @param force      the NativeNonbondedForce to copy the parameters from
+     * @param context         the context to copy parameters to
+     * @param force           the NativeNonbondedForce to copy the parameters from
+     * @param firstParticle   the index of the first particle whose parameters might have changed
+     * @param lastParticle    the index of the last particle whose parameters might have changed
+     * @param firstException  the index of the first exception whose parameters might have changed
+     * @param lastException   the index of the last exception whose parameters might have changed
      */
-    void copyParametersToContext(ContextImpl& context, const NativeNonbondedForce& force);
+    void copyParametersToContext(ContextImpl& context, const NativeNonbondedForce& force, int firstParticle, int lastParticle, int firstException, int lastException);
     /**
      * Get the parameters being used for PME.
      *
@@ -94,6 +101,15 @@ public:
      * @param nz      the number of grid points along the Z axis
      */
     void getLJPMEParameters(double& alpha, int& nx, int& ny, int& nz) const;
+    /**
+     * Get the parameters being used for MSM.
+     *
+     * @param numLevels  the number of grid levels
+     * @param nx         the number of points along the X axis of the finest grid
+     * @param ny         the number of points along the Y axis of the finest grid
+     * @param nz         the number of points along the Z axis of the finest grid
+     */
+    void getMSMParameters(int& numLevels, int& nx, int& ny, int& nz) const;
 private:
     class SortTrait : public OpenCLSort::SortTrait {
         int getDataSize() const {return 8;}
@@ -111,11 +127,17 @@ private:
     class PmePostComputation;
     class SyncQueuePreComputation;
     class SyncQueuePostComputation;
+    void initializePmeGrids();
+    void resizePmeGrids(const Vec3* boxVectors);
+    double getSelfEnergy(const mm_float4& params) const;
+    void getLJTypeTable(const NativeNonbondedForce& force, std::vector<mm_float2>& table) const;
     OpenCLContext& cl;
     ForceInfo* info;
     bool hasInitializedKernel;
     OpenCLArray charges;
     OpenCLArray sigmaEpsilon;
+    OpenCLArray ljTypes;
+    OpenCLArray ljTypeTable;
     OpenCLArray exceptionParams;
     OpenCLArray exclusionAtoms;
     OpenCLArray exclusionParams;
@@ -168,12 +190,19 @@ private:
     cl::Kernel pmeDispersionInterpolateForceKernel;
     std::map<std::string, std::string> pmeDefines;
     std::vector<std::pair<int, int> > exceptionAtoms;
+    std::vector<mm_float4> hostParticleParams;
+    std::vector<int> exceptionIndex;
+    int numNonExcludedExceptions, numLJTypes;
+    std::vector<int> hostLJTypes;
+    std::vector<mm_float2> hostLJTypeTable;
     std::vector<std::string> paramNames;
     std::vector<double> paramValues;
     double ewaldSelfEnergy, dispersionCoefficient, alpha, dispersionAlpha;
+    NativeNonbondedForceImpl::DispersionCorrection* dispersionCorrection;
+    double cutoff, ewaldErrorTol, pmeGridResizeThreshold, pmeGridVolume;
     int gridSizeX, gridSizeY, gridSizeZ;
     int dispersionGridSizeX, dispersionGridSizeY, dispersionGridSizeZ;
-    bool hasCoulomb, hasLJ, usePmeQueue, doLJPME, usePosqCharges, recomputeParams, hasOffsets;
+    bool hasCoulomb, hasLJ, usePmeQueue, doLJPME, usePosqCharges, recomputeParams, hasOffsets, autoGridSize, autoDispersionGridSize;
     NonbondedMethod nonbondedMethod;
     static const int PmeOrder = 5;
 };
@@ -33,16 +33,17 @@ using namespace std;
 class OpenCLParallelCalcNativeNonbondedForceKernel::Task : public OpenCLContext::WorkTask {
 public:
     Task(ContextImpl& context, OpenCLCalcNativeNonbondedForceKernel& kernel, bool includeForce,
-            bool includeEnergy, bool includeDirect, bool includeReciprocal, double& energy) : context(context), kernel(kernel),
-            includeForce(includeForce), includeEnergy(includeEnergy), includeDirect(includeDirect), includeReciprocal(includeReciprocal), energy(energy) {
+            bool includeEnergy, bool includeDirect, bool includeReciprocal, bool includeOuterShell, double& energy) : context(context), kernel(kernel),
+            includeForce(includeForce), includeEnergy(includeEnergy), includeDirect(includeDirect), includeReciprocal(includeReciprocal),
+            includeOuterShell(includeOuterShell), energy(energy) {
     }
     void execute() {
-        energy += kernel.execute(context, includeForce, includeEnergy, includeDirect, includeReciprocal);
+        energy += kernel.execute(context, includeForce, includeEnergy, includeDirect, includeReciprocal, includeOuterShell);
     }
 private:
     ContextImpl& context;
     OpenCLCalcNativeNonbondedForceKernel& kernel;
-    bool includeForce, includeEnergy, includeDirect, includeReciprocal;
+    bool includeForce, includeEnergy, includeDirect, includeReciprocal, includeOuterShell;
     double& energy;
 };
 
@@ -52,23 +53,23 @@ OpenCLParallelCalcNativeNonbondedForceKernel::OpenCLParallelCalcNativeNonbondedF
         kernels.push_back(Kernel(new OpenCLCalcNativeNonbondedForceKernel(name, platform, *data.contexts[i], system)));
 }
 
-void OpenCLParallelCalcNativeNonbondedForceKernel::initialize(const System& system, const NativeNonbondedForce& force) {
+void OpenCLParallelCalcNativeNonbondedForceKernel::initialize(const System& system, const NativeNonbondedForce& force, const vector<vector<int> >& exclusions) {
     for (int i = 0; i < (int) kernels.size(); i++)
-        getKernel(i).initialize(system, force);
+        getKernel(i).initialize(system, force, exclusions);
 }
 
-double OpenCLParallelCalcNativeNonbondedForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy, bool includeDirect, bool includeReciprocal) {
+double OpenCLParallelCalcNativeNonbondedForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy, bool includeDirect, bool includeReciprocal, bool includeOuterShell) {
     for (int i = 0; i < (int) data.contexts.size(); i++) {
         OpenCLContext& cl = *data.contexts[i];
         ComputeContext::WorkThread& thread = cl.getWorkThread();
-        thread.addTask(new Task(context, getKernel(i), includeForces, includeEnergy, includeDirect, includeReciprocal, data.contextEnergy[i]));
+        thread.addTask(new Task(context, getKernel(i), includeForces, includeEnergy, includeDirect, includeReciprocal, includeOuterShell, data.contextEnergy[i]));
     }
     return 0.0;
 }
 
-void OpenCLParallelCalcNativeNonbondedForceKernel::copyParametersToContext(ContextImpl& context, const NativeNonbondedForce& force) {
+void OpenCLParallelCalcNativeNonbondedForceKernel::copyParametersToContext(ContextImpl& context, const NativeNonbondedForce& force, int firstParticle, int lastParticle, int firstException, int lastException) {
     for (int i = 0; i < (int) kernels.size(); i++)
-        getKernel(i).copyParametersToContext(context, force);
+        getKernel(i).copyParametersToContext(context, force, firstParticle, lastParticle, firstException, lastException);
 }
 
 void OpenCLParallelCalcNativeNonbondedForceKernel::getPMEParameters(double& alpha, int& nx, int& ny, int& nz) const {
@@ -78,3 +79,7 @@ void OpenCLParallelCalcNativeNonbondedForceKernel::getPMEParameters(double& alph
 void OpenCLParallelCalcNativeNonbondedForceKernel::getLJPMEParameters(double& alpha, int& nx, int& ny, int& nz) const {
     dynamic_cast<const OpenCLCalcNativeNonbondedForceKernel&>(kernels[0].getImpl()).getLJPMEParameters(alpha, nx, ny, nz);
 }
+
+void OpenCLParallelCalcNativeNonbondedForceKernel::getMSMParameters(int& numLevels, int& nx, int& ny, int& nz) const {
+    dynamic_cast<const OpenCLCalcNativeNonbondedForceKernel&>(kernels[0].getImpl()).getMSMParameters(numLevels, nx, ny, nz);
+}
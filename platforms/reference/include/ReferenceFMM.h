@@ -0,0 +1,88 @@
+
+/* Portions copyright (c) 2026 Stanford University and Simbios.
+ * Contributors: Pande Group
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __ReferenceFMM_H__
+#define __ReferenceFMM_H__
+
+#include "openmm/Vec3.h"
+#include "internal/windowsExportNativeNonbonded.h"
+#include <set>
+#include <vector>
+
+namespace OpenMM {
+    class ThreadPool;
+}
+
+namespace NativeNonbondedPlugin {
+
+/**
+ * This class computes the Coulomb interaction between all pairs of particles in a non-periodic system with the
+ * fast multipole method (FMM).  The cube enclosing all particles is divided into an octree.  Interactions between
+ * particles in the same or adjacent leaf cells (the near field) are computed directly, and all others through
+ * Cartesian multipole and local expansions of a given order that are passed up and down the tree.  The cost is
+ * linear in the number of particles.
+ */
+
+class OPENMM_EXPORT_NATIVENONBONDED ReferenceFMM {
+public:
+    /**
+     * Create a ReferenceFMM.
+     *
+     * @param order      the order of the multipole and local expansions
+     * @param treeDepth  the number of times the enclosing cube is subdivided.  Leaf cells have 8^treeDepth times
+     *                   smaller volume than the cube.
+     */
+    ReferenceFMM(int order, int treeDepth);
+    /**
+     * Select a tree depth that puts a few dozen particles in each leaf cell, assuming they are spread evenly.
+     */
+    static int selectTreeDepth(int numParticles);
+    /**
+     * Compute the Coulomb energy and forces.  Excluded pairs are omitted from the near field, and subtracted
+     * from the far field in the rare case that they are not in adjacent cells.  The near field is divided
+     * between the threads of a thread pool.
+     *
+     * @param atomCoordinates    the particle positions
+     * @param charges            the particle charges
+     * @param exclusions         exclusions[i] contains the particles whose interaction with particle i is omitted
+     * @param threads            the thread pool used for the near field
+     * @param forces             the forces are added to this
+     * @return the energy in kJ/mol
+     */
+    double calculate(const std::vector<OpenMM::Vec3>& atomCoordinates, const std::vector<double>& charges,
+                     const std::vector<std::set<int> >& exclusions, OpenMM::ThreadPool& threads, std::vector<OpenMM::Vec3>& forces);
+private:
+    void computeDerivatives(const OpenMM::Vec3& r, std::vector<double>& derivatives);
+    void computePowers(const OpenMM::Vec3& r, std::vector<double>& powers) const;
+    int term(int a, int b, int c) const {
+        return termIndex[(a*(order+1)+b)*(order+1)+c];
+    }
+    int order, treeDepth, numTerms;
+    std::vector<int> termIndex, termX, termY, termZ, termsUpToDegree, m2lIndex;
+    std::vector<double> inverseFactorial, binomial, hermite;
+};
+
+} // namespace NativeNonbondedPlugin
+
+#endif // __ReferenceFMM_H__
@@ -27,9 +27,23 @@
 
 #include "openmm/reference/ReferencePairIxn.h"
 #include "openmm/reference/ReferenceNeighborList.h"
+#include "ReferencePME.h"
+
+namespace OpenMM_SFMT {
+    class SFMT;
+}
+
+namespace OpenMM {
+    class ThreadPool;
+}
 
 namespace NativeNonbondedPlugin {
 
+struct p3m_influence_function;
+class ReferenceMSM;
+class ReferenceSlabPME;
+class ReferenceTiledAllPairs;
+
 class ReferenceLJCoulombIxn {
 
    private:
@@ -38,14 +52,32 @@ class ReferenceLJCoulombIxn {
       bool useSwitch;
       bool periodic, periodicExceptions;
       bool ewald;
-      bool pme, ljpme;
+      bool pme, ljpme, msm, dsf, rbe, fmm, ips, useries, slab;
+      bool innerShell, includeInnerShell, includeOuterShell;
       const OpenMM::NeighborList* neighborList;
       OpenMM::Vec3 periodicBoxVectors[3];
-      double cutoffDistance, switchingDistance;
+      double cutoffDistance, ljCutoffDistance, switchingDistance;
       double krf, crf;
-      double alphaEwald, alphaDispersionEwald;
+      double alphaEwald, alphaDispersionEwald, alphaDSF, useriesSpacing;
+      double innerSwitchingDistance, innerCutoffDistance;
       int numRx, numRy, numRz;
       int meshDim[3], dispersionMeshDim[3];
+      int msmOrder, rbeBatchSize, fmmOrder, fmmTreeDepth;
+      OpenMM_SFMT::SFMT* rbeRandom;
+      p3m_influence_function* p3mInfluence;
+      pme_t pmeData;
+      ReferenceMSM* msmData;
+      ReferenceSlabPME* slabPme;
+      OpenMM::ThreadPool* threadPool;
+      const ReferenceTiledAllPairs* tiles;
+      int numLJTypes;
+      const std::vector<int>* ljTypes;
+      const std::vector<double>* ljTypeTable;
+      const std::vector<int>* particleClasses;
+      const std::vector<int>* pairClassStart;
+      const std::vector<int>* waterMolecules;
+      const OpenMM::NeighborList* waterNeighborList;
+      int waterSize;
 
       // parameter indices
 
@@ -59,6 +91,7 @@ class ReferenceLJCoulombIxn {
       
          @param atom1            the index of the first atom
          @param atom2            the index of the second atom
+         @param pairClass        the terms to compute, a combination of HasCoulomb and HasLJ
          @param atomCoordinates  atom coordinates
          @param atomParameters   atom parameters (charges, c6, c12, ...)     atomParameters[atomIndex][paramterIndex]
          @param forces           force array (forces added)
@@ -66,13 +99,97 @@ class ReferenceLJCoulombIxn {
             
          --------------------------------------------------------------------------------------- */
           
-      void calculateOneIxn(int atom1, int atom2, std::vector<OpenMM::Vec3>& atomCoordinates,
+      void calculateOneIxn(int atom1, int atom2, int pairClass, std::vector<OpenMM::Vec3>& atomCoordinates,
                            std::vector<std::vector<double> >& atomParameters, std::vector<OpenMM::Vec3>& forces,
                            double* totalEnergy) const;
 
+      /**---------------------------------------------------------------------------------------
+
+         Multiply the energy and force of a pair by the weight of the shells being computed
+
+         @param r       the distance between the two atoms
+         @param dEdR    the pair force divided by r
+         @param energy  the pair energy
+
+         @return false if the pair has zero weight and can be skipped
+
+         --------------------------------------------------------------------------------------- */
+
+      bool splitDirectSpace(double r, double& dEdR, double& energy) const;
+
+      /**---------------------------------------------------------------------------------------
+
+         Get the Lennard-Jones parameters for a pair of atoms, either by combining their own
+         parameters or by looking up their atom types in the table
+
+         @param atom1            the index of the first atom
+         @param atom2            the index of the second atom
+         @param atomParameters   atom parameters (charges, c6, c12, ...)     atomParameters[atomIndex][paramterIndex]
+         @param sig              on exit, the sigma of the pair
+         @param eps              on exit, 4 times the epsilon of the pair
+
+         --------------------------------------------------------------------------------------- */
+
+      void getLJParameters(int atom1, int atom2, const std::vector<std::vector<double> >& atomParameters, double& sig, double& eps) const {
+          if (ljTypes == NULL) {
+              sig = atomParameters[atom1][SigIndex] + atomParameters[atom2][SigIndex];
+              eps = atomParameters[atom1][EpsIndex]*atomParameters[atom2][EpsIndex];
+          }
+          else {
+              const double* entry = &(*ljTypeTable)[2*((*ljTypes)[atom1]*numLJTypes + (*ljTypes)[atom2])];
+              sig = entry[0];
+              eps = entry[1];
+          }
+      }
+
+      /**---------------------------------------------------------------------------------------
+
+         Get which terms must be computed for a pair of atoms.  A term is only needed if both
+         atoms take part in it.
+
+         @param atom1            the index of the first atom
+         @param atom2            the index of the second atom
+
+         @return a combination of HasCoulomb and HasLJ, or 0 if the pair does not interact
+
+         --------------------------------------------------------------------------------------- */
+
+      int getPairClass(int atom1, int atom2) const {
+          if (particleClasses == NULL)
+              return HasCoulomb | HasLJ;
+          return (*particleClasses)[atom1] & (*particleClasses)[atom2];
+      }
+
+      /**---------------------------------------------------------------------------------------
+
+         Get the range of the neighbor list that holds the pairs of one class.  If the list has not
+         been sorted by class, every pair is treated as needing both terms.
+
+         @param pairClass        a combination of HasCoulomb and HasLJ
+         @param start            on exit, the index of the first pair of this class
+         @param end              on exit, one past the index of the last pair of this class
+
+         --------------------------------------------------------------------------------------- */
+
+      void getPairClassRange(int pairClass, int& start, int& end) const {
+          if (pairClassStart == NULL || pairClassStart->empty()) {
+              start = (pairClass == (HasCoulomb | HasLJ) ? 0 : neighborList->size());
+              end = neighborList->size();
+          }
+          else {
+              start = (*pairClassStart)[pairClass-1];
+              end = (*pairClassStart)[pairClass];
+          }
+      }
+
 
    public:
 
+      // flags describing which terms a particle takes part in
+
+      static const int HasCoulomb = 1;
+      static const int HasLJ = 2;
+
       /**---------------------------------------------------------------------------------------
       
          Constructor
@@ -110,6 +227,18 @@ class ReferenceLJCoulombIxn {
          --------------------------------------------------------------------------------------- */
       
       void setUseSwitchingFunction(double distance);
+
+      /**---------------------------------------------------------------------------------------
+
+         Set a different cutoff for the Lennard-Jones interaction.  The cutoff passed to
+         setUseCutoff() then applies only to the Coulomb interaction, and the neighbor list must
+         extend to the larger of the two.
+
+         @param distance            the Lennard-Jones cutoff distance
+
+         --------------------------------------------------------------------------------------- */
+
+      void setLJCutoff(double distance);
       
       /**---------------------------------------------------------------------------------------
       
@@ -158,7 +287,199 @@ class ReferenceLJCoulombIxn {
          --------------------------------------------------------------------------------------- */
 
       void setUseLJPME(double dalpha, int dmeshSize[3]);
+
+      /**---------------------------------------------------------------------------------------
+
+         Set the force to use the P3M method.  This is identical to PME except for the influence
+         function used in the reciprocal space convolution.
+
+         @param alpha     the Ewald separation parameter
+         @param gridSize  the dimensions of the mesh
+         @param influence the cached influence function, which is recomputed when the box changes
+
+         --------------------------------------------------------------------------------------- */
+
+      void setUseP3M(double alpha, int meshSize[3], p3m_influence_function& influence);
+
+      /**---------------------------------------------------------------------------------------
+
+         Use a PME object created by the caller, rather than creating a new one for every
+         calculation.  This avoids allocating the grid and computing the B-spline moduli each time.
+         It is used for PME, P3M and the u-series method, but not for the slab correction or for a
+         separate LJPME dispersion grid.
+
+         @param data      the PME object, initialized with the Ewald separation parameter and mesh
+                          dimensions passed to setUsePME()
+
+         --------------------------------------------------------------------------------------- */
+
+      void setPMEData(pme_t data);
+
+      /**---------------------------------------------------------------------------------------
+
+         Treat the system as a slab that is periodic only along x and y.  The PME reciprocal space
+         calculation is done on a grid that is truncated along z, with the Yeh-Berkowitz and
+         electrostatic layer corrections.  This requires that PME has also been set.
+
+         @param data       the object that computes the slab reciprocal space interaction.  It keeps
+                           a PME object for each height of the truncated grid, so it is kept from one
+                           calculation to the next.
+
+         --------------------------------------------------------------------------------------- */
+
+      void setUseSlabCorrection(ReferenceSlabPME& data);
+
+      /**---------------------------------------------------------------------------------------
+
+         Set the force to use the multilevel summation method (MSM).  This requires that a cutoff
+         and periodic boundary conditions have also been set.
+
+         @param data       the MSM object, created by the caller with the same cutoff distance.  It
+                           holds the grids and stencils, so it is kept from one calculation to the next.
+         @param threads    the thread pool used to process the grids
+
+         --------------------------------------------------------------------------------------- */
+
+      void setUseMSM(ReferenceMSM& data, OpenMM::ThreadPool& threads);
+
+      /**---------------------------------------------------------------------------------------
+
+         Set the force to use the damped shifted force (DSF) method for Coulomb interactions.
+         This requires that a cutoff and periodic boundary conditions have also been set.
+
+         @param alpha    the damping parameter
+
+         --------------------------------------------------------------------------------------- */
+
+      void setUseDSF(double alpha);
+
+      /**---------------------------------------------------------------------------------------
+
+         Set the force to use Random Batch Ewald (RBE) summation.
+
+         @param alpha      the Ewald separation parameter
+         @param batchSize  the number of wave vectors to sample
+         @param random     the random number generator used to sample wave vectors
+
+         --------------------------------------------------------------------------------------- */
+
+      void setUseRandomBatchEwald(double alpha, int batchSize, OpenMM_SFMT::SFMT& random);
+
+      /**---------------------------------------------------------------------------------------
+
+         Set the force to use the fast multipole method (FMM) for Coulomb interactions.  This
+         requires that a cutoff has also been set, which is applied to the Lennard-Jones interaction.
+
+         @param order      the order of the multipole expansions
+         @param treeDepth  the depth of the octree
+         @param threads    the thread pool used to compute the near field
+
+         --------------------------------------------------------------------------------------- */
+
+      void setUseFMM(int order, int treeDepth, OpenMM::ThreadPool& threads);
+
+      /**---------------------------------------------------------------------------------------
+
+         Set the force to use the isotropic periodic sum (IPS) method for Coulomb and dispersion
+         interactions.  This requires that a cutoff and periodic boundary conditions have also been set.
+
+         --------------------------------------------------------------------------------------- */
+
+      void setUseIPS();
+
+      /**---------------------------------------------------------------------------------------
+
+         Compute direct space interactions by looping over all pairs in tiles, rather than over a
+         neighbor list.  This can only be used for non-periodic systems.  If a cutoff has been set,
+         pairs beyond it are skipped.
+
+         @param tiles      describes the tiles and the excluded pairs in each one
+         @param threads    the thread pool used to process the tiles
+
+         --------------------------------------------------------------------------------------- */
+
+      void setUseTiledAllPairs(const ReferenceTiledAllPairs& tiles, OpenMM::ThreadPool& threads);
+
+      /**---------------------------------------------------------------------------------------
+
+         Take the Lennard-Jones parameters of each pair of atoms from a table of atom types,
+         rather than combining the sigma and epsilon of the two atoms.  This cannot be used
+         with LJPME.
+
+         @param numTypes   the number of atom types
+         @param types      the type of each atom
+         @param table      the parameters for types i and j are table[2*(i*numTypes+j)] (sigma)
+                           and table[2*(i*numTypes+j)+1] (4 times epsilon)
+
+         --------------------------------------------------------------------------------------- */
+
+      void setUseLJTypes(int numTypes, const std::vector<int>& types, const std::vector<double>& table);
+
+      /**---------------------------------------------------------------------------------------
+
+         Describe which terms each atom takes part in, so that the pair loops can skip the
+         Coulomb or Lennard-Jones term for pairs that would give zero, and skip pairs that do
+         not interact at all.  If this is not called, every pair computes both terms.
+
+         The neighbor list must be sorted by the class of each pair, with pairs that do not
+         interact removed, so that the loops over it decide which terms to compute once for each
+         class rather than once for each pair.
+
+         @param classes    for each atom, a combination of HasCoulomb and HasLJ
+         @param start      element c-1 is the index in the neighbor list of the first pair
+                           of class c, and element 3 is the size of the list
+
+         --------------------------------------------------------------------------------------- */
+
+      void setParticleClasses(const std::vector<int>& classes, const std::vector<int>& start);
+
+      /**---------------------------------------------------------------------------------------
+
+         Compute the interactions between rigid water molecules from a list of pairs of molecules,
+         rather than from the neighbor list.  Every molecule must consist of the same number of
+         consecutive atoms with identical parameters, the atoms of each molecule must exclude each
+         other and nothing else, and the neighbor list must omit all pairs of atoms in two
+         different molecules.  This is only used with a cutoff, and not with LJPME or atom types.
+         If the system is periodic, each box dimension must be more than twice the cutoff plus
+         twice the size of a molecule.
+
+         @param molecules   the index of the first atom of each molecule
+         @param size        the number of atoms in each molecule
+         @param pairs       the pairs of molecules (indices into molecules) that might interact
+
+         --------------------------------------------------------------------------------------- */
+
+      void setWaterMolecules(const std::vector<int>& molecules, int size, const OpenMM::NeighborList& pairs);
       
+      /**---------------------------------------------------------------------------------------
+
+         Set the force to use the u-series method for Coulomb interactions.  This requires that a
+         cutoff and periodic boundary conditions have also been set.
+
+         @param alpha     the inverse width of the narrowest Gaussian computed on the grid
+         @param spacing   the logarithmic spacing between the widths of successive Gaussians
+         @param gridSize  the dimensions of the mesh
+
+         --------------------------------------------------------------------------------------- */
+
+      void setUseUSeries(double alpha, double spacing, int meshSize[3]);
+
+      /**---------------------------------------------------------------------------------------
+
+         Split direct space interactions into an inner and an outer shell, so that they can be
+         computed separately.  Pairs closer than the switching distance belong to the inner shell,
+         pairs beyond the inner cutoff to the outer shell, and a smooth switching function divides
+         the pairs in between.  Excluded pairs and self energies belong to the inner shell.
+
+         @param switchingDistance  the inner switching distance
+         @param cutoffDistance     the inner cutoff distance
+         @param includeInner       true if the inner shell should be included
+         @param includeOuter       true if the outer shell should be included
+
+         --------------------------------------------------------------------------------------- */
+
+      void setUseInnerCutoff(double switchingDistance, double cutoffDistance, bool includeInner, bool includeOuter);
+
       /**---------------------------------------------------------------------------------------
 
          Set whether exceptions use periodic boundary conditions.
@@ -207,6 +528,130 @@ private:
       void calculateEwaldIxn(int numberOfAtoms, std::vector<OpenMM::Vec3>& atomCoordinates,
                              std::vector<std::vector<double> >& atomParameters, std::vector<std::set<int> >& exclusions,
                              std::vector<OpenMM::Vec3>& forces, double* totalEnergy, bool includeDirect, bool includeReciprocal) const;
+
+      /**---------------------------------------------------------------------------------------
+
+         Calculate MSM ixn
+
+         @param numberOfAtoms    number of atoms
+         @param atomCoordinates  atom coordinates
+         @param atomParameters   atom parameters (charges, c6, c12, ...)     atomParameters[atomIndex][paramterIndex]
+         @param exclusions       atom exclusion indices
+                                 exclusions[atomIndex] contains the list of exclusions for that atom
+         @param forces           force array (forces added)
+         @param totalEnergy      total energy
+         @param includeDirect      true if direct space interactions should be included
+         @param includeReciprocal  true if the grid based long range interactions should be included
+
+         --------------------------------------------------------------------------------------- */
+
+      void calculateMSMIxn(int numberOfAtoms, std::vector<OpenMM::Vec3>& atomCoordinates,
+                           std::vector<std::vector<double> >& atomParameters, std::vector<std::set<int> >& exclusions,
+                           std::vector<OpenMM::Vec3>& forces, double* totalEnergy, bool includeDirect, bool includeReciprocal) const;
+
+      /**---------------------------------------------------------------------------------------
+
+         Calculate u-series ixn
+
+         @param numberOfAtoms    number of atoms
+         @param atomCoordinates  atom coordinates
+         @param atomParameters   atom parameters (charges, c6, c12, ...)     atomParameters[atomIndex][paramterIndex]
+         @param exclusions       atom exclusion indices
+                                 exclusions[atomIndex] contains the list of exclusions for that atom
+         @param forces           force array (forces added)
+         @param totalEnergy      total energy
+         @param includeDirect      true if direct space interactions should be included
+         @param includeReciprocal  true if the grid based long range interactions should be included
+
+         --------------------------------------------------------------------------------------- */
+
+      void calculateUSeriesIxn(int numberOfAtoms, std::vector<OpenMM::Vec3>& atomCoordinates,
+                               std::vector<std::vector<double> >& atomParameters, std::vector<std::set<int> >& exclusions,
+                               std::vector<OpenMM::Vec3>& forces, double* totalEnergy, bool includeDirect, bool includeReciprocal) const;
+
+      /**---------------------------------------------------------------------------------------
+
+         Calculate DSF ixn
+
+         @param numberOfAtoms    number of atoms
+         @param atomCoordinates  atom coordinates
+         @param atomParameters   atom parameters (charges, c6, c12, ...)     atomParameters[atomIndex][paramterIndex]
+         @param exclusions       atom exclusion indices
+                                 exclusions[atomIndex] contains the list of exclusions for that atom
+         @param forces           force array (forces added)
+         @param totalEnergy      total energy
+
+         --------------------------------------------------------------------------------------- */
+
+      void calculateDSFIxn(int numberOfAtoms, std::vector<OpenMM::Vec3>& atomCoordinates,
+                           std::vector<std::vector<double> >& atomParameters, std::vector<std::set<int> >& exclusions,
+                           std::vector<OpenMM::Vec3>& forces, double* totalEnergy) const;
+
+      /**---------------------------------------------------------------------------------------
+
+         Calculate FMM ixn
+
+         @param numberOfAtoms    number of atoms
+         @param atomCoordinates  atom coordinates
+         @param atomParameters   atom parameters (charges, c6, c12, ...)     atomParameters[atomIndex][paramterIndex]
+         @param exclusions       atom exclusion indices
+                                 exclusions[atomIndex] contains the list of exclusions for that atom
+         @param forces           force array (forces added)
+         @param totalEnergy      total energy
+
+         --------------------------------------------------------------------------------------- */
+
+      void calculateFMMIxn(int numberOfAtoms, std::vector<OpenMM::Vec3>& atomCoordinates,
+                           std::vector<std::vector<double> >& atomParameters, std::vector<std::set<int> >& exclusions,
+                           std::vector<OpenMM::Vec3>& forces, double* totalEnergy) const;
+
+      /**---------------------------------------------------------------------------------------
+
+         Calculate IPS ixn
+
+         @param numberOfAtoms    number of atoms
+         @param atomCoordinates  atom coordinates
+         @param atomParameters   atom parameters (charges, c6, c12, ...)     atomParameters[atomIndex][paramterIndex]
+         @param exclusions       atom exclusion indices
+                                 exclusions[atomIndex] contains the list of exclusions for that atom
+         @param forces           force array (forces added)
+         @param totalEnergy      total energy
+
+         --------------------------------------------------------------------------------------- */
+
+      void calculateIPSIxn(int numberOfAtoms, std::vector<OpenMM::Vec3>& atomCoordinates,
+                           std::vector<std::vector<double> >& atomParameters, std::vector<std::set<int> >& exclusions,
+                           std::vector<OpenMM::Vec3>& forces, double* totalEnergy) const;
+
+      /**---------------------------------------------------------------------------------------
+
+         Calculate direct space ixn by looping over all pairs in tiles
+
+         @param numberOfAtoms    number of atoms
+         @param atomCoordinates  atom coordinates
+         @param atomParameters   atom parameters (charges, c6, c12, ...)     atomParameters[atomIndex][paramterIndex]
+         @param forces           force array (forces added)
+         @param totalEnergy      total energy
+
+         --------------------------------------------------------------------------------------- */
+
+      void calculateTiledIxn(int numberOfAtoms, std::vector<OpenMM::Vec3>& atomCoordinates,
+                             std::vector<std::vector<double> >& atomParameters, std::vector<OpenMM::Vec3>& forces,
+                             double* totalEnergy) const;
+
+      /**---------------------------------------------------------------------------------------
+
+         Calculate direct space ixn between pairs of water molecules
+
+         @param atomCoordinates  atom coordinates
+         @param atomParameters   atom parameters (charges, c6, c12, ...)     atomParameters[atomIndex][paramterIndex]
+         @param forces           force array (forces added)
+         @param totalEnergy      total energy
+
+         --------------------------------------------------------------------------------------- */
+
+      void calculateWaterIxn(std::vector<OpenMM::Vec3>& atomCoordinates, std::vector<std::vector<double> >& atomParameters,
+                             std::vector<OpenMM::Vec3>& forces, double* totalEnergy) const;
 };
 
 } // namespace OpenMM
@@ -0,0 +1,119 @@
+
+/* Portions copyright (c) 2026 Stanford University and Simbios.
+ * Contributors: Pande Group
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __ReferenceMSM_H__
+#define __ReferenceMSM_H__
+
+#include "openmm/Vec3.h"
+#include "internal/windowsExportNativeNonbonded.h"
+#include <vector>
+
+namespace OpenMM {
+    class ThreadPool;
+}
+
+namespace NativeNonbondedPlugin {
+
+/**
+ * This class computes the long range part of the Coulomb interaction with the multilevel summation
+ * method (MSM) of Hardy and Skeel.  The 1/r kernel is split into a short range part that vanishes
+ * beyond the cutoff distance a, which is computed in direct space, and a series of smooth kernels
+ * g(r, a*2^(l-1)) - g(r, a*2^l) of increasing range, each of which is computed by a local convolution
+ * on a grid whose spacing doubles from one level to the next.  The smooth kernel g remaining at the
+ * top level is computed exactly on the (small) top level grid, including all periodic copies.
+ *
+ * Charges are transferred between particles and the finest grid, and between consecutive levels,
+ * with piecewise polynomial nodal basis functions of order 4 (C1 cubic) or 6 (C1 quintic).  Every
+ * operation except the top level is local, so the cost is linear in the number of particles.
+ *
+ * The grids, stencils and top level kernel are kept from one calculation to the next, and the stencils
+ * and kernel are only recomputed when the periodic box changes.  Every stage is divided between the
+ * threads of a ThreadPool.
+ */
+
+class OPENMM_EXPORT_NATIVENONBONDED ReferenceMSM {
+public:
+    /**
+     * Create a ReferenceMSM.
+     *
+     * @param cutoff     the cutoff distance a beyond which the short range part vanishes
+     * @param gridSize   the dimensions of the finest grid.  Each one must be divisible by 2^(numLevels-1).
+     * @param numLevels  the number of grid levels
+     * @param order      the interpolation order (4 or 6)
+     */
+    ReferenceMSM(double cutoff, const int gridSize[3], int numLevels, int order);
+    /**
+     * Evaluate the smoothed kernel g(r, a) = gamma(r/a)/a and its derivative with respect to r.  gamma equals
+     * 1/rho beyond rho=1, and is an even polynomial inside that matches it with C2 continuity for order 4
+     * or C3 continuity for order 6.
+     */
+    static void evaluateSmoothing(double r, double a, int order, double& g, double& dgdr);
+    /**
+     * Get the interpolation order.
+     */
+    int getOrder() const {
+        return order;
+    }
+    /**
+     * Compute the long range energy and forces.  This includes the interaction of every charge with
+     * itself through the smoothed kernel, which the caller should remove by subtracting q^2*g(0, a)/2 for
+     * each particle.
+     *
+     * @param atomCoordinates    the particle positions
+     * @param charges            the particle charges
+     * @param periodicBoxVectors the vectors defining the periodic box
+     * @param threads            the thread pool used to process the particles and grids
+     * @param forces             the forces are added to this
+     * @return the energy in kJ/mol
+     */
+    double calculate(const std::vector<OpenMM::Vec3>& atomCoordinates, const std::vector<double>& charges,
+                     const OpenMM::Vec3 periodicBoxVectors[3], OpenMM::ThreadPool& threads, std::vector<OpenMM::Vec3>& forces);
+private:
+    struct StencilPoint {
+        int dx, dy, dz;
+        double value;
+    };
+    void setPeriodicBox(const OpenMM::Vec3 periodicBoxVectors[3]);
+    void computeStencil(int level);
+    void computeTopKernel();
+    double basis(double t) const;
+    double basisDerivative(double t) const;
+    void computeWeights(const OpenMM::Vec3& pos, double* weights, double* derivs, int* gridIndex) const;
+    int index(int level, int x, int y, int z) const {
+        return (x*gridSize[level][1]+y)*gridSize[level][2]+z;
+    }
+    double cutoff;
+    int numLevels, order;
+    std::vector<std::vector<int> > gridSize;
+    std::vector<std::vector<double> > gridCharge, gridPotential, threadCharge;
+    std::vector<std::vector<StencilPoint> > stencils;
+    std::vector<double> topKernel;
+    std::vector<double> prolongationWeights;
+    OpenMM::Vec3 boxVectors[3], recipBoxVectors[3];
+    bool hasBox;
+};
+
+} // namespace NativeNonbondedPlugin
+
+#endif // __ReferenceMSM_H__
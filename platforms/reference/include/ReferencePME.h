@@ -44,6 +44,22 @@ typedef double rvec[3];
 typedef struct pme *
 pme_t;
 
+/*
+ * Cached P3M influence function, together with the box, grid and Ewald coefficient it was computed for.
+ * Default constructed objects are empty and get filled in by the first call to pme_exec_p3m().
+ */
+struct p3m_influence_function
+{
+    p3m_influence_function() : ewaldcoeff(0.0)
+    {
+        ngrid[0] = ngrid[1] = ngrid[2] = 0;
+    }
+    OpenMM::Vec3        box[3];
+    int                 ngrid[3];
+    double              ewaldcoeff;
+    std::vector<double> values;
+};
+
 /*
  * Initialize a PME calculation and set up data structures
  *
@@ -86,6 +102,58 @@ pme_exec(pme_t pme,
          const OpenMM::Vec3 periodicBoxVectors[3],
          double* energy);
 
+/*
+ * Evaluate reciprocal space P3M energy and forces. Charges are spread and forces interpolated exactly as in
+ * pme_exec(), but the convolution uses the influence function that is optimal for the B-spline assignment
+ * function instead of the SPME one, which gives the same accuracy on a coarser grid.
+ *
+ * Args:
+ *
+ * pme         Opaque pme_t object, must have been initialized with pme_init()
+ * x           Pointer to coordinate data array (nm)
+ * f           Pointer to force data array (will be written as kJ/mol/nm)
+ * charge      Array of charges (units of e)
+ * box         Simulation cell dimensions (nm)
+ * influence   Cached influence function. It is recomputed only if the box, grid or Ewald coefficient changed.
+ * energy      Total energy (will be written in units of kJ/mol)
+ */
+int OPENMM_EXPORT_NATIVENONBONDED
+pme_exec_p3m(pme_t pme,
+             const std::vector<OpenMM::Vec3>& atomCoordinates,
+             std::vector<OpenMM::Vec3>& forces,
+             const std::vector<double>& charges,
+             const OpenMM::Vec3 periodicBoxVectors[3],
+             p3m_influence_function& influence,
+             double* energy);
+
+/*
+ * Evaluate the long range part of the u-series Coulomb energy and forces. 1/r is approximated by a sum of Gaussians
+ * whose widths form a geometric series, and those at least as wide as 1/ewaldcoeff are computed on grids. Band b
+ * holds the Gaussians between 2^b and 2^(b+1) times that width, and uses a grid 2^b times coarser than the one pme
+ * was initialized with. The widest Gaussians are summed directly over the few wave vectors they need. On each grid
+ * charges are spread and forces interpolated exactly as in pme_exec(). The coarser grids and the influence functions
+ * are kept in the pme object, and recomputed only if the box or the spacing changed.
+ *
+ * Args:
+ *
+ * pme         Opaque pme_t object, must have been initialized with pme_init(), where ewaldcoeff is the inverse
+ *             width of the narrowest Gaussian and ngrid the size of the finest grid
+ * spacing     Logarithmic spacing between the widths of successive Gaussians
+ * x           Pointer to coordinate data array (nm)
+ * f           Pointer to force data array (will be written as kJ/mol/nm)
+ * charge      Array of charges (units of e)
+ * box         Simulation cell dimensions (nm)
+ * energy      Total energy (will be written in units of kJ/mol)
+ */
+int OPENMM_EXPORT_NATIVENONBONDED
+pme_exec_useries(pme_t pme,
+                 double spacing,
+                 const std::vector<OpenMM::Vec3>& atomCoordinates,
+                 std::vector<OpenMM::Vec3>& forces,
+                 const std::vector<double>& charges,
+                 const OpenMM::Vec3 periodicBoxVectors[3],
+                 double* energy);
+
 
 /**
  * Evaluate reciprocal space PME dispersion energy and forces.
@@ -110,6 +178,35 @@ pme_exec_dpme(pme_t pme,
 
 
 
+/**
+ * Evaluate reciprocal space PME Coulomb and dispersion energies and forces together. Both real grids
+ * are packed into one complex grid, so a single forward and backward FFT serve both terms. The
+ * grid dimensions are those pme was initialized with, and apply to both terms.
+ *
+ * Args:
+ *
+ * pme                  Opaque pme_t object, must have been initialized with pme_init() using the Coulomb Ewald coefficient
+ * dispersionewaldcoeff The dispersion Ewald coefficient (nm^-1)
+ * x                    Pointer to coordinate data array (nm)
+ * f                    Pointer to force data array (will be written as kJ/mol/nm)
+ * charge               Array of charges (units of e)
+ * c6s                  Array of c6 coefficients (units of sqrt(kJ/mol).nm^3 )
+ * box                  Simulation cell dimensions (nm)
+ * energy               Coulomb energy (will be written in units of kJ/mol)
+ * dispersionenergy     Dispersion energy (will be written in units of kJ/mol)
+ */
+int OPENMM_EXPORT_NATIVENONBONDED
+pme_exec_packed(pme_t pme,
+                double dispersionewaldcoeff,
+                const std::vector<OpenMM::Vec3>& atomCoordinates,
+                std::vector<OpenMM::Vec3>& forces,
+                const std::vector<double>& charges,
+                const std::vector<double>& c6s,
+                const OpenMM::Vec3 periodicBoxVectors[3],
+                double* energy,
+                double* dispersionenergy);
+
+
 /* Release all memory in pme structure */
 int OPENMM_EXPORT_NATIVENONBONDED
 pme_destroy(pme_t    pme);
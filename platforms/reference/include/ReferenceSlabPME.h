@@ -0,0 +1,105 @@
+
+/* Portions copyright (c) 2026 Stanford University and Simbios.
+ * Contributors: Pande Group
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __ReferenceSlabPME_H__
+#define __ReferenceSlabPME_H__
+
+#include "ReferencePME.h"
+#include "openmm/Vec3.h"
+#include "internal/windowsExportNativeNonbonded.h"
+#include <map>
+#include <vector>
+
+namespace NativeNonbondedPlugin {
+
+/**
+ * This class computes the reciprocal space PME energy and forces for a slab: a system that is periodic along the
+ * x and y axes, and that has been padded with vacuum along the z axis.  It finds the largest gap between particles
+ * along z, and replaces the vacuum by a narrower gap so the grid only spans the particles plus that gap.  The
+ * energy is then corrected to that of a system that is truly periodic in two dimensions:
+ *
+ * <ul>
+ * <li>The Yeh-Berkowitz term removes the interaction between the net dipole moments of the periodic copies of
+ * the slab, including the terms of Ballenegger et al. for a system with a net charge.</li>
+ * <li>The electrostatic layer correction (ELC) of Arnold, de Joannis and Holm removes the remaining interaction
+ * between the slab and its periodic copies.  It converges exponentially with the width of the gap, and is
+ * truncated when the neglected terms fall below the error tolerance.</li>
+ * </ul>
+ *
+ * Because the corrected energy no longer depends on the height of the periodic box, the reduced grid gives the
+ * same result as the full one.
+ *
+ * The height of the reduced grid follows the particles, so it can change from one calculation to the next.  A PME
+ * object is created the first time each height is used, and kept until this object is deleted.
+ */
+
+class OPENMM_EXPORT_NATIVENONBONDED ReferenceSlabPME {
+public:
+    /**
+     * Create a ReferenceSlabPME.
+     *
+     * @param alpha      the Ewald separation parameter
+     * @param gridSize   the dimensions of the PME grid that spans the full periodic box
+     * @param tolerance  the error tolerance, used to truncate the layer correction
+     */
+    ReferenceSlabPME(double alpha, const int gridSize[3], double tolerance);
+    ~ReferenceSlabPME();
+    /**
+     * Compute the reciprocal space energy and forces.  The third box vector must be parallel to the z axis.
+     *
+     * @param atomCoordinates    the particle positions
+     * @param charges            the particle charges
+     * @param boxVectors         the periodic box vectors
+     * @param minGap             the narrowest gap to leave between the slab and its periodic copies.  This must be
+     *                           at least the direct space cutoff, so the direct space interactions are unaffected.
+     * @param forces             the forces are added to this
+     * @return the energy in kJ/mol
+     */
+    double calculate(const std::vector<OpenMM::Vec3>& atomCoordinates, const std::vector<double>& charges,
+                     const OpenMM::Vec3* boxVectors, double minGap, std::vector<OpenMM::Vec3>& forces);
+    /**
+     * Get the number of grid points along the z axis used by the most recent call to calculate().
+     */
+    int getReducedGridSize() const {
+        return reducedGridSize;
+    }
+    /**
+     * Get whether this object was created for a PME grid with the given dimensions.
+     */
+    bool hasGridSize(const int size[3]) const {
+        return (size[0] == gridSize[0] && size[1] == gridSize[1] && size[2] == gridSize[2]);
+    }
+private:
+    ReferenceSlabPME(const ReferenceSlabPME&);
+    ReferenceSlabPME& operator=(const ReferenceSlabPME&);
+    double calculateLayerCorrection(const std::vector<OpenMM::Vec3>& atomCoordinates, const std::vector<double>& charges,
+                                    const OpenMM::Vec3* boxVectors, double slabHeight, std::vector<OpenMM::Vec3>& forces) const;
+    double alpha, tolerance;
+    int gridSize[3], reducedGridSize;
+    std::map<int, pme_t> pmeData;
+};
+
+} // namespace NativeNonbondedPlugin
+
+#endif // __ReferenceSlabPME_H__
@@ -0,0 +1,100 @@
+
+/* Portions copyright (c) 2026 Stanford University and Simbios.
+ * Contributors: Pande Group
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __ReferenceTiledAllPairs_H__
+#define __ReferenceTiledAllPairs_H__
+
+#include "internal/windowsExportNativeNonbonded.h"
+#include <cstddef>
+#include <set>
+#include <vector>
+
+namespace NativeNonbondedPlugin {
+
+/**
+ * This class describes how to loop over all pairs of particles in tiles.  Particles are divided into blocks of
+ * TileSize consecutive indices, and a tile is the set of pairs formed between two blocks.  Only tiles on or below
+ * the diagonal are listed, ordered row by row, so that striding through them distributes the work evenly between
+ * threads.  For every tile that contains excluded pairs, or that lies on the diagonal, a bitmask records which
+ * pairs must be skipped, so the loop never needs to search the exclusion lists.
+ *
+ * For small non-periodic systems this is faster than building a neighbor list, even when a cutoff is used.
+ */
+
+class OPENMM_EXPORT_NATIVENONBONDED ReferenceTiledAllPairs {
+public:
+    static const int TileSize = 32;
+    /**
+     * Create a ReferenceTiledAllPairs.
+     *
+     * @param numParticles  the number of particles
+     * @param exclusions    exclusions[i] contains the particles whose interaction with particle i is omitted
+     */
+    ReferenceTiledAllPairs(int numParticles, const std::vector<std::set<int> >& exclusions);
+    /**
+     * Get whether looping over all pairs is expected to be faster than building a neighbor list for a
+     * non-periodic system with a cutoff.
+     */
+    static bool isFasterThanNeighborList(int numParticles);
+    /**
+     * Get the number of particles.
+     */
+    int getNumParticles() const {
+        return numParticles;
+    }
+    /**
+     * Get the number of tiles.
+     */
+    int getNumTiles() const {
+        return tileX.size();
+    }
+    /**
+     * Get the block whose particles are the first particle of each pair in a tile.  This is never less than the
+     * block returned by getTileY().
+     */
+    int getTileX(int tile) const {
+        return tileX[tile];
+    }
+    /**
+     * Get the block whose particles are the second particle of each pair in a tile.
+     */
+    int getTileY(int tile) const {
+        return tileY[tile];
+    }
+    /**
+     * Get the exclusion mask for a tile.  Bit j of element i is set if the pair formed by particle i of
+     * block X and particle j of block Y should be skipped.  This returns NULL if no pair in the tile is skipped.
+     */
+    const unsigned int* getExclusionMask(int tile) const {
+        return (tileMask[tile] == -1 ? NULL : &masks[tileMask[tile]*TileSize]);
+    }
+private:
+    int numParticles;
+    std::vector<int> tileX, tileY, tileMask;
+    std::vector<unsigned int> masks;
+};
+
+} // namespace NativeNonbondedPlugin
+
+#endif // __ReferenceTiledAllPairs_H__
@@ -0,0 +1,390 @@
+/* Portions copyright (c) 2026 Stanford University and Simbios.
+ * Contributors: Pande Group
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include "ReferenceFMM.h"
+#include "openmm/reference/SimTKOpenMMRealType.h"
+#include "openmm/internal/ThreadPool.h"
+#include "openmm/OpenMMException.h"
+
+using std::set;
+using std::vector;
+using namespace NativeNonbondedPlugin;
+using namespace OpenMM;
+
+/**
+ * The expansions use Cartesian multi-indices n = (a, b, c) with |n| = a+b+c <= order.  For a cell centered at
+ * c, the multipole moments are M_n = sum_i q_i (x_i-c)^n/n!, and the potential of its charges at a distant point
+ * x is sum_n (-1)^|n| M_n D_n(x-c), where D_n is a derivative of 1/r.  A local expansion about z represents the
+ * potential as sum_k L_k (x-z)^k.
+ */
+
+ReferenceFMM::ReferenceFMM(int order, int treeDepth) : order(order), treeDepth(treeDepth) {
+    if (order < 1)
+        throw OpenMMException("FMM: The expansion order must be at least 1");
+    if (treeDepth < 0)
+        throw OpenMMException("FMM: The tree depth cannot be negative");
+
+    // Order the terms by total degree, so the terms of degree up to s are the first (s+1)(s+2)(s+3)/6.
+
+    termIndex.resize((order+1)*(order+1)*(order+1), -1);
+    for (int s = 0; s <= order; s++)
+        for (int a = s; a >= 0; a--)
+            for (int b = s-a; b >= 0; b--) {
+                int c = s-a-b;
+                termIndex[(a*(order+1)+b)*(order+1)+c] = termX.size();
+                termX.push_back(a);
+                termY.push_back(b);
+                termZ.push_back(c);
+            }
+    numTerms = termX.size();
+    vector<double> factorial(order+1, 1.0);
+    for (int i = 1; i <= order; i++)
+        factorial[i] = i*factorial[i-1];
+    inverseFactorial.resize(numTerms);
+    for (int t = 0; t < numTerms; t++)
+        inverseFactorial[t] = 1.0/(factorial[termX[t]]*factorial[termY[t]]*factorial[termZ[t]]);
+    binomial.resize((order+1)*(order+1));
+    for (int n = 0; n <= order; n++)
+        for (int k = 0; k <= n; k++)
+            binomial[n*(order+1)+k] = factorial[n]/(factorial[k]*factorial[n-k]);
+    hermite.resize((order+1)*numTerms);
+
+    // Tabulate which derivative each pair of terms contributes to the local expansion in the M2L step.
+
+    termsUpToDegree.resize(order+1);
+    for (int s = 0; s <= order; s++)
+        termsUpToDegree[s] = (s+1)*(s+2)*(s+3)/6;
+    m2lIndex.resize(numTerms*numTerms, -1);
+    for (int k = 0; k < numTerms; k++)
+        for (int n = 0; n < termsUpToDegree[order-termX[k]-termY[k]-termZ[k]]; n++)
+            m2lIndex[k*numTerms+n] = term(termX[n]+termX[k], termY[n]+termY[k], termZ[n]+termZ[k]);
+}
+
+int ReferenceFMM::selectTreeDepth(int numParticles) {
+    int depth = 0;
+    while (64*(1<<(3*depth)) < numParticles)
+        depth++;
+    return depth;
+}
+
+void ReferenceFMM::computePowers(const Vec3& r, vector<double>& powers) const {
+    vector<double> px(order+1), py(order+1), pz(order+1);
+    px[0] = py[0] = pz[0] = 1.0;
+    for (int i = 1; i <= order; i++) {
+        px[i] = px[i-1]*r[0];
+        py[i] = py[i-1]*r[1];
+        pz[i] = pz[i-1]*r[2];
+    }
+    powers.resize(numTerms);
+    for (int t = 0; t < numTerms; t++)
+        powers[t] = px[termX[t]]*py[termY[t]]*pz[termZ[t]];
+}
+
+void ReferenceFMM::computeDerivatives(const Vec3& r, vector<double>& derivatives) {
+    // Evaluate the derivatives of 1/r with the McMurchie-Davidson recurrence.  hermite[j*numTerms+t] holds
+    // the auxiliary quantity R^(j) for term t, whose j=0 values are the derivatives.
+
+    double r2 = r.dot(r);
+    double invR2 = 1.0/r2;
+    double base = 1.0/sqrt(r2);
+    for (int j = 0; j <= order; j++) {
+        hermite[j*numTerms] = base;
+        base *= -(2*j+1)*invR2;
+    }
+    int first = 1;
+    for (int s = 1; s <= order; s++) {
+        int last = first+(s+1)*(s+2)/2;
+        for (int j = 0; j <= order-s; j++) {
+            double* current = &hermite[j*numTerms];
+            const double* next = &hermite[(j+1)*numTerms];
+            for (int t = first; t < last; t++) {
+                int a = termX[t], b = termY[t], c = termZ[t];
+                if (a > 0)
+                    current[t] = r[0]*next[term(a-1, b, c)] + (a > 1 ? (a-1)*next[term(a-2, b, c)] : 0.0);
+                else if (b > 0)
+                    current[t] = r[1]*next[term(a, b-1, c)] + (b > 1 ? (b-1)*next[term(a, b-2, c)] : 0.0);
+                else
+                    current[t] = r[2]*next[term(a, b, c-1)] + (c > 1 ? (c-1)*next[term(a, b, c-2)] : 0.0);
+            }
+        }
+        first = last;
+    }
+    derivatives.assign(hermite.begin(), hermite.begin()+numTerms);
+}
+
+double ReferenceFMM::calculate(const vector<Vec3>& atomCoordinates, const vector<double>& charges,
+                               const vector<set<int> >& exclusions, ThreadPool& threads, vector<Vec3>& forces) {
+    int numParticles = atomCoordinates.size();
+    if (numParticles == 0)
+        return 0.0;
+
+    // Find the cube enclosing all particles and the leaf cell containing each one.
+
+    Vec3 low = atomCoordinates[0], high = atomCoordinates[0];
+    for (int i = 1; i < numParticles; i++)
+        for (int d = 0; d < 3; d++) {
+            low[d] = std::min(low[d], atomCoordinates[i][d]);
+            high[d] = std::max(high[d], atomCoordinates[i][d]);
+        }
+    double width = std::max(high[0]-low[0], std::max(high[1]-low[1], high[2]-low[2]));
+    if (width == 0.0)
+        width = 1.0;
+    int leavesPerSide = 1<<treeDepth;
+    vector<int> leafCoords(3*numParticles);
+    for (int i = 0; i < numParticles; i++)
+        for (int d = 0; d < 3; d++) {
+            int index = (int) ((atomCoordinates[i][d]-low[d])*leavesPerSide/width);
+            leafCoords[3*i+d] = std::max(0, std::min(index, leavesPerSide-1));
+        }
+
+    // Record the occupied cells on every level.  cellSlot maps the index of a cell to its position in the
+    // list of occupied cells, or -1 if it is empty.
+
+    vector<vector<int> > cellSlot(treeDepth+1), cells(treeDepth+1);
+    for (int level = 0; level <= treeDepth; level++) {
+        int side = 1<<level;
+        cellSlot[level].resize(side*side*side, -1);
+        for (int i = 0; i < numParticles; i++) {
+            int shift = treeDepth-level;
+            int key = ((leafCoords[3*i]>>shift)*side + (leafCoords[3*i+1]>>shift))*side + (leafCoords[3*i+2]>>shift);
+            if (cellSlot[level][key] == -1) {
+                cellSlot[level][key] = cells[level].size();
+                cells[level].push_back(key);
+            }
+        }
+    }
+    int numLeaves = cells[treeDepth].size();
+    vector<int> particleLeaf(numParticles), leafStart(numLeaves+1, 0), leafAtoms(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        int key = (leafCoords[3*i]*leavesPerSide + leafCoords[3*i+1])*leavesPerSide + leafCoords[3*i+2];
+        particleLeaf[i] = cellSlot[treeDepth][key];
+        leafStart[particleLeaf[i]+1]++;
+    }
+    for (int i = 0; i < numLeaves; i++)
+        leafStart[i+1] += leafStart[i];
+    vector<int> leafFill(leafStart.begin(), leafStart.end()-1);
+    for (int i = 0; i < numParticles; i++)
+        leafAtoms[leafFill[particleLeaf[i]]++] = i;
+    auto cellCenter = [&] (int level, int key) {
+        int side = 1<<level;
+        return low+Vec3(key/(side*side)+0.5, (key/side)%side+0.5, key%side+0.5)*(width/side);
+    };
+
+    // The far field is only needed once cells can be separated by more than one cell, which starts at level 2.
+
+    double farEnergy = 0.0;
+    vector<Vec3> farForces(numParticles);
+    if (treeDepth >= 2) {
+        vector<vector<double> > multipole(treeDepth+1), local(treeDepth+1);
+        for (int level = 2; level <= treeDepth; level++) {
+            multipole[level].resize(cells[level].size()*numTerms, 0.0);
+            local[level].resize(cells[level].size()*numTerms, 0.0);
+        }
+        vector<double> powers;
+
+        // Compute the multipole moments of the leaves and pass them up the tree.
+
+        for (int i = 0; i < numParticles; i++) {
+            double* m = &multipole[treeDepth][particleLeaf[i]*numTerms];
+            computePowers(atomCoordinates[i]-cellCenter(treeDepth, cells[treeDepth][particleLeaf[i]]), powers);
+            for (int t = 0; t < numTerms; t++)
+                m[t] += charges[i]*powers[t]*inverseFactorial[t];
+        }
+        for (int level = treeDepth; level > 2; level--) {
+            int side = 1<<level;
+            for (int slot = 0; slot < (int) cells[level].size(); slot++) {
+                int key = cells[level][slot];
+                int x = key/(side*side), y = (key/side)%side, z = key%side;
+                int parentKey = ((x>>1)*(side>>1) + (y>>1))*(side>>1) + (z>>1);
+                const double* child = &multipole[level][slot*numTerms];
+                double* parent = &multipole[level-1][cellSlot[level-1][parentKey]*numTerms];
+                computePowers(cellCenter(level, key)-cellCenter(level-1, parentKey), powers);
+                for (int n = 0; n < numTerms; n++)
+                    for (int j = 0; j <= n; j++)
+                        if (termX[j] <= termX[n] && termY[j] <= termY[n] && termZ[j] <= termZ[n]) {
+                            int diff = term(termX[n]-termX[j], termY[n]-termY[j], termZ[n]-termZ[j]);
+                            parent[n] += child[j]*powers[diff]*inverseFactorial[diff];
+                        }
+            }
+        }
+
+        // Convert the multipoles of every cell's interaction list (children of its parent's neighbors that are
+        // not adjacent to it) to local expansions.  The offsets between interacting cells are at most 3 cells,
+        // so the derivatives are tabulated once per level.  The factor (-1)^|n| is applied to the multipoles
+        // in advance.
+
+        for (int level = 2; level <= treeDepth; level++)
+            for (int slot = 0; slot < (int) cells[level].size(); slot++)
+                for (int n = 0; n < numTerms; n++)
+                    if ((termX[n]+termY[n]+termZ[n])%2 == 1)
+                        multipole[level][slot*numTerms+n] *= -1;
+        for (int level = 2; level <= treeDepth; level++) {
+            int side = 1<<level;
+            double cellWidth = width/side;
+            vector<vector<double> > derivatives(343);
+            for (int dx = -3; dx <= 3; dx++)
+                for (int dy = -3; dy <= 3; dy++)
+                    for (int dz = -3; dz <= 3; dz++)
+                        if (abs(dx) > 1 || abs(dy) > 1 || abs(dz) > 1)
+                            computeDerivatives(Vec3(dx, dy, dz)*cellWidth, derivatives[((dx+3)*7+dy+3)*7+dz+3]);
+            for (int slot = 0; slot < (int) cells[level].size(); slot++) {
+                int key = cells[level][slot];
+                int x = key/(side*side), y = (key/side)%side, z = key%side;
+                double* l = &local[level][slot*numTerms];
+                for (int sx = std::max(0, 2*((x>>1)-1)); sx < std::min(side, 2*((x>>1)+2)); sx++)
+                    for (int sy = std::max(0, 2*((y>>1)-1)); sy < std::min(side, 2*((y>>1)+2)); sy++)
+                        for (int sz = std::max(0, 2*((z>>1)-1)); sz < std::min(side, 2*((z>>1)+2)); sz++) {
+                            if (abs(sx-x) <= 1 && abs(sy-y) <= 1 && abs(sz-z) <= 1)
+                                continue;
+                            int sourceSlot = cellSlot[level][(sx*side+sy)*side+sz];
+                            if (sourceSlot == -1)
+                                continue;
+                            const double* m = &multipole[level][sourceSlot*numTerms];
+                            const vector<double>& deriv = derivatives[((x-sx+3)*7+y-sy+3)*7+z-sz+3];
+                            for (int k = 0; k < numTerms; k++) {
+                                const int* index = &m2lIndex[k*numTerms];
+                                int numSourceTerms = termsUpToDegree[order-termX[k]-termY[k]-termZ[k]];
+                                double sum = 0.0;
+                                for (int n = 0; n < numSourceTerms; n++)
+                                    sum += m[n]*deriv[index[n]];
+                                l[k] += sum*inverseFactorial[k];
+                            }
+                        }
+            }
+        }
+
+        // Pass the local expansions down the tree.
+
+        for (int level = 3; level <= treeDepth; level++) {
+            int side = 1<<level;
+            for (int slot = 0; slot < (int) cells[level].size(); slot++) {
+                int key = cells[level][slot];
+                int x = key/(side*side), y = (key/side)%side, z = key%side;
+                int parentKey = ((x>>1)*(side>>1) + (y>>1))*(side>>1) + (z>>1);
+                const double* parent = &local[level-1][cellSlot[level-1][parentKey]*numTerms];
+                double* child = &local[level][slot*numTerms];
+                computePowers(cellCenter(level, key)-cellCenter(level-1, parentKey), powers);
+                for (int j = 0; j < numTerms; j++)
+                    for (int k = j; k < numTerms; k++)
+                        if (termX[j] <= termX[k] && termY[j] <= termY[k] && termZ[j] <= termZ[k]) {
+                            double coeff = binomial[termX[k]*(order+1)+termX[j]]*binomial[termY[k]*(order+1)+termY[j]]*binomial[termZ[k]*(order+1)+termZ[j]];
+                            child[j] += parent[k]*coeff*powers[term(termX[k]-termX[j], termY[k]-termY[j], termZ[k]-termZ[j])];
+                        }
+            }
+        }
+
+        // Evaluate the local expansions at the particles.
+
+        for (int i = 0; i < numParticles; i++) {
+            const double* l = &local[treeDepth][particleLeaf[i]*numTerms];
+            computePowers(atomCoordinates[i]-cellCenter(treeDepth, cells[treeDepth][particleLeaf[i]]), powers);
+            double potential = 0.0;
+            Vec3 gradient;
+            for (int t = 0; t < numTerms; t++) {
+                int a = termX[t], b = termY[t], c = termZ[t];
+                potential += l[t]*powers[t];
+                if (a > 0)
+                    gradient[0] += a*l[t]*powers[term(a-1, b, c)];
+                if (b > 0)
+                    gradient[1] += b*l[t]*powers[term(a, b-1, c)];
+                if (c > 0)
+                    gradient[2] += c*l[t]*powers[term(a, b, c-1)];
+            }
+            farEnergy += 0.5*charges[i]*potential;
+            farForces[i] -= gradient*charges[i];
+        }
+
+        // The far field included any excluded pairs that are not in adjacent leaves, so subtract them.
+
+        for (int i = 0; i < numParticles; i++)
+            for (int j : exclusions[i]) {
+                if (j <= i)
+                    continue;
+                if (abs(leafCoords[3*i]-leafCoords[3*j]) <= 1 && abs(leafCoords[3*i+1]-leafCoords[3*j+1]) <= 1 && abs(leafCoords[3*i+2]-leafCoords[3*j+2]) <= 1)
+                    continue;
+                Vec3 delta = atomCoordinates[i]-atomCoordinates[j];
+                double invR = 1.0/sqrt(delta.dot(delta));
+                double chargeProd = charges[i]*charges[j];
+                farEnergy -= chargeProd*invR;
+                Vec3 force = delta*(chargeProd*invR*invR*invR);
+                farForces[i] -= force;
+                farForces[j] += force;
+            }
+    }
+
+    // Compute the near field directly.  Each thread handles a fixed subset of the leaves, and accumulates
+    // into its own buffer so the result does not depend on timing.
+
+    int numThreads = threads.getNumThreads();
+    vector<vector<Vec3> > threadForces(numThreads, vector<Vec3>(numParticles));
+    vector<double> threadEnergy(numThreads, 0.0);
+    threads.execute([&] (ThreadPool& pool, int threadIndex) {
+        vector<Vec3>& f = threadForces[threadIndex];
+        double energy = 0.0;
+        for (int slot = threadIndex; slot < numLeaves; slot += numThreads) {
+            int key = cells[treeDepth][slot];
+            int side = leavesPerSide;
+            int x = key/(side*side), y = (key/side)%side, z = key%side;
+            for (int nx = std::max(0, x-1); nx <= std::min(side-1, x+1); nx++)
+                for (int ny = std::max(0, y-1); ny <= std::min(side-1, y+1); ny++)
+                    for (int nz = std::max(0, z-1); nz <= std::min(side-1, z+1); nz++) {
+                        int neighborKey = (nx*side+ny)*side+nz;
+                        if (neighborKey < key)
+                            continue;
+                        int neighborSlot = cellSlot[treeDepth][neighborKey];
+                        if (neighborSlot == -1)
+                            continue;
+                        for (int ii = leafStart[slot]; ii < leafStart[slot+1]; ii++) {
+                            int i = leafAtoms[ii];
+                            for (int jj = (neighborKey == key ? ii+1 : leafStart[neighborSlot]); jj < leafStart[neighborSlot+1]; jj++) {
+                                int j = leafAtoms[jj];
+                                if (exclusions[i].find(j) != exclusions[i].end())
+                                    continue;
+                                Vec3 delta = atomCoordinates[i]-atomCoordinates[j];
+                                double invR = 1.0/sqrt(delta.dot(delta));
+                                double chargeProd = charges[i]*charges[j];
+                                energy += chargeProd*invR;
+                                Vec3 force = delta*(chargeProd*invR*invR*invR);
+                                f[i] += force;
+                                f[j] -= force;
+                            }
+                        }
+                    }
+        }
+        threadEnergy[threadIndex] = energy;
+    });
+    threads.waitForThreads();
+
+    double totalEnergy = farEnergy;
+    for (int i = 0; i < numParticles; i++)
+        forces[i] += farForces[i]*ONE_4PI_EPS0;
+    for (int thread = 0; thread < numThreads; thread++) {
+        totalEnergy += threadEnergy[thread];
+        for (int i = 0; i < numParticles; i++)
+            forces[i] += threadForces[thread][i]*ONE_4PI_EPS0;
+    }
+    return totalEnergy*ONE_4PI_EPS0;
+}
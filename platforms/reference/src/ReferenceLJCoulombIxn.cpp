@@ -30,9 +30,15 @@
 
 #include "ReferenceLJCoulombIxn.h"
 #include "ReferencePME.h"
+#include "ReferenceMSM.h"
+#include "ReferenceSlabPME.h"
+#include "ReferenceFMM.h"
+#include "ReferenceTiledAllPairs.h"
 #include "openmm/reference/SimTKOpenMMUtilities.h"
 #include "openmm/reference/ReferenceForce.h"
 #include "openmm/OpenMMException.h"
+#include "openmm/internal/ThreadPool.h"
+#include "sfmt/SFMT.h"
 
 // In case we're using some primitive version of Visual Studio this will
 // make sure that erf() and erfc() are defined.
@@ -49,7 +55,7 @@ using namespace OpenMM;
 
    --------------------------------------------------------------------------------------- */
 
-ReferenceLJCoulombIxn::ReferenceLJCoulombIxn() : cutoff(false), useSwitch(false), periodic(false), periodicExceptions(false), ewald(false), pme(false), ljpme(false) {
+ReferenceLJCoulombIxn::ReferenceLJCoulombIxn() : cutoff(false), useSwitch(false), periodic(false), periodicExceptions(false), ewald(false), pme(false), ljpme(false), msm(false), dsf(false), rbe(false), fmm(false), ips(false), useries(false), slab(false), innerShell(false), includeInnerShell(true), includeOuterShell(true), p3mInfluence(NULL), pmeData(NULL), msmData(NULL), slabPme(NULL), threadPool(NULL), tiles(NULL), numLJTypes(0), ljTypes(NULL), ljTypeTable(NULL), particleClasses(NULL), pairClassStart(NULL), waterMolecules(NULL), waterNeighborList(NULL), waterSize(0) {
 }
 
 /**---------------------------------------------------------------------------------------
@@ -75,11 +81,25 @@ void ReferenceLJCoulombIxn::setUseCutoff(double distance, const OpenMM::Neighbor
 
     cutoff = true;
     cutoffDistance = distance;
+    ljCutoffDistance = distance;
     neighborList = &neighbors;
     krf = pow(cutoffDistance, -3.0)*(solventDielectric-1.0)/(2.0*solventDielectric+1.0);
     crf = (1.0/cutoffDistance)*(3.0*solventDielectric)/(2.0*solventDielectric+1.0);
 }
 
+/**---------------------------------------------------------------------------------------
+
+   Set a different cutoff for the Lennard-Jones interaction.  This requires that a cutoff has
+   already been set, and the neighbor list must extend to the larger of the two cutoffs.
+
+   @param distance            the Lennard-Jones cutoff distance
+
+   --------------------------------------------------------------------------------------- */
+
+void ReferenceLJCoulombIxn::setLJCutoff(double distance) {
+    ljCutoffDistance = distance;
+}
+
 /**---------------------------------------------------------------------------------------
 
    Set the force to use a switching function on the Lennard-Jones interaction.
@@ -168,6 +188,218 @@ void ReferenceLJCoulombIxn::setUseLJPME(double alpha, int meshSize[3]) {
     ljpme = true;
 }
 
+/**---------------------------------------------------------------------------------------
+
+     Set the force to use the P3M method.
+
+     @param alpha     the Ewald separation parameter
+     @param gridSize  the dimensions of the mesh
+     @param influence the cached influence function, which is recomputed when the box changes
+
+     --------------------------------------------------------------------------------------- */
+
+void ReferenceLJCoulombIxn::setUseP3M(double alpha, int meshSize[3], p3m_influence_function& influence) {
+    setUsePME(alpha, meshSize);
+    p3mInfluence = &influence;
+}
+
+/**---------------------------------------------------------------------------------------
+
+     Use a PME object created by the caller, rather than creating a new one for every calculation.
+
+     @param data      the PME object, initialized with the Ewald separation parameter and mesh
+                      dimensions passed to setUsePME()
+
+     --------------------------------------------------------------------------------------- */
+
+void ReferenceLJCoulombIxn::setPMEData(pme_t data) {
+    pmeData = data;
+}
+
+/**---------------------------------------------------------------------------------------
+
+     Treat the system as a slab that is periodic only along x and y.
+
+     @param data       the object that computes the slab reciprocal space interaction
+
+     --------------------------------------------------------------------------------------- */
+
+void ReferenceLJCoulombIxn::setUseSlabCorrection(ReferenceSlabPME& data) {
+    slabPme = &data;
+    slab = true;
+}
+
+/**---------------------------------------------------------------------------------------
+
+     Set the force to use the multilevel summation method (MSM).
+
+     @param data       the MSM object, which is kept from one calculation to the next
+     @param threads    the thread pool used to process the grids
+
+     --------------------------------------------------------------------------------------- */
+
+void ReferenceLJCoulombIxn::setUseMSM(ReferenceMSM& data, ThreadPool& threads) {
+    msmData = &data;
+    msmOrder = data.getOrder();
+    threadPool = &threads;
+    msm = true;
+}
+
+/**---------------------------------------------------------------------------------------
+
+     Set the force to use the damped shifted force (DSF) method for Coulomb interactions.
+
+     @param alpha  the damping parameter
+
+     --------------------------------------------------------------------------------------- */
+
+void ReferenceLJCoulombIxn::setUseDSF(double alpha) {
+    alphaDSF = alpha;
+    dsf = true;
+}
+
+/**---------------------------------------------------------------------------------------
+
+     Set the force to use Random Batch Ewald (RBE) summation.
+
+     @param alpha      the Ewald separation parameter
+     @param batchSize  the number of wave vectors to sample
+     @param random     the random number generator used to sample wave vectors
+
+     --------------------------------------------------------------------------------------- */
+
+void ReferenceLJCoulombIxn::setUseRandomBatchEwald(double alpha, int batchSize, OpenMM_SFMT::SFMT& random) {
+    alphaEwald = alpha;
+    rbeBatchSize = batchSize;
+    rbeRandom = &random;
+    rbe = true;
+}
+
+/**---------------------------------------------------------------------------------------
+
+     Set the force to use the fast multipole method (FMM) for Coulomb interactions.
+
+     @param order      the order of the multipole expansions
+     @param treeDepth  the depth of the octree
+     @param threads    the thread pool used to compute the near field
+
+     --------------------------------------------------------------------------------------- */
+
+void ReferenceLJCoulombIxn::setUseFMM(int order, int treeDepth, ThreadPool& threads) {
+    fmmOrder = order;
+    fmmTreeDepth = treeDepth;
+    threadPool = &threads;
+    fmm = true;
+}
+
+/**---------------------------------------------------------------------------------------
+
+     Set the force to use the isotropic periodic sum (IPS) method for Coulomb and dispersion interactions.
+
+     --------------------------------------------------------------------------------------- */
+
+void ReferenceLJCoulombIxn::setUseIPS() {
+    ips = true;
+}
+
+/**---------------------------------------------------------------------------------------
+
+     Compute direct space interactions by looping over all pairs in tiles.
+
+     @param tiles      describes the tiles and the excluded pairs in each one
+     @param threads    the thread pool used to process the tiles
+
+     --------------------------------------------------------------------------------------- */
+
+void ReferenceLJCoulombIxn::setUseTiledAllPairs(const ReferenceTiledAllPairs& tiles, ThreadPool& threads) {
+    this->tiles = &tiles;
+    threadPool = &threads;
+}
+
+/**---------------------------------------------------------------------------------------
+
+     Take the Lennard-Jones parameters of each pair of atoms from a table of atom types.
+
+     @param numTypes   the number of atom types
+     @param types      the type of each atom
+     @param table      the sigma and 4*epsilon for each pair of types
+
+   --------------------------------------------------------------------------------------- */
+
+void ReferenceLJCoulombIxn::setUseLJTypes(int numTypes, const vector<int>& types, const vector<double>& table) {
+    numLJTypes = numTypes;
+    ljTypes = &types;
+    ljTypeTable = &table;
+}
+
+/**---------------------------------------------------------------------------------------
+
+   Describe which terms each atom takes part in.
+
+   @param classes    for each atom, a combination of HasCoulomb and HasLJ
+   @param start      the index in the neighbor list of the first pair of each class
+
+   --------------------------------------------------------------------------------------- */
+
+void ReferenceLJCoulombIxn::setParticleClasses(const vector<int>& classes, const vector<int>& start) {
+    particleClasses = &classes;
+    pairClassStart = &start;
+}
+
+/**---------------------------------------------------------------------------------------
+
+   Compute the interactions between rigid water molecules from a list of pairs of molecules.
+
+   @param molecules   the index of the first atom of each molecule
+   @param size        the number of atoms in each molecule
+   @param pairs       the pairs of molecules that might interact
+
+   --------------------------------------------------------------------------------------- */
+
+void ReferenceLJCoulombIxn::setWaterMolecules(const vector<int>& molecules, int size, const NeighborList& pairs) {
+    waterMolecules = &molecules;
+    waterSize = size;
+    waterNeighborList = &pairs;
+}
+
+/**---------------------------------------------------------------------------------------
+
+   Split direct space interactions into an inner and an outer shell.
+
+   @param switchingDistance  the distance at which the inner shell starts to be switched off
+   @param cutoffDistance     the distance beyond which pairs belong entirely to the outer shell
+   @param includeInner       true if the inner shell should be included
+   @param includeOuter       true if the outer shell should be included
+
+   --------------------------------------------------------------------------------------- */
+
+void ReferenceLJCoulombIxn::setUseInnerCutoff(double switchingDistance, double cutoffDistance, bool includeInner, bool includeOuter) {
+    innerShell = true;
+    innerSwitchingDistance = switchingDistance;
+    innerCutoffDistance = cutoffDistance;
+    includeInnerShell = includeInner;
+    includeOuterShell = includeOuter;
+}
+
+/**---------------------------------------------------------------------------------------
+
+     Set the force to use the u-series method for Coulomb interactions.
+
+     @param alpha     the inverse width of the narrowest Gaussian computed on the grid
+     @param spacing   the logarithmic spacing between the widths of successive Gaussians
+     @param gridSize  the dimensions of the mesh
+
+     --------------------------------------------------------------------------------------- */
+
+void ReferenceLJCoulombIxn::setUseUSeries(double alpha, double spacing, int meshSize[3]) {
+    alphaEwald = alpha;
+    useriesSpacing = spacing;
+    meshDim[0] = meshSize[0];
+    meshDim[1] = meshSize[1];
+    meshDim[2] = meshSize[2];
+    useries = true;
+}
+
 void ReferenceLJCoulombIxn::setPeriodicExceptions(bool periodic) {
     periodicExceptions = periodic;
 }
@@ -238,34 +470,65 @@ void ReferenceLJCoulombIxn::calculateEwaldIxn(int numberOfAtoms, vector<Vec3>& a
     // **************************************************************************************
     // PME
 
-    if (pme && includeReciprocal) {
-        pme_t          pmedata; /* abstract handle for PME data */
-
-        pme_init(&pmedata,alphaEwald,numberOfAtoms,meshDim,5,1);
+    if (pme && includeReciprocal && slab) {
+        // The grid only needs to leave a gap of one cutoff between periodic copies of the slab.
 
         vector<double> charges(numberOfAtoms);
         for (int i = 0; i < numberOfAtoms; i++)
             charges[i] = atomParameters[i][QIndex];
-        pme_exec(pmedata,atomCoordinates,forces,charges,periodicBoxVectors,&recipEnergy);
-
+        recipEnergy = slabPme->calculate(atomCoordinates, charges, periodicBoxVectors, cutoffDistance, forces);
         if (totalEnergy)
             *totalEnergy += recipEnergy;
+    }
+    else if (pme && includeReciprocal) {
+        pme_t          pmedata; /* abstract handle for PME data */
 
-        pme_destroy(pmedata);
+        if (pmeData != NULL)
+            pmedata = pmeData;
+        else
+            pme_init(&pmedata,alphaEwald,numberOfAtoms,meshDim,5,1);
 
-        if (ljpme) {
-            // Dispersion reciprocal space terms
-            pme_init(&pmedata,alphaDispersionEwald,numberOfAtoms,dispersionMeshDim,5,1);
+        vector<double> charges(numberOfAtoms);
+        for (int i = 0; i < numberOfAtoms; i++)
+            charges[i] = atomParameters[i][QIndex];
+        if (ljpme && meshDim[0] == dispersionMeshDim[0] && meshDim[1] == dispersionMeshDim[1] && meshDim[2] == dispersionMeshDim[2]) {
+            // Both grids have the same dimensions, so pack them into a single complex grid and share the FFTs.
 
-            std::vector<Vec3> dpmeforces(numberOfAtoms);
+            vector<double> c6s(numberOfAtoms);
             for (int i = 0; i < numberOfAtoms; i++)
-                charges[i] = 8.0*pow(atomParameters[i][SigIndex], 3.0) * atomParameters[i][EpsIndex];
-            pme_exec_dpme(pmedata,atomCoordinates,dpmeforces,charges,periodicBoxVectors,&recipDispersionEnergy);
-            for (int i = 0; i < numberOfAtoms; i++)
-                forces[i] += dpmeforces[i];
+                c6s[i] = 8.0*pow(atomParameters[i][SigIndex], 3.0) * atomParameters[i][EpsIndex];
+            pme_exec_packed(pmedata,alphaDispersionEwald,atomCoordinates,forces,charges,c6s,periodicBoxVectors,&recipEnergy,&recipDispersionEnergy);
             if (totalEnergy)
-                *totalEnergy += recipDispersionEnergy;
-            pme_destroy(pmedata);
+                *totalEnergy += recipEnergy + recipDispersionEnergy;
+            if (pmeData == NULL)
+                pme_destroy(pmedata);
+        }
+        else {
+            if (p3mInfluence != NULL)
+                pme_exec_p3m(pmedata,atomCoordinates,forces,charges,periodicBoxVectors,*p3mInfluence,&recipEnergy);
+            else
+                pme_exec(pmedata,atomCoordinates,forces,charges,periodicBoxVectors,&recipEnergy);
+
+            if (totalEnergy)
+                *totalEnergy += recipEnergy;
+
+            if (pmeData == NULL)
+                pme_destroy(pmedata);
+
+            if (ljpme) {
+                // Dispersion reciprocal space terms
+                pme_init(&pmedata,alphaDispersionEwald,numberOfAtoms,dispersionMeshDim,5,1);
+
+                std::vector<Vec3> dpmeforces(numberOfAtoms);
+                for (int i = 0; i < numberOfAtoms; i++)
+                    charges[i] = 8.0*pow(atomParameters[i][SigIndex], 3.0) * atomParameters[i][EpsIndex];
+                pme_exec_dpme(pmedata,atomCoordinates,dpmeforces,charges,periodicBoxVectors,&recipDispersionEnergy);
+                for (int i = 0; i < numberOfAtoms; i++)
+                    forces[i] += dpmeforces[i];
+                if (totalEnergy)
+                    *totalEnergy += recipDispersionEnergy;
+                pme_destroy(pmedata);
+            }
         }
     }
     // Ewald method
@@ -367,6 +630,63 @@ void ReferenceLJCoulombIxn::calculateEwaldIxn(int numberOfAtoms, vector<Vec3>& a
         }
     }
 
+    // Random Batch Ewald
+
+    else if (rbe && includeReciprocal) {
+
+        // The distribution exp(-k^2/4alpha^2) factors into one dimensional distributions for the three
+        // components of the wave vector.  Tabulate their cumulative distributions.
+
+        vector<vector<double> > cdf(3);
+        int maxIndex[3];
+        double totalWeight = 1.0;
+        for (int d = 0; d < 3; d++) {
+            double scale = PI_M/(alphaEwald*periodicBoxVectors[d][d]);
+            maxIndex[d] = (int) ceil(sqrt(40.0)/scale);
+            double sum = 0.0;
+            for (int m = -maxIndex[d]; m <= maxIndex[d]; m++) {
+                sum += exp(-scale*scale*m*m);
+                cdf[d].push_back(sum);
+            }
+            for (double& c : cdf[d])
+                c /= sum;
+            cdf[d].back() = 1.0;
+            totalWeight *= sum;
+        }
+
+        // Sample nonzero wave vectors.  Each one contributes an estimate of the full sum, scaled by the
+        // total weight of all nonzero wave vectors.
+
+        totalWeight -= 1.0;
+        double batchScale = recipCoeff*totalWeight/rbeBatchSize;
+        vector<double> cosTerm(numberOfAtoms), sinTerm(numberOfAtoms);
+        for (int sample = 0; sample < rbeBatchSize; sample++) {
+            int m[3];
+            do {
+                for (int d = 0; d < 3; d++) {
+                    double u = genrand_real2(*rbeRandom);
+                    m[d] = (int) (std::lower_bound(cdf[d].begin(), cdf[d].end(), u)-cdf[d].begin()) - maxIndex[d];
+                }
+            } while (m[0] == 0 && m[1] == 0 && m[2] == 0);
+            Vec3 k(TWO_PI*m[0]/periodicBoxVectors[0][0], TWO_PI*m[1]/periodicBoxVectors[1][1], TWO_PI*m[2]/periodicBoxVectors[2][2]);
+            double cs = 0.0;
+            double ss = 0.0;
+            for (int n = 0; n < numberOfAtoms; n++) {
+                double kr = k.dot(atomCoordinates[n]);
+                cosTerm[n] = atomParameters[n][QIndex]*cos(kr);
+                sinTerm[n] = atomParameters[n][QIndex]*sin(kr);
+                cs += cosTerm[n];
+                ss += sinTerm[n];
+            }
+            double ak = batchScale/k.dot(k);
+            for (int n = 0; n < numberOfAtoms; n++)
+                forces[n] += k*(ak*(cs*sinTerm[n] - ss*cosTerm[n]));
+            totalRecipEnergy += 0.5*ak*(cs*cs + ss*ss);
+        }
+        if (totalEnergy)
+            *totalEnergy += totalRecipEnergy;
+    }
+
     // **************************************************************************************
     // SHORT-RANGE ENERGY AND FORCES
     // **************************************************************************************
@@ -376,89 +696,116 @@ void ReferenceLJCoulombIxn::calculateEwaldIxn(int numberOfAtoms, vector<Vec3>& a
     double totalVdwEnergy            = 0.0f;
     double totalRealSpaceEwaldEnergy = 0.0f;
 
+    // The neighbor list is sorted by the class of each pair, so the terms to compute are the same for a whole
+    // range of pairs.
+
+    for (int pairClass = HasCoulomb; pairClass <= (HasCoulomb | HasLJ); pairClass++) {
+        int start, end;
+        getPairClassRange(pairClass, start, end);
+        for (int pairIndex = start; pairIndex < end; pairIndex++) {
+            int ii = (*neighborList)[pairIndex].first;
+            int jj = (*neighborList)[pairIndex].second;
+
+            double deltaR[2][ReferenceForce::LastDeltaRIndex];
+            ReferenceForce::getDeltaRPeriodic(atomCoordinates[jj], atomCoordinates[ii], periodicBoxVectors, deltaR[0]);
+            double r         = deltaR[0][ReferenceForce::RIndex];
+            double inverseR  = 1.0/(deltaR[0][ReferenceForce::RIndex]);
+
+            // The error function is the most expensive part of the loop, so skip it for pairs that are
+            // missing a charge.
+
+            double dEdR = 0.0;
+            realSpaceEwaldEnergy = 0.0;
+            if ((pairClass & HasCoulomb) && r < cutoffDistance) {
+                double alphaR = alphaEwald * r;
+                double erfcAlphaR = erfc(alphaR);
+                double chargeProd = atomParameters[ii][QIndex]*atomParameters[jj][QIndex];
+                dEdR = ONE_4PI_EPS0 * chargeProd * inverseR * inverseR * inverseR;
+                dEdR = dEdR * (erfcAlphaR + 2 * alphaR * exp (- alphaR * alphaR) / SQRT_PI);
+                realSpaceEwaldEnergy = ONE_4PI_EPS0*chargeProd*inverseR*erfcAlphaR;
+            }
+            vdwEnergy = 0.0;
+            if (pairClass & HasLJ) {
+                double switchValue = 1, switchDeriv = 0;
+                if (useSwitch && r > switchingDistance) {
+                    double t = (r-switchingDistance)/(ljCutoffDistance-switchingDistance);
+                    switchValue = 1+t*t*t*(-10+t*(15-t*6));
+                    switchDeriv = t*t*(-30+t*(60-t*30))/(ljCutoffDistance-switchingDistance);
+                }
+                double sig, eps;
+                getLJParameters(ii, jj, atomParameters, sig, eps);
+                double sig2 = inverseR*sig;
+                sig2 *= sig2;
+                double sig6 = sig2*sig2*sig2;
+                if (r >= ljCutoffDistance)
+                    eps = 0.0;
+                dEdR += switchValue*eps*(12.0*sig6 - 6.0)*sig6*inverseR*inverseR;
+                vdwEnergy = eps*(sig6-1.0)*sig6;
+
+                if (ljpme && r < ljCutoffDistance) {
+                    double dalphaR   = alphaDispersionEwald * r;
+                    double dar2 = dalphaR*dalphaR;
+                    double dar4 = dar2*dar2;
+                    double dar6 = dar4*dar2;
+                    double inverseR2 = inverseR*inverseR;
+                    double c6i = 8.0*pow(atomParameters[ii][SigIndex], 3.0) * atomParameters[ii][EpsIndex];
+                    double c6j = 8.0*pow(atomParameters[jj][SigIndex], 3.0) * atomParameters[jj][EpsIndex];
+                    // For the energies and forces, we first add the regular Lorentz−Berthelot terms.  The C12 term is treated as usual
+                    // but we then subtract out (remembering that the C6 term is negative) the multiplicative C6 term that has been
+                    // computed in real space.  Finally, we add a potential shift term to account for the difference between the LB
+                    // and multiplicative functional forms at the cutoff.
+                    double emult = c6i*c6j*inverseR2*inverseR2*inverseR2*(1.0 - EXP(-dar2) * (1.0 + dar2 + 0.5*dar4));
+                    dEdR += 6.0*c6i*c6j*inverseR2*inverseR2*inverseR2*inverseR2*(1.0 - EXP(-dar2) * (1.0 + dar2 + 0.5*dar4 + dar6/6.0));
+
+                    double inverseCut2 = 1.0/(ljCutoffDistance*ljCutoffDistance);
+                    double inverseCut6 = inverseCut2*inverseCut2*inverseCut2;
+                    sig2 = atomParameters[ii][SigIndex] +  atomParameters[jj][SigIndex];
+                    sig2 *= sig2;
+                    sig6 = sig2*sig2*sig2;
+                    // The additive part of the potential shift
+                    double potentialshift = eps*(1.0-sig6*inverseCut6)*sig6*inverseCut6;
+                    dalphaR   = alphaDispersionEwald * ljCutoffDistance;
+                    dar2 = dalphaR*dalphaR;
+                    dar4 = dar2*dar2;
+                    // The multiplicative part of the potential shift
+                    potentialshift -= c6i*c6j*inverseCut6*(1.0 - EXP(-dar2) * (1.0 + dar2 + 0.5*dar4));
+                    vdwEnergy += emult + potentialshift;
+                }
 
-    for (auto& pair : *neighborList) {
-        int ii = pair.first;
-        int jj = pair.second;
-
-        double deltaR[2][ReferenceForce::LastDeltaRIndex];
-        ReferenceForce::getDeltaRPeriodic(atomCoordinates[jj], atomCoordinates[ii], periodicBoxVectors, deltaR[0]);
-        double r         = deltaR[0][ReferenceForce::RIndex];
-        double inverseR  = 1.0/(deltaR[0][ReferenceForce::RIndex]);
-        double switchValue = 1, switchDeriv = 0;
-        if (useSwitch && r > switchingDistance) {
-            double t = (r-switchingDistance)/(cutoffDistance-switchingDistance);
-            switchValue = 1+t*t*t*(-10+t*(15-t*6));
-            switchDeriv = t*t*(-30+t*(60-t*30))/(cutoffDistance-switchingDistance);
-        }
-        double alphaR = alphaEwald * r;
-
-
-        double dEdR = ONE_4PI_EPS0 * atomParameters[ii][QIndex] * atomParameters[jj][QIndex] * inverseR * inverseR * inverseR;
-        dEdR = dEdR * (erfc(alphaR) + 2 * alphaR * exp (- alphaR * alphaR) / SQRT_PI);
+                if (useSwitch) {
+                    dEdR -= vdwEnergy*switchDeriv*inverseR;
+                    vdwEnergy *= switchValue;
+                }
+            }
+            if (innerShell) {
+                double pairEnergy = realSpaceEwaldEnergy + vdwEnergy;
+                if (!splitDirectSpace(r, dEdR, pairEnergy))
+                    continue;
+                realSpaceEwaldEnergy = pairEnergy;
+                vdwEnergy = 0.0;
+            }
 
-        double sig = atomParameters[ii][SigIndex] +  atomParameters[jj][SigIndex];
-        double sig2 = inverseR*sig;
-        sig2 *= sig2;
-        double sig6 = sig2*sig2*sig2;
-        double eps = atomParameters[ii][EpsIndex]*atomParameters[jj][EpsIndex];
-        dEdR += switchValue*eps*(12.0*sig6 - 6.0)*sig6*inverseR*inverseR;
-        vdwEnergy = eps*(sig6-1.0)*sig6;
-
-        if (ljpme) {
-            double dalphaR   = alphaDispersionEwald * r;
-            double dar2 = dalphaR*dalphaR;
-            double dar4 = dar2*dar2;
-            double dar6 = dar4*dar2;
-            double inverseR2 = inverseR*inverseR;
-            double c6i = 8.0*pow(atomParameters[ii][SigIndex], 3.0) * atomParameters[ii][EpsIndex];
-            double c6j = 8.0*pow(atomParameters[jj][SigIndex], 3.0) * atomParameters[jj][EpsIndex];
-            // For the energies and forces, we first add the regular Lorentz−Berthelot terms.  The C12 term is treated as usual
-            // but we then subtract out (remembering that the C6 term is negative) the multiplicative C6 term that has been
-            // computed in real space.  Finally, we add a potential shift term to account for the difference between the LB
-            // and multiplicative functional forms at the cutoff.
-            double emult = c6i*c6j*inverseR2*inverseR2*inverseR2*(1.0 - EXP(-dar2) * (1.0 + dar2 + 0.5*dar4));
-            dEdR += 6.0*c6i*c6j*inverseR2*inverseR2*inverseR2*inverseR2*(1.0 - EXP(-dar2) * (1.0 + dar2 + 0.5*dar4 + dar6/6.0));
-
-            double inverseCut2 = 1.0/(cutoffDistance*cutoffDistance);
-            double inverseCut6 = inverseCut2*inverseCut2*inverseCut2;
-            sig2 = atomParameters[ii][SigIndex] +  atomParameters[jj][SigIndex];
-            sig2 *= sig2;
-            sig6 = sig2*sig2*sig2;
-            // The additive part of the potential shift
-            double potentialshift = eps*(1.0-sig6*inverseCut6)*sig6*inverseCut6;
-            dalphaR   = alphaDispersionEwald * cutoffDistance;
-            dar2 = dalphaR*dalphaR;
-            dar4 = dar2*dar2;
-            // The multiplicative part of the potential shift
-            potentialshift -= c6i*c6j*inverseCut6*(1.0 - EXP(-dar2) * (1.0 + dar2 + 0.5*dar4));
-            vdwEnergy += emult + potentialshift;
-        }
+            // accumulate forces
 
-        if (useSwitch) {
-            dEdR -= vdwEnergy*switchDeriv*inverseR;
-            vdwEnergy *= switchValue;
-        }
+            for (int kk = 0; kk < 3; kk++) {
+                double force  = dEdR*deltaR[0][kk];
+                forces[ii][kk]   += force;
+                forces[jj][kk]   -= force;
+            }
 
-        // accumulate forces
+            // accumulate energies
 
-        for (int kk = 0; kk < 3; kk++) {
-            double force  = dEdR*deltaR[0][kk];
-            forces[ii][kk]   += force;
-            forces[jj][kk]   -= force;
+            totalVdwEnergy             += vdwEnergy;
+            totalRealSpaceEwaldEnergy  += realSpaceEwaldEnergy;
         }
-
-        // accumulate energies
-
-        realSpaceEwaldEnergy        = ONE_4PI_EPS0*atomParameters[ii][QIndex]*atomParameters[jj][QIndex]*inverseR*erfc(alphaR);
-
-        totalVdwEnergy             += vdwEnergy;
-        totalRealSpaceEwaldEnergy  += realSpaceEwaldEnergy;
-
     }
 
     if (totalEnergy)
         *totalEnergy += totalRealSpaceEwaldEnergy + totalVdwEnergy;
+    if (waterMolecules != NULL)
+        calculateWaterIxn(atomCoordinates, atomParameters, forces, totalEnergy);
+    if (!includeInnerShell)
+        return;
 
     // Now subtract off the exclusions, since they were implicitly included in the reciprocal space sum.
 
@@ -527,7 +874,7 @@ void ReferenceLJCoulombIxn::calculateEwaldIxn(int numberOfAtoms, vector<Vec3>& a
 
 /**---------------------------------------------------------------------------------------
 
-   Calculate LJ Coulomb pair ixn
+   Calculate MSM ixn
 
    @param numberOfAtoms    number of atoms
    @param atomCoordinates  atom coordinates
@@ -537,93 +884,742 @@ void ReferenceLJCoulombIxn::calculateEwaldIxn(int numberOfAtoms, vector<Vec3>& a
    @param forces           force array (forces added)
    @param totalEnergy      total energy
    @param includeDirect      true if direct space interactions should be included
-   @param includeReciprocal  true if reciprocal space interactions should be included
+   @param includeReciprocal  true if the grid based long range interactions should be included
 
    --------------------------------------------------------------------------------------- */
 
-void ReferenceLJCoulombIxn::calculatePairIxn(int numberOfAtoms, vector<Vec3>& atomCoordinates,
-                                             vector<vector<double> >& atomParameters, vector<set<int> >& exclusions,
-                                             vector<Vec3>& forces, double* totalEnergy, bool includeDirect, bool includeReciprocal) const {
+void ReferenceLJCoulombIxn::calculateMSMIxn(int numberOfAtoms, vector<Vec3>& atomCoordinates,
+                                            vector<vector<double> >& atomParameters, vector<set<int> >& exclusions,
+                                            vector<Vec3>& forces, double* totalEnergy, bool includeDirect, bool includeReciprocal) const {
+    // The Coulomb kernel 1/r is split into 1/r-g(r) which vanishes beyond the cutoff, and the smooth
+    // kernel g(r) which is computed on the grids.  The grids include the interaction of each charge with
+    // itself and with the excluded particles, both of which must be removed.
 
-    if (ewald || pme || ljpme) {
-        calculateEwaldIxn(numberOfAtoms, atomCoordinates, atomParameters, exclusions, forces,
-                          totalEnergy, includeDirect, includeReciprocal);
-        return;
+    double g0, dg0;
+    ReferenceMSM::evaluateSmoothing(0.0, cutoffDistance, msmOrder, g0, dg0);
+    if (includeReciprocal) {
+        vector<double> charges(numberOfAtoms);
+        double selfEnergy = 0.0;
+        for (int i = 0; i < numberOfAtoms; i++) {
+            charges[i] = atomParameters[i][QIndex];
+            selfEnergy -= 0.5*ONE_4PI_EPS0*charges[i]*charges[i]*g0;
+        }
+        double recipEnergy = msmData->calculate(atomCoordinates, charges, periodicBoxVectors, *threadPool, forces);
+        if (totalEnergy)
+            *totalEnergy += recipEnergy + selfEnergy;
     }
     if (!includeDirect)
         return;
-    if (cutoff) {
-        for (auto& pair : *neighborList)
-            calculateOneIxn(pair.first, pair.second, atomCoordinates, atomParameters, forces, totalEnergy);
-    }
-    else {
-        for (int ii = 0; ii < numberOfAtoms; ii++) {
-            // loop over atom pairs
 
-            for (int jj = ii+1; jj < numberOfAtoms; jj++)
-                if (exclusions[jj].find(ii) == exclusions[jj].end())
-                    calculateOneIxn(ii, jj, atomCoordinates, atomParameters, forces, totalEnergy);
+    // Short range interactions.
+
+    double totalDirectEnergy = 0.0;
+    for (auto& pair : *neighborList) {
+        int ii = pair.first;
+        int jj = pair.second;
+
+        double deltaR[ReferenceForce::LastDeltaRIndex];
+        ReferenceForce::getDeltaRPeriodic(atomCoordinates[jj], atomCoordinates[ii], periodicBoxVectors, deltaR);
+        double r = deltaR[ReferenceForce::RIndex];
+        double inverseR = 1.0/r;
+        double switchValue = 1, switchDeriv = 0;
+        if (useSwitch && r > switchingDistance) {
+            double t = (r-switchingDistance)/(ljCutoffDistance-switchingDistance);
+            switchValue = 1+t*t*t*(-10+t*(15-t*6));
+            switchDeriv = t*t*(-30+t*(60-t*30))/(ljCutoffDistance-switchingDistance);
+        }
+        double g, dgdr;
+        ReferenceMSM::evaluateSmoothing(r, cutoffDistance, msmOrder, g, dgdr);
+        double prefactor = (r < cutoffDistance ? ONE_4PI_EPS0*atomParameters[ii][QIndex]*atomParameters[jj][QIndex] : 0.0);
+        double dEdR = prefactor*(inverseR*inverseR+dgdr)*inverseR;
+
+        double sig, eps;
+        getLJParameters(ii, jj, atomParameters, sig, eps);
+        double sig2 = inverseR*sig;
+        sig2 *= sig2;
+        double sig6 = sig2*sig2*sig2;
+        if (r >= ljCutoffDistance)
+            eps = 0.0;
+        dEdR += switchValue*eps*(12.0*sig6 - 6.0)*sig6*inverseR*inverseR;
+        double vdwEnergy = eps*(sig6-1.0)*sig6;
+        if (useSwitch) {
+            dEdR -= vdwEnergy*switchDeriv*inverseR;
+            vdwEnergy *= switchValue;
+        }
+        double energy = prefactor*(inverseR-g) + vdwEnergy;
+        if (!splitDirectSpace(r, dEdR, energy))
+            continue;
+        for (int kk = 0; kk < 3; kk++) {
+            double force = dEdR*deltaR[kk];
+            forces[ii][kk] += force;
+            forces[jj][kk] -= force;
         }
+        totalDirectEnergy += energy;
     }
+
+    // Subtract off the smooth part of the excluded interactions.
+
+    for (int i = 0; i < numberOfAtoms && includeInnerShell; i++)
+        for (int exclusion : exclusions[i]) {
+            if (exclusion > i) {
+                int ii = i;
+                int jj = exclusion;
+
+                double deltaR[ReferenceForce::LastDeltaRIndex];
+                if (periodicExceptions)
+                    ReferenceForce::getDeltaRPeriodic(atomCoordinates[jj], atomCoordinates[ii], periodicBoxVectors, deltaR);
+                else
+                    ReferenceForce::getDeltaR(atomCoordinates[jj], atomCoordinates[ii], deltaR);
+                double r = deltaR[ReferenceForce::RIndex];
+                double g, dgdr;
+                ReferenceMSM::evaluateSmoothing(r, cutoffDistance, msmOrder, g, dgdr);
+                double prefactor = ONE_4PI_EPS0*atomParameters[ii][QIndex]*atomParameters[jj][QIndex];
+                if (r > 0.0) {
+                    double dEdR = prefactor*dgdr/r;
+                    for (int kk = 0; kk < 3; kk++) {
+                        double force = dEdR*deltaR[kk];
+                        forces[ii][kk] += force;
+                        forces[jj][kk] -= force;
+                    }
+                }
+                totalDirectEnergy -= prefactor*g;
+            }
+        }
+    if (totalEnergy)
+        *totalEnergy += totalDirectEnergy;
 }
 
 /**---------------------------------------------------------------------------------------
 
-     Calculate LJ Coulomb pair ixn between two atoms
+   Sum the Gaussians of the u-series decomposition of 1/r that are narrower than sigma0, which make up the
+   direct space interaction, or those at least as wide as sigma0, which are computed on the grid.
 
-     @param ii               the index of the first atom
-     @param jj               the index of the second atom
-     @param atomCoordinates  atom coordinates
-     @param atomParameters   atom parameters (charges, c6, c12, ...)     atomParameters[atomIndex][paramterIndex]
-     @param forces           force array (forces added)
-     @param totalEnergy      total energy
+   @param r        the distance
+   @param sigma0   the width of the narrowest long range Gaussian
+   @param spacing  the logarithmic spacing between the widths of successive Gaussians
+   @param value    on exit, the sum of the Gaussians
+   @param deriv    on exit, the derivative of value with respect to r
 
-     --------------------------------------------------------------------------------------- */
+   --------------------------------------------------------------------------------------- */
 
-void ReferenceLJCoulombIxn::calculateOneIxn(int ii, int jj, vector<Vec3>& atomCoordinates,
-                                            vector<vector<double> >& atomParameters, vector<Vec3>& forces,
-                                            double* totalEnergy) const {
-    double deltaR[2][ReferenceForce::LastDeltaRIndex];
+static void evaluateUSeriesShortRange(double r, double sigma0, double spacing, double& value, double& deriv) {
+    // Gaussians narrower than r/8 are below exp(-64) and can be skipped.
 
-    // get deltaR, R2, and R between 2 atoms
+    double ratio = exp(spacing);
+    value = 0.0;
+    deriv = 0.0;
+    for (double sigma = sigma0/ratio; sigma > 0.125*r; sigma /= ratio) {
+        double term = 2*spacing/(sqrt(PI_M)*sigma)*exp(-r*r/(sigma*sigma));
+        value += term;
+        deriv -= 2*r*term/(sigma*sigma);
+    }
+}
+
+static void evaluateUSeriesLongRange(double r, double sigma0, double spacing, double& value, double& deriv) {
+    // Once the weights have decayed by a factor 1e-8, the Gaussians are indistinguishable from 1 at any
+    // distance of interest, so the rest of the series is summed as a geometric series.
+
+    double ratio = exp(spacing);
+    double weight0 = 2*spacing/(sqrt(PI_M)*sigma0);
+    double sigma = sigma0;
+    value = 0.0;
+    deriv = 0.0;
+    for (double weight = weight0; weight > 1e-8*weight0; weight /= ratio, sigma *= ratio) {
+        double term = weight*exp(-r*r/(sigma*sigma));
+        value += term;
+        deriv -= 2*r*term/(sigma*sigma);
+    }
+    value += 2*spacing/(sqrt(PI_M)*sigma)/(1-1/ratio);
+}
+
+/**---------------------------------------------------------------------------------------
+
+   Calculate u-series ixn
+
+   @param numberOfAtoms    number of atoms
+   @param atomCoordinates  atom coordinates
+   @param atomParameters   atom parameters                             atomParameters[atomIndex][paramterIndex]
+   @param exclusions       atom exclusion indices
+                           exclusions[atomIndex] contains the list of exclusions for that atom
+   @param forces           force array (forces added)
+   @param totalEnergy      total energy
+   @param includeDirect      true if direct space interactions should be included
+   @param includeReciprocal  true if the grid based long range interactions should be included
+
+   --------------------------------------------------------------------------------------- */
+
+void ReferenceLJCoulombIxn::calculateUSeriesIxn(int numberOfAtoms, vector<Vec3>& atomCoordinates,
+                                                vector<vector<double> >& atomParameters, vector<set<int> >& exclusions,
+                                                vector<Vec3>& forces, double* totalEnergy, bool includeDirect, bool includeReciprocal) const {
+    // 1/r is approximated by the sum of w_l*exp(-r^2/sigma_l^2), where sigma_l = sigma_0*exp(l*h) and
+    // w_l = 2h/(sqrt(pi)*sigma_l).  The Gaussians with l < 0 vanish beyond the cutoff and make up the direct space
+    // interaction, and those with l >= 0 are computed on the grid.  The grid includes the interaction of each charge
+    // with itself and with the excluded particles, both of which must be removed.
+
+    double sigma0 = 1.0/alphaEwald;
+    if (includeReciprocal) {
+        double g0, dg0;
+        evaluateUSeriesLongRange(0.0, sigma0, useriesSpacing, g0, dg0);
+        vector<double> charges(numberOfAtoms);
+        double selfEnergy = 0.0;
+        for (int i = 0; i < numberOfAtoms; i++) {
+            charges[i] = atomParameters[i][QIndex];
+            selfEnergy -= 0.5*ONE_4PI_EPS0*charges[i]*charges[i]*g0;
+        }
+        pme_t pmedata = pmeData;
+        double recipEnergy = 0.0;
+        if (pmeData == NULL)
+            pme_init(&pmedata, alphaEwald, numberOfAtoms, meshDim, 5, 1);
+        pme_exec_useries(pmedata, useriesSpacing, atomCoordinates, forces, charges, periodicBoxVectors, &recipEnergy);
+        if (pmeData == NULL)
+            pme_destroy(pmedata);
+        if (totalEnergy)
+            *totalEnergy += recipEnergy + selfEnergy;
+    }
+    if (!includeDirect)
+        return;
+
+    // Short range interactions.
+
+    double totalDirectEnergy = 0.0;
+    for (auto& pair : *neighborList) {
+        int ii = pair.first;
+        int jj = pair.second;
+
+        double deltaR[ReferenceForce::LastDeltaRIndex];
+        ReferenceForce::getDeltaRPeriodic(atomCoordinates[jj], atomCoordinates[ii], periodicBoxVectors, deltaR);
+        double r = deltaR[ReferenceForce::RIndex];
+        double inverseR = 1.0/r;
+        double switchValue = 1, switchDeriv = 0;
+        if (useSwitch && r > switchingDistance) {
+            double t = (r-switchingDistance)/(ljCutoffDistance-switchingDistance);
+            switchValue = 1+t*t*t*(-10+t*(15-t*6));
+            switchDeriv = t*t*(-30+t*(60-t*30))/(ljCutoffDistance-switchingDistance);
+        }
+        double g, dgdr;
+        evaluateUSeriesShortRange(r, sigma0, useriesSpacing, g, dgdr);
+        double prefactor = (r < cutoffDistance ? ONE_4PI_EPS0*atomParameters[ii][QIndex]*atomParameters[jj][QIndex] : 0.0);
+        double dEdR = -prefactor*dgdr*inverseR;
+
+        double sig, eps;
+        getLJParameters(ii, jj, atomParameters, sig, eps);
+        double sig2 = inverseR*sig;
+        sig2 *= sig2;
+        double sig6 = sig2*sig2*sig2;
+        if (r >= ljCutoffDistance)
+            eps = 0.0;
+        dEdR += switchValue*eps*(12.0*sig6 - 6.0)*sig6*inverseR*inverseR;
+        double vdwEnergy = eps*(sig6-1.0)*sig6;
+        if (useSwitch) {
+            dEdR -= vdwEnergy*switchDeriv*inverseR;
+            vdwEnergy *= switchValue;
+        }
+        double energy = prefactor*g + vdwEnergy;
+        if (!splitDirectSpace(r, dEdR, energy))
+            continue;
+        for (int kk = 0; kk < 3; kk++) {
+            double force = dEdR*deltaR[kk];
+            forces[ii][kk] += force;
+            forces[jj][kk] -= force;
+        }
+        totalDirectEnergy += energy;
+    }
+
+    // Subtract off the long range part of the excluded interactions.
+
+    for (int i = 0; i < numberOfAtoms && includeInnerShell; i++)
+        for (int exclusion : exclusions[i]) {
+            if (exclusion > i) {
+                int ii = i;
+                int jj = exclusion;
+
+                double deltaR[ReferenceForce::LastDeltaRIndex];
+                if (periodicExceptions)
+                    ReferenceForce::getDeltaRPeriodic(atomCoordinates[jj], atomCoordinates[ii], periodicBoxVectors, deltaR);
+                else
+                    ReferenceForce::getDeltaR(atomCoordinates[jj], atomCoordinates[ii], deltaR);
+                double r = deltaR[ReferenceForce::RIndex];
+                double g, dgdr;
+                evaluateUSeriesLongRange(r, sigma0, useriesSpacing, g, dgdr);
+                double prefactor = ONE_4PI_EPS0*atomParameters[ii][QIndex]*atomParameters[jj][QIndex];
+                if (r > 0.0) {
+                    double dEdR = prefactor*dgdr/r;
+                    for (int kk = 0; kk < 3; kk++) {
+                        double force = dEdR*deltaR[kk];
+                        forces[ii][kk] += force;
+                        forces[jj][kk] -= force;
+                    }
+                }
+                totalDirectEnergy -= prefactor*g;
+            }
+        }
+    if (totalEnergy)
+        *totalEnergy += totalDirectEnergy;
+}
+
+/**---------------------------------------------------------------------------------------
+
+   Calculate DSF ixn
+
+   @param numberOfAtoms    number of atoms
+   @param atomCoordinates  atom coordinates
+   @param atomParameters   atom parameters                             atomParameters[atomIndex][paramterIndex]
+   @param exclusions       atom exclusion indices
+                           exclusions[atomIndex] contains the list of exclusions for that atom
+   @param forces           force array (forces added)
+   @param totalEnergy      total energy
+
+   --------------------------------------------------------------------------------------- */
+
+void ReferenceLJCoulombIxn::calculateDSFIxn(int numberOfAtoms, vector<Vec3>& atomCoordinates,
+                                            vector<vector<double> >& atomParameters, vector<set<int> >& exclusions,
+                                            vector<Vec3>& forces, double* totalEnergy) const {
+    // The pair energy is q1*q2*(erfc(alpha*r)/r - energyShift + forceShift*(r-cutoff)), where the shifts make both
+    // the energy and the force go to zero at the cutoff.
+
+    const double TWO_OVER_SQRT_PI = 2/sqrt(PI_M);
+    double erfcAlphaCutoff = erfc(alphaDSF*cutoffDistance);
+    double energyShift = erfcAlphaCutoff/cutoffDistance;
+    double forceShift = erfcAlphaCutoff/(cutoffDistance*cutoffDistance) +
+            TWO_OVER_SQRT_PI*alphaDSF*exp(-alphaDSF*alphaDSF*cutoffDistance*cutoffDistance)/cutoffDistance;
+
+    // Self energy.
+
+    double totalDSFEnergy = 0.0;
+    for (int i = 0; i < numberOfAtoms && includeInnerShell; i++)
+        totalDSFEnergy -= ONE_4PI_EPS0*atomParameters[i][QIndex]*atomParameters[i][QIndex]*(0.5*energyShift + alphaDSF/sqrt(PI_M));
+
+    // Short range interactions.
+
+    for (auto& pair : *neighborList) {
+        int ii = pair.first;
+        int jj = pair.second;
+
+        double deltaR[ReferenceForce::LastDeltaRIndex];
+        ReferenceForce::getDeltaRPeriodic(atomCoordinates[jj], atomCoordinates[ii], periodicBoxVectors, deltaR);
+        double r = deltaR[ReferenceForce::RIndex];
+        double inverseR = 1.0/r;
+        double switchValue = 1, switchDeriv = 0;
+        if (useSwitch && r > switchingDistance) {
+            double t = (r-switchingDistance)/(ljCutoffDistance-switchingDistance);
+            switchValue = 1+t*t*t*(-10+t*(15-t*6));
+            switchDeriv = t*t*(-30+t*(60-t*30))/(ljCutoffDistance-switchingDistance);
+        }
+        double alphaR = alphaDSF*r;
+        double erfcAlphaR = erfc(alphaR);
+        double prefactor = (r < cutoffDistance ? ONE_4PI_EPS0*atomParameters[ii][QIndex]*atomParameters[jj][QIndex] : 0.0);
+        double dEdR = prefactor*((erfcAlphaR + TWO_OVER_SQRT_PI*alphaR*exp(-alphaR*alphaR))*inverseR*inverseR - forceShift)*inverseR;
+
+        double sig, eps;
+        getLJParameters(ii, jj, atomParameters, sig, eps);
+        double sig2 = inverseR*sig;
+        sig2 *= sig2;
+        double sig6 = sig2*sig2*sig2;
+        if (r >= ljCutoffDistance)
+            eps = 0.0;
+        dEdR += switchValue*eps*(12.0*sig6 - 6.0)*sig6*inverseR*inverseR;
+        double vdwEnergy = eps*(sig6-1.0)*sig6;
+        if (useSwitch) {
+            dEdR -= vdwEnergy*switchDeriv*inverseR;
+            vdwEnergy *= switchValue;
+        }
+        double energy = prefactor*(erfcAlphaR*inverseR - energyShift + forceShift*(r-cutoffDistance)) + vdwEnergy;
+        if (!splitDirectSpace(r, dEdR, energy))
+            continue;
+        for (int kk = 0; kk < 3; kk++) {
+            double force = dEdR*deltaR[kk];
+            forces[ii][kk] += force;
+            forces[jj][kk] -= force;
+        }
+        totalDSFEnergy += energy;
+    }
+
+    // Excluded pairs within the cutoff interact through the damped shifted potential minus the bare Coulomb
+    // interaction, which makes the result consistent with the self energy.
+
+    for (int i = 0; i < numberOfAtoms && includeInnerShell; i++)
+        for (int exclusion : exclusions[i]) {
+            if (exclusion > i) {
+                int ii = i;
+                int jj = exclusion;
+
+                double deltaR[ReferenceForce::LastDeltaRIndex];
+                if (periodicExceptions)
+                    ReferenceForce::getDeltaRPeriodic(atomCoordinates[jj], atomCoordinates[ii], periodicBoxVectors, deltaR);
+                else
+                    ReferenceForce::getDeltaR(atomCoordinates[jj], atomCoordinates[ii], deltaR);
+                double r = deltaR[ReferenceForce::RIndex];
+                if (r >= cutoffDistance)
+                    continue;
+                double prefactor = ONE_4PI_EPS0*atomParameters[ii][QIndex]*atomParameters[jj][QIndex];
+                double alphaR = alphaDSF*r;
+                if (alphaR > 1e-6) {
+                    double inverseR = 1.0/r;
+                    double erfAlphaR = erf(alphaR);
+                    double dEdR = prefactor*(-(erfAlphaR - TWO_OVER_SQRT_PI*alphaR*exp(-alphaR*alphaR))*inverseR*inverseR - forceShift)*inverseR;
+                    for (int kk = 0; kk < 3; kk++) {
+                        double force = dEdR*deltaR[kk];
+                        forces[ii][kk] += force;
+                        forces[jj][kk] -= force;
+                    }
+                    totalDSFEnergy += prefactor*(-erfAlphaR*inverseR - energyShift + forceShift*(r-cutoffDistance));
+                }
+                else
+                    totalDSFEnergy += prefactor*(-TWO_OVER_SQRT_PI*alphaDSF - energyShift - forceShift*cutoffDistance);
+            }
+        }
+    if (totalEnergy)
+        *totalEnergy += totalDSFEnergy;
+}
+
+/**---------------------------------------------------------------------------------------
+
+   Calculate FMM ixn
+
+   @param numberOfAtoms    number of atoms
+   @param atomCoordinates  atom coordinates
+   @param atomParameters   atom parameters                             atomParameters[atomIndex][paramterIndex]
+   @param exclusions       atom exclusion indices
+                           exclusions[atomIndex] contains the list of exclusions for that atom
+   @param forces           force array (forces added)
+   @param totalEnergy      total energy
+
+   --------------------------------------------------------------------------------------- */
+
+void ReferenceLJCoulombIxn::calculateFMMIxn(int numberOfAtoms, vector<Vec3>& atomCoordinates,
+                                            vector<vector<double> >& atomParameters, vector<set<int> >& exclusions,
+                                            vector<Vec3>& forces, double* totalEnergy) const {
+    // The Coulomb interaction between all pairs is computed by the FMM.
+
+    vector<double> charges(numberOfAtoms);
+    for (int i = 0; i < numberOfAtoms; i++)
+        charges[i] = atomParameters[i][QIndex];
+    ReferenceFMM fmmSolver(fmmOrder, fmmTreeDepth);
+    double totalFMMEnergy = fmmSolver.calculate(atomCoordinates, charges, exclusions, *threadPool, forces);
+
+    // The Lennard-Jones interaction is truncated at the cutoff.
+
+    for (auto& pair : *neighborList) {
+        int ii = pair.first;
+        int jj = pair.second;
+
+        double deltaR[ReferenceForce::LastDeltaRIndex];
+        ReferenceForce::getDeltaR(atomCoordinates[jj], atomCoordinates[ii], deltaR);
+        double r = deltaR[ReferenceForce::RIndex];
+        double inverseR = 1.0/r;
+        double switchValue = 1, switchDeriv = 0;
+        if (useSwitch && r > switchingDistance) {
+            double t = (r-switchingDistance)/(ljCutoffDistance-switchingDistance);
+            switchValue = 1+t*t*t*(-10+t*(15-t*6));
+            switchDeriv = t*t*(-30+t*(60-t*30))/(ljCutoffDistance-switchingDistance);
+        }
+        double sig, eps;
+        getLJParameters(ii, jj, atomParameters, sig, eps);
+        double sig2 = inverseR*sig;
+        sig2 *= sig2;
+        double sig6 = sig2*sig2*sig2;
+        if (r >= ljCutoffDistance)
+            eps = 0.0;
+        double dEdR = switchValue*eps*(12.0*sig6 - 6.0)*sig6*inverseR*inverseR;
+        double vdwEnergy = eps*(sig6-1.0)*sig6;
+        if (useSwitch) {
+            dEdR -= vdwEnergy*switchDeriv*inverseR;
+            vdwEnergy *= switchValue;
+        }
+        for (int kk = 0; kk < 3; kk++) {
+            double force = dEdR*deltaR[kk];
+            forces[ii][kk] += force;
+            forces[jj][kk] -= force;
+        }
+        totalFMMEnergy += vdwEnergy;
+    }
+    if (totalEnergy)
+        *totalEnergy += totalFMMEnergy;
+}
+
+/**---------------------------------------------------------------------------------------
+
+   Calculate IPS ixn
+
+   @param numberOfAtoms    number of atoms
+   @param atomCoordinates  atom coordinates
+   @param atomParameters   atom parameters                             atomParameters[atomIndex][paramterIndex]
+   @param exclusions       atom exclusion indices
+                           exclusions[atomIndex] contains the list of exclusions for that atom
+   @param forces           force array (forces added)
+   @param totalEnergy      total energy
+
+   --------------------------------------------------------------------------------------- */
+
+void ReferenceLJCoulombIxn::calculateIPSIxn(int numberOfAtoms, vector<Vec3>& atomCoordinates,
+                                            vector<vector<double> >& atomParameters, vector<set<int> >& exclusions,
+                                            vector<Vec3>& forces, double* totalEnergy) const {
+    // With u = r/cutoff, the Coulomb pair energy is q1*q2*(1/r + (a0 + a1*u^2 + a2*u^4 + a3*u^6)/cutoff) and the
+    // dispersion energy is -C6*(1/r^6 + (b1*u^2 + b2*u^4 + b3*u^6 - b0)/cutoff^6).  The coefficients are those of
+    // Wu and Brooks for a homogeneous isotropic distribution of images, and make both forces vanish at the cutoff.
+
+    const double a0 = -35.0/16.0, a1 = 35.0/16.0, a2 = -21.0/16.0, a3 = 5.0/16.0;
+    const double b1 = 9.0/14.0, b2 = -3.0/28.0, b3 = 6.0/7.0, b0 = 1.0+b1+b2+b3;
+    double invCutoff = 1.0/cutoffDistance;
+    double invCutoff2 = invCutoff*invCutoff;
+    double invLJCutoff2 = 1.0/(ljCutoffDistance*ljCutoffDistance);
+    double invLJCutoff6 = invLJCutoff2*invLJCutoff2*invLJCutoff2;
+
+    // Self energy.
+
+    double totalIPSEnergy = 0.0;
+    for (int i = 0; i < numberOfAtoms && includeInnerShell; i++)
+        totalIPSEnergy += 0.5*ONE_4PI_EPS0*atomParameters[i][QIndex]*atomParameters[i][QIndex]*a0*invCutoff;
+
+    // Short range interactions.
+
+    for (auto& pair : *neighborList) {
+        int ii = pair.first;
+        int jj = pair.second;
+
+        double deltaR[ReferenceForce::LastDeltaRIndex];
+        ReferenceForce::getDeltaRPeriodic(atomCoordinates[jj], atomCoordinates[ii], periodicBoxVectors, deltaR);
+        double r = deltaR[ReferenceForce::RIndex];
+        double inverseR = 1.0/r;
+        double u2 = r*r*invCutoff2;
+        double prefactor = (r < cutoffDistance ? ONE_4PI_EPS0*atomParameters[ii][QIndex]*atomParameters[jj][QIndex] : 0.0);
+        double dEdR = prefactor*(inverseR*inverseR*inverseR - (2*a1 + u2*(4*a2 + u2*6*a3))*invCutoff2*invCutoff);
+        double energy = prefactor*(inverseR + (a0 + u2*(a1 + u2*(a2 + u2*a3)))*invCutoff);
+
+        double v2 = r*r*invLJCutoff2;
+        double sig, eps;
+        getLJParameters(ii, jj, atomParameters, sig, eps);
+        double sig2 = sig*sig;
+        if (r >= ljCutoffDistance)
+            eps = 0.0;
+        double c6 = eps*sig2*sig2*sig2;
+        double inverseR2 = inverseR*inverseR;
+        double inverseR6 = inverseR2*inverseR2*inverseR2;
+        double c12TermR6 = c6*sig2*sig2*sig2*inverseR6;
+        dEdR += (12.0*c12TermR6 - 6.0*c6)*inverseR6*inverseR2 + c6*(2*b1 + v2*(4*b2 + v2*6*b3))*invLJCutoff6*invLJCutoff2;
+        energy += (c12TermR6 - c6)*inverseR6 - c6*(v2*(b1 + v2*(b2 + v2*b3)) - b0)*invLJCutoff6;
+        if (!splitDirectSpace(r, dEdR, energy))
+            continue;
+        for (int kk = 0; kk < 3; kk++) {
+            double force = dEdR*deltaR[kk];
+            forces[ii][kk] += force;
+            forces[jj][kk] -= force;
+        }
+        totalIPSEnergy += energy;
+    }
+
+    // Excluded pairs within the cutoff interact through the Coulomb polynomial alone, which makes the result
+    // consistent with the self energy.
+
+    for (int i = 0; i < numberOfAtoms && includeInnerShell; i++)
+        for (int exclusion : exclusions[i]) {
+            if (exclusion > i) {
+                int ii = i;
+                int jj = exclusion;
+
+                double deltaR[ReferenceForce::LastDeltaRIndex];
+                if (periodicExceptions)
+                    ReferenceForce::getDeltaRPeriodic(atomCoordinates[jj], atomCoordinates[ii], periodicBoxVectors, deltaR);
+                else
+                    ReferenceForce::getDeltaR(atomCoordinates[jj], atomCoordinates[ii], deltaR);
+                double r = deltaR[ReferenceForce::RIndex];
+                if (r >= cutoffDistance)
+                    continue;
+                double u2 = r*r*invCutoff2;
+                double prefactor = ONE_4PI_EPS0*atomParameters[ii][QIndex]*atomParameters[jj][QIndex];
+                double dEdR = -prefactor*(2*a1 + u2*(4*a2 + u2*6*a3))*invCutoff2*invCutoff;
+                for (int kk = 0; kk < 3; kk++) {
+                    double force = dEdR*deltaR[kk];
+                    forces[ii][kk] += force;
+                    forces[jj][kk] -= force;
+                }
+                totalIPSEnergy += prefactor*(a0 + u2*(a1 + u2*(a2 + u2*a3)))*invCutoff;
+            }
+        }
+    if (totalEnergy)
+        *totalEnergy += totalIPSEnergy;
+}
+
+/**---------------------------------------------------------------------------------------
+
+   Multiply the energy of a pair by the weight of the shells that are being computed.  The inner
+   shell has weight 1 up to the inner switching distance and is smoothly switched off at the inner
+   cutoff, and the outer shell has the complementary weight.
+
+   @param r       the distance between the two atoms
+   @param dEdR    the pair force divided by r, which is updated to match the weighted energy
+   @param energy  the pair energy, which is multiplied by the weight
+
+   @return false if the pair has zero weight and can be skipped
+
+   --------------------------------------------------------------------------------------- */
+
+bool ReferenceLJCoulombIxn::splitDirectSpace(double r, double& dEdR, double& energy) const {
+    if (!innerShell || (includeInnerShell && includeOuterShell))
+        return true;
+    double weight = 1, weightDeriv = 0;
+    if (r >= innerCutoffDistance)
+        weight = 0;
+    else if (r > innerSwitchingDistance) {
+        double t = (r-innerSwitchingDistance)/(innerCutoffDistance-innerSwitchingDistance);
+        weight = 1+t*t*t*(-10+t*(15-t*6));
+        weightDeriv = t*t*(-30+t*(60-t*30))/(innerCutoffDistance-innerSwitchingDistance);
+    }
+    if (!includeInnerShell) {
+        weight = 1-weight;
+        weightDeriv = -weightDeriv;
+    }
+    if (weight == 0 && weightDeriv == 0)
+        return false;
+    dEdR = weight*dEdR - weightDeriv*energy/r;
+    energy *= weight;
+    return true;
+}
+
+/**---------------------------------------------------------------------------------------
+
+   Calculate LJ Coulomb pair ixn
+
+   @param numberOfAtoms    number of atoms
+   @param atomCoordinates  atom coordinates
+   @param atomParameters   atom parameters                             atomParameters[atomIndex][paramterIndex]
+   @param exclusions       atom exclusion indices
+                           exclusions[atomIndex] contains the list of exclusions for that atom
+   @param forces           force array (forces added)
+   @param totalEnergy      total energy
+   @param includeDirect      true if direct space interactions should be included
+   @param includeReciprocal  true if reciprocal space interactions should be included
+
+   --------------------------------------------------------------------------------------- */
+
+void ReferenceLJCoulombIxn::calculatePairIxn(int numberOfAtoms, vector<Vec3>& atomCoordinates,
+                                             vector<vector<double> >& atomParameters, vector<set<int> >& exclusions,
+                                             vector<Vec3>& forces, double* totalEnergy, bool includeDirect, bool includeReciprocal) const {
+
+    if (ewald || pme || ljpme || rbe) {
+        calculateEwaldIxn(numberOfAtoms, atomCoordinates, atomParameters, exclusions, forces,
+                          totalEnergy, includeDirect, includeReciprocal);
+        return;
+    }
+    if (msm) {
+        calculateMSMIxn(numberOfAtoms, atomCoordinates, atomParameters, exclusions, forces,
+                        totalEnergy, includeDirect, includeReciprocal);
+        return;
+    }
+    if (useries) {
+        calculateUSeriesIxn(numberOfAtoms, atomCoordinates, atomParameters, exclusions, forces,
+                            totalEnergy, includeDirect, includeReciprocal);
+        return;
+    }
+    if (!includeDirect)
+        return;
+    if (dsf) {
+        calculateDSFIxn(numberOfAtoms, atomCoordinates, atomParameters, exclusions, forces, totalEnergy);
+        return;
+    }
+    if (ips) {
+        calculateIPSIxn(numberOfAtoms, atomCoordinates, atomParameters, exclusions, forces, totalEnergy);
+        return;
+    }
+    if (fmm) {
+        calculateFMMIxn(numberOfAtoms, atomCoordinates, atomParameters, exclusions, forces, totalEnergy);
+        return;
+    }
+    if (tiles != NULL) {
+        calculateTiledIxn(numberOfAtoms, atomCoordinates, atomParameters, forces, totalEnergy);
+        return;
+    }
+    if (cutoff) {
+        for (int pairClass = HasCoulomb; pairClass <= (HasCoulomb | HasLJ); pairClass++) {
+            int start, end;
+            getPairClassRange(pairClass, start, end);
+            for (int i = start; i < end; i++)
+                calculateOneIxn((*neighborList)[i].first, (*neighborList)[i].second, pairClass, atomCoordinates, atomParameters, forces, totalEnergy);
+        }
+        if (waterMolecules != NULL)
+            calculateWaterIxn(atomCoordinates, atomParameters, forces, totalEnergy);
+    }
+    else {
+        for (int ii = 0; ii < numberOfAtoms; ii++) {
+            // loop over atom pairs
+
+            for (int jj = ii+1; jj < numberOfAtoms; jj++) {
+                int pairClass = getPairClass(ii, jj);
+                if (pairClass != 0 && exclusions[jj].find(ii) == exclusions[jj].end())
+                    calculateOneIxn(ii, jj, pairClass, atomCoordinates, atomParameters, forces, totalEnergy);
+            }
+        }
+    }
+}
+
+/**---------------------------------------------------------------------------------------
+
+     Calculate LJ Coulomb pair ixn between two atoms
+
+     @param ii               the index of the first atom
+     @param jj               the index of the second atom
+     @param pairClass        the terms to compute, a combination of HasCoulomb and HasLJ
+     @param atomCoordinates  atom coordinates
+     @param atomParameters   atom parameters (charges, c6, c12, ...)     atomParameters[atomIndex][paramterIndex]
+     @param forces           force array (forces added)
+     @param totalEnergy      total energy
+
+     --------------------------------------------------------------------------------------- */
+
+void ReferenceLJCoulombIxn::calculateOneIxn(int ii, int jj, int pairClass, vector<Vec3>& atomCoordinates,
+                                            vector<vector<double> >& atomParameters, vector<Vec3>& forces,
+                                            double* totalEnergy) const {
+    double deltaR[2][ReferenceForce::LastDeltaRIndex];
+
+    // get deltaR, R2, and R between 2 atoms
 
     if (periodic)
         ReferenceForce::getDeltaRPeriodic(atomCoordinates[jj], atomCoordinates[ii], periodicBoxVectors, deltaR[0]);
     else
         ReferenceForce::getDeltaR(atomCoordinates[jj], atomCoordinates[ii], deltaR[0]);
 
+    double r         = deltaR[0][ReferenceForce::RIndex];
     double r2        = deltaR[0][ReferenceForce::R2Index];
     double inverseR  = 1.0/(deltaR[0][ReferenceForce::RIndex]);
-    double switchValue = 1, switchDeriv = 0;
-    if (useSwitch) {
-        double r = deltaR[0][ReferenceForce::RIndex];
-        if (r > switchingDistance) {
-            double t = (r-switchingDistance)/(cutoffDistance-switchingDistance);
-            switchValue = 1+t*t*t*(-10+t*(15-t*6));
-            switchDeriv = t*t*(-30+t*(60-t*30))/(cutoffDistance-switchingDistance);
+    double dEdR = 0.0, energy = 0.0;
+
+    // Only compute the terms that both atoms take part in.
+
+    if ((pairClass & HasLJ) && (!cutoff || r < ljCutoffDistance)) {
+        double switchValue = 1, switchDeriv = 0;
+        if (useSwitch) {
+            if (r > switchingDistance) {
+                double t = (r-switchingDistance)/(ljCutoffDistance-switchingDistance);
+                switchValue = 1+t*t*t*(-10+t*(15-t*6));
+                switchDeriv = t*t*(-30+t*(60-t*30))/(ljCutoffDistance-switchingDistance);
+            }
+        }
+        double sig, eps;
+        getLJParameters(ii, jj, atomParameters, sig, eps);
+        double sig2 = inverseR*sig;
+        sig2 *= sig2;
+        double sig6 = sig2*sig2*sig2;
+        dEdR = switchValue*eps*(12.0*sig6 - 6.0)*sig6;
+        energy = eps*(sig6-1.0)*sig6;
+        if (useSwitch) {
+            dEdR -= energy*switchDeriv*r;
+            energy *= switchValue;
         }
     }
-    double sig = atomParameters[ii][SigIndex] +  atomParameters[jj][SigIndex];
-    double sig2 = inverseR*sig;
-    sig2 *= sig2;
-    double sig6 = sig2*sig2*sig2;
-
-    double eps = atomParameters[ii][EpsIndex]*atomParameters[jj][EpsIndex];
-    double dEdR = switchValue*eps*(12.0*sig6 - 6.0)*sig6;
-    if (cutoff)
-        dEdR += ONE_4PI_EPS0*atomParameters[ii][QIndex]*atomParameters[jj][QIndex]*(inverseR-2.0f*krf*r2);
-    else
-        dEdR += ONE_4PI_EPS0*atomParameters[ii][QIndex]*atomParameters[jj][QIndex]*inverseR;
-    dEdR     *= inverseR*inverseR;
-    double energy = eps*(sig6-1.0)*sig6;
-    if (useSwitch) {
-        dEdR -= energy*switchDeriv*inverseR;
-        energy *= switchValue;
+    if ((pairClass & HasCoulomb) && (!cutoff || r < cutoffDistance)) {
+        double chargeProd = atomParameters[ii][QIndex]*atomParameters[jj][QIndex];
+        if (cutoff) {
+            dEdR += ONE_4PI_EPS0*chargeProd*(inverseR-2.0f*krf*r2);
+            energy += ONE_4PI_EPS0*chargeProd*(inverseR+krf*r2-crf);
+        }
+        else {
+            dEdR += ONE_4PI_EPS0*chargeProd*inverseR;
+            energy += ONE_4PI_EPS0*chargeProd*inverseR;
+        }
     }
-    if (cutoff)
-        energy += ONE_4PI_EPS0*atomParameters[ii][QIndex]*atomParameters[jj][QIndex]*(inverseR+krf*r2-crf);
-    else
-        energy += ONE_4PI_EPS0*atomParameters[ii][QIndex]*atomParameters[jj][QIndex]*inverseR;
+    dEdR     *= inverseR*inverseR;
+    if (!splitDirectSpace(r, dEdR, energy))
+        return;
 
     // accumulate forces
 
@@ -639,3 +1635,259 @@ void ReferenceLJCoulombIxn::calculateOneIxn(int ii, int jj, vector<Vec3>& atomCo
         *totalEnergy += energy;
 }
 
+/**---------------------------------------------------------------------------------------
+
+     Calculate direct space ixn by looping over all pairs in tiles.  Each tile is processed in
+     two passes: the first computes the interaction with every particle of the other block
+     without any branching, so the compiler can vectorize it, and the second accumulates forces.
+     Excluded pairs and pairs beyond the cutoff are given zero parameters in the first pass.
+     Each tile only computes the terms that some pair in it needs, which is decided from the
+     classes of the particles in its two blocks.
+
+     @param numberOfAtoms    number of atoms
+     @param atomCoordinates  atom coordinates
+     @param atomParameters   atom parameters (charges, c6, c12, ...)     atomParameters[atomIndex][paramterIndex]
+     @param forces           force array (forces added)
+     @param totalEnergy      total energy
+
+     --------------------------------------------------------------------------------------- */
+
+void ReferenceLJCoulombIxn::calculateTiledIxn(int numberOfAtoms, vector<Vec3>& atomCoordinates,
+                                              vector<vector<double> >& atomParameters, vector<Vec3>& forces,
+                                              double* totalEnergy) const {
+    const int TileSize = ReferenceTiledAllPairs::TileSize;
+
+    // Copy positions and parameters into separate arrays so the inner loop reads contiguous memory.
+
+    vector<double> posx(numberOfAtoms), posy(numberOfAtoms), posz(numberOfAtoms);
+    vector<double> sigma(numberOfAtoms), epsilon(numberOfAtoms), charge(numberOfAtoms);
+    for (int i = 0; i < numberOfAtoms; i++) {
+        posx[i] = atomCoordinates[i][0];
+        posy[i] = atomCoordinates[i][1];
+        posz[i] = atomCoordinates[i][2];
+        sigma[i] = atomParameters[i][SigIndex];
+        epsilon[i] = atomParameters[i][EpsIndex];
+        charge[i] = atomParameters[i][QIndex];
+    }
+    double maxCutoff = std::max(cutoffDistance, ljCutoffDistance);
+    double maxCutoff2 = maxCutoff*maxCutoff;
+
+    // Combine the classes of the particles in each block.  A tile needs a term if some particle in each of
+    // its blocks takes part in it.
+
+    int numBlocks = (numberOfAtoms+TileSize-1)/TileSize;
+    vector<int> blockClasses(numBlocks, particleClasses == NULL ? HasCoulomb | HasLJ : 0);
+    if (particleClasses != NULL)
+        for (int i = 0; i < numberOfAtoms; i++)
+            blockClasses[i/TileSize] |= (*particleClasses)[i];
+    int numThreads = threadPool->getNumThreads();
+    int numTiles = tiles->getNumTiles();
+    vector<vector<Vec3> > threadForces(numThreads, vector<Vec3>(numberOfAtoms));
+    vector<double> threadEnergy(numThreads, 0.0);
+    threadPool->execute([&] (ThreadPool& pool, int threadIndex) {
+        vector<Vec3>& f = threadForces[threadIndex];
+        double energySum = 0.0;
+        double dx[TileSize], dy[TileSize], dz[TileSize], dist[TileSize], dEdR[TileSize], pairEnergy[TileSize];
+        for (int tile = threadIndex; tile < numTiles; tile += numThreads) {
+            int tileClass = blockClasses[tiles->getTileX(tile)] & blockClasses[tiles->getTileY(tile)];
+            if (tileClass == 0)
+                continue;
+            bool tileHasLJ = (tileClass & HasLJ) != 0;
+            bool tileHasCoulomb = (tileClass & HasCoulomb) != 0;
+            int x0 = tiles->getTileX(tile)*TileSize;
+            int y0 = tiles->getTileY(tile)*TileSize;
+            int numI = std::min(TileSize, numberOfAtoms-x0);
+            int numJ = std::min(TileSize, numberOfAtoms-y0);
+            const unsigned int* mask = tiles->getExclusionMask(tile);
+            for (int i = 0; i < numI; i++) {
+                int ii = x0+i;
+                unsigned int excluded = (mask == NULL ? 0 : mask[i]);
+                double xi = posx[ii], yi = posy[ii], zi = posz[ii];
+                double sigI = sigma[ii], epsI = epsilon[ii], chargeI = charge[ii];
+                const double* typeRow = (ljTypes == NULL ? NULL : &(*ljTypeTable)[2*numLJTypes*(*ljTypes)[ii]]);
+                for (int j = 0; j < numJ; j++) {
+                    int jj = y0+j;
+                    dx[j] = xi-posx[jj];
+                    dy[j] = yi-posy[jj];
+                    dz[j] = zi-posz[jj];
+                    double r2 = dx[j]*dx[j] + dy[j]*dy[j] + dz[j]*dz[j];
+                    bool include = ((excluded>>j)&1) == 0 && (!cutoff || r2 < maxCutoff2);
+                    r2 = (include ? r2 : 1.0);
+                    double inverseR = 1.0/sqrt(r2);
+                    double r = r2*inverseR;
+                    double force = 0.0, energy = 0.0;
+
+                    // These branches are the same for every pair in the tile, so they do not prevent vectorization.
+
+                    if (tileHasLJ) {
+                        double switchValue = 1, switchDeriv = 0;
+                        if (useSwitch) {
+                            double t = std::max(0.0, (r-switchingDistance)/(ljCutoffDistance-switchingDistance));
+                            switchValue = 1+t*t*t*(-10+t*(15-t*6));
+                            switchDeriv = t*t*(-30+t*(60-t*30))/(ljCutoffDistance-switchingDistance);
+                        }
+                        double sigIJ = sigI+sigma[jj], epsIJ = epsI*epsilon[jj];
+                        if (typeRow != NULL) {
+                            sigIJ = typeRow[2*(*ljTypes)[jj]];
+                            epsIJ = typeRow[2*(*ljTypes)[jj]+1];
+                        }
+                        double sig2 = inverseR*sigIJ;
+                        sig2 *= sig2;
+                        double sig6 = sig2*sig2*sig2;
+                        double eps = (include ? epsIJ : 0.0);
+                        if (cutoff)
+                            eps = (r < ljCutoffDistance ? eps : 0.0);
+                        force = switchValue*eps*(12.0*sig6 - 6.0)*sig6*inverseR*inverseR;
+                        energy = eps*(sig6-1.0)*sig6;
+                        if (useSwitch) {
+                            force -= energy*switchDeriv*inverseR;
+                            energy *= switchValue;
+                        }
+                    }
+                    if (tileHasCoulomb) {
+                        double chargeProd = (include ? chargeI*charge[jj] : 0.0);
+                        if (cutoff) {
+                            chargeProd = (r < cutoffDistance ? chargeProd : 0.0);
+                            force += ONE_4PI_EPS0*chargeProd*(inverseR-2.0f*krf*r2)*inverseR*inverseR;
+                            energy += ONE_4PI_EPS0*chargeProd*(inverseR+krf*r2-crf);
+                        }
+                        else {
+                            force += ONE_4PI_EPS0*chargeProd*inverseR*inverseR*inverseR;
+                            energy += ONE_4PI_EPS0*chargeProd*inverseR;
+                        }
+                    }
+                    dist[j] = r;
+                    dEdR[j] = force;
+                    pairEnergy[j] = energy;
+                }
+                Vec3 forceI;
+                for (int j = 0; j < numJ; j++) {
+                    if (innerShell && !splitDirectSpace(dist[j], dEdR[j], pairEnergy[j]))
+                        continue;
+                    Vec3 force = Vec3(dx[j], dy[j], dz[j])*dEdR[j];
+                    forceI += force;
+                    f[y0+j] -= force;
+                    energySum += pairEnergy[j];
+                }
+                f[ii] += forceI;
+            }
+        }
+        threadEnergy[threadIndex] = energySum;
+    });
+    threadPool->waitForThreads();
+
+    // Sum the contributions from all threads in a fixed order so results are reproducible.
+
+    for (int i = 0; i < numThreads; i++) {
+        for (int j = 0; j < numberOfAtoms; j++)
+            forces[j] += threadForces[i][j];
+        if (totalEnergy)
+            *totalEnergy += threadEnergy[i];
+    }
+}
+
+/**---------------------------------------------------------------------------------------
+
+     Calculate direct space ixn between pairs of water molecules.  All molecules have the same
+     parameters, so the charge product, sigma, and epsilon of every pair of sites are computed
+     once, and pairs of sites that do not interact are dropped.  For each pair of molecules the
+     periodic image is chosen once from the first atom of each one, which gives the correct
+     image for every pair of sites within the cutoff because the box is large enough.  Each pair
+     of molecules is processed in two passes like a tile in calculateTiledIxn().
+
+     @param atomCoordinates  atom coordinates
+     @param atomParameters   atom parameters (charges, c6, c12, ...)     atomParameters[atomIndex][paramterIndex]
+     @param forces           force array (forces added)
+     @param totalEnergy      total energy
+
+     --------------------------------------------------------------------------------------- */
+
+void ReferenceLJCoulombIxn::calculateWaterIxn(vector<Vec3>& atomCoordinates, vector<vector<double> >& atomParameters,
+                                              vector<Vec3>& forces, double* totalEnergy) const {
+    const int MaxSitePairs = 16;
+    if (waterMolecules->size() == 0)
+        return;
+
+    // Build the table of interacting pairs of sites.
+
+    int numSitePairs = 0;
+    int site1[MaxSitePairs], site2[MaxSitePairs];
+    double sitePrefactor[MaxSitePairs], siteSigma[MaxSitePairs], siteEpsilon[MaxSitePairs];
+    int first = (*waterMolecules)[0];
+    for (int i = 0; i < waterSize; i++)
+        for (int j = 0; j < waterSize; j++) {
+            double sig, eps;
+            getLJParameters(first+i, first+j, atomParameters, sig, eps);
+            double prefactor = ONE_4PI_EPS0*atomParameters[first+i][QIndex]*atomParameters[first+j][QIndex];
+            if (prefactor == 0.0 && eps == 0.0)
+                continue;
+            site1[numSitePairs] = i;
+            site2[numSitePairs] = j;
+            sitePrefactor[numSitePairs] = prefactor;
+            siteSigma[numSitePairs] = sig;
+            siteEpsilon[numSitePairs] = eps;
+            numSitePairs++;
+        }
+    bool useEwald = (ewald || pme || rbe);
+    double maxCutoff = std::max(cutoffDistance, ljCutoffDistance);
+    double maxCutoff2 = maxCutoff*maxCutoff;
+    double SQRT_PI = sqrt(PI_M);
+    double totalWaterEnergy = 0.0;
+    Vec3 delta[MaxSitePairs];
+    double dist[MaxSitePairs], dEdR[MaxSitePairs], pairEnergy[MaxSitePairs];
+    for (auto& pair : *waterNeighborList) {
+        int first1 = (*waterMolecules)[pair.first];
+        int first2 = (*waterMolecules)[pair.second];
+        Vec3 shift;
+        if (periodic) {
+            double deltaR[ReferenceForce::LastDeltaRIndex];
+            ReferenceForce::getDeltaRPeriodic(atomCoordinates[first2], atomCoordinates[first1], periodicBoxVectors, deltaR);
+            shift = Vec3(deltaR[0], deltaR[1], deltaR[2]) - (atomCoordinates[first1]-atomCoordinates[first2]);
+        }
+        for (int k = 0; k < numSitePairs; k++) {
+            delta[k] = atomCoordinates[first1+site1[k]] - atomCoordinates[first2+site2[k]] + shift;
+            double r2 = delta[k].dot(delta[k]);
+            bool include = (r2 < maxCutoff2);
+            r2 = (include ? r2 : 1.0);
+            double inverseR = 1.0/sqrt(r2);
+            double r = r2*inverseR;
+            double sig2 = inverseR*siteSigma[k];
+            sig2 *= sig2;
+            double sig6 = sig2*sig2*sig2;
+            double eps = (include && r < ljCutoffDistance ? siteEpsilon[k] : 0.0);
+            double force = eps*(12.0*sig6 - 6.0)*sig6;
+            double energy = eps*(sig6-1.0)*sig6;
+            if (useSwitch) {
+                double t = std::max(0.0, (r-switchingDistance)/(ljCutoffDistance-switchingDistance));
+                double switchValue = 1+t*t*t*(-10+t*(15-t*6));
+                double switchDeriv = t*t*(-30+t*(60-t*30))/(ljCutoffDistance-switchingDistance);
+                force = force*switchValue - energy*switchDeriv*r;
+                energy *= switchValue;
+            }
+            double prefactor = (include && r < cutoffDistance ? sitePrefactor[k] : 0.0);
+            if (useEwald) {
+                double alphaR = alphaEwald*r;
+                double erfcAlphaR = erfc(alphaR);
+                force += prefactor*inverseR*(erfcAlphaR + 2*alphaR*exp(-alphaR*alphaR)/SQRT_PI);
+                energy += prefactor*inverseR*erfcAlphaR;
+            }
+            else {
+                force += prefactor*(inverseR-2.0*krf*r2);
+                energy += prefactor*(inverseR+krf*r2-crf);
+            }
+            dist[k] = r;
+            dEdR[k] = force*inverseR*inverseR;
+            pairEnergy[k] = energy;
+        }
+        for (int k = 0; k < numSitePairs; k++) {
+            if (innerShell && !splitDirectSpace(dist[k], dEdR[k], pairEnergy[k]))
+                continue;
+            Vec3 force = delta[k]*dEdR[k];
+            forces[first1+site1[k]] += force;
+            forces[first2+site2[k]] -= force;
+            totalWaterEnergy += pairEnergy[k];
+        }
+    }
+    if (totalEnergy)
+        *totalEnergy += totalWaterEnergy;
+}
@@ -0,0 +1,483 @@
+
+/* Portions copyright (c) 2026 Stanford University and Simbios.
+ * Contributors: Pande Group
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <cmath>
+#include "ReferenceMSM.h"
+#include "openmm/reference/SimTKOpenMMRealType.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/internal/ThreadPool.h"
+
+// In case we're using some primitive version of Visual Studio this will
+// make sure that erf() and erfc() are defined.
+#include "openmm/internal/MSVC_erfc.h"
+
+using std::vector;
+using namespace NativeNonbondedPlugin;
+using namespace OpenMM;
+
+ReferenceMSM::ReferenceMSM(double cutoff, const int size[3], int numLevels, int order) :
+        cutoff(cutoff), numLevels(numLevels), order(order), hasBox(false) {
+    if (order != 4 && order != 6)
+        throw OpenMMException("MSM: The interpolation order must be 4 or 6");
+    if (numLevels < 1)
+        throw OpenMMException("MSM: The number of levels must be at least 1");
+    int factor = 1<<(numLevels-1);
+    if (size[0]%factor != 0 || size[1]%factor != 0 || size[2]%factor != 0)
+        throw OpenMMException("MSM: The grid dimensions must be divisible by 2^(numLevels-1)");
+    gridSize.resize(numLevels, vector<int>(3));
+    gridCharge.resize(numLevels);
+    gridPotential.resize(numLevels);
+    for (int level = 0; level < numLevels; level++) {
+        for (int i = 0; i < 3; i++)
+            gridSize[level][i] = size[i]>>level;
+        gridCharge[level].resize(gridSize[level][0]*gridSize[level][1]*gridSize[level][2]);
+        gridPotential[level].resize(gridCharge[level].size());
+    }
+    stencils.resize(numLevels-1);
+
+    // A fine grid point at offset j from twice the index of a coarse grid point is
+    // j/2 coarse grid spacings away from it.
+
+    prolongationWeights.resize(2*order-1);
+    for (int j = 1-order; j < order; j++)
+        prolongationWeights[j+order-1] = basis(0.5*j);
+}
+
+void ReferenceMSM::evaluateSmoothing(double r, double a, int order, double& g, double& dgdr) {
+    if (r >= a) {
+        g = 1.0/r;
+        dgdr = -1.0/(r*r);
+        return;
+    }
+    double rho = r/a;
+    double rho2 = rho*rho;
+    if (order == 4) {
+        g = (15.0/8.0 + rho2*(-5.0/4.0 + rho2*(3.0/8.0)))/a;
+        dgdr = rho*(-5.0/2.0 + rho2*(3.0/2.0))/(a*a);
+    }
+    else {
+        g = (35.0/16.0 + rho2*(-35.0/16.0 + rho2*(21.0/16.0 + rho2*(-5.0/16.0))))/a;
+        dgdr = rho*(-35.0/8.0 + rho2*(21.0/4.0 + rho2*(-15.0/8.0)))/(a*a);
+    }
+}
+
+double ReferenceMSM::basis(double t) const {
+    double s = fabs(t);
+    if (order == 4) {
+        if (s <= 1)
+            return (1-s)*(1+s-1.5*s*s);
+        if (s <= 2)
+            return -0.5*(s-1)*(2-s)*(2-s);
+        return 0;
+    }
+    if (s <= 1)
+        return (1-s*s)*(2-s)*(6+s*(3-5*s))/12;
+    if (s <= 2)
+        return -(s-1)*(2-s)*(3-s)*(4+s*(9-5*s))/24;
+    if (s <= 3)
+        return (s-1)*(s-2)*(3-s)*(3-s)*(4-s)/24;
+    return 0;
+}
+
+double ReferenceMSM::basisDerivative(double t) const {
+    double s = fabs(t);
+    double sign = (t < 0 ? -1 : 1);
+    if (order == 4) {
+        if (s <= 1)
+            return sign*s*(-5+4.5*s);
+        if (s <= 2)
+            return -sign*0.5*(2-s)*(4-3*s);
+        return 0;
+    }
+    if (s <= 1)
+        return sign*s*(-25.0/6.0 + s*(5.0/4.0 + s*(13.0/3.0 - s*(25.0/12.0))));
+    if (s <= 2)
+        return sign*(5.0/12.0 + s*(-35.0/4.0 + s*(105.0/8.0 + s*(-13.0/2.0 + s*(25.0/24.0)))));
+    if (s <= 3)
+        return sign*(-29.0/4.0 + s*(155.0/12.0 + s*(-65.0/8.0 + s*(13.0/6.0 - s*(5.0/24.0)))));
+    return 0;
+}
+
+void ReferenceMSM::setPeriodicBox(const Vec3 periodicBoxVectors[3]) {
+    if (hasBox && periodicBoxVectors[0] == boxVectors[0] && periodicBoxVectors[1] == boxVectors[1] && periodicBoxVectors[2] == boxVectors[2])
+        return;
+    hasBox = true;
+    for (int i = 0; i < 3; i++)
+        boxVectors[i] = periodicBoxVectors[i];
+    double determinant = boxVectors[0][0]*boxVectors[1][1]*boxVectors[2][2];
+    double scale = 1.0/determinant;
+    recipBoxVectors[0] = Vec3(boxVectors[1][1]*boxVectors[2][2], 0, 0)*scale;
+    recipBoxVectors[1] = Vec3(-boxVectors[1][0]*boxVectors[2][2], boxVectors[0][0]*boxVectors[2][2], 0)*scale;
+    recipBoxVectors[2] = Vec3(boxVectors[1][0]*boxVectors[2][1]-boxVectors[1][1]*boxVectors[2][0], -boxVectors[0][0]*boxVectors[2][1], boxVectors[0][0]*boxVectors[1][1])*scale;
+    for (int level = 0; level < numLevels-1; level++)
+        computeStencil(level);
+    computeTopKernel();
+}
+
+void ReferenceMSM::computeStencil(int level) {
+    // The kernel at this level is g(r, a_l) - g(r, 2*a_l), which vanishes beyond 2*a_l.  The fractional
+    // coordinate along each box vector is bounded by the distance times the length of the corresponding
+    // reciprocal vector, which bounds the range of grid offsets to consider.
+
+    double a = cutoff*(1<<level);
+    double range = 2*a;
+    const vector<int>& size = gridSize[level];
+    int maxOffset[3];
+    for (int i = 0; i < 3; i++) {
+        Vec3 recip(recipBoxVectors[0][i], recipBoxVectors[1][i], recipBoxVectors[2][i]);
+        maxOffset[i] = (int) ceil(range*size[i]*sqrt(recip.dot(recip)));
+    }
+    vector<StencilPoint>& stencil = stencils[level];
+    stencil.clear();
+    for (int dx = -maxOffset[0]; dx <= maxOffset[0]; dx++)
+        for (int dy = -maxOffset[1]; dy <= maxOffset[1]; dy++)
+            for (int dz = -maxOffset[2]; dz <= maxOffset[2]; dz++) {
+                Vec3 delta = boxVectors[0]*((double) dx/size[0]) + boxVectors[1]*((double) dy/size[1]) + boxVectors[2]*((double) dz/size[2]);
+                double r = sqrt(delta.dot(delta));
+                if (r >= range)
+                    continue;
+                double g1, g2, dgdr;
+                evaluateSmoothing(r, a, order, g1, dgdr);
+                evaluateSmoothing(r, range, order, g2, dgdr);
+                StencilPoint point = {dx, dy, dz, g1-g2};
+                stencil.push_back(point);
+            }
+}
+
+void ReferenceMSM::computeTopKernel() {
+    // The top level kernel g(r, a_top) is summed over all periodic copies.  This is done as an Ewald sum
+    // of 1/r, from which the short range part 1/r - g(r, a_top) is subtracted.  The top grid is small,
+    // so the kernel is tabulated for every displacement between two grid points.  As in the PME
+    // reciprocal space sum, the zero frequency term is omitted.
+
+    int top = numLevels-1;
+    const vector<int>& size = gridSize[top];
+    double aTop = cutoff*(1<<top);
+    double boxLength = 0;
+    double recipLength[3];
+    for (int i = 0; i < 3; i++) {
+        boxLength = std::max(boxLength, sqrt(boxVectors[i].dot(boxVectors[i])));
+        Vec3 recip(recipBoxVectors[0][i], recipBoxVectors[1][i], recipBoxVectors[2][i]);
+        recipLength[i] = sqrt(recip.dot(recip));
+    }
+    double realCutoff = boxLength;
+    double alpha = 5.0/realCutoff;
+    double kmax = 10.0*alpha;
+    double volume = boxVectors[0][0]*boxVectors[1][1]*boxVectors[2][2];
+
+    // Build the list of wave vectors.  Only half of them are needed, since k and -k contribute equally.
+
+    vector<Vec3> waveVectors;
+    vector<double> waveCoefficients;
+    int kRange[3], realRange[3], shortRange[3];
+    for (int i = 0; i < 3; i++) {
+        kRange[i] = (int) ceil(kmax*sqrt(boxVectors[i].dot(boxVectors[i]))/(2*M_PI));
+        realRange[i] = (int) ceil(realCutoff*recipLength[i])+1;
+        shortRange[i] = (int) ceil(aTop*recipLength[i])+1;
+    }
+    for (int nx = 0; nx <= kRange[0]; nx++)
+        for (int ny = (nx == 0 ? 0 : -kRange[1]); ny <= kRange[1]; ny++)
+            for (int nz = (nx == 0 && ny == 0 ? 1 : -kRange[2]); nz <= kRange[2]; nz++) {
+                Vec3 k(nx*recipBoxVectors[0][0], nx*recipBoxVectors[1][0]+ny*recipBoxVectors[1][1], nx*recipBoxVectors[2][0]+ny*recipBoxVectors[2][1]+nz*recipBoxVectors[2][2]);
+                k *= 2*M_PI;
+                double k2 = k.dot(k);
+                if (k2 > kmax*kmax)
+                    continue;
+                waveVectors.push_back(k);
+                waveCoefficients.push_back(2*(4*M_PI/volume)*exp(-k2/(4*alpha*alpha))/k2);
+            }
+
+    // Tabulate the kernel.
+
+    topKernel.resize(gridCharge[top].size());
+    for (int x = 0; x < size[0]; x++)
+        for (int y = 0; y < size[1]; y++)
+            for (int z = 0; z < size[2]; z++) {
+                Vec3 delta = boxVectors[0]*((double) x/size[0]) + boxVectors[1]*((double) y/size[1]) + boxVectors[2]*((double) z/size[2]);
+                double sum = 0;
+                for (int i = 0; i < (int) waveVectors.size(); i++)
+                    sum += waveCoefficients[i]*cos(waveVectors[i].dot(delta));
+                for (int nx = -realRange[0]; nx <= realRange[0]; nx++)
+                    for (int ny = -realRange[1]; ny <= realRange[1]; ny++)
+                        for (int nz = -realRange[2]; nz <= realRange[2]; nz++) {
+                            Vec3 r = delta + boxVectors[0]*nx + boxVectors[1]*ny + boxVectors[2]*nz;
+                            double dist = sqrt(r.dot(r));
+                            if (dist == 0)
+                                sum -= 2*alpha/sqrt(M_PI);
+                            else if (dist < realCutoff)
+                                sum += erfc(alpha*dist)/dist;
+                        }
+                for (int nx = -shortRange[0]; nx <= shortRange[0]; nx++)
+                    for (int ny = -shortRange[1]; ny <= shortRange[1]; ny++)
+                        for (int nz = -shortRange[2]; nz <= shortRange[2]; nz++) {
+                            Vec3 r = delta + boxVectors[0]*nx + boxVectors[1]*ny + boxVectors[2]*nz;
+                            double dist = sqrt(r.dot(r));
+                            if (dist >= aTop)
+                                continue;
+                            double g, dgdr;
+                            evaluateSmoothing(dist, aTop, order, g, dgdr);
+                            if (dist == 0)
+                                sum += g;
+                            else
+                                sum -= 1.0/dist - g;
+                        }
+                topKernel[index(top, x, y, z)] = sum;
+            }
+}
+
+void ReferenceMSM::computeWeights(const Vec3& pos, double* weights, double* derivs, int* gridIndex) const {
+    // Each particle contributes to order^3 grid points, starting at the point base, with weights given by
+    // the nodal basis functions.
+
+    const vector<int>& size = gridSize[0];
+    for (int i = 0; i < 3; i++) {
+        double t = pos[0]*recipBoxVectors[0][i] + pos[1]*recipBoxVectors[1][i] + pos[2]*recipBoxVectors[2][i];
+        t = (t-floor(t))*size[i];
+        int base = (int) floor(t) - order/2 + 1;
+        for (int j = 0; j < order; j++) {
+            weights[i*order+j] = basis(t-(base+j));
+            derivs[i*order+j] = basisDerivative(t-(base+j));
+            gridIndex[i*order+j] = ((base+j)%size[i] + size[i])%size[i];
+        }
+    }
+}
+
+double ReferenceMSM::calculate(const vector<Vec3>& atomCoordinates, const vector<double>& charges,
+                               const Vec3 periodicBoxVectors[3], ThreadPool& threads, vector<Vec3>& forces) {
+    setPeriodicBox(periodicBoxVectors);
+    int numAtoms = atomCoordinates.size();
+    int numThreads = threads.getNumThreads();
+    const vector<int>& size = gridSize[0];
+    int gridPoints = gridCharge[0].size();
+    threadCharge.resize(numThreads);
+
+    // Spread the charges onto the finest grid.  Each thread spreads a fixed subset of the particles onto its
+    // own copy of the grid, and the copies are then summed in a fixed order so the result does not depend
+    // on timing.
+
+    threads.execute([&] (ThreadPool& pool, int threadIndex) {
+        vector<double>& grid = threadCharge[threadIndex];
+        grid.resize(gridPoints);
+        std::fill(grid.begin(), grid.end(), 0.0);
+        vector<double> weights(3*order), derivs(3*order);
+        vector<int> gridIndex(3*order);
+        for (int atom = threadIndex; atom < numAtoms; atom += numThreads) {
+            double q = charges[atom];
+            if (q == 0)
+                continue;
+            computeWeights(atomCoordinates[atom], &weights[0], &derivs[0], &gridIndex[0]);
+            for (int ix = 0; ix < order; ix++)
+                for (int iy = 0; iy < order; iy++) {
+                    double wxy = q*weights[ix]*weights[order+iy];
+                    int base = index(0, gridIndex[ix], gridIndex[order+iy], 0);
+                    for (int iz = 0; iz < order; iz++)
+                        grid[base+gridIndex[2*order+iz]] += wxy*weights[2*order+iz];
+                }
+        }
+    });
+    threads.waitForThreads();
+    vector<double>& charge0 = gridCharge[0];
+    threads.execute([&] (ThreadPool& pool, int threadIndex) {
+        int start = (int) ((long long) gridPoints*threadIndex/numThreads);
+        int end = (int) ((long long) gridPoints*(threadIndex+1)/numThreads);
+        for (int i = start; i < end; i++) {
+            double sum = 0;
+            for (int thread = 0; thread < numThreads; thread++)
+                sum += threadCharge[thread][i];
+            charge0[i] = sum;
+        }
+    });
+    threads.waitForThreads();
+
+    // Restrict the charges to each coarser level.  Every coarse point is a weighted sum of nearby fine
+    // points, so the planes of the coarse grid are divided between the threads.
+
+    for (int level = 1; level < numLevels; level++) {
+        const vector<int>& fineSize = gridSize[level-1];
+        const vector<int>& coarseSize = gridSize[level];
+        const vector<double>& fine = gridCharge[level-1];
+        vector<double>& coarse = gridCharge[level];
+        threads.execute([&] (ThreadPool& pool, int threadIndex) {
+            for (int x = threadIndex; x < coarseSize[0]; x += numThreads)
+                for (int y = 0; y < coarseSize[1]; y++)
+                    for (int z = 0; z < coarseSize[2]; z++) {
+                        double sum = 0;
+                        for (int jx = 1-order; jx < order; jx++) {
+                            double wx = prolongationWeights[jx+order-1];
+                            if (wx == 0)
+                                continue;
+                            int fx = ((2*x+jx)%fineSize[0] + fineSize[0])%fineSize[0];
+                            for (int jy = 1-order; jy < order; jy++) {
+                                double wxy = wx*prolongationWeights[jy+order-1];
+                                if (wxy == 0)
+                                    continue;
+                                int fy = ((2*y+jy)%fineSize[1] + fineSize[1])%fineSize[1];
+                                for (int jz = 1-order; jz < order; jz++) {
+                                    double w = wxy*prolongationWeights[jz+order-1];
+                                    if (w == 0)
+                                        continue;
+                                    int fz = ((2*z+jz)%fineSize[2] + fineSize[2])%fineSize[2];
+                                    sum += w*fine[index(level-1, fx, fy, fz)];
+                                }
+                            }
+                        }
+                        coarse[index(level, x, y, z)] = sum;
+                    }
+        });
+        threads.waitForThreads();
+    }
+
+    // Compute the potential at each level below the top by convolving with the local stencil, and at the
+    // top level by interacting with every other point on the top grid.
+
+    int top = numLevels-1;
+    threads.execute([&] (ThreadPool& pool, int threadIndex) {
+        for (int level = 0; level < top; level++) {
+            const vector<int>& levelSize = gridSize[level];
+            const vector<double>& q = gridCharge[level];
+            vector<double>& potential = gridPotential[level];
+            for (int x = threadIndex; x < levelSize[0]; x += numThreads)
+                for (int y = 0; y < levelSize[1]; y++)
+                    for (int z = 0; z < levelSize[2]; z++) {
+                        double sum = 0;
+                        for (const StencilPoint& point : stencils[level]) {
+                            int sx = ((x+point.dx)%levelSize[0] + levelSize[0])%levelSize[0];
+                            int sy = ((y+point.dy)%levelSize[1] + levelSize[1])%levelSize[1];
+                            int sz = ((z+point.dz)%levelSize[2] + levelSize[2])%levelSize[2];
+                            sum += point.value*q[index(level, sx, sy, sz)];
+                        }
+                        potential[index(level, x, y, z)] = sum;
+                    }
+        }
+        const vector<int>& topSize = gridSize[top];
+        const vector<double>& topCharge = gridCharge[top];
+        vector<double>& topPotential = gridPotential[top];
+        for (int x1 = threadIndex; x1 < topSize[0]; x1 += numThreads)
+            for (int y1 = 0; y1 < topSize[1]; y1++)
+                for (int z1 = 0; z1 < topSize[2]; z1++) {
+                    double sum = 0;
+                    for (int x2 = 0; x2 < topSize[0]; x2++)
+                        for (int y2 = 0; y2 < topSize[1]; y2++)
+                            for (int z2 = 0; z2 < topSize[2]; z2++) {
+                                int dx = (x2-x1+topSize[0])%topSize[0];
+                                int dy = (y2-y1+topSize[1])%topSize[1];
+                                int dz = (z2-z1+topSize[2])%topSize[2];
+                                sum += topKernel[index(top, dx, dy, dz)]*topCharge[index(top, x2, y2, z2)];
+                            }
+                    topPotential[index(top, x1, y1, z1)] = sum;
+                }
+    });
+    threads.waitForThreads();
+
+    // Prolongate the potential from each level to the next finer one.  This is the transpose of restriction.
+    // It is written as a gather, so each thread can handle its own planes of the fine grid: the coarse point
+    // x contributes to the fine point 2*x+j, so the fine point f receives from the coarse point (f-j)/2 for
+    // every offset j of the same parity as f.  The fine grid size is even, so the parity is unaffected by
+    // wrapping.
+
+    for (int level = numLevels-1; level > 0; level--) {
+        const vector<int>& fineSize = gridSize[level-1];
+        const vector<int>& coarseSize = gridSize[level];
+        vector<double>& fine = gridPotential[level-1];
+        const vector<double>& coarse = gridPotential[level];
+        threads.execute([&] (ThreadPool& pool, int threadIndex) {
+            for (int fx = threadIndex; fx < fineSize[0]; fx += numThreads)
+                for (int fy = 0; fy < fineSize[1]; fy++)
+                    for (int fz = 0; fz < fineSize[2]; fz++) {
+                        double sum = 0;
+                        for (int jx = 1-order+((fx+order+1)%2); jx < order; jx += 2) {
+                            double wx = prolongationWeights[jx+order-1];
+                            if (wx == 0)
+                                continue;
+                            int x = (((fx-jx)/2)%coarseSize[0] + coarseSize[0])%coarseSize[0];
+                            for (int jy = 1-order+((fy+order+1)%2); jy < order; jy += 2) {
+                                double wxy = wx*prolongationWeights[jy+order-1];
+                                if (wxy == 0)
+                                    continue;
+                                int y = (((fy-jy)/2)%coarseSize[1] + coarseSize[1])%coarseSize[1];
+                                for (int jz = 1-order+((fz+order+1)%2); jz < order; jz += 2) {
+                                    double w = wxy*prolongationWeights[jz+order-1];
+                                    if (w == 0)
+                                        continue;
+                                    int z = (((fz-jz)/2)%coarseSize[2] + coarseSize[2])%coarseSize[2];
+                                    sum += w*coarse[index(level, x, y, z)];
+                                }
+                            }
+                        }
+                        fine[index(level-1, fx, fy, fz)] += sum;
+                    }
+        });
+        threads.waitForThreads();
+    }
+
+    // Compute the energy, and interpolate the forces from the finest grid.  Each thread handles a fixed
+    // subset of the particles, and a fixed range of grid points for the energy.
+
+    const vector<double>& potential0 = gridPotential[0];
+    vector<double> threadEnergy(numThreads, 0.0);
+    threads.execute([&] (ThreadPool& pool, int threadIndex) {
+        int start = (int) ((long long) gridPoints*threadIndex/numThreads);
+        int end = (int) ((long long) gridPoints*(threadIndex+1)/numThreads);
+        double energy = 0;
+        for (int i = start; i < end; i++)
+            energy += charge0[i]*potential0[i];
+        threadEnergy[threadIndex] = energy;
+        vector<double> weights(3*order), derivs(3*order);
+        vector<int> gridIndex(3*order);
+        for (int atom = threadIndex; atom < numAtoms; atom += numThreads) {
+            double q = charges[atom];
+            if (q == 0)
+                continue;
+            computeWeights(atomCoordinates[atom], &weights[0], &derivs[0], &gridIndex[0]);
+            double dx = 0, dy = 0, dz = 0;
+            for (int ix = 0; ix < order; ix++)
+                for (int iy = 0; iy < order; iy++) {
+                    int base = index(0, gridIndex[ix], gridIndex[order+iy], 0);
+                    double sum = 0, dsum = 0;
+                    for (int iz = 0; iz < order; iz++) {
+                        double value = potential0[base+gridIndex[2*order+iz]];
+                        sum += weights[2*order+iz]*value;
+                        dsum += derivs[2*order+iz]*value;
+                    }
+                    dx += derivs[ix]*weights[order+iy]*sum;
+                    dy += weights[ix]*derivs[order+iy]*sum;
+                    dz += weights[ix]*weights[order+iy]*dsum;
+                }
+
+            // Convert the gradient with respect to grid coordinates to Cartesian coordinates.
+
+            double scale = ONE_4PI_EPS0*q;
+            dx *= scale*size[0];
+            dy *= scale*size[1];
+            dz *= scale*size[2];
+            for (int i = 0; i < 3; i++)
+                forces[atom][i] -= dx*recipBoxVectors[i][0] + dy*recipBoxVectors[i][1] + dz*recipBoxVectors[i][2];
+        }
+    });
+    threads.waitForThreads();
+    double energy = 0;
+    for (int thread = 0; thread < numThreads; thread++)
+        energy += threadEnergy[thread];
+    return 0.5*ONE_4PI_EPS0*energy;
+}
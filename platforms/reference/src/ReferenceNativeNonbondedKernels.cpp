@@ -34,15 +34,20 @@
 #include "internal/NativeNonbondedForceImpl.h"
 #include "openmm/OpenMMException.h"
 #include "openmm/internal/ContextImpl.h"
+#include "openmm/internal/OSRngSeed.h"
 #include "openmm/reference/RealVec.h"
 #include "openmm/reference/ReferencePlatform.h"
 #include "openmm/reference/SimTKOpenMMRealType.h"
 #include "openmm/reference/ReferenceBondForce.h"
 #include "openmm/reference/ReferenceNeighborList.h"
+#include <algorithm>
+#include <cmath>
 #include <cstring>
+#include <limits>
 
 #include "ReferenceLJCoulombIxn.h"
 #include "ReferenceLJCoulomb14.h"
+#include "ReferenceFMM.h"
 
 using namespace NativeNonbondedPlugin;
 using namespace OpenMM;
@@ -66,52 +71,35 @@ static RealVec* extractBoxVectors(ContextImpl& context) {
 ReferenceCalcNativeNonbondedForceKernel::~ReferenceCalcNativeNonbondedForceKernel() {
     if (neighborList != NULL)
         delete neighborList;
+    if (threads != NULL)
+        delete threads;
+    if (tiles != NULL)
+        delete tiles;
+    if (pmeData != NULL)
+        pme_destroy(pmeData);
+    if (msmData != NULL)
+        delete msmData;
+    if (slabPme != NULL)
+        delete slabPme;
+    if (dispersionCorrection != NULL)
+        delete dispersionCorrection;
+    if (waterNeighborList != NULL)
+        delete waterNeighborList;
 }
 
-void ReferenceCalcNativeNonbondedForceKernel::initialize(const System& system, const NativeNonbondedForce& force) {
-
-    // Identify which exceptions are 1-4 interactions.
-
-    set<int> exceptionsWithOffsets;
-    for (int i = 0; i < force.getNumExceptionParameterOffsets(); i++) {
-        string param;
-        int exception;
-        double charge, sigma, epsilon;
-        force.getExceptionParameterOffset(i, param, exception, charge, sigma, epsilon);
-        exceptionsWithOffsets.insert(exception);
-    }
-    numParticles = force.getNumParticles();
-    exclusions.resize(numParticles);
-    vector<int> nb14s;
-    map<int, int> nb14Index;
-    for (int i = 0; i < force.getNumExceptions(); i++) {
-        int particle1, particle2;
-        double chargeProd, sigma, epsilon;
-        force.getExceptionParameters(i, particle1, particle2, chargeProd, sigma, epsilon);
-        exclusions[particle1].insert(particle2);
-        exclusions[particle2].insert(particle1);
-        if (chargeProd != 0.0 || epsilon != 0.0 || exceptionsWithOffsets.find(i) != exceptionsWithOffsets.end()) {
-            nb14Index[i] = nb14s.size();
-            nb14s.push_back(i);
-        }
-    }
+void ReferenceCalcNativeNonbondedForceKernel::initialize(const System& system, const NativeNonbondedForce& force, const vector<vector<int> >& exclusionLists) {
 
     // Build the arrays.
 
-    num14 = nb14s.size();
-    bonded14IndexArray.resize(num14, vector<int>(2));
-    bonded14ParamArray.resize(num14, vector<double>(3));
+    numParticles = force.getNumParticles();
+    setExceptions(force, exclusionLists);
     particleParamArray.resize(numParticles, vector<double>(3));
+    particleClasses.resize(numParticles);
     baseParticleParams.resize(numParticles);
-    baseExceptionParams.resize(num14);
     for (int i = 0; i < numParticles; ++i)
        force.getParticleParameters(i, baseParticleParams[i][0], baseParticleParams[i][1], baseParticleParams[i][2]);
-    for (int i = 0; i < num14; ++i) {
-        int particle1, particle2;
-        force.getExceptionParameters(nb14s[i], particle1, particle2, baseExceptionParams[i][0], baseExceptionParams[i][1], baseExceptionParams[i][2]);
-        bonded14IndexArray[i][0] = particle1;
-        bonded14IndexArray[i][1] = particle2;
-    }
+    numLJTypes = 0;
+    updateLJTypes(force, 0, numParticles-1);
     for (int i = 0; i < force.getNumParticleParameterOffsets(); i++) {
         string param;
         int particle;
@@ -119,15 +107,20 @@ void ReferenceCalcNativeNonbondedForceKernel::initialize(const System& system, c
         force.getParticleParameterOffset(i, param, particle, charge, sigma, epsilon);
         particleParamOffsets[make_pair(param, particle)] = {charge, sigma, epsilon};
     }
-    for (int i = 0; i < force.getNumExceptionParameterOffsets(); i++) {
-        string param;
-        int exception;
-        double charge, sigma, epsilon;
-        force.getExceptionParameterOffset(i, param, exception, charge, sigma, epsilon);
-        exceptionParamOffsets[make_pair(param, nb14Index[exception])] = {charge, sigma, epsilon};
-    }
+    set<string> paramNames;
+    for (auto& offset : particleParamOffsets)
+        paramNames.insert(offset.first.first);
+    for (auto& offset : exceptionParamOffsets)
+        paramNames.insert(offset.first.first);
+    offsetParamNames = vector<string>(paramNames.begin(), paramNames.end());
+    // The cached values start as NaN, so the first evaluation passes every value to the dispersion correction,
+    // which otherwise assumes the default values.
+
+    offsetParamValues.assign(offsetParamNames.size(), numeric_limits<double>::quiet_NaN());
+    parametersChanged = true;
     nonbondedMethod = CalcNativeNonbondedForceKernel::NonbondedMethod(force.getNonbondedMethod());
     nonbondedCutoff = force.getCutoffDistance();
+    ljCutoff = NativeNonbondedForceImpl::getEffectiveLJCutoff(force);
     if (nonbondedMethod == NoCutoff) {
         neighborList = NULL;
         useSwitchingFunction = false;
@@ -137,6 +130,10 @@ void ReferenceCalcNativeNonbondedForceKernel::initialize(const System& system, c
         useSwitchingFunction = force.getUseSwitchingFunction();
         switchingDistance = force.getSwitchingDistance();
     }
+    neighborListSkin = 0.0;
+    innerCutoff = force.getInnerCutoffDistance();
+    innerSwitchingDistance = force.getInnerSwitchingDistance();
+    useSlabCorrection = force.getUseSlabCorrection();
     if (nonbondedMethod == Ewald) {
         double alpha;
         NativeNonbondedForceImpl::calcEwaldParameters(system, force, alpha, kmax[0], kmax[1], kmax[2]);
@@ -155,18 +152,85 @@ void ReferenceCalcNativeNonbondedForceKernel::initialize(const System& system, c
         ewaldDispersionAlpha = alpha;
         useSwitchingFunction = false;
     }
-    if (nonbondedMethod == NoCutoff || nonbondedMethod == CutoffNonPeriodic)
+    else if (nonbondedMethod == P3M) {
+        double alpha;
+        NativeNonbondedForceImpl::calcP3MParameters(system, force, alpha, gridSize[0], gridSize[1], gridSize[2]);
+        ewaldAlpha = alpha;
+    }
+    else if (nonbondedMethod == MSM) {
+        int numLevels;
+        force.getMSMParameters(numLevels, msmOrder);
+        NativeNonbondedForceImpl::calcMSMParameters(system, force, msmLevels, msmGridSize[0], msmGridSize[1], msmGridSize[2]);
+        msmData = new ReferenceMSM(nonbondedCutoff, msmGridSize, msmLevels, msmOrder);
+        threads = new ThreadPool();
+    }
+    else if (nonbondedMethod == DampedShiftedForce)
+        dsfAlpha = force.getDSFAlpha();
+    else if (nonbondedMethod == RandomBatchEwald) {
+        double alpha;
+        NativeNonbondedForceImpl::calcEwaldParameters(system, force, alpha, kmax[0], kmax[1], kmax[2]);
+        ewaldAlpha = alpha;
+        rbeBatchSize = force.getRBEBatchSize();
+        int seed = force.getRandomNumberSeed();
+        if (seed == 0)
+            seed = osrngseed();
+        init_gen_rand(seed, random);
+    }
+    else if (nonbondedMethod == FMM) {
+        force.getFMMParameters(fmmOrder, fmmTreeDepth);
+        if (fmmTreeDepth == 0)
+            fmmTreeDepth = ReferenceFMM::selectTreeDepth(numParticles);
+        threads = new ThreadPool();
+    }
+    else if (nonbondedMethod == IPS)
+        useSwitchingFunction = false;
+    else if (nonbondedMethod == USeries) {
+        double alpha;
+        NativeNonbondedForceImpl::calcUSeriesParameters(system, force, alpha, gridSize[0], gridSize[1], gridSize[2]);
+        ewaldAlpha = alpha;
+        useriesSpacing = NativeNonbondedForceImpl::calcUSeriesSpacing(force.getEwaldErrorTolerance());
+    }
+
+    // Small systems without periodic boundary conditions loop over all pairs in tiles instead of using a neighbor list.
+
+    if (nonbondedMethod == NoCutoff || (nonbondedMethod == CutoffNonPeriodic && ReferenceTiledAllPairs::isFasterThanNeighborList(numParticles))) {
+        tiles = new ReferenceTiledAllPairs(numParticles, exclusions);
+        threads = new ThreadPool();
+    }
+
+    // If requested, record what is needed to choose new grid dimensions when the box volume changes.
+
+    double alpha;
+    int nx, ny, nz;
+    force.getPMEParameters(alpha, nx, ny, nz);
+    autoGridSize = (alpha == 0.0);
+    force.getLJPMEParameters(alpha, nx, ny, nz);
+    autoDispersionGridSize = (alpha == 0.0 && nonbondedMethod == LJPME);
+    ewaldErrorTol = force.getEwaldErrorTolerance();
+    if ((nonbondedMethod == PME || nonbondedMethod == LJPME || nonbondedMethod == P3M || nonbondedMethod == USeries) && (autoGridSize || autoDispersionGridSize))
+        pmeGridResizeThreshold = force.getPMEGridResizeThreshold();
+    else
+        pmeGridResizeThreshold = 0.0;
+    Vec3 boxVectors[3];
+    system.getDefaultPeriodicBoxVectors(boxVectors[0], boxVectors[1], boxVectors[2]);
+    pmeGridVolume = boxVectors[0][0]*boxVectors[1][1]*boxVectors[2][2];
+    if (nonbondedMethod == NoCutoff || nonbondedMethod == CutoffNonPeriodic || nonbondedMethod == FMM)
         exceptionsArePeriodic = false;
     else
         exceptionsArePeriodic = force.getExceptionsUsePeriodicBoundaryConditions();
     rfDielectric = force.getReactionFieldDielectric();
-    if (force.getUseDispersionCorrection())
-        dispersionCoefficient = NativeNonbondedForceImpl::calcDispersionCorrection(system, force);
+    if (force.getUseDispersionCorrection()) {
+        dispersionCorrection = new NativeNonbondedForceImpl::DispersionCorrection(force);
+        dispersionCoefficient = dispersionCorrection->getCoefficient();
+    }
     else
         dispersionCoefficient = 0.0;
+    waterNeighborList = new NeighborList();
+    useWaterNeighborList = false;
+    findWaterMolecules(system);
 }
 
-double ReferenceCalcNativeNonbondedForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy, bool includeDirect, bool includeReciprocal) {
+double ReferenceCalcNativeNonbondedForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy, bool includeDirect, bool includeReciprocal, bool includeOuterShell) {
     computeParameters(context);
     vector<Vec3>& posData = extractPositions(context);
     vector<Vec3>& forceData = extractForces(context);
@@ -176,29 +240,111 @@ double ReferenceCalcNativeNonbondedForceKernel::execute(ContextImpl& context, bo
     bool ewald  = (nonbondedMethod == Ewald);
     bool pme  = (nonbondedMethod == PME);
     bool ljpme = (nonbondedMethod == LJPME);
+    bool msm = (nonbondedMethod == MSM);
+    bool dsf = (nonbondedMethod == DampedShiftedForce);
+    bool rbe = (nonbondedMethod == RandomBatchEwald);
+    bool p3m = (nonbondedMethod == P3M);
+    bool fmm = (nonbondedMethod == FMM);
+    bool ips = (nonbondedMethod == IPS);
+    bool useries = (nonbondedMethod == USeries);
     if (nonbondedMethod != NoCutoff) {
-        computeNeighborListVoxelHash(*neighborList, numParticles, posData, exclusions, extractBoxVectors(context), periodic || ewald || pme || ljpme, nonbondedCutoff, 0.0);
+        Vec3* boxVectors = extractBoxVectors(context);
+        if (tiles == NULL && !neighborListIsValid(posData, boxVectors)) {
+            // Build the list with a margin beyond the cutoff, so it can be reused until some particle has moved
+            // by half the margin.  Every pair loop checks the distance against the cutoff, so the extra pairs
+            // contribute nothing.
+
+            bool periodicList = (periodic || ewald || pme || ljpme || msm || dsf || rbe || p3m || ips || useries);
+            double maxCutoff = max(nonbondedCutoff, ljCutoff);
+            neighborListSkin = 0.1*maxCutoff;
+            if (periodicList)
+                neighborListSkin = min(neighborListSkin, 0.5*min(boxVectors[0][0], min(boxVectors[1][1], boxVectors[2][2]))-maxCutoff);
+            if (neighborListSkin < 0.0)
+                neighborListSkin = 0.0;
+            computeNeighborListVoxelHash(*neighborList, numParticles, posData, exclusions, boxVectors, periodicList, maxCutoff+neighborListSkin, 0.0);
+            useWaterNeighborList = (waterMolecules.size() > 1 && buildWaterNeighborList(posData, boxVectors, periodicList, maxCutoff+neighborListSkin));
+            sortNeighborListByClass();
+            neighborListPositions = posData;
+            for (int i = 0; i < 3; i++)
+                neighborListBoxVectors[i] = boxVectors[i];
+        }
         clj.setUseCutoff(nonbondedCutoff, *neighborList, rfDielectric);
+        clj.setLJCutoff(ljCutoff);
     }
-    if (periodic || ewald || pme || ljpme) {
+    if (periodic || ewald || pme || ljpme || msm || dsf || rbe || p3m || ips || useries) {
         Vec3* boxVectors = extractBoxVectors(context);
-        double minAllowedSize = 1.999999*nonbondedCutoff;
+        double minAllowedSize = 1.999999*max(nonbondedCutoff, ljCutoff);
         if (boxVectors[0][0] < minAllowedSize || boxVectors[1][1] < minAllowedSize || boxVectors[2][2] < minAllowedSize)
             throw OpenMMException("The periodic box size has decreased to less than twice the nonbonded cutoff.");
         clj.setPeriodic(boxVectors);
         clj.setPeriodicExceptions(exceptionsArePeriodic);
+        if (pmeGridResizeThreshold > 0.0) {
+            double volume = boxVectors[0][0]*boxVectors[1][1]*boxVectors[2][2];
+            if (fabs(volume-pmeGridVolume) > pmeGridResizeThreshold*pmeGridVolume)
+                resizePmeGrids(boxVectors);
+        }
+    }
+    if ((pme && !useSlabCorrection) || ljpme || p3m || useries) {
+        // Creating the PME object allocates the grid and computes the B-spline moduli, so keep it until the
+        // grid dimensions change.
+
+        if (pmeData == NULL || pmeDataGridSize[0] != gridSize[0] || pmeDataGridSize[1] != gridSize[1] || pmeDataGridSize[2] != gridSize[2]) {
+            if (pmeData != NULL)
+                pme_destroy(pmeData);
+            pme_init(&pmeData, ewaldAlpha, numParticles, gridSize, 5, 1);
+            for (int i = 0; i < 3; i++)
+                pmeDataGridSize[i] = gridSize[i];
+        }
+        clj.setPMEData(pmeData);
+    }
+    if (pme && useSlabCorrection && (slabPme == NULL || !slabPme->hasGridSize(gridSize))) {
+        // The slab calculation keeps a PME object for each height of the truncated grid, so likewise keep it
+        // until the grid dimensions change.
+
+        if (slabPme != NULL)
+            delete slabPme;
+        slabPme = new ReferenceSlabPME(ewaldAlpha, gridSize, ewaldErrorTol);
     }
     if (ewald)
         clj.setUseEwald(ewaldAlpha, kmax[0], kmax[1], kmax[2]);
-    if (pme)
+    if (pme) {
         clj.setUsePME(ewaldAlpha, gridSize);
+        if (useSlabCorrection)
+            clj.setUseSlabCorrection(*slabPme);
+    }
     if (ljpme){
         clj.setUsePME(ewaldAlpha, gridSize);
         clj.setUseLJPME(ewaldDispersionAlpha, dispersionGridSize);
     }
+    if (p3m)
+        clj.setUseP3M(ewaldAlpha, gridSize, p3mInfluence);
+    if (msm)
+        clj.setUseMSM(*msmData, *threads);
+    if (dsf)
+        clj.setUseDSF(dsfAlpha);
+    if (rbe)
+        clj.setUseRandomBatchEwald(ewaldAlpha, rbeBatchSize, random);
+    if (fmm)
+        clj.setUseFMM(fmmOrder, fmmTreeDepth, *threads);
+    if (ips)
+        clj.setUseIPS();
+    if (useries)
+        clj.setUseUSeries(ewaldAlpha, useriesSpacing, gridSize);
+    if (tiles != NULL)
+        clj.setUseTiledAllPairs(*tiles, *threads);
+    if (numLJTypes > 0)
+        clj.setUseLJTypes(numLJTypes, ljTypes, ljTypeTable);
+    clj.setParticleClasses(particleClasses, pairClassStart);
+    if (useWaterNeighborList)
+        clj.setWaterMolecules(waterMolecules, waterSize, *waterNeighborList);
     if (useSwitchingFunction)
         clj.setUseSwitchingFunction(switchingDistance);
-    clj.calculatePairIxn(numParticles, posData, particleParamArray, exclusions, forceData, includeEnergy ? &energy : NULL, includeDirect, includeReciprocal);
+    bool includePairs = includeDirect;
+    if (innerCutoff > 0.0) {
+        clj.setUseInnerCutoff(innerSwitchingDistance, innerCutoff, includeDirect, includeOuterShell);
+        includePairs = includeDirect || includeOuterShell;
+    }
+    clj.calculatePairIxn(numParticles, posData, particleParamArray, exclusions, forceData, includeEnergy ? &energy : NULL, includePairs, includeReciprocal);
     if (includeDirect) {
         ReferenceBondForce refBondForce;
         ReferenceLJCoulomb14 nonbonded14;
@@ -207,7 +353,7 @@ double ReferenceCalcNativeNonbondedForceKernel::execute(ContextImpl& context, bo
             nonbonded14.setPeriodic(boxVectors);
         }
         refBondForce.calculateForce(num14, bonded14IndexArray, posData, bonded14ParamArray, forceData, includeEnergy ? &energy : NULL, nonbonded14);
-        if (periodic || ewald || pme) {
+        if (periodic || ewald || pme || msm || dsf || rbe || p3m || useries) {
             Vec3* boxVectors = extractBoxVectors(context);
             energy += dispersionCoefficient/(boxVectors[0][0]*boxVectors[1][1]*boxVectors[2][2]);
         }
@@ -215,10 +361,127 @@ double ReferenceCalcNativeNonbondedForceKernel::execute(ContextImpl& context, bo
     return energy;
 }
 
-void ReferenceCalcNativeNonbondedForceKernel::copyParametersToContext(ContextImpl& context, const NativeNonbondedForce& force) {
+void ReferenceCalcNativeNonbondedForceKernel::copyParametersToContext(ContextImpl& context, const NativeNonbondedForce& force, int firstParticle, int lastParticle, int firstException, int lastException) {
     if (force.getNumParticles() != numParticles)
         throw OpenMMException("updateParametersInContext: The number of particles has changed");
+    NativeNonbondedForceImpl::checkLJTypes(force);
+
+    // If exceptions have been added, have changed which particles they involve, or have switched between being
+    // excluded and being computed, rebuild everything that depends on them.  Everything is checked before any
+    // state is changed, so an update that throws an exception leaves the kernel as it was.
+
+    set<int> exceptionsWithOffsets;
+    set<string> exceptionOffsetParams;
+    for (int i = 0; i < force.getNumExceptionParameterOffsets(); i++) {
+        string param;
+        int exception;
+        double charge, sigma, epsilon;
+        force.getExceptionParameterOffset(i, param, exception, charge, sigma, epsilon);
+        exceptionsWithOffsets.insert(exception);
+        exceptionOffsetParams.insert(param);
+    }
+    bool topologyChanged = (force.getNumExceptions() != exceptionPairs.size());
+    for (int i = firstException; i <= lastException && !topologyChanged; i++) {
+        int particle1, particle2;
+        double chargeProd, sigma, epsilon;
+        force.getExceptionParameters(i, particle1, particle2, chargeProd, sigma, epsilon);
+        bool include = (chargeProd != 0.0 || epsilon != 0.0 || exceptionsWithOffsets.find(i) != exceptionsWithOffsets.end());
+        if (make_pair(particle1, particle2) != exceptionPairs[i] || (nb14Index[i] >= 0) != include)
+            topologyChanged = true;
+    }
+    if (topologyChanged) {
+        for (const string& param : exceptionOffsetParams)
+            if (find(offsetParamNames.begin(), offsetParamNames.end(), param) == offsetParamNames.end())
+                throw OpenMMException("updateParametersInContext: Cannot add a parameter offset for a new global parameter");
+        vector<vector<int> > exclusionLists;
+        NativeNonbondedForceImpl::findExclusions(force, exclusionLists, threads);
+        setExceptions(force, exclusionLists);
+        if (tiles != NULL) {
+            delete tiles;
+            tiles = new ReferenceTiledAllPairs(numParticles, exclusions);
+        }
+        neighborListPositions.clear();
+        firstException = 0;
+        lastException = -1;
+    }
+
+    // Record the values.
+
+    bool ljChanged = false;
+    for (int i = firstParticle; i <= lastParticle; ++i) {
+        double charge, sigma, epsilon;
+        force.getParticleParameters(i, charge, sigma, epsilon);
+        if (sigma != baseParticleParams[i][1] || epsilon != baseParticleParams[i][2])
+            ljChanged = true;
+        baseParticleParams[i] = {charge, sigma, epsilon};
+    }
+    for (int i = firstException; i <= lastException; ++i) {
+        int index = nb14Index[i];
+        if (index < 0)
+            continue;
+        int particle1, particle2;
+        force.getExceptionParameters(i, particle1, particle2, baseExceptionParams[index][0], baseExceptionParams[index][1], baseExceptionParams[index][2]);
+        bonded14IndexArray[index][0] = particle1;
+        bonded14IndexArray[index][1] = particle2;
+    }
+    parametersChanged = true;
+    
+    if (updateLJTypes(force, firstParticle, lastParticle))
+        ljChanged = true;
+
+    // Update the coefficient for the dispersion correction if any Lennard-Jones parameters changed.
+
+    if (ljChanged && dispersionCorrection != NULL) {
+        dispersionCorrection->updateParticles(force, firstParticle, lastParticle);
+        dispersionCoefficient = dispersionCorrection->getCoefficient();
+    }
+
+    // Parameters or exclusions may have changed which particles form water molecules.
+
+    vector<int> lastWaterMolecules = waterMolecules;
+    findWaterMolecules(context.getSystem());
+    if (waterMolecules != lastWaterMolecules)
+        neighborListPositions.clear();
+}
+
+bool ReferenceCalcNativeNonbondedForceKernel::updateLJTypes(const NativeNonbondedForce& force, int firstParticle, int lastParticle) {
+    // Build the table of sigma and 4*epsilon for each pair of types, in the form used by ReferenceLJCoulombIxn.
+
+    int numTypes = force.getNumLJTypes();
+    vector<double> table;
+    if (numTypes > 0) {
+        vector<double> sigma, epsilon;
+        NativeNonbondedForceImpl::getLJTypeTable(force, sigma, epsilon);
+        table.resize(2*sigma.size());
+        for (int i = 0; i < sigma.size(); i++) {
+            table[2*i] = sigma[i];
+            table[2*i+1] = 4.0*epsilon[i];
+        }
+    }
+    bool changed = (table != ljTypeTable);
+    ljTypeTable.swap(table);
+
+    // Record the type of each particle.  If the number of types has changed, all of them must be copied.
+
+    if (numTypes != numLJTypes) {
+        numLJTypes = numTypes;
+        ljTypes.assign(numTypes > 0 ? numParticles : 0, -1);
+        firstParticle = 0;
+        lastParticle = numParticles-1;
+        changed = true;
+    }
+    if (numTypes > 0)
+        for (int i = firstParticle; i <= lastParticle; i++) {
+            int type = force.getParticleLJType(i);
+            if (type != ljTypes[i]) {
+                ljTypes[i] = type;
+                changed = true;
+            }
+        }
+    return changed;
+}
 
+void ReferenceCalcNativeNonbondedForceKernel::setExceptions(const NativeNonbondedForce& force, const vector<vector<int> >& exclusionLists) {
     // Identify which exceptions are 1-4 interactions.
 
     set<int> exceptionsWithOffsets;
@@ -229,38 +492,49 @@ void ReferenceCalcNativeNonbondedForceKernel::copyParametersToContext(ContextImp
         force.getExceptionParameterOffset(i, param, exception, charge, sigma, epsilon);
         exceptionsWithOffsets.insert(exception);
     }
+    exclusions.resize(numParticles);
+    for (int i = 0; i < numParticles; i++)
+        exclusions[i] = set<int>(exclusionLists[i].begin(), exclusionLists[i].end());
+    exceptionPairs.resize(force.getNumExceptions());
+    nb14Index.assign(force.getNumExceptions(), -1);
     vector<int> nb14s;
     for (int i = 0; i < force.getNumExceptions(); i++) {
         int particle1, particle2;
         double chargeProd, sigma, epsilon;
         force.getExceptionParameters(i, particle1, particle2, chargeProd, sigma, epsilon);
-        if (chargeProd != 0.0 || epsilon != 0.0 || exceptionsWithOffsets.find(i) != exceptionsWithOffsets.end())
+        exceptionPairs[i] = make_pair(particle1, particle2);
+        if (chargeProd != 0.0 || epsilon != 0.0 || exceptionsWithOffsets.find(i) != exceptionsWithOffsets.end()) {
+            nb14Index[i] = nb14s.size();
             nb14s.push_back(i);
+        }
     }
-    if (nb14s.size() != num14)
-        throw OpenMMException("updateParametersInContext: The number of non-excluded exceptions has changed");
 
-    // Record the values.
+    // Build the arrays.
 
-    for (int i = 0; i < numParticles; ++i)
-        force.getParticleParameters(i, baseParticleParams[i][0], baseParticleParams[i][1], baseParticleParams[i][2]);
+    num14 = nb14s.size();
+    bonded14IndexArray.assign(num14, vector<int>(2));
+    bonded14ParamArray.assign(num14, vector<double>(3));
+    baseExceptionParams.resize(num14);
     for (int i = 0; i < num14; ++i) {
         int particle1, particle2;
         force.getExceptionParameters(nb14s[i], particle1, particle2, baseExceptionParams[i][0], baseExceptionParams[i][1], baseExceptionParams[i][2]);
         bonded14IndexArray[i][0] = particle1;
         bonded14IndexArray[i][1] = particle2;
     }
-    
-    // Recompute the coefficient for the dispersion correction.
-
-    NativeNonbondedForce::NonbondedMethod method = force.getNonbondedMethod();
-    if (force.getUseDispersionCorrection() && (method == NativeNonbondedForce::CutoffPeriodic || method == NativeNonbondedForce::Ewald || method == NativeNonbondedForce::PME))
-        dispersionCoefficient = NativeNonbondedForceImpl::calcDispersionCorrection(context.getSystem(), force);
+    exceptionParamOffsets.clear();
+    for (int i = 0; i < force.getNumExceptionParameterOffsets(); i++) {
+        string param;
+        int exception;
+        double charge, sigma, epsilon;
+        force.getExceptionParameterOffset(i, param, exception, charge, sigma, epsilon);
+        exceptionParamOffsets[make_pair(param, nb14Index[exception])] = {charge, sigma, epsilon};
+    }
+    parametersChanged = true;
 }
 
 void ReferenceCalcNativeNonbondedForceKernel::getPMEParameters(double& alpha, int& nx, int& ny, int& nz) const {
-    if (nonbondedMethod != PME && nonbondedMethod != LJPME)
-        throw OpenMMException("getPMEParametersInContext: This Context is not using PME or LJPME");
+    if (nonbondedMethod != PME && nonbondedMethod != LJPME && nonbondedMethod != P3M && nonbondedMethod != USeries)
+        throw OpenMMException("getPMEParametersInContext: This Context is not using PME, LJPME, P3M, or USeries");
     alpha = ewaldAlpha;
     nx = gridSize[0];
     ny = gridSize[1];
@@ -276,7 +550,174 @@ void ReferenceCalcNativeNonbondedForceKernel::getLJPMEParameters(double& alpha,
     nz = dispersionGridSize[2];
 }
 
+void ReferenceCalcNativeNonbondedForceKernel::getMSMParameters(int& numLevels, int& nx, int& ny, int& nz) const {
+    if (nonbondedMethod != MSM)
+        throw OpenMMException("getMSMParametersInContext: This Context is not using MSM");
+    numLevels = msmLevels;
+    nx = msmGridSize[0];
+    ny = msmGridSize[1];
+    nz = msmGridSize[2];
+}
+
+void ReferenceCalcNativeNonbondedForceKernel::resizePmeGrids(const Vec3* boxVectors) {
+    // Alpha depends only on the cutoff and the error tolerance, so only the grid dimensions change.
+
+    double alpha;
+    if (autoGridSize && nonbondedMethod == P3M)
+        NativeNonbondedForceImpl::calcP3MParameters(boxVectors, nonbondedCutoff, ewaldErrorTol, alpha, gridSize[0], gridSize[1], gridSize[2]);
+    else if (autoGridSize && nonbondedMethod == USeries)
+        NativeNonbondedForceImpl::calcUSeriesParameters(boxVectors, nonbondedCutoff, ewaldErrorTol, alpha, gridSize[0], gridSize[1], gridSize[2]);
+    else if (autoGridSize)
+        NativeNonbondedForceImpl::calcPMEParameters(boxVectors, nonbondedCutoff, ewaldErrorTol, alpha, gridSize[0], gridSize[1], gridSize[2], false);
+    if (autoDispersionGridSize)
+        NativeNonbondedForceImpl::calcPMEParameters(boxVectors, nonbondedCutoff, ewaldErrorTol, alpha, dispersionGridSize[0], dispersionGridSize[1], dispersionGridSize[2], true);
+    pmeGridVolume = boxVectors[0][0]*boxVectors[1][1]*boxVectors[2][2];
+}
+
+bool ReferenceCalcNativeNonbondedForceKernel::neighborListIsValid(const vector<Vec3>& positions, const Vec3* boxVectors) const {
+    if (neighborListPositions.size() != positions.size())
+        return false;
+    for (int i = 0; i < 3; i++)
+        if (boxVectors[i] != neighborListBoxVectors[i])
+            return false;
+    double maxDisplacement2 = 0.25*neighborListSkin*neighborListSkin;
+    for (int i = 0; i < numParticles; i++) {
+        Vec3 delta = positions[i]-neighborListPositions[i];
+        if (delta.dot(delta) > maxDisplacement2)
+            return false;
+    }
+    return true;
+}
+
+void ReferenceCalcNativeNonbondedForceKernel::findWaterMolecules(const System& system) {
+    // A water molecule is three consecutive particles that are all constrained to each other, optionally followed by
+    // a virtual site.  Its particles must exclude each other and nothing else, have the same parameters as the
+    // first molecule that was found, and have no parameter offsets.  Only the methods that compute direct space
+    // interactions from the neighbor list can process them separately.
+
+    waterMolecules.clear();
+    waterIndex.assign(numParticles, -1);
+    waterSize = 0;
+    bool supported = (nonbondedMethod == CutoffNonPeriodic || nonbondedMethod == CutoffPeriodic || nonbondedMethod == Ewald ||
+                      nonbondedMethod == PME || nonbondedMethod == P3M || nonbondedMethod == RandomBatchEwald);
+    if (!supported || tiles != NULL || numLJTypes > 0)
+        return;
+    set<pair<int, int> > constraints;
+    for (int i = 0; i < system.getNumConstraints(); i++) {
+        int particle1, particle2;
+        double distance;
+        system.getConstraintParameters(i, particle1, particle2, distance);
+        constraints.insert(make_pair(min(particle1, particle2), max(particle1, particle2)));
+    }
+    set<int> particlesWithOffsets;
+    for (auto& offset : particleParamOffsets)
+        particlesWithOffsets.insert(offset.first.second);
+    int first = 0;
+    while (first+2 < numParticles) {
+        int size = 0;
+        if (constraints.count(make_pair(first, first+1)) && constraints.count(make_pair(first, first+2)) && constraints.count(make_pair(first+1, first+2)))
+            size = (first+3 < numParticles && system.isVirtualSite(first+3) ? 4 : 3);
+        bool isWater = (size > 0 && (waterSize == 0 || size == waterSize));
+        for (int i = 0; i < size && isWater; i++) {
+            if (system.isVirtualSite(first+i) != (i == 3) || exclusions[first+i].size() != size-1)
+                isWater = false;
+            for (int j = 0; j < size; j++)
+                if (j != i && exclusions[first+i].find(first+j) == exclusions[first+i].end())
+                    isWater = false;
+            if (waterSize != 0 && baseParticleParams[first+i] != baseParticleParams[waterMolecules[0]+i])
+                isWater = false;
+            if (particlesWithOffsets.find(first+i) != particlesWithOffsets.end())
+                isWater = false;
+        }
+        if (!isWater) {
+            first++;
+            continue;
+        }
+        waterSize = size;
+        for (int i = 0; i < size; i++)
+            waterIndex[first+i] = waterMolecules.size();
+        waterMolecules.push_back(first);
+        first += size;
+    }
+}
+
+bool ReferenceCalcNativeNonbondedForceKernel::buildWaterNeighborList(const vector<Vec3>& positions, const Vec3* boxVectors, bool periodic, double maxDistance) {
+    // Find how far the particles of a molecule extend from its first particle.  The molecules are rigid, so this
+    // does not change while the list is in use, except within the tolerance of the constraints.
+
+    int numMolecules = waterMolecules.size();
+    double extent = 0.0;
+    for (int first : waterMolecules)
+        for (int i = 1; i < waterSize; i++) {
+            Vec3 delta = positions[first+i]-positions[first];
+            extent = max(extent, sqrt(delta.dot(delta)));
+        }
+    extent *= 1.01;
+
+    // Two molecules can interact if their first particles are within the cutoff plus twice the extent.  The image
+    // chosen for the first particles must also be correct for every other pair, which requires a large enough box.
+
+    double listDistance = maxDistance+2*extent;
+    if (periodic && min(boxVectors[0][0], min(boxVectors[1][1], boxVectors[2][2])) <= 2*listDistance)
+        return false;
+    vector<Vec3> moleculePositions(numMolecules);
+    for (int i = 0; i < numMolecules; i++)
+        moleculePositions[i] = positions[waterMolecules[i]];
+    computeNeighborListVoxelHash(*waterNeighborList, numMolecules, moleculePositions, vector<set<int> >(numMolecules), boxVectors, periodic, listDistance, 0.0);
+
+    // Remove pairs of particles in two different molecules from the list of particle pairs.
+
+    NeighborList& pairs = *neighborList;
+    int numPairs = 0;
+    for (int i = 0; i < pairs.size(); i++)
+        if (waterIndex[pairs[i].first] == -1 || waterIndex[pairs[i].second] == -1)
+            pairs[numPairs++] = pairs[i];
+    pairs.resize(numPairs);
+    return true;
+}
+
+void ReferenceCalcNativeNonbondedForceKernel::sortNeighborListByClass() {
+    // Group the pairs by which terms they need, so the pair loops decide that once for each group instead of once
+    // for each pair.  Pairs that do not interact at all are removed.  The order within each group is preserved.
+
+    NeighborList& pairs = *neighborList;
+    vector<int> count(4, 0);
+    for (auto& pair : pairs)
+        count[particleClasses[pair.first] & particleClasses[pair.second]]++;
+    pairClassStart.resize(4);
+    pairClassStart[0] = 0;
+    for (int i = 1; i < 4; i++)
+        pairClassStart[i] = pairClassStart[i-1]+count[i];
+    if (count[ReferenceLJCoulombIxn::HasCoulomb | ReferenceLJCoulombIxn::HasLJ] == pairs.size())
+        return;
+    vector<int> position(pairClassStart.begin(), pairClassStart.begin()+3);
+    NeighborList sorted(pairClassStart[3]);
+    for (auto& pair : pairs) {
+        int pairClass = particleClasses[pair.first] & particleClasses[pair.second];
+        if (pairClass != 0)
+            sorted[position[pairClass-1]++] = pair;
+    }
+    pairs.swap(sorted);
+}
+
 void ReferenceCalcNativeNonbondedForceKernel::computeParameters(ContextImpl& context) {
+    // The parameters only need to be recomputed if the force has been updated or a global parameter has changed.
+
+    for (int i = 0; i < offsetParamNames.size(); i++) {
+        double value = context.getParameter(offsetParamNames[i]);
+        if (value != offsetParamValues[i]) {
+            offsetParamValues[i] = value;
+            parametersChanged = true;
+            if (dispersionCorrection != NULL)
+                dispersionCorrection->setParameter(offsetParamNames[i], value);
+        }
+    }
+    if (dispersionCorrection != NULL)
+        dispersionCoefficient = dispersionCorrection->getCoefficient();
+    if (!parametersChanged)
+        return;
+    parametersChanged = false;
+
     // Compute particle parameters.
 
     vector<double> charges(numParticles), sigmas(numParticles), epsilons(numParticles);
@@ -298,6 +739,27 @@ void ReferenceCalcNativeNonbondedForceKernel::computeParameters(ContextImpl& con
         particleParamArray[i][2] = charges[i];
     }
 
+    // Record which terms each particle takes part in, so the pair loops can skip the others.  With atom types,
+    // a particle has Lennard-Jones interactions if its type has a nonzero epsilon with any type.  The neighbor
+    // list is sorted by class and omits pairs that do not interact, so it must be rebuilt if any class changes.
+
+    vector<bool> typeHasLJ(numLJTypes, false);
+    for (int i = 0; i < numLJTypes; i++)
+        for (int j = 0; j < numLJTypes; j++)
+            if (ljTypeTable[2*(i*numLJTypes+j)+1] != 0.0)
+                typeHasLJ[i] = true;
+    for (int i = 0; i < numParticles; i++) {
+        int particleClass = 0;
+        if (charges[i] != 0.0)
+            particleClass |= ReferenceLJCoulombIxn::HasCoulomb;
+        if (numLJTypes > 0 ? typeHasLJ[ljTypes[i]] : epsilons[i] != 0.0)
+            particleClass |= ReferenceLJCoulombIxn::HasLJ;
+        if (particleClass != particleClasses[i]) {
+            particleClasses[i] = particleClass;
+            neighborListPositions.clear();
+        }
+    }
+
     // Compute exception parameters.
 
     charges.resize(num14);
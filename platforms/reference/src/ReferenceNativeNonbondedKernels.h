@@ -33,8 +33,15 @@
  * -------------------------------------------------------------------------- */
 
 #include "NativeNonbondedKernels.h"
+#include "internal/NativeNonbondedForceImpl.h"
+#include "ReferenceMSM.h"
+#include "ReferencePME.h"
+#include "ReferenceSlabPME.h"
+#include "ReferenceTiledAllPairs.h"
 #include "openmm/Platform.h"
+#include "openmm/internal/ThreadPool.h"
 #include "openmm/reference/ReferenceNeighborList.h"
+#include "sfmt/SFMT.h"
 #include <vector>
 #include <array>
 #include <map>
@@ -46,16 +53,17 @@ namespace NativeNonbondedPlugin {
  */
 class ReferenceCalcNativeNonbondedForceKernel : public CalcNativeNonbondedForceKernel {
 public:
-    ReferenceCalcNativeNonbondedForceKernel(std::string name, const OpenMM::Platform& platform) : CalcNativeNonbondedForceKernel(name, platform) {
+    ReferenceCalcNativeNonbondedForceKernel(std::string name, const OpenMM::Platform& platform) : CalcNativeNonbondedForceKernel(name, platform), pmeData(NULL), msmData(NULL), slabPme(NULL), threads(NULL), tiles(NULL), dispersionCorrection(NULL), waterNeighborList(NULL) {
     }
     ~ReferenceCalcNativeNonbondedForceKernel();
     /**
      * Initialize the kernel.
      * 
-     * @param system     the System this kernel will be applied to
-     * @param force      the NativeNonbondedForce this kernel will be used for
+     * @param system          the System this kernel will be applied to
+     * @param force           the NativeNonbondedForce this kernel will be used for
+     * @param exclusionLists  exclusionLists[i] contains the particles excluded from particle i in increasing order
      */
-    void initialize(const OpenMM::System& system, const NativeNonbondedForce& force);
+    void initialize(const OpenMM::System& system, const NativeNonbondedForce& force, const std::vector<std::vector<int> >& exclusionLists);
     /**
      * Execute the kernel to calculate the forces and/or energy.
      *
@@ -63,16 +71,21 @@ public:
      * @param includeForces  true if forces should be calculated
      * @param includeEnergy  true if the energy should be calculated
      * @param includeReciprocal  true if reciprocal space interactions should be included
+     * @param includeOuterShell  true if the outer shell of direct space interactions should be included
      * @return the potential energy due to the force
      */
-    double execute(OpenMM::ContextImpl& context, bool includeForces, bool includeEnergy, bool includeDirect, bool includeReciprocal);
+    double execute(OpenMM::ContextImpl& context, bool includeForces, bool includeEnergy, bool includeDirect, bool includeReciprocal, bool includeOuterShell);
     /**
      * Copy changed parameters over to a context.
      *
-     * @param context    the context to copy parameters to
-     * @param force      the NativeNonbondedForce to copy the parameters from
+     * @param context         the context to copy parameters to
+     * @param force           the NativeNonbondedForce to copy the parameters from
+     * @param firstParticle   the index of the first particle whose parameters might have changed
+     * @param lastParticle    the index of the last particle whose parameters might have changed
+     * @param firstException  the index of the first exception whose parameters might have changed
+     * @param lastException   the index of the last exception whose parameters might have changed
      */
-    void copyParametersToContext(OpenMM::ContextImpl& context, const NativeNonbondedForce& force);
+    void copyParametersToContext(OpenMM::ContextImpl& context, const NativeNonbondedForce& force, int firstParticle, int lastParticle, int firstException, int lastException);
     /**
      * Get the parameters being used for PME.
      * 
@@ -91,19 +104,60 @@ public:
      * @param nz      the number of grid points along the Z axis
      */
     void getLJPMEParameters(double& alpha, int& nx, int& ny, int& nz) const;
+    /**
+     * Get the parameters being used for MSM.
+     *
+     * @param numLevels  the number of grid levels
+     * @param nx         the number of points along the X axis of the finest grid
+     * @param ny         the number of points along the Y axis of the finest grid
+     * @param nz         the number of points along the Z axis of the finest grid
+     */
+    void getMSMParameters(int& numLevels, int& nx, int& ny, int& nz) const;
 private:
     void computeParameters(OpenMM::ContextImpl& context);
-    int numParticles, num14;
+    void setExceptions(const NativeNonbondedForce& force, const std::vector<std::vector<int> >& exclusionLists);
+    bool updateLJTypes(const NativeNonbondedForce& force, int firstParticle, int lastParticle);
+    void findWaterMolecules(const OpenMM::System& system);
+    bool buildWaterNeighborList(const std::vector<OpenMM::Vec3>& positions, const OpenMM::Vec3* boxVectors, bool periodic, double maxDistance);
+    void sortNeighborListByClass();
+    void resizePmeGrids(const OpenMM::Vec3* boxVectors);
+    bool neighborListIsValid(const std::vector<OpenMM::Vec3>& positions, const OpenMM::Vec3* boxVectors) const;
+    int numParticles, num14, numLJTypes;
+    std::vector<int> ljTypes, particleClasses, pairClassStart;
+    std::vector<double> ljTypeTable;
     std::vector<std::vector<int> >bonded14IndexArray;
+    std::vector<int> nb14Index;
+    std::vector<std::pair<int, int> > exceptionPairs;
     std::vector<std::vector<double> > particleParamArray, bonded14ParamArray;
     std::vector<std::array<double, 3> > baseParticleParams, baseExceptionParams;
     std::map<std::pair<std::string, int>, std::array<double, 3> > particleParamOffsets, exceptionParamOffsets;
-    double nonbondedCutoff, switchingDistance, rfDielectric, ewaldAlpha, ewaldDispersionAlpha, dispersionCoefficient;
-    int kmax[3], gridSize[3], dispersionGridSize[3];
-    bool useSwitchingFunction, exceptionsArePeriodic;
+    std::vector<std::string> offsetParamNames;
+    std::vector<double> offsetParamValues;
+    bool parametersChanged;
+    double nonbondedCutoff, ljCutoff, switchingDistance, rfDielectric, ewaldAlpha, ewaldDispersionAlpha, dispersionCoefficient;
+    NativeNonbondedForceImpl::DispersionCorrection* dispersionCorrection;
+    double ewaldErrorTol, pmeGridResizeThreshold, pmeGridVolume, dsfAlpha, useriesSpacing;
+    double innerCutoff, innerSwitchingDistance;
+    int kmax[3], gridSize[3], dispersionGridSize[3], msmGridSize[3], msmLevels, msmOrder, rbeBatchSize, fmmOrder, fmmTreeDepth;
+    bool useSwitchingFunction, exceptionsArePeriodic, autoGridSize, autoDispersionGridSize, useSlabCorrection;
     std::vector<std::set<int> > exclusions;
     NonbondedMethod nonbondedMethod;
     OpenMM::NeighborList* neighborList;
+    std::vector<OpenMM::Vec3> neighborListPositions;
+    OpenMM::Vec3 neighborListBoxVectors[3];
+    double neighborListSkin;
+    OpenMM_SFMT::SFMT random;
+    p3m_influence_function p3mInfluence;
+    pme_t pmeData;
+    int pmeDataGridSize[3];
+    ReferenceMSM* msmData;
+    ReferenceSlabPME* slabPme;
+    OpenMM::ThreadPool* threads;
+    ReferenceTiledAllPairs* tiles;
+    std::vector<int> waterMolecules, waterIndex;
+    int waterSize;
+    OpenMM::NeighborList* waterNeighborList;
+    bool useWaterNeighborList;
 };
 
 } // namespace NativeNonbondedPlugin
@@ -29,6 +29,7 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -43,8 +44,24 @@ using namespace OpenMM;
 
 typedef int    ivec[3];
 
+/* Largest interpolation order supported by the stencil loops */
+#define PME_MAX_ORDER 8
+
 namespace NativeNonbondedPlugin {
 
+/* Cached data for the u-series method, see pme_exec_useries(). It is owned by the pme object of the finest grid,
+ * and rebuilt when the box or the spacing changes.
+ */
+struct useries_data
+{
+    Vec3                    box[3];
+    double                  spacing;
+    vector<pme_t>           bands;            /* pme objects for bands 1, 2, ... Band 0 uses the owning pme object. */
+    vector<vector<double> > influence;        /* The influence function of each band, including band 0 */
+    vector<Vec3>            wavevectors;      /* Integer indices of the wave vectors summed directly, one of each +-m pair */
+    vector<double>          wavecoefficients; /* The influence function at each of those wave vectors */
+};
+
 struct pme
 {
     int          natoms;
@@ -61,8 +78,14 @@ struct pme
 
     /* Data for bspline interpolation, see the Essman PME paper */
     double *     bsplines_moduli[3];   /* 3 pointers, to x/y/z bspline moduli, each of length ngrid[x/y/z]   */
-    double *     bsplines_theta[3];    /* each of x/y/z has length order*natoms */
-    double *     bsplines_dtheta[3];   /* each of x/y/z has length order*natoms */
+    double *     bsplines_theta[3];    /* each of x/y/z has length order*natoms, stored in sorted atom order */
+    double *     bsplines_dtheta[3];   /* each of x/y/z has length order*natoms, stored in sorted atom order */
+
+    int *        sortedatoms;          /* Array of length natoms. Atom indices sorted by the grid line (x,y index)
+                                        * they fall in, so consecutive atoms touch overlapping parts of the grid.
+                                        * Updated every step!
+                                        */
+    int *        linestart;            /* Array of length ngrid[0]*ngrid[1]+1, used for the counting sort */
 
     ivec *       particleindex;        /* Array of length natoms. Each element is
                                         * an ivec (3 ints) that specify the grid
@@ -89,6 +112,8 @@ struct pme
      */
 
     double       epsilon_r;             /* Dielectric coefficient to use, typically 1.0 */
+
+    useries_data * useries;             /* Created by the first call to pme_exec_useries(), otherwise NULL */
 };
 
 
@@ -268,6 +293,42 @@ pme_update_grid_index_and_fraction(pme_t    pme,
 }
 
 
+/* Bucket the atoms by the grid line they fall in with a counting sort.
+ *
+ * Spreading and interpolation touch an order*order*order block of the grid starting at each atom's
+ * grid index. Processing atoms in input order scatters these accesses over the whole grid, while
+ * processing them line by line keeps the working set to a few neighboring planes.
+ */
+static void
+pme_sort_atoms(pme_t pme)
+{
+    int    i;
+    int    line;
+    int    nlines;
+
+    nlines = pme->ngrid[0]*pme->ngrid[1];
+
+    for (i=0;i<=nlines;i++)
+    {
+        pme->linestart[i] = 0;
+    }
+    for (i=0;i<pme->natoms;i++)
+    {
+        line = pme->particleindex[i][0]*pme->ngrid[1] + pme->particleindex[i][1];
+        pme->linestart[line+1]++;
+    }
+    for (i=0;i<nlines;i++)
+    {
+        pme->linestart[i+1] += pme->linestart[i];
+    }
+    for (i=0;i<pme->natoms;i++)
+    {
+        line = pme->particleindex[i][0]*pme->ngrid[1] + pme->particleindex[i][1];
+        pme->sortedatoms[pme->linestart[line]++] = i;
+    }
+}
+
+
 /* Ugly bspline calculation taken from Tom Dardens reference equations.
  * This probably very sub-optimal in Cuda? Separate kernel?
  *
@@ -284,12 +345,13 @@ pme_update_bsplines(pme_t    pme)
 
     order = pme->order;
 
+    /* The splines are stored in sorted order, so spreading and interpolation read them sequentially */
     for (i=0; (i<pme->natoms); i++)
     {
         for (j=0; j<3; j++)
         {
             /* dr is relative offset from lower cell limit */
-            dr = pme->particlefraction[i][j];
+            dr = pme->particlefraction[pme->sortedatoms[i]][j];
 
             data  = &(pme->bsplines_theta[j][i*order]);
             ddata = &(pme->bsplines_dtheta[j][i*order]);
@@ -330,35 +392,55 @@ pme_update_bsplines(pme_t    pme)
 
 
 static void
-pme_grid_spread_charge(pme_t pme, const vector<double>& charges)
+pme_grid_clear(pme_t pme)
+{
+    int i;
+
+    for (i=0;i<pme->ngrid[0]*pme->ngrid[1]*pme->ngrid[2];i++)
+    {
+        pme->grid[i].re = pme->grid[i].im = 0;
+    }
+}
+
+
+/* Spread onto the real part of the grid, or the imaginary part when two real grids are packed into one complex grid */
+static void
+pme_grid_spread_charge(pme_t pme, const vector<double>& charges, bool imaginary)
 {
     int       order;
     int       i;
+    int       atom;
     int       ix,iy,iz;
     int       x0index,y0index,z0index;
-    int       xindex,yindex,zindex;
-    int       index;
-    double    q;
+    int       xindex[PME_MAX_ORDER],yindex[PME_MAX_ORDER],zindex[PME_MAX_ORDER];
+    int       nx,ny,nz;
+    double    q,qxy;
     double *  thetax;
     double *  thetay;
     double *  thetaz;
+    t_complex * line;
+    double t_complex::* part;
 
     order = pme->order;
+    nx    = pme->ngrid[0];
+    ny    = pme->ngrid[1];
+    nz    = pme->ngrid[2];
+    part  = (imaginary ? &t_complex::im : &t_complex::re);
 
-    /* Reset the grid */
-    for (i=0;i<pme->ngrid[0]*pme->ngrid[1]*pme->ngrid[2];i++)
-    {
-        pme->grid[i].re = pme->grid[i].im = 0;
-    }
-
+    /* Atoms are visited in sorted order, so consecutive atoms spread onto the same or neighboring grid lines */
     for (i=0;i<pme->natoms;i++)
     {
-        q = charges[i];
+        atom = pme->sortedatoms[i];
+        q = charges[atom];
+        if (q == 0)
+        {
+            continue;
+        }
 
         /* Grid index for the actual atom position */
-        x0index = pme->particleindex[i][0];
-        y0index = pme->particleindex[i][1];
-        z0index = pme->particleindex[i][2];
+        x0index = pme->particleindex[atom][0];
+        y0index = pme->particleindex[atom][1];
+        z0index = pme->particleindex[atom][2];
 
         /* Bspline factors for this atom in each dimension , calculated from fractional coordinates */
         thetax  = &(pme->bsplines_theta[0][i*order]);
@@ -381,52 +463,352 @@ pme_grid_spread_charge(pme_t pme, const vector<double>& charges)
          * 1) The loops get much simpler
          * 2) Just looking forward will hopefully get us more cache hits
          * 3) When we parallelize things, we only need to communicate in one direction instead of two!
+         *
+         * The periodic wrapping is done once per atom rather than in the innermost loop.
          */
-
         for (ix=0;ix<order;ix++)
         {
-            /* Calculate index, apply PBC so we spread to index 0/1/2 when a particle is close to the upper limit of the grid */
-            xindex = (x0index + ix) % pme->ngrid[0];
+            xindex[ix] = ((x0index + ix) % nx)*ny*nz;
+            yindex[ix] = ((y0index + ix) % ny)*nz;
+            zindex[ix] = (z0index + ix) % nz;
+        }
 
+        for (ix=0;ix<order;ix++)
+        {
             for (iy=0;iy<order;iy++)
             {
-                yindex = (y0index + iy) % pme->ngrid[1];
+                qxy  = q*thetax[ix]*thetay[iy];
+                line = pme->grid + xindex[ix] + yindex[iy];
+
+                if (z0index+order <= nz)
+                {
+                    /* The stencil does not wrap around in z, so the innermost loop runs over contiguous memory */
+                    line += z0index;
+                    for (iz=0;iz<order;iz++)
+                    {
+                        line[iz].*part += qxy*thetaz[iz];
+                    }
+                }
+                else
+                {
+                    for (iz=0;iz<order;iz++)
+                    {
+                        line[zindex[iz]].*part += qxy*thetaz[iz];
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+/* Coulomb influence function for one frequency, see the Essman/Darden paper for the equation!
+ * m2 is the squared reciprocal vector, bmod the product of the bspline moduli in the three dimensions.
+ */
+static double
+pme_coulomb_eterm(pme_t pme, double ewaldcoeff, double m2, double bmod, double volume)
+{
+    double factor = M_PI*M_PI/(ewaldcoeff*ewaldcoeff);
+
+    return ONE_4PI_EPS0/pme->epsilon_r*exp(-factor*m2)/(m2*M_PI*volume*bmod);
+}
+
+
+/* Dispersion influence function for one frequency. Unlike the Coulombic case, it is finite at m=0. */
+static double
+pme_dispersion_eterm(double ewaldcoeff, double m2, double bmod, double volume)
+{
+    double fac1 = 2.0*M_PI*M_PI*M_PI*sqrt(M_PI);
+    double fac2 = ewaldcoeff*ewaldcoeff*ewaldcoeff;
+    double fac3 = -2.0*ewaldcoeff*M_PI*M_PI;
+    double denom = -2*M_PI*sqrt(M_PI) / (6.0*volume*bmod);
+    double m = sqrt(m2);
+    double b = M_PI*m/ewaldcoeff;
+
+    return (fac1*erfc(b)*m*m2 + exp(-b*b)*(fac2 + fac3*m2)) * denom;
+}
+
+
+/* Fill in the P3M influence function that is optimal for analytically differentiated B-spline assignment
+ * (Ballenegger, Cerda & Holm, J. Chem. Theory Comput. 8, 936 (2012)):
+ *
+ *   G(k) = sum_m k_m^2 U^2(k_m) phi(k_m) / ( [sum_m U^2(k_m)] [sum_m k_m^2 U^2(k_m)] )
+ *
+ * where k_m runs over the aliases k+m*ngrid of each frequency, U is the Fourier transform of the assignment
+ * function and phi the reciprocal space Ewald kernel, normalized the same way as pme_coulomb_eterm().
+ * Aliases beyond P3M_ALIAS_RANGE grid lengths contribute negligibly. Only called when the box changes.
+ */
+#define P3M_ALIAS_RANGE 2
+
+static void
+p3m_calculate_influence_function(pme_t pme,
+                                 const Vec3 periodicBoxVectors[3],
+                                 const Vec3 recipBoxVectors[3],
+                                 vector<double>& influence)
+{
+    int nx = pme->ngrid[0];
+    int ny = pme->ngrid[1];
+    int nz = pme->ngrid[2];
+    double volume = periodicBoxVectors[0][0]*periodicBoxVectors[1][1]*periodicBoxVectors[2][2];
+
+    /* The assignment function is separable, so tabulate U^2 of every alias along each axis */
+    int naliases = 2*P3M_ALIAS_RANGE+1;
+    vector<double> usquared[3];
+    for (int d = 0; d < 3; d++)
+    {
+        int n = pme->ngrid[d];
+        usquared[d].resize(n*naliases);
+        for (int k = 0; k < n; k++)
+        {
+            int m = (k < (n+1)/2) ? k : (k-n);
+            for (int j = -P3M_ALIAS_RANGE; j <= P3M_ALIAS_RANGE; j++)
+            {
+                double arg = M_PI*(m+j*n)/n;
+                double u = (arg == 0.0 ? 1.0 : pow(sin(arg)/arg, pme->order));
+                usquared[d][k*naliases+j+P3M_ALIAS_RANGE] = u*u;
+            }
+        }
+    }
 
-                for (iz=0;iz<order;iz++)
+    influence.resize(nx*ny*nz);
+    influence[0] = 0.0;
+    for (int kx = 0; kx < nx; kx++)
+    {
+        int mx = (kx < (nx+1)/2) ? kx : (kx-nx);
+        for (int ky = 0; ky < ny; ky++)
+        {
+            int my = (ky < (ny+1)/2) ? ky : (ky-ny);
+            for (int kz = 0; kz < nz; kz++)
+            {
+                if (kx == 0 && ky == 0 && kz == 0)
+                    continue;
+                int mz = (kz < (nz+1)/2) ? kz : (kz-nz);
+                double numerator = 0, usum = 0, k2usum = 0;
+                for (int jx = 0; jx < naliases; jx++)
                 {
-                    /* Can be optimized, but we keep it simple here */
-                    zindex               = (z0index + iz) % pme->ngrid[2];
-                    /* Calculate index in the charge grid */
-                    index                = xindex*pme->ngrid[1]*pme->ngrid[2] + yindex*pme->ngrid[2] + zindex;
-                    /* Add the charge times the bspline spread/interpolation factors to this grid position */
-                    pme->grid[index].re += q*thetax[ix]*thetay[iy]*thetaz[iz];
+                    double ax = mx+(jx-P3M_ALIAS_RANGE)*nx;
+                    double ux = usquared[0][kx*naliases+jx];
+                    for (int jy = 0; jy < naliases; jy++)
+                    {
+                        double ay = my+(jy-P3M_ALIAS_RANGE)*ny;
+                        double uxy = ux*usquared[1][ky*naliases+jy];
+                        for (int jz = 0; jz < naliases; jz++)
+                        {
+                            double az = mz+(jz-P3M_ALIAS_RANGE)*nz;
+                            double u2 = uxy*usquared[2][kz*naliases+jz];
+                            double mhx = ax*recipBoxVectors[0][0];
+                            double mhy = ax*recipBoxVectors[1][0]+ay*recipBoxVectors[1][1];
+                            double mhz = ax*recipBoxVectors[2][0]+ay*recipBoxVectors[2][1]+az*recipBoxVectors[2][2];
+                            double m2 = mhx*mhx+mhy*mhy+mhz*mhz;
+                            usum += u2;
+                            k2usum += m2*u2;
+                            numerator += m2*u2*pme_coulomb_eterm(pme,pme->ewaldcoeff,m2,1.0,volume);
+                        }
+                    }
                 }
+                influence[kx*ny*nz+ky*nz+kz] = numerator/(usum*k2usum);
             }
         }
     }
 }
 
 
+/* The long range part of the u-series decomposition approximates 1/r by
+ *
+ *   sum_l w_l exp(-r^2/sigma_l^2),   sigma_l = sigma_0 exp(l*h),   w_l = 2h/(sqrt(pi) sigma_l),   l >= 0
+ *
+ * The Gaussians are divided into bands whose widths double from one to the next. Band b starts at the first
+ * Gaussian at least 2^b times as wide as sigma_0, and is computed on a grid 2^b times coarser than the finest one,
+ * so every band resolves its narrowest Gaussian equally well. The widest Gaussians need only a few wave vectors,
+ * so once the remaining ones need no more wave vectors than the order^3 grid points each particle is spread onto,
+ * they are summed directly over those wave vectors instead of on another grid.
+ *
+ * Terms whose Gaussian factor is below exp(-USERIES_MAX_EXPONENT) are dropped. Since the widths grow with l, the
+ * sum for each wave vector can stop at the first such term.
+ */
+#define USERIES_MAX_EXPONENT 40.0
+
+static int
+useries_band_start(int band, double spacing)
+{
+    return (int) ceil(band*log(2.0)/spacing - 1e-10);
+}
 
+/* Sum the Fourier transforms of the Gaussians lstart <= l < lend at the squared wave vector m2, normalized the same
+ * way as pme_coulomb_eterm() except for the bspline moduli.
+ */
+static double
+useries_sum_gaussians(pme_t pme, double spacing, int lstart, int lend, double m2, double volume)
+{
+    double sum = 0;
+    for (int l = lstart; l < lend; l++)
+    {
+        double sigma = exp(l*spacing)/pme->ewaldcoeff;
+        double exponent = M_PI*M_PI*sigma*sigma*m2;
+        if (exponent >= USERIES_MAX_EXPONENT)
+            break;
+        sum += 2*spacing*M_PI*sigma*sigma*exp(-exponent);
+    }
+    return ONE_4PI_EPS0/pme->epsilon_r*sum/volume;
+}
+
+/* Fill in the influence function of the Gaussians lstart <= l < lend on the grid of a pme object. */
+static void
+useries_calculate_influence_function(pme_t pme,
+                                     double spacing,
+                                     int lstart,
+                                     int lend,
+                                     const Vec3 periodicBoxVectors[3],
+                                     const Vec3 recipBoxVectors[3],
+                                     vector<double>& influence)
+{
+    int nx = pme->ngrid[0];
+    int ny = pme->ngrid[1];
+    int nz = pme->ngrid[2];
+    double volume = periodicBoxVectors[0][0]*periodicBoxVectors[1][1]*periodicBoxVectors[2][2];
+
+    influence.resize(nx*ny*nz);
+    influence[0] = 0.0;
+    for (int kx = 0; kx < nx; kx++)
+    {
+        int mx = (kx < (nx+1)/2) ? kx : (kx-nx);
+        double mhx = mx*recipBoxVectors[0][0];
+        double bx = pme->bsplines_moduli[0][kx];
+        for (int ky = 0; ky < ny; ky++)
+        {
+            int my = (ky < (ny+1)/2) ? ky : (ky-ny);
+            double mhy = mx*recipBoxVectors[1][0]+my*recipBoxVectors[1][1];
+            double by = pme->bsplines_moduli[1][ky];
+            for (int kz = 0; kz < nz; kz++)
+            {
+                if (kx == 0 && ky == 0 && kz == 0)
+                    continue;
+                int mz = (kz < (nz+1)/2) ? kz : (kz-nz);
+                double mhz = mx*recipBoxVectors[2][0]+my*recipBoxVectors[2][1]+mz*recipBoxVectors[2][2];
+                double m2 = mhx*mhx+mhy*mhy+mhz*mhz;
+                double bz = pme->bsplines_moduli[2][kz];
+                influence[kx*ny*nz+ky*nz+kz] = useries_sum_gaussians(pme,spacing,lstart,lend,m2,volume)/(bx*by*bz);
+            }
+        }
+    }
+}
+
+/* List the wave vectors, one of each +-m pair, for which some Gaussian from l = lstart on is not negligible. */
+static void
+useries_find_wave_vectors(pme_t pme,
+                          double spacing,
+                          int lstart,
+                          const Vec3 periodicBoxVectors[3],
+                          const Vec3 recipBoxVectors[3],
+                          vector<Vec3>& wavevectors)
+{
+    double sigma = exp(lstart*spacing)/pme->ewaldcoeff;
+    double maxm2 = USERIES_MAX_EXPONENT/(M_PI*M_PI*sigma*sigma);
+    int range[3];
+    for (int d = 0; d < 3; d++)
+        range[d] = (int) floor(sqrt(maxm2*periodicBoxVectors[d].dot(periodicBoxVectors[d])));
+    wavevectors.clear();
+    for (int mx = 0; mx <= range[0]; mx++)
+    {
+        double mhx = mx*recipBoxVectors[0][0];
+        for (int my = (mx == 0 ? 0 : -range[1]); my <= range[1]; my++)
+        {
+            double mhy = mx*recipBoxVectors[1][0]+my*recipBoxVectors[1][1];
+            for (int mz = (mx == 0 && my == 0 ? 1 : -range[2]); mz <= range[2]; mz++)
+            {
+                double mhz = mx*recipBoxVectors[2][0]+my*recipBoxVectors[2][1]+mz*recipBoxVectors[2][2];
+                if (mhx*mhx+mhy*mhy+mhz*mhz < maxm2)
+                    wavevectors.push_back(Vec3(mx, my, mz));
+            }
+        }
+    }
+}
+
+/* Divide the Gaussians into bands for the current box, and compute the influence function of each one. Only called
+ * when the box or the spacing changes.
+ */
+static void
+useries_setup(pme_t pme,
+              double spacing,
+              const Vec3 periodicBoxVectors[3],
+              const Vec3 recipBoxVectors[3])
+{
+    useries_data& data = *pme->useries;
+    double volume = periodicBoxVectors[0][0]*periodicBoxVectors[1][1]*periodicBoxVectors[2][2];
+    int maxwavevectors = pme->order*pme->order*pme->order;
+    int numbands = 1;
+    while (true)
+    {
+        useries_find_wave_vectors(pme,spacing,useries_band_start(numbands,spacing),periodicBoxVectors,recipBoxVectors,data.wavevectors);
+        bool coarsest = ((int) data.wavevectors.size() <= maxwavevectors);
+        for (int d = 0; d < 3; d++)
+            coarsest |= ((pme->ngrid[d]+(1<<numbands)-1)>>numbands < 2*pme->order);
+        if (coarsest)
+            break;
+        numbands++;
+    }
+
+    /* The grid of each band only depends on its index, so existing pme objects can be kept */
+    while ((int) data.bands.size() > numbands-1)
+    {
+        pme_destroy(data.bands.back());
+        data.bands.pop_back();
+    }
+    while ((int) data.bands.size() < numbands-1)
+    {
+        int band = data.bands.size()+1;
+        int ngrid[3];
+        for (int d = 0; d < 3; d++)
+            ngrid[d] = (pme->ngrid[d]+(1<<band)-1)>>band;
+        pme_t bandpme;
+        pme_init(&bandpme,pme->ewaldcoeff,pme->natoms,ngrid,pme->order,pme->epsilon_r);
+        data.bands.push_back(bandpme);
+    }
+    data.influence.resize(numbands);
+    for (int band = 0; band < numbands; band++)
+    {
+        pme_t bandpme = (band == 0 ? pme : data.bands[band-1]);
+        useries_calculate_influence_function(bandpme,spacing,useries_band_start(band,spacing),useries_band_start(band+1,spacing),
+                                             periodicBoxVectors,recipBoxVectors,data.influence[band]);
+    }
+
+    /* The remaining Gaussians are summed directly */
+    int lstart = useries_band_start(numbands,spacing);
+    data.wavecoefficients.resize(data.wavevectors.size());
+    for (int i = 0; i < (int) data.wavevectors.size(); i++)
+    {
+        Vec3 m = data.wavevectors[i];
+        double mhx = m[0]*recipBoxVectors[0][0];
+        double mhy = m[0]*recipBoxVectors[1][0]+m[1]*recipBoxVectors[1][1];
+        double mhz = m[0]*recipBoxVectors[2][0]+m[1]*recipBoxVectors[2][1]+m[2]*recipBoxVectors[2][2];
+        data.wavecoefficients[i] = useries_sum_gaussians(pme,spacing,lstart,INT_MAX,mhx*mhx+mhy*mhy+mhz*mhz,volume);
+    }
+    data.spacing = spacing;
+    for (int d = 0; d < 3; d++)
+        data.box[d] = periodicBoxVectors[d];
+}
+
+
+/* Convolve the transformed charge grid with the influence function. If influence is NULL, the SPME influence
+ * function is computed on the fly from the bspline moduli. Otherwise it must hold one value for every grid point.
+ */
 static void
 pme_reciprocal_convolution(pme_t     pme,
                            const Vec3 periodicBoxVectors[3],
                            const Vec3 recipBoxVectors[3],
+                           const double* influence,
                            double *  energy)
 {
     int kx,ky,kz;
     int nx,ny,nz;
     double mx,my,mz;
     double mhx,mhy,mhz,m2;
-    double one_4pi_eps;
     double virxx,virxy,virxz,viryy,viryz,virzz;
     double bx,by,bz;
     double d1,d2;
     double eterm,vfactor,struct2,ets2;
     double esum;
-    double factor;
-    double denom;
-    double boxfactor;
+    double volume;
     double maxkx,maxky,maxkz;
 
     t_complex *ptr;
@@ -435,9 +817,7 @@ pme_reciprocal_convolution(pme_t     pme,
     ny = pme->ngrid[1];
     nz = pme->ngrid[2];
 
-    one_4pi_eps = ONE_4PI_EPS0/pme->epsilon_r;
-    factor = M_PI*M_PI/(pme->ewaldcoeff*pme->ewaldcoeff);
-    boxfactor = M_PI*periodicBoxVectors[0][0]*periodicBoxVectors[1][1]*periodicBoxVectors[2][2];
+    volume = periodicBoxVectors[0][0]*periodicBoxVectors[1][1]*periodicBoxVectors[2][2];
 
     esum = 0;
     virxx = 0;
@@ -456,7 +836,7 @@ pme_reciprocal_convolution(pme_t     pme,
         /* Calculate frequency. Grid indices in the upper half correspond to negative frequencies! */
         mx  = (kx<maxkx) ? kx : (kx-nx);
         mhx = mx*recipBoxVectors[0][0];
-        bx  = boxfactor*pme->bsplines_moduli[0][kx];
+        bx  = pme->bsplines_moduli[0][kx];
 
         for (ky=0;ky<ny;ky++)
         {
@@ -492,11 +872,16 @@ pme_reciprocal_convolution(pme_t     pme,
                 d2        = ptr->im;
 
                 /* Calculate the convolution - see the Essman/Darden paper for the equation! */
-                m2        = mhx*mhx+mhy*mhy+mhz*mhz;
-                bz        = pme->bsplines_moduli[2][kz];
-                denom     = m2*bx*by*bz;
-
-                eterm     = one_4pi_eps*exp(-factor*m2)/denom;
+                if (influence != NULL)
+                {
+                    eterm = influence[kx*ny*nz + ky*nz + kz];
+                }
+                else
+                {
+                    m2    = mhx*mhx+mhy*mhy+mhz*mhz;
+                    bz    = pme->bsplines_moduli[2][kz];
+                    eterm = pme_coulomb_eterm(pme,pme->ewaldcoeff,m2,bx*by*bz,volume);
+                }
 
                 /* write back convolution data to grid */
                 ptr->re   = d1*eterm;
@@ -530,8 +915,7 @@ dpme_reciprocal_convolution(pme_t pme,
     double d1,d2;
     double eterm,struct2,ets2;
     double esum;
-    double denom;
-    double boxfactor;
+    double volume;
     double maxkx,maxky,maxkz;
 
     t_complex *ptr;
@@ -540,7 +924,7 @@ dpme_reciprocal_convolution(pme_t pme,
     ny = pme->ngrid[1];
     nz = pme->ngrid[2];
 
-    boxfactor = -2*M_PI*sqrt(M_PI) / (6.0*periodicBoxVectors[0][0]*periodicBoxVectors[1][1]*periodicBoxVectors[2][2]);
+    volume = periodicBoxVectors[0][0]*periodicBoxVectors[1][1]*periodicBoxVectors[2][2];
 
     esum = 0;
 
@@ -548,12 +932,6 @@ dpme_reciprocal_convolution(pme_t pme,
     maxky = (ny+1)/2;
     maxkz = (nz+1)/2;
 
-    double bfac = M_PI / pme->ewaldcoeff;
-    double fac1 = 2.0*M_PI*M_PI*M_PI*sqrt(M_PI);
-    double fac2 = pme->ewaldcoeff*pme->ewaldcoeff*pme->ewaldcoeff;
-    double fac3 = -2.0*pme->ewaldcoeff*M_PI*M_PI;
-    double b, m, m3, expfac, expterm, erfcterm;
-
     for (kx=0;kx<nx;kx++)
     {
         /* Calculate frequency. Grid indices in the upper half correspond to negative frequencies! */
@@ -588,16 +966,7 @@ dpme_reciprocal_convolution(pme_t pme,
                 /* Calculate the convolution - see the Essman/Darden paper for the equation! */
                 m2        = mhx*mhx+mhy*mhy+mhz*mhz;
                 bz        = pme->bsplines_moduli[2][kz];
-                denom     = boxfactor / (bx*by*bz);
-
-                m = sqrt(m2);
-                m3 = m*m2;
-                b = bfac*m;
-                expfac = -b*b;
-                erfcterm = erfc(b);
-                expterm = exp(expfac);
-
-                eterm     = (fac1*erfcterm*m3 + expterm*(fac2 + fac3*m2)) * denom;
+                eterm     = pme_dispersion_eterm(pme->ewaldcoeff,m2,bx*by*bz,volume);
 
                 /* write back convolution data to grid */
                 ptr->re   = d1*eterm;
@@ -616,17 +985,140 @@ dpme_reciprocal_convolution(pme_t pme,
 }
 
 
+/* Convolution of a grid holding the transform of the charge grid in its real part and the c6 grid
+ * in its imaginary part. Since both grids are real, their transforms are Hermitian, and the transforms
+ * at k and -k can be separated as A(k) = (C(k)+conj(C(-k)))/2 and B(k) = (C(k)-conj(C(-k)))/2i.
+ * Both influence functions are real and even, so the convolved grids are packed back the same way.
+ */
+static void
+pme_packed_reciprocal_convolution(pme_t pme,
+                                  double dispersionewaldcoeff,
+                                  const Vec3 periodicBoxVectors[3],
+                                  const Vec3 recipBoxVectors[3],
+                                  double* energy,
+                                  double* dispersionenergy)
+{
+    int kx,ky,kz;
+    int px,py,pz;
+    int nx,ny,nz;
+    int index,pindex;
+    double mx,my,mz;
+    double mhx,mhy,mhz,m2;
+    double pmx,pmy,pmz;
+    double mhx2,mhy2,mhz2,pm2;
+    double bmod,pbmod;
+    double ar,ai,br,bi;
+    double eterm,determ,weight;
+    double esum,desum;
+    double volume;
+    double maxkx,maxky,maxkz;
+
+    t_complex *ptr;
+    t_complex *pptr;
+
+    nx = pme->ngrid[0];
+    ny = pme->ngrid[1];
+    nz = pme->ngrid[2];
+
+    volume = periodicBoxVectors[0][0]*periodicBoxVectors[1][1]*periodicBoxVectors[2][2];
+
+    esum  = 0;
+    desum = 0;
+
+    maxkx = (nx+1)/2;
+    maxky = (ny+1)/2;
+    maxkz = (nz+1)/2;
+
+    for (kx=0;kx<nx;kx++)
+    {
+        /* Calculate frequency. Grid indices in the upper half correspond to negative frequencies! */
+        mx  = (kx<maxkx) ? kx : (kx-nx);
+        mhx = mx*recipBoxVectors[0][0];
+        px  = (nx-kx)%nx;
+
+        for (ky=0;ky<ny;ky++)
+        {
+            my  = (ky<maxky) ? ky : (ky-ny);
+            mhy = mx*recipBoxVectors[1][0]+my*recipBoxVectors[1][1];
+            py  = (ny-ky)%ny;
+
+            for (kz=0;kz<nz;kz++)
+            {
+                /* Each pair of frequencies k and -k is handled once, when visiting the first of them */
+                pz     = (nz-kz)%nz;
+                index  = kx*ny*nz + ky*nz + kz;
+                pindex = px*ny*nz + py*nz + pz;
+                if (pindex < index)
+                {
+                    continue;
+                }
+
+                mz   = (kz<maxkz) ? kz : (kz-nz);
+                mhz  = mx*recipBoxVectors[2][0]+my*recipBoxVectors[2][1]+mz*recipBoxVectors[2][2];
+                m2   = mhx*mhx+mhy*mhy+mhz*mhz;
+                bmod = pme->bsplines_moduli[0][kx]*pme->bsplines_moduli[1][ky]*pme->bsplines_moduli[2][kz];
+
+                /* The zero frequency is excluded for Coulomb, but not for dispersion */
+                eterm  = (index == 0 ? 0.0 : pme_coulomb_eterm(pme,pme->ewaldcoeff,m2,bmod,volume));
+                determ = pme_dispersion_eterm(dispersionewaldcoeff,m2,bmod,volume);
+
+                if (pindex != index)
+                {
+                    /* On the Nyquist planes the frequency stored at -k is not exactly -m for triclinic boxes,
+                     * so the influence function is not quite even. Use its average over the pair, which is
+                     * what taking the real part of the unpacked result amounts to.
+                     */
+                    pmx  = (px<maxkx) ? px : (px-nx);
+                    pmy  = (py<maxky) ? py : (py-ny);
+                    pmz  = (pz<maxkz) ? pz : (pz-nz);
+                    mhx2 = pmx*recipBoxVectors[0][0];
+                    mhy2 = pmx*recipBoxVectors[1][0]+pmy*recipBoxVectors[1][1];
+                    mhz2 = pmx*recipBoxVectors[2][0]+pmy*recipBoxVectors[2][1]+pmz*recipBoxVectors[2][2];
+                    pm2  = mhx2*mhx2+mhy2*mhy2+mhz2*mhz2;
+                    pbmod = pme->bsplines_moduli[0][px]*pme->bsplines_moduli[1][py]*pme->bsplines_moduli[2][pz];
+                    eterm  = 0.5*(eterm + pme_coulomb_eterm(pme,pme->ewaldcoeff,pm2,pbmod,volume));
+                    determ = 0.5*(determ + pme_dispersion_eterm(dispersionewaldcoeff,pm2,pbmod,volume));
+                }
+
+                /* Separate the two transforms */
+                ptr  = pme->grid + index;
+                pptr = pme->grid + pindex;
+                ar   = 0.5*(ptr->re+pptr->re);
+                ai   = 0.5*(ptr->im-pptr->im);
+                br   = 0.5*(ptr->im+pptr->im);
+                bi   = 0.5*(pptr->re-ptr->re);
+
+                /* Both frequencies contribute to the energy, unless k and -k are the same point */
+                weight = (pindex == index ? 1.0 : 2.0);
+                esum  += weight*eterm*(ar*ar+ai*ai);
+                desum += weight*determ*(br*br+bi*bi);
+
+                /* Write back eterm*A(k) + i*determ*B(k), and the conjugates at -k */
+                ptr->re  = eterm*ar - determ*bi;
+                ptr->im  = eterm*ai + determ*br;
+                pptr->re = eterm*ar + determ*bi;
+                pptr->im = -eterm*ai + determ*br;
+            }
+        }
+    }
+
+    *energy = 0.5*esum;
+    *dispersionenergy = 0.5*desum;
+}
+
+
 static void
 pme_grid_interpolate_force(pme_t pme,
                            const Vec3 recipBoxVectors[3],
                            const vector<double>& charges,
-                           vector<Vec3>& forces)
+                           vector<Vec3>& forces,
+                           bool imaginary)
 {
     int       i;
+    int       atom;
     int       ix,iy,iz;
     int       x0index,y0index,z0index;
-    int       xindex,yindex,zindex;
-    int       index;
+    int       xindex[PME_MAX_ORDER],yindex[PME_MAX_ORDER],zindex[PME_MAX_ORDER];
     int       order;
     double    q;
     double *  thetax;
@@ -635,30 +1127,39 @@ pme_grid_interpolate_force(pme_t pme,
     double *  dthetax;
     double *  dthetay;
     double *  dthetaz;
-    double    tx,ty,tz;
-    double    dtx,dty,dtz;
+    double    tx,ty;
+    double    dtx,dty;
     double    fx,fy,fz;
+    double    sz,dsz;
     double    gridvalue;
     int       nx,ny,nz;
+    const t_complex * line;
+    double t_complex::* part;
 
+    part  = (imaginary ? &t_complex::im : &t_complex::re);
     nx    = pme->ngrid[0];
     ny    = pme->ngrid[1];
     nz    = pme->ngrid[2];
 
     order = pme->order;
 
-    /* This is almost identical to the charge spreading routine! */
+    /* This is almost identical to the charge spreading routine, including the sorted atom order! */
 
     for (i=0;i<pme->natoms;i++)
     {
-        fx = fy = fz = 0;
+        atom = pme->sortedatoms[i];
+        q = charges[atom];
+        if (q == 0)
+        {
+            continue;
+        }
 
-        q = charges[i];
+        fx = fy = fz = 0;
 
         /* Grid index for the actual atom position */
-        x0index = pme->particleindex[i][0];
-        y0index = pme->particleindex[i][1];
-        z0index = pme->particleindex[i][2];
+        x0index = pme->particleindex[atom][0];
+        y0index = pme->particleindex[atom][1];
+        z0index = pme->particleindex[atom][2];
 
         /* Bspline factors for this atom in each dimension , calculated from fractional coordinates */
         thetax  = &(pme->bsplines_theta[0][i*order]);
@@ -669,48 +1170,63 @@ pme_grid_interpolate_force(pme_t pme,
         dthetaz = &(pme->bsplines_dtheta[2][i*order]);
 
         /* See pme_grid_spread_charge() for comments about the order here, and only interpolation in one direction */
+        for (ix=0;ix<order;ix++)
+        {
+            xindex[ix] = ((x0index + ix) % nx)*ny*nz;
+            yindex[ix] = ((y0index + ix) % ny)*nz;
+            zindex[ix] = (z0index + ix) % nz;
+        }
 
         /* Since we will add order^3 (typically 4*4*4=64) terms to the force on each particle, we use temporary fx/fy/fz
          * variables, and only add it to memory forces[] at the end.
          */
         for (ix=0;ix<order;ix++)
         {
-            xindex = (x0index + ix) % pme->ngrid[0];
             /* Get both the bspline factor and its derivative with respect to the x coordinate! */
             tx     = thetax[ix];
             dtx    = dthetax[ix];
 
             for (iy=0;iy<order;iy++)
             {
-                yindex = (y0index + iy) % pme->ngrid[1];
                 /* bspline + derivative wrt y */
                 ty     = thetay[iy];
                 dty    = dthetay[iy];
+                line   = pme->grid + xindex[ix] + yindex[iy];
 
-                for (iz=0;iz<order;iz++)
+                /* Reduce along z first: sz is the spline weighted sum of the grid line, dsz uses the derivative.
+                 * The grid data is the fft+convoluted+ifft:d result, which must be real by definition.
+                 */
+                sz = dsz = 0;
+                if (z0index+order <= nz)
                 {
-                    /* Can be optimized, but we keep it simple here */
-                    zindex               = (z0index + iz) % pme->ngrid[2];
-                    /* bspline + derivative wrt z */
-                    tz                   = thetaz[iz];
-                    dtz                  = dthetaz[iz];
-                    index                = xindex*pme->ngrid[1]*pme->ngrid[2] + yindex*pme->ngrid[2] + zindex;
-
-                    /* Get the fft+convoluted+ifft:d data from the grid, which must be real by definition */
-                    /* Checking that the imaginary part is indeed zero might be a good check :-) */
-                    gridvalue            = pme->grid[index].re;
-
-                    /* The d component of the force is calculated by taking the derived bspline in dimension d, normal bsplines in the other two */
-                    fx                  += dtx*ty*tz*gridvalue;
-                    fy                  += tx*dty*tz*gridvalue;
-                    fz                  += tx*ty*dtz*gridvalue;
+                    line += z0index;
+                    for (iz=0;iz<order;iz++)
+                    {
+                        gridvalue = line[iz].*part;
+                        sz       += thetaz[iz]*gridvalue;
+                        dsz      += dthetaz[iz]*gridvalue;
+                    }
                 }
+                else
+                {
+                    for (iz=0;iz<order;iz++)
+                    {
+                        gridvalue = line[zindex[iz]].*part;
+                        sz       += thetaz[iz]*gridvalue;
+                        dsz      += dthetaz[iz]*gridvalue;
+                    }
+                }
+
+                /* The d component of the force is calculated by taking the derived bspline in dimension d, normal bsplines in the other two */
+                fx += dtx*ty*sz;
+                fy += tx*dty*sz;
+                fz += tx*ty*dsz;
             }
         }
         /* Update memory force, note that we multiply by charge and some box stuff */
-        forces[i][0] -= q*(fx*nx*recipBoxVectors[0][0]);
-        forces[i][1] -= q*(fx*nx*recipBoxVectors[1][0]+fy*ny*recipBoxVectors[1][1]);
-        forces[i][2] -= q*(fx*nx*recipBoxVectors[2][0]+fy*ny*recipBoxVectors[2][1]+fz*nz*recipBoxVectors[2][2]);
+        forces[atom][0] -= q*(fx*nx*recipBoxVectors[0][0]);
+        forces[atom][1] -= q*(fx*nx*recipBoxVectors[1][0]+fy*ny*recipBoxVectors[1][1]);
+        forces[atom][2] -= q*(fx*nx*recipBoxVectors[2][0]+fy*ny*recipBoxVectors[2][1]+fz*nz*recipBoxVectors[2][2]);
     }
 }
 
@@ -731,10 +1247,12 @@ pme_init(pme_t *       ppme,
 
     pme = (pme_t) malloc(sizeof(struct pme));
 
+    assert(pme_order <= PME_MAX_ORDER);
     pme->order       = pme_order;
     pme->epsilon_r   = epsilon_r;
     pme->ewaldcoeff  = ewaldcoeff;
     pme->natoms      = natoms;
+    pme->useries     = NULL;
 
     for (d=0;d<3;d++)
     {
@@ -745,6 +1263,8 @@ pme_init(pme_t *       ppme,
 
     pme->particlefraction = (rvec *)malloc(sizeof(rvec)*natoms);
     pme->particleindex    = (ivec *)malloc(sizeof(ivec)*natoms);
+    pme->sortedatoms      = (int *)malloc(sizeof(int)*natoms);
+    pme->linestart        = (int *)malloc(sizeof(int)*(ngrid[0]*ngrid[1]+1));
 
     /* Allocate charge grid storage */
     pme->grid        = (t_complex *)malloc(sizeof(t_complex)*ngrid[0]*ngrid[1]*ngrid[2]);
@@ -785,23 +1305,27 @@ int pme_exec(pme_t       pme,
      */
     pme_update_grid_index_and_fraction(pme,atomCoordinates,periodicBoxVectors,recipBoxVectors);
 
+    /* Bucket the atoms by grid line so spreading and interpolation sweep through the grid */
+    pme_sort_atoms(pme);
+
     /* Calculate bsplines (and their differentials) from current fractional coordinates, store in pme structure */
     pme_update_bsplines(pme);
 
     /* Spread the charges on grid (using newly calculated bsplines in the pme structure) */
-    pme_grid_spread_charge(pme, charges);
+    pme_grid_clear(pme);
+    pme_grid_spread_charge(pme, charges, false);
 
     /* do 3d-fft */
     fftpack_exec_3d(pme->fftplan,FFTPACK_FORWARD,pme->grid,pme->grid);
 
     /* solve in k-space */
-    pme_reciprocal_convolution(pme,periodicBoxVectors,recipBoxVectors,energy);
+    pme_reciprocal_convolution(pme,periodicBoxVectors,recipBoxVectors,NULL,energy);
 
     /* do 3d-invfft */
     fftpack_exec_3d(pme->fftplan,FFTPACK_BACKWARD,pme->grid,pme->grid);
 
     /* Get the particle forces from the grid and bsplines in the pme structure */
-    pme_grid_interpolate_force(pme,recipBoxVectors,charges,forces);
+    pme_grid_interpolate_force(pme,recipBoxVectors,charges,forces,false);
 
     return 0;
 }
@@ -829,11 +1353,15 @@ int pme_exec_dpme(pme_t       pme,
      */
     pme_update_grid_index_and_fraction(pme,atomCoordinates,periodicBoxVectors,recipBoxVectors);
 
+    /* Bucket the atoms by grid line so spreading and interpolation sweep through the grid */
+    pme_sort_atoms(pme);
+
     /* Calculate bsplines (and their differentials) from current fractional coordinates, store in pme structure */
     pme_update_bsplines(pme);
 
     /* Spread the charges on grid (using newly calculated bsplines in the pme structure) */
-    pme_grid_spread_charge(pme, c6s);
+    pme_grid_clear(pme);
+    pme_grid_spread_charge(pme, c6s, false);
 
     /* do 3d-fft */
     fftpack_exec_3d(pme->fftplan,FFTPACK_FORWARD,pme->grid,pme->grid);
@@ -845,7 +1373,189 @@ int pme_exec_dpme(pme_t       pme,
     fftpack_exec_3d(pme->fftplan,FFTPACK_BACKWARD,pme->grid,pme->grid);
 
     /* Get the particle forces from the grid and bsplines in the pme structure */
-    pme_grid_interpolate_force(pme,recipBoxVectors,c6s,forces);
+    pme_grid_interpolate_force(pme,recipBoxVectors,c6s,forces,false);
+
+    return 0;
+}
+
+
+
+int pme_exec_packed(pme_t       pme,
+                    double      dispersionewaldcoeff,
+                    const vector<Vec3>& atomCoordinates,
+                    vector<Vec3>& forces,
+                    const vector<double>& charges,
+                    const vector<double>& c6s,
+                    const Vec3 periodicBoxVectors[3],
+                    double* energy,
+                    double* dispersionenergy)
+{
+    Vec3 recipBoxVectors[3];
+    invert_box_vectors(periodicBoxVectors, recipBoxVectors);
+
+    /* The grid indices and bsplines only depend on the grid, so they are shared by both terms */
+    pme_update_grid_index_and_fraction(pme,atomCoordinates,periodicBoxVectors,recipBoxVectors);
+    pme_sort_atoms(pme);
+    pme_update_bsplines(pme);
+
+    /* Charges go in the real part of the grid, c6 coefficients in the imaginary part */
+    pme_grid_clear(pme);
+    pme_grid_spread_charge(pme, charges, false);
+    pme_grid_spread_charge(pme, c6s, true);
+
+    /* One forward and one backward transform serve both convolutions */
+    fftpack_exec_3d(pme->fftplan,FFTPACK_FORWARD,pme->grid,pme->grid);
+    pme_packed_reciprocal_convolution(pme,dispersionewaldcoeff,periodicBoxVectors,recipBoxVectors,energy,dispersionenergy);
+    fftpack_exec_3d(pme->fftplan,FFTPACK_BACKWARD,pme->grid,pme->grid);
+
+    pme_grid_interpolate_force(pme,recipBoxVectors,charges,forces,false);
+    pme_grid_interpolate_force(pme,recipBoxVectors,c6s,forces,true);
+
+    return 0;
+}
+
+
+int pme_exec_p3m(pme_t       pme,
+                 const vector<Vec3>& atomCoordinates,
+                 vector<Vec3>& forces,
+                 const vector<double>& charges,
+                 const Vec3 periodicBoxVectors[3],
+                 p3m_influence_function& influence,
+                 double* energy)
+{
+    Vec3 recipBoxVectors[3];
+    invert_box_vectors(periodicBoxVectors, recipBoxVectors);
+
+    /* The influence function only depends on the box, the grid and the Ewald coefficient, so reuse it when possible */
+    bool valid = (influence.ewaldcoeff == pme->ewaldcoeff && (int) influence.values.size() == pme->ngrid[0]*pme->ngrid[1]*pme->ngrid[2]);
+    for (int d = 0; d < 3 && valid; d++)
+    {
+        valid = (influence.ngrid[d] == pme->ngrid[d] && influence.box[d] == periodicBoxVectors[d]);
+    }
+    if (!valid)
+    {
+        p3m_calculate_influence_function(pme,periodicBoxVectors,recipBoxVectors,influence.values);
+        influence.ewaldcoeff = pme->ewaldcoeff;
+        for (int d = 0; d < 3; d++)
+        {
+            influence.ngrid[d] = pme->ngrid[d];
+            influence.box[d]   = periodicBoxVectors[d];
+        }
+    }
+
+    /* Spreading and interpolation are the same as for SPME, only the convolution differs */
+    pme_update_grid_index_and_fraction(pme,atomCoordinates,periodicBoxVectors,recipBoxVectors);
+    pme_sort_atoms(pme);
+    pme_update_bsplines(pme);
+    pme_grid_clear(pme);
+    pme_grid_spread_charge(pme, charges, false);
+    fftpack_exec_3d(pme->fftplan,FFTPACK_FORWARD,pme->grid,pme->grid);
+    pme_reciprocal_convolution(pme,periodicBoxVectors,recipBoxVectors,&influence.values[0],energy);
+    fftpack_exec_3d(pme->fftplan,FFTPACK_BACKWARD,pme->grid,pme->grid);
+    pme_grid_interpolate_force(pme,recipBoxVectors,charges,forces,false);
+
+    return 0;
+}
+
+
+int pme_exec_useries(pme_t       pme,
+                     double      spacing,
+                     const vector<Vec3>& atomCoordinates,
+                     vector<Vec3>& forces,
+                     const vector<double>& charges,
+                     const Vec3 periodicBoxVectors[3],
+                     double* energy)
+{
+    Vec3 recipBoxVectors[3];
+    invert_box_vectors(periodicBoxVectors, recipBoxVectors);
+
+    /* The bands and their influence functions only depend on the box and the spacing, so reuse them when possible */
+    if (pme->useries == NULL)
+    {
+        pme->useries = new useries_data();
+        pme->useries->spacing = 0.0;
+    }
+    useries_data& data = *pme->useries;
+    bool valid = (data.spacing == spacing);
+    for (int d = 0; d < 3 && valid; d++)
+    {
+        valid = (data.box[d] == periodicBoxVectors[d]);
+    }
+    if (!valid)
+    {
+        useries_setup(pme,spacing,periodicBoxVectors,recipBoxVectors);
+    }
+
+    /* Spreading and interpolation on each grid are the same as for SPME, only the convolution differs */
+    *energy = 0;
+    for (int band = 0; band < (int) data.influence.size(); band++)
+    {
+        pme_t bandpme = (band == 0 ? pme : data.bands[band-1]);
+        double bandenergy;
+        pme_update_grid_index_and_fraction(bandpme,atomCoordinates,periodicBoxVectors,recipBoxVectors);
+        pme_sort_atoms(bandpme);
+        pme_update_bsplines(bandpme);
+        pme_grid_clear(bandpme);
+        pme_grid_spread_charge(bandpme, charges, false);
+        fftpack_exec_3d(bandpme->fftplan,FFTPACK_FORWARD,bandpme->grid,bandpme->grid);
+        pme_reciprocal_convolution(bandpme,periodicBoxVectors,recipBoxVectors,&data.influence[band][0],&bandenergy);
+        fftpack_exec_3d(bandpme->fftplan,FFTPACK_BACKWARD,bandpme->grid,bandpme->grid);
+        pme_grid_interpolate_force(bandpme,recipBoxVectors,charges,forces,false);
+        *energy += bandenergy;
+    }
+
+    /* Sum the widest Gaussians directly. For each wave vector m, the energy is c(m)*|S(m)|^2, counting m and -m
+     * together, where S(m) is the sum of q_j*exp(2*pi*i*m.r_j).
+     */
+    int numwavevectors = data.wavevectors.size();
+    if (numwavevectors == 0)
+    {
+        return 0;
+    }
+    int natoms = atomCoordinates.size();
+    vector<double> fraction(3*natoms);
+    for (int i = 0; i < natoms; i++)
+    {
+        for (int d = 0; d < 3; d++)
+        {
+            const Vec3& r = atomCoordinates[i];
+            fraction[3*i+d] = r[0]*recipBoxVectors[0][d]+r[1]*recipBoxVectors[1][d]+r[2]*recipBoxVectors[2][d];
+        }
+    }
+    vector<double> cosphase(natoms), sinphase(natoms);
+    for (int k = 0; k < numwavevectors; k++)
+    {
+        Vec3 m = data.wavevectors[k];
+        double mhx = m[0]*recipBoxVectors[0][0];
+        double mhy = m[0]*recipBoxVectors[1][0]+m[1]*recipBoxVectors[1][1];
+        double mhz = m[0]*recipBoxVectors[2][0]+m[1]*recipBoxVectors[2][1]+m[2]*recipBoxVectors[2][2];
+        double sre = 0, sim = 0;
+        for (int i = 0; i < natoms; i++)
+        {
+            if (charges[i] == 0)
+            {
+                continue;
+            }
+            double phase = 2*M_PI*(m[0]*fraction[3*i]+m[1]*fraction[3*i+1]+m[2]*fraction[3*i+2]);
+            cosphase[i] = cos(phase);
+            sinphase[i] = sin(phase);
+            sre += charges[i]*cosphase[i];
+            sim += charges[i]*sinphase[i];
+        }
+        double coefficient = data.wavecoefficients[k];
+        *energy += coefficient*(sre*sre+sim*sim);
+        for (int i = 0; i < natoms; i++)
+        {
+            if (charges[i] == 0)
+            {
+                continue;
+            }
+            double scale = 4*M_PI*coefficient*charges[i]*(sre*sinphase[i]-sim*cosphase[i]);
+            forces[i][0] += scale*mhx;
+            forces[i][1] += scale*mhy;
+            forces[i][2] += scale*mhz;
+        }
+    }
 
     return 0;
 }
@@ -867,9 +1577,18 @@ pme_destroy(pme_t    pme)
 
     free(pme->particlefraction);
     free(pme->particleindex);
+    free(pme->sortedatoms);
+    free(pme->linestart);
 
     fftpack_destroy(pme->fftplan);
 
+    if (pme->useries != NULL)
+    {
+        for (pme_t band : pme->useries->bands)
+            pme_destroy(band);
+        delete pme->useries;
+    }
+
     /* destroy structure itself */
     free(pme);
 
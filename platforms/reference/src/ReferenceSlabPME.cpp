@@ -0,0 +1,167 @@
+/* Portions copyright (c) 2026 Stanford University and Simbios.
+ * Contributors: Pande Group
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include "ReferenceSlabPME.h"
+#include "openmm/reference/SimTKOpenMMRealType.h"
+#include "openmm/OpenMMException.h"
+
+using std::vector;
+using namespace NativeNonbondedPlugin;
+using namespace OpenMM;
+
+ReferenceSlabPME::ReferenceSlabPME(double alpha, const int gridSize[3], double tolerance) : alpha(alpha), tolerance(tolerance) {
+    for (int i = 0; i < 3; i++)
+        this->gridSize[i] = gridSize[i];
+    reducedGridSize = gridSize[2];
+}
+
+ReferenceSlabPME::~ReferenceSlabPME() {
+    for (auto& data : pmeData)
+        pme_destroy(data.second);
+}
+
+double ReferenceSlabPME::calculate(const vector<Vec3>& atomCoordinates, const vector<double>& charges, const Vec3* boxVectors,
+                                   double minGap, vector<Vec3>& forces) {
+    if (boxVectors[2][0] != 0.0 || boxVectors[2][1] != 0.0)
+        throw OpenMMException("NativeNonbondedForce: The slab correction requires the third periodic box vector to be parallel to the z axis");
+    int numParticles = atomCoordinates.size();
+    if (numParticles == 0)
+        return 0.0;
+
+    // Find the largest gap between particles along z.  Heights are measured from the particle just above it.
+
+    double boxHeight = boxVectors[2][2];
+    vector<double> z(numParticles);
+    for (int i = 0; i < numParticles; i++)
+        z[i] = atomCoordinates[i][2]-floor(atomCoordinates[i][2]/boxHeight)*boxHeight;
+    vector<double> sortedZ = z;
+    sort(sortedZ.begin(), sortedZ.end());
+    double bottom = sortedZ[0];
+    double gap = sortedZ[0]+boxHeight-sortedZ[numParticles-1];
+    for (int i = 1; i < numParticles; i++)
+        if (sortedZ[i]-sortedZ[i-1] > gap) {
+            gap = sortedZ[i]-sortedZ[i-1];
+            bottom = sortedZ[i];
+        }
+    double slabHeight = boxHeight-gap;
+
+    // Shrink the box to the slab plus the narrowest allowed gap, keeping the grid spacing along z.
+
+    double height = std::min(boxHeight, slabHeight+minGap);
+    reducedGridSize = std::min(gridSize[2], std::max(6, (int) ceil(gridSize[2]*height/boxHeight)));
+    Vec3 reducedBox[3] = {boxVectors[0], boxVectors[1], Vec3(0, 0, height)};
+    vector<Vec3> reducedCoordinates(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        double s = z[i]-bottom;
+        if (s < 0)
+            s += boxHeight;
+        reducedCoordinates[i] = Vec3(atomCoordinates[i][0], atomCoordinates[i][1], s);
+    }
+    pme_t& pmedata = pmeData[reducedGridSize];
+    if (pmedata == NULL) {
+        int reducedGrid[3] = {gridSize[0], gridSize[1], reducedGridSize};
+        pme_init(&pmedata, alpha, numParticles, reducedGrid, 5, 1);
+    }
+    double energy = 0.0;
+    pme_exec(pmedata, reducedCoordinates, forces, charges, reducedBox, &energy);
+
+    // Add the Yeh-Berkowitz correction for the dipole moment along z.  The extra terms for a net charge make it
+    // independent of the origin.  A net charge also requires the energy of the neutralizing background, which
+    // is normally omitted because it is constant, but here depends on the height of the reduced box.
+
+    double volume = reducedBox[0][0]*reducedBox[1][1]*height;
+    double totalCharge = 0.0, dipole = 0.0, quadrupole = 0.0;
+    for (int i = 0; i < numParticles; i++) {
+        double s = reducedCoordinates[i][2];
+        totalCharge += charges[i];
+        dipole += charges[i]*s;
+        quadrupole += charges[i]*s*s;
+    }
+    double scale = 2*M_PI*ONE_4PI_EPS0/volume;
+    energy += scale*(dipole*dipole - totalCharge*quadrupole - totalCharge*totalCharge*height*height/12);
+    energy -= M_PI*ONE_4PI_EPS0*totalCharge*totalCharge/(2*alpha*alpha*volume);
+    for (int i = 0; i < numParticles; i++)
+        forces[i][2] -= 2*scale*charges[i]*(dipole - totalCharge*reducedCoordinates[i][2]);
+
+    // Remove the interactions with the periodic copies of the slab that remain.
+
+    energy -= calculateLayerCorrection(reducedCoordinates, charges, reducedBox, slabHeight, forces);
+    return energy;
+}
+
+double ReferenceSlabPME::calculateLayerCorrection(const vector<Vec3>& atomCoordinates, const vector<double>& charges,
+                                                  const Vec3* boxVectors, double slabHeight, vector<Vec3>& forces) const {
+    // For each in-plane wave vector k, the periodic copies of the slab at z+n*h (n != 0) contribute
+    // 2*pi/(A*|k|) * 2*cosh(|k|*(zi-zj))/(exp(|k|*h)-1) * cos(k.(ri-rj)) to the interaction between particles
+    // i and j.  Expanding the cosines into products gives four structure factors.  The terms decay as
+    // exp(-|k|*gap), which determines where the sum is truncated.
+
+    int numParticles = atomCoordinates.size();
+    double height = boxVectors[2][2];
+    double area = boxVectors[0][0]*boxVectors[1][1];
+    double maxK = -log(tolerance)/(height-slabHeight);
+    double g1x = 2*M_PI/boxVectors[0][0];
+    double g1y = -2*M_PI*boxVectors[1][0]/area;
+    double g2y = 2*M_PI/boxVectors[1][1];
+    int maxM1 = (int) floor(maxK/g1x);
+    int maxM2 = (int) floor(maxK*sqrt(boxVectors[1].dot(boxVectors[1]))/(2*M_PI));
+    vector<double> cosk(numParticles), sink(numParticles), coshk(numParticles), sinhk(numParticles);
+    double energy = 0.0;
+
+    // Only half the wave vectors are summed, since k and -k give the same contribution.
+
+    for (int m2 = 0; m2 <= maxM2; m2++)
+        for (int m1 = (m2 == 0 ? 1 : -maxM1); m1 <= maxM1; m1++) {
+            double kx = m1*g1x;
+            double ky = m1*g1y + m2*g2y;
+            double k = sqrt(kx*kx + ky*ky);
+            if (k > maxK)
+                continue;
+            double cc = 0.0, sc = 0.0, cs = 0.0, ss = 0.0;
+            for (int i = 0; i < numParticles; i++) {
+                double phase = kx*atomCoordinates[i][0] + ky*atomCoordinates[i][1];
+                double kz = k*(atomCoordinates[i][2]-0.5*slabHeight);
+                cosk[i] = cos(phase);
+                sink[i] = sin(phase);
+                coshk[i] = cosh(kz);
+                sinhk[i] = sinh(kz);
+                cc += charges[i]*cosk[i]*coshk[i];
+                sc += charges[i]*sink[i]*coshk[i];
+                cs += charges[i]*cosk[i]*sinhk[i];
+                ss += charges[i]*sink[i]*sinhk[i];
+            }
+            double weight = 4*M_PI*ONE_4PI_EPS0/(area*k*expm1(k*height));
+            energy += weight*(cc*cc + sc*sc - cs*cs - ss*ss);
+            for (int i = 0; i < numParticles; i++) {
+                double dEdRho = 2*weight*charges[i]*(-cc*sink[i]*coshk[i] + sc*cosk[i]*coshk[i] + cs*sink[i]*sinhk[i] - ss*cosk[i]*sinhk[i]);
+                double dEdZ = 2*weight*charges[i]*k*(cc*cosk[i]*sinhk[i] + sc*sink[i]*sinhk[i] - cs*cosk[i]*coshk[i] - ss*sink[i]*coshk[i]);
+
+                // This energy is subtracted, so the force is its gradient.
+
+                forces[i] += Vec3(dEdRho*kx, dEdRho*ky, dEdZ);
+            }
+        }
+    return energy;
+}
@@ -0,0 +1,69 @@
+/* Portions copyright (c) 2026 Stanford University and Simbios.
+ * Contributors: Pande Group
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "ReferenceTiledAllPairs.h"
+#include <map>
+
+using namespace NativeNonbondedPlugin;
+using namespace std;
+
+ReferenceTiledAllPairs::ReferenceTiledAllPairs(int numParticles, const vector<set<int> >& exclusions) : numParticles(numParticles) {
+    int numBlocks = (numParticles+TileSize-1)/TileSize;
+    map<pair<int, int>, int> maskIndex;
+    for (int x = 0; x < numBlocks; x++)
+        for (int y = 0; y <= x; y++) {
+            tileX.push_back(x);
+            tileY.push_back(y);
+            tileMask.push_back(-1);
+            if (x == y) {
+                // On the diagonal, particle i only interacts with the particles j < i in the same block.
+
+                tileMask.back() = maskIndex.size();
+                maskIndex[make_pair(x, y)] = tileMask.back();
+                for (int i = 0; i < TileSize; i++)
+                    masks.push_back(~((1u<<i)-1));
+            }
+        }
+    for (int i = 0; i < numParticles; i++)
+        for (int j : exclusions[i]) {
+            if (j >= i)
+                continue;
+            pair<int, int> key(i/TileSize, j/TileSize);
+            auto entry = maskIndex.find(key);
+            if (entry == maskIndex.end()) {
+                int tile = key.first*(key.first+1)/2+key.second;
+                tileMask[tile] = maskIndex.size();
+                entry = maskIndex.insert(make_pair(key, tileMask[tile])).first;
+                masks.resize(masks.size()+TileSize, 0);
+            }
+            masks[entry->second*TileSize+i%TileSize] |= 1u<<(j%TileSize);
+        }
+}
+
+bool ReferenceTiledAllPairs::isFasterThanNeighborList(int numParticles) {
+    // The crossover was measured on a single thread for a 1 nm cutoff and a density of 100 particles/nm^3.
+    // It lies between 1000 and 1500 particles.  With more threads the tiles become relatively cheaper,
+    // so this is conservative.
+
+    return (numParticles < 1000);
+}
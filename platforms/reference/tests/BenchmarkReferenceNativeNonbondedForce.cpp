@@ -0,0 +1,105 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2026 Stanford University and the Authors.           *
+ * Authors:                                                                   *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This program measures the time per call to evaluate small systems repeatedly, as a caller that drives
+ * its own integration loop would.  It is not run as part of the test suite.
+ */
+
+#include "ReferenceNativeNonbondedPluginTests.h"
+#include "NativeNonbondedForce.h"
+#include "openmm/Context.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "sfmt/SFMT.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+using namespace NativeNonbondedPlugin;
+using namespace OpenMM;
+using namespace std;
+
+void benchmark(const char* name, NativeNonbondedForce::NonbondedMethod method, int numParticles, double boxSize, int numCalls) {
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NativeNonbondedForce* force = new NativeNonbondedForce();
+    force->setNonbondedMethod(method);
+    force->setCutoffDistance(min(1.0, 0.5*boxSize));
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        force->addParticle(i%2 == 0 ? 0.5 : -0.5, 0.3, 0.5);
+        positions[i] = Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*boxSize;
+    }
+    system.addForce(force);
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+
+    // Each call moves the particles slightly, as a time step would.
+
+    vector<Vec3> forces;
+    double energy = 0.0;
+    auto start = chrono::steady_clock::now();
+    for (int call = 0; call < numCalls; call++) {
+        positions[call%numParticles][0] += 1e-4;
+        context.setPositions(positions);
+        State state = context.getState(State::Forces | State::Energy);
+        energy += state.getPotentialEnergy();
+    }
+    auto middle = chrono::steady_clock::now();
+    for (int call = 0; call < numCalls; call++) {
+        positions[call%numParticles][0] += 1e-4;
+        energy += force->computeForcesAndEnergyInContext(context, positions, forces);
+    }
+    auto end = chrono::steady_clock::now();
+    double stateTime = chrono::duration<double, micro>(middle-start).count()/numCalls;
+    double directTime = chrono::duration<double, micro>(end-middle).count()/numCalls;
+    printf("%-24s %6d particles   getState: %10.1f us/call   computeForcesAndEnergyInContext: %10.1f us/call\n", name, numParticles, stateTime, directTime);
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        initializeTests(argc, argv);
+        benchmark("NoCutoff", NativeNonbondedForce::NoCutoff, 30, 3.0, 10000);
+        benchmark("CutoffNonPeriodic", NativeNonbondedForce::CutoffNonPeriodic, 300, 3.0, 1000);
+        benchmark("PME", NativeNonbondedForce::PME, 300, 2.2, 200);
+        benchmark("PME", NativeNonbondedForce::PME, 3000, 4.6, 20);
+    }
+    catch(const exception& e) {
+        printf("exception: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -31,6 +31,812 @@
 
 #include "ReferenceNativeNonbondedPluginTests.h"
 #include "TestNativeNonbondedForce.h"
+#include "openmm/VirtualSite.h"
+
+/**
+ * Add a neutral set of random dimers to a System.  Every force receives the same particles, and is added to the
+ * System in the force group given by its position in the list.  The two particles of each dimer interact only
+ * through an exception whose charge product is exceptionScale times the charge of the first one, so they are
+ * excluded from each other if it is 0.  The dimers fill a cube of the given size, which is also used as the
+ * periodic box.
+ */
+vector<Vec3> createRandomDimers(System& system, const vector<NativeNonbondedForce*>& forces, int numMolecules, double size,
+                                double epsilon, double exceptionScale, double cutoff) {
+    system.setDefaultPeriodicBoxVectors(Vec3(size, 0, 0), Vec3(0, size, 0), Vec3(0, 0, size));
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions(2*numMolecules);
+    for (int i = 0; i < numMolecules; i++) {
+        system.addParticle(1.0);
+        system.addParticle(1.0);
+        double charge = 0.2+0.6*genrand_real2(sfmt);
+        for (NativeNonbondedForce* force : forces) {
+            force->addParticle(charge, 0.2, epsilon);
+            force->addParticle(-charge, 0.2, epsilon);
+            force->addException(2*i, 2*i+1, exceptionScale*charge, 0.2, 0.0);
+        }
+        positions[2*i] = Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*size;
+        positions[2*i+1] = positions[2*i]+Vec3(0.1, 0.0, 0.0);
+    }
+    for (int i = 0; i < (int) forces.size(); i++) {
+        forces[i]->setCutoffDistance(cutoff);
+        forces[i]->setForceGroup(i);
+        system.addForce(forces[i]);
+    }
+    return positions;
+}
+
+/**
+ * Compute the RMS difference between the forces in two States, relative to the RMS force in the reference.
+ */
+double computeRelativeForceError(const State& state, const State& reference) {
+    double diff = 0.0, norm = 0.0;
+    for (int i = 0; i < (int) state.getForces().size(); i++) {
+        Vec3 delta = state.getForces()[i]-reference.getForces()[i];
+        diff += delta.dot(delta);
+        norm += reference.getForces()[i].dot(reference.getForces()[i]);
+    }
+    return sqrt(diff/norm);
+}
+
+/**
+ * Check that the energy and forces computed by one set of force groups match those computed by another, and
+ * return the relative force error.
+ */
+double compareToReference(Context& context, int groups, int referenceGroups, double energyTol, double forceTol) {
+    State state = context.getState(State::Forces | State::Energy, false, groups);
+    State reference = context.getState(State::Forces | State::Energy, false, referenceGroups);
+    ASSERT_EQUAL_TOL(reference.getPotentialEnergy(), state.getPotentialEnergy(), energyTol);
+    double error = computeRelativeForceError(state, reference);
+    ASSERT(error < forceTol);
+    return error;
+}
+
+void testMSM(Platform& platform) {
+    // Compare MSM to a much more accurate PME calculation.
+
+    System system;
+    NativeNonbondedForce* msm = new NativeNonbondedForce();
+    NativeNonbondedForce* pme = new NativeNonbondedForce();
+    msm->setNonbondedMethod(NativeNonbondedForce::MSM);
+    pme->setNonbondedMethod(NativeNonbondedForce::PME);
+    pme->setEwaldErrorTolerance(1e-6);
+    vector<Vec3> positions = createRandomDimers(system, {msm, pme}, 40, 2.5, 0.5, 0.0, 0.8);
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+    int numLevels, nx, ny, nz;
+    msm->getMSMParametersInContext(context, numLevels, nx, ny, nz);
+    ASSERT(numLevels > 1);
+    ASSERT_EQUAL(0, nx%(1<<(numLevels-1)));
+    ASSERT_EQUAL(0, ny%(1<<(numLevels-1)));
+    ASSERT_EQUAL(0, nz%(1<<(numLevels-1)));
+    compareToReference(context, 1<<0, 1<<1, 1e-3, 5e-3);
+}
+
+void testRandomBatchEwald(Platform& platform) {
+    // Create a neutral system of random charges, with one force using Ewald and another using RBE.  The
+    // reciprocal space parts are put in separate force groups so they can be compared individually.
+
+    const int numParticles = 30;
+    const double boxSize = 3.0;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, 1.1*boxSize, 0), Vec3(0, 0, 0.9*boxSize));
+    NativeNonbondedForce* ewald = new NativeNonbondedForce();
+    NativeNonbondedForce* rbe = new NativeNonbondedForce();
+    ewald->setNonbondedMethod(NativeNonbondedForce::Ewald);
+    ewald->setReciprocalSpaceForceGroup(1);
+    rbe->setNonbondedMethod(NativeNonbondedForce::RandomBatchEwald);
+    rbe->setRBEBatchSize(200);
+    rbe->setRandomNumberSeed(5);
+    rbe->setForceGroup(2);
+    rbe->setReciprocalSpaceForceGroup(3);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        double charge = (i%2 == 0 ? 0.5 : -0.5);
+        ewald->addParticle(charge, 0.2, 0.5);
+        rbe->addParticle(charge, 0.2, 0.5);
+        positions[i] = Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*boxSize;
+    }
+    for (NativeNonbondedForce* force : {ewald, rbe}) {
+        force->setCutoffDistance(1.0);
+        system.addForce(force);
+    }
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+
+    // The direct space parts should be identical.
+
+    State direct1 = context.getState(State::Forces | State::Energy, false, 1<<0);
+    State direct2 = context.getState(State::Forces | State::Energy, false, 1<<2);
+    ASSERT_EQUAL_TOL(direct1.getPotentialEnergy(), direct2.getPotentialEnergy(), 1e-10);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(direct1.getForces()[i], direct2.getForces()[i], 1e-10);
+
+    // Averaged over many batches, the reciprocal space part should converge to the Ewald result.
+
+    State recip1 = context.getState(State::Forces | State::Energy, false, 1<<1);
+    const int numBatches = 1000;
+    double recipEnergy = 0.0;
+    vector<Vec3> recipForces(numParticles);
+    for (int batch = 0; batch < numBatches; batch++) {
+        State recip2 = context.getState(State::Forces | State::Energy, false, 1<<3);
+        recipEnergy += recip2.getPotentialEnergy()/numBatches;
+        for (int i = 0; i < numParticles; i++)
+            recipForces[i] += recip2.getForces()[i]/numBatches;
+    }
+    ASSERT_EQUAL_TOL(recip1.getPotentialEnergy(), recipEnergy, 0.05);
+    double diff = 0.0, norm = 0.0;
+    for (int i = 0; i < numParticles; i++) {
+        Vec3 delta = recipForces[i]-recip1.getForces()[i];
+        diff += delta.dot(delta);
+        norm += recip1.getForces()[i].dot(recip1.getForces()[i]);
+    }
+    ASSERT(sqrt(diff/norm) < 0.1);
+
+    // A second Context with the same seed should sample the same sequence of batches.
+
+    VerletIntegrator integrator2(0.001);
+    Context context2(system, integrator2, platform);
+    context2.setPositions(positions);
+    VerletIntegrator integrator3(0.001);
+    Context context3(system, integrator3, platform);
+    context3.setPositions(positions);
+    State state2 = context2.getState(State::Forces, false, 1<<3);
+    State state3 = context3.getState(State::Forces, false, 1<<3);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(state2.getForces()[i], state3.getForces()[i], 1e-10);
+}
+
+void testP3M(Platform& platform) {
+    // Compare PME and P3M on the same coarse grid to a PME calculation on a much finer one.  All three use
+    // the same alpha, so the direct space parts are identical and any differences come from the mesh.
+
+    const double alpha = 3.0;
+    System system;
+    NativeNonbondedForce* reference = new NativeNonbondedForce();
+    NativeNonbondedForce* pme = new NativeNonbondedForce();
+    NativeNonbondedForce* p3m = new NativeNonbondedForce();
+    reference->setNonbondedMethod(NativeNonbondedForce::PME);
+    reference->setPMEParameters(alpha, 64, 64, 64);
+    pme->setNonbondedMethod(NativeNonbondedForce::PME);
+    pme->setPMEParameters(alpha, 12, 12, 12);
+    p3m->setNonbondedMethod(NativeNonbondedForce::P3M);
+    p3m->setPMEParameters(alpha, 12, 12, 12);
+    vector<Vec3> positions = createRandomDimers(system, {reference, pme, p3m}, 40, 2.5, 0.5, 0.0, 0.8);
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+    double alphaInContext;
+    int nx, ny, nz;
+    p3m->getPMEParametersInContext(context, alphaInContext, nx, ny, nz);
+    ASSERT_EQUAL_TOL(alpha, alphaInContext, 1e-10);
+    ASSERT_EQUAL(12, nx);
+    State state0 = context.getState(State::Forces | State::Energy, false, 1<<0);
+    State state1 = context.getState(State::Forces | State::Energy, false, 1<<1);
+    State state2 = context.getState(State::Forces | State::Energy, false, 1<<2);
+    double pmeError = computeRelativeForceError(state1, state0);
+    double p3mError = computeRelativeForceError(state2, state0);
+    ASSERT(p3mError < pmeError);
+    ASSERT(p3mError < 2e-3);
+    ASSERT(fabs(state2.getPotentialEnergy()-state0.getPotentialEnergy()) < fabs(state1.getPotentialEnergy()-state0.getPotentialEnergy()));
+
+    // When the grids are chosen automatically, P3M should pick a coarser one than PME but give nearly the same result.
+
+    pme->setPMEParameters(0.0, 0, 0, 0);
+    p3m->setPMEParameters(0.0, 0, 0, 0);
+    context.reinitialize(true);
+    int pmeX, pmeY, pmeZ, p3mX, p3mY, p3mZ;
+    double pmeAlpha, p3mAlpha;
+    pme->getPMEParametersInContext(context, pmeAlpha, pmeX, pmeY, pmeZ);
+    p3m->getPMEParametersInContext(context, p3mAlpha, p3mX, p3mY, p3mZ);
+    ASSERT_EQUAL_TOL(pmeAlpha, p3mAlpha, 1e-10);
+    ASSERT(p3mX < pmeX);
+    ASSERT(p3mY < pmeY);
+    ASSERT(p3mZ < pmeZ);
+    compareToReference(context, 1<<2, 1<<1, 1e-3, 1e-3);
+}
+
+void testFMM(Platform& platform) {
+    // Compare FMM to an exact calculation on a cluster of random dimers.  One exclusion connects particles
+    // on opposite sides of the cluster, so it must be removed from the far field.
+
+    const int numMolecules = 300;
+    const int numParticles = 2*numMolecules;
+    const double size = 4.0;
+    System system;
+    NativeNonbondedForce* fmm = new NativeNonbondedForce();
+    NativeNonbondedForce* exact = new NativeNonbondedForce();
+    NativeNonbondedForce* cutoff = new NativeNonbondedForce();
+    fmm->setNonbondedMethod(NativeNonbondedForce::FMM);
+    exact->setNonbondedMethod(NativeNonbondedForce::NoCutoff);
+    cutoff->setNonbondedMethod(NativeNonbondedForce::CutoffNonPeriodic);
+    vector<Vec3> positions = createRandomDimers(system, {fmm, exact, cutoff}, numMolecules, size, 0.0, 0.2, 1.0);
+    positions[0] = Vec3(0, 0, 0);
+    positions[numParticles-1] = Vec3(size, size, size);
+    for (NativeNonbondedForce* force : {fmm, exact, cutoff})
+        force->addException(0, numParticles-1, 0.0, 1.0, 0.0);
+    ASSERT(!fmm->usesPeriodicBoundaryConditions());
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+    compareToReference(context, 1<<0, 1<<1, 5e-4, 1e-3);
+
+    // Without charges, FMM should compute the same Lennard-Jones interaction as CutoffNonPeriodic.
+
+    for (NativeNonbondedForce* force : {fmm, cutoff}) {
+        for (int i = 0; i < numParticles; i++)
+            force->setParticleParameters(i, 0.0, 0.2, 0.5);
+        for (int i = 0; i < numMolecules; i++)
+            force->setExceptionParameters(i, 2*i, 2*i+1, 0.0, 0.2, 0.5);
+        force->updateParametersInContext(context);
+    }
+    State state0 = context.getState(State::Forces | State::Energy, false, 1<<0);
+    State state2 = context.getState(State::Forces | State::Energy, false, 1<<2);
+    ASSERT_EQUAL_TOL(state2.getPotentialEnergy(), state0.getPotentialEnergy(), 1e-10);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(state2.getForces()[i], state0.getForces()[i], 1e-10);
+}
+
+void testUSeries(Platform& platform) {
+    // Compare the u-series method and PME, both with automatically chosen parameters, to a PME calculation
+    // on a much finer grid.
+
+    const int numMolecules = 40;
+    const int numParticles = 2*numMolecules;
+    System system;
+    NativeNonbondedForce* reference = new NativeNonbondedForce();
+    NativeNonbondedForce* pme = new NativeNonbondedForce();
+    NativeNonbondedForce* useries = new NativeNonbondedForce();
+    reference->setNonbondedMethod(NativeNonbondedForce::PME);
+    reference->setPMEParameters(4.0, 64, 64, 64);
+    pme->setNonbondedMethod(NativeNonbondedForce::PME);
+    useries->setNonbondedMethod(NativeNonbondedForce::USeries);
+    vector<Vec3> positions = createRandomDimers(system, {reference, pme, useries}, numMolecules, 2.5, 0.0, 0.0, 0.8);
+    useries->setReciprocalSpaceForceGroup(3);
+    ASSERT(useries->usesPeriodicBoundaryConditions());
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+
+    // The narrowest Gaussian on the grid is wider than the Ewald one, so a coarser grid suffices.
+
+    int pmeX, pmeY, pmeZ, useriesX, useriesY, useriesZ;
+    double pmeAlpha, useriesAlpha;
+    pme->getPMEParametersInContext(context, pmeAlpha, pmeX, pmeY, pmeZ);
+    useries->getPMEParametersInContext(context, useriesAlpha, useriesX, useriesY, useriesZ);
+    ASSERT(useriesAlpha < pmeAlpha);
+    ASSERT(useriesX < pmeX);
+    ASSERT(useriesY < pmeY);
+    ASSERT(useriesZ < pmeZ);
+
+    // The accuracy should be similar to PME.
+
+    State state0 = context.getState(State::Forces | State::Energy, false, 1<<0);
+    State state1 = context.getState(State::Forces | State::Energy, false, 1<<1);
+    State state2 = context.getState(State::Forces | State::Energy, false, (1<<2) + (1<<3));
+    double useriesError = compareToReference(context, (1<<2) + (1<<3), 1<<0, 5e-4, 1e-3);
+    ASSERT(useriesError < 2*computeRelativeForceError(state1, state0));
+
+    // The direct and long range parts should add up to the full interaction.
+
+    State direct = context.getState(State::Forces | State::Energy, false, 1<<2);
+    State longRange = context.getState(State::Forces | State::Energy, false, 1<<3);
+    ASSERT_EQUAL_TOL(state2.getPotentialEnergy(), direct.getPotentialEnergy()+longRange.getPotentialEnergy(), 1e-10);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(state2.getForces()[i], direct.getForces()[i]+longRange.getForces()[i], 1e-10);
+
+    // Explicitly specified parameters should be used as is.
+
+    useries->setPMEParameters(2.5, 20, 21, 22);
+    context.reinitialize(true);
+    useries->getPMEParametersInContext(context, useriesAlpha, useriesX, useriesY, useriesZ);
+    ASSERT_EQUAL_TOL(2.5, useriesAlpha, 1e-10);
+    ASSERT_EQUAL(20, useriesX);
+    ASSERT_EQUAL(21, useriesY);
+    ASSERT_EQUAL(22, useriesZ);
+    state2 = context.getState(State::Energy, false, (1<<2) + (1<<3));
+    ASSERT_EQUAL_TOL(state0.getPotentialEnergy(), state2.getPotentialEnergy(), 5e-3);
+}
+
+void testInnerCutoff(Platform& platform) {
+    // Place particles on a jittered lattice, so that some pairs fall in each shell, and compare a force whose
+    // direct space is split into an inner and an outer shell to one that is not split.
+
+    const int gridSize = 4;
+    const int numParticles = gridSize*gridSize*gridSize;
+    const double boxSize = 2.5;
+    const double spacing = boxSize/gridSize;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NativeNonbondedForce* reference = new NativeNonbondedForce();
+    NativeNonbondedForce* split = new NativeNonbondedForce();
+    split->setForceGroup(1);
+    split->setOuterShellForceGroup(2);
+    split->setInnerCutoffDistance(0.7);
+    split->setInnerSwitchingDistance(0.5);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        double charge = (i%2 == 0 ? 0.5 : -0.5);
+        reference->addParticle(charge, 0.3, 0.5);
+        split->addParticle(charge, 0.3, 0.5);
+        Vec3 jitter(genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5);
+        positions[i] = Vec3(i%gridSize, (i/gridSize)%gridSize, i/(gridSize*gridSize))*spacing + jitter*0.2;
+    }
+    for (int i = 0; i < numParticles; i += 8) {
+        reference->addException(i, i+1, 0.0, 1.0, 0.0);
+        split->addException(i, i+1, 0.0, 1.0, 0.0);
+    }
+    for (NativeNonbondedForce* force : {reference, split}) {
+        force->setCutoffDistance(1.0);
+        force->setUseSwitchingFunction(true);
+        force->setSwitchingDistance(0.9);
+        system.addForce(force);
+    }
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+
+    // For every method, the two shells should add up to the full interaction.
+
+    NativeNonbondedForce::NonbondedMethod methods[] = {NativeNonbondedForce::CutoffPeriodic, NativeNonbondedForce::PME,
+            NativeNonbondedForce::DampedShiftedForce, NativeNonbondedForce::MSM};
+    for (NativeNonbondedForce::NonbondedMethod method : methods) {
+        reference->setNonbondedMethod(method);
+        split->setNonbondedMethod(method);
+        context.reinitialize(true);
+        State full = context.getState(State::Forces | State::Energy, false, 1<<0);
+        State inner = context.getState(State::Forces | State::Energy, false, 1<<1);
+        State outer = context.getState(State::Forces | State::Energy, false, 1<<2);
+        ASSERT_EQUAL_TOL(full.getPotentialEnergy(), inner.getPotentialEnergy()+outer.getPotentialEnergy(), 1e-8);
+        for (int i = 0; i < numParticles; i++)
+            ASSERT_EQUAL_VEC(full.getForces()[i], inner.getForces()[i]+outer.getForces()[i], 1e-8);
+    }
+
+    // Using the same force group for both shells should give the full interaction.
+
+    split->setOuterShellForceGroup(-1);
+    context.reinitialize(true);
+    State full = context.getState(State::Forces | State::Energy, false, 1<<0);
+    State both = context.getState(State::Forces | State::Energy, false, 1<<1);
+    ASSERT_EQUAL_TOL(full.getPotentialEnergy(), both.getPotentialEnergy(), 1e-10);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(full.getForces()[i], both.getForces()[i], 1e-10);
+}
+
+void testInnerCutoffPair(Platform& platform) {
+    // Check the shells for a single pair of particles at different distances.
+
+    System system;
+    system.addParticle(1.0);
+    system.addParticle(1.0);
+    NativeNonbondedForce* force = new NativeNonbondedForce();
+    force->setNonbondedMethod(NativeNonbondedForce::CutoffNonPeriodic);
+    force->setCutoffDistance(1.0);
+    force->setInnerCutoffDistance(0.6);
+    force->setInnerSwitchingDistance(0.4);
+    force->setOuterShellForceGroup(1);
+    force->addParticle(1.0, 0.3, 0.5);
+    force->addParticle(-1.0, 0.3, 0.5);
+    system.addForce(force);
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+
+    // Below the inner switching distance, the pair belongs entirely to the inner shell.
+
+    context.setPositions({Vec3(0, 0, 0), Vec3(0.35, 0, 0)});
+    State outer = context.getState(State::Forces | State::Energy, false, 1<<1);
+    ASSERT_EQUAL(0.0, outer.getPotentialEnergy());
+    ASSERT_EQUAL_VEC(Vec3(0, 0, 0), outer.getForces()[0], 0.0);
+
+    // Beyond the inner cutoff, it belongs entirely to the outer shell.
+
+    context.setPositions({Vec3(0, 0, 0), Vec3(0.7, 0, 0)});
+    State inner = context.getState(State::Forces | State::Energy, false, 1<<0);
+    ASSERT_EQUAL(0.0, inner.getPotentialEnergy());
+    ASSERT_EQUAL_VEC(Vec3(0, 0, 0), inner.getForces()[0], 0.0);
+
+    // In between, each shell's force should be the derivative of its energy.
+
+    const double delta = 1e-5;
+    for (int group = 0; group < 2; group++) {
+        context.setPositions({Vec3(0, 0, 0), Vec3(0.5, 0, 0)});
+        State state = context.getState(State::Forces | State::Energy, false, 1<<group);
+        ASSERT(state.getPotentialEnergy() != 0.0);
+        context.setPositions({Vec3(0, 0, 0), Vec3(0.5+delta, 0, 0)});
+        double e1 = context.getState(State::Energy, false, 1<<group).getPotentialEnergy();
+        context.setPositions({Vec3(0, 0, 0), Vec3(0.5-delta, 0, 0)});
+        double e2 = context.getState(State::Energy, false, 1<<group).getPotentialEnergy();
+        ASSERT_EQUAL_TOL(-(e1-e2)/(2*delta), state.getForces()[1][0], 1e-5);
+    }
+
+    // An inner cutoff requires a cutoff, and must lie inside it.
+
+    for (int i = 0; i < 3; i++) {
+        force->setNonbondedMethod(i == 0 ? NativeNonbondedForce::NoCutoff : NativeNonbondedForce::CutoffNonPeriodic);
+        force->setInnerCutoffDistance(i == 1 ? 1.2 : 0.6);
+        force->setInnerSwitchingDistance(i == 2 ? 0.6 : 0.4);
+        bool threwException = false;
+        try {
+            context.reinitialize(true);
+        }
+        catch (const OpenMMException& ex) {
+            threwException = true;
+        }
+        ASSERT(threwException);
+    }
+}
+
+void testTiledAllPairs(Platform& platform) {
+    // Small non-periodic systems loop over all pairs in tiles.  Use a number of particles that is not a multiple
+    // of the tile size, with exclusions both inside and between tiles, and compare to a direct summation.
+
+    const int gridSize = 6;
+    const int numParticles = 150;
+    const double spacing = 0.35;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(20, 0, 0), Vec3(0, 20, 0), Vec3(0, 0, 20));
+    NativeNonbondedForce* force = new NativeNonbondedForce();
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        force->addParticle(i%2 == 0 ? 0.5 : -0.5, 0.2+0.02*(i%5), 0.5+0.1*(i%3));
+        Vec3 site(i%gridSize, (i/gridSize)%gridSize, i/(gridSize*gridSize));
+        positions[i] = site*spacing + Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*0.1;
+    }
+    set<pair<int, int> > excluded;
+    for (int i = 0; i < numParticles; i += 7) {
+        int j = (i*37+11)%numParticles;
+        if (i != j && excluded.find(make_pair(j, i)) == excluded.end()) {
+            force->addException(i, j, 0.0, 1.0, 0.0);
+            excluded.insert(make_pair(i, j));
+        }
+    }
+    system.addForce(force);
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+    State state = context.getState(State::Forces | State::Energy);
+    double expectedEnergy = 0;
+    vector<Vec3> expectedForces(numParticles);
+    for (int i = 0; i < numParticles; i++)
+        for (int j = 0; j < i; j++) {
+            if (excluded.find(make_pair(i, j)) != excluded.end() || excluded.find(make_pair(j, i)) != excluded.end())
+                continue;
+            double qi, si, ei, qj, sj, ej;
+            force->getParticleParameters(i, qi, si, ei);
+            force->getParticleParameters(j, qj, sj, ej);
+            Vec3 delta = positions[i]-positions[j];
+            double r = sqrt(delta.dot(delta));
+            double sig6 = pow(0.5*(si+sj)/r, 6);
+            double eps = sqrt(ei*ej);
+            expectedEnergy += ONE_4PI_EPS0*qi*qj/r + 4*eps*(sig6*sig6-sig6);
+            Vec3 f = delta*((ONE_4PI_EPS0*qi*qj/r + 4*eps*(12*sig6*sig6-6*sig6))/(r*r));
+            expectedForces[i] += f;
+            expectedForces[j] -= f;
+        }
+    ASSERT_EQUAL_TOL(expectedEnergy, state.getPotentialEnergy(), 1e-10);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(expectedForces[i], state.getForces()[i], 1e-10);
+
+    // With a cutoff, the result should match a periodic box that is too large for periodicity to matter, which
+    // uses a neighbor list.
+
+    force->setNonbondedMethod(NativeNonbondedForce::CutoffNonPeriodic);
+    force->setCutoffDistance(1.0);
+    force->setUseSwitchingFunction(true);
+    force->setSwitchingDistance(0.8);
+    context.reinitialize(true);
+    State tiled = context.getState(State::Forces | State::Energy);
+    force->setNonbondedMethod(NativeNonbondedForce::CutoffPeriodic);
+    force->setUseDispersionCorrection(false);
+    context.reinitialize(true);
+    State neighborList = context.getState(State::Forces | State::Energy);
+    ASSERT_EQUAL_TOL(neighborList.getPotentialEnergy(), tiled.getPotentialEnergy(), 1e-10);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(neighborList.getForces()[i], tiled.getForces()[i], 1e-10);
+}
+
+void testSlabCorrection(Platform& platform) {
+    // A slab is periodic only along x and y, so its energy and forces should not depend on how much vacuum pads
+    // the box along z.
+
+    const int gridSize = 5;
+    const int numParticles = gridSize*gridSize*4;
+    const double width = 3.0;
+    const double spacing = width/gridSize;
+    System system;
+    NativeNonbondedForce* force = new NativeNonbondedForce();
+    force->setNonbondedMethod(NativeNonbondedForce::PME);
+    force->setCutoffDistance(1.0);
+    force->setEwaldErrorTolerance(1e-5);
+    force->setUseDispersionCorrection(false);
+    force->setUseSlabCorrection(true);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        force->addParticle(i%2 == 0 ? 0.6 : -0.5, 0.3, 0.5);
+        Vec3 site(i%gridSize, (i/gridSize)%gridSize, i/(gridSize*gridSize));
+        positions[i] = Vec3(0, 0, 3.0) + site*spacing + Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*0.2;
+    }
+    system.addForce(force);
+    vector<State> states;
+    for (double height : {7.0, 15.0}) {
+        system.setDefaultPeriodicBoxVectors(Vec3(width, 0, 0), Vec3(0, width, 0), Vec3(0, 0, height));
+        VerletIntegrator integrator(0.001);
+        Context context(system, integrator, platform);
+        context.setPositions(positions);
+        states.push_back(context.getState(State::Forces | State::Energy));
+    }
+    ASSERT_EQUAL_TOL(states[0].getPotentialEnergy(), states[1].getPotentialEnergy(), 1e-5);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(states[0].getForces()[i], states[1].getForces()[i], 1e-4);
+
+    // The forces should be the gradient of the energy.
+
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+    State state = context.getState(State::Forces);
+    double norm = 0.0;
+    for (Vec3 f : state.getForces())
+        norm += f.dot(f);
+    norm = sqrt(norm);
+    const double stepSize = 1e-3;
+    double step = 0.5*stepSize/norm;
+    vector<Vec3> positions2(numParticles), positions3(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        Vec3 p = positions[i];
+        Vec3 f = state.getForces()[i];
+        positions2[i] = p-f*step;
+        positions3[i] = p+f*step;
+    }
+    context.setPositions(positions2);
+    State state2 = context.getState(State::Energy);
+    context.setPositions(positions3);
+    State state3 = context.getState(State::Energy);
+    ASSERT_EQUAL_TOL(norm, (state2.getPotentialEnergy()-state3.getPotentialEnergy())/stepSize, 1e-3);
+
+    // The slab correction requires PME.
+
+    force->setNonbondedMethod(NativeNonbondedForce::Ewald);
+    bool threwException = false;
+    try {
+        context.reinitialize();
+    }
+    catch (const OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+}
+
+void testRepeatedEvaluation(Platform& platform) {
+    // Evaluate a system many times as particles move and a global parameter changes.  The neighbor list, PME
+    // object, and parameters are reused between evaluations when possible, so compare each one to a fresh Context.
+
+    const int numParticles = 200;
+    const double boxSize = 3.0;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NativeNonbondedForce* force = new NativeNonbondedForce();
+    force->setNonbondedMethod(NativeNonbondedForce::PME);
+    force->setCutoffDistance(1.0);
+    force->addGlobalParameter("scale", 0.0);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        force->addParticle(i%2 == 0 ? 0.5 : -0.5, 0.2, 0.5);
+        positions[i] = Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*boxSize;
+    }
+    for (int i = 0; i < numParticles; i += 10)
+        force->addParticleParameterOffset("scale", i, 0.1, 0.0, 0.2);
+    system.addForce(force);
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+    for (int step = 0; step < 10; step++) {
+        for (int i = 0; i < numParticles; i++)
+            positions[i] += Vec3(genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5)*0.02;
+        if (step%3 == 2)
+            context.setParameter("scale", 0.1*step);
+        vector<Vec3> forces;
+        double energy = force->computeForcesAndEnergyInContext(context, positions, forces);
+        VerletIntegrator integrator2(0.001);
+        Context context2(system, integrator2, platform);
+        context2.setParameter("scale", context.getParameter("scale"));
+        context2.setPositions(positions);
+        State state = context2.getState(State::Forces | State::Energy);
+        ASSERT_EQUAL_TOL(state.getPotentialEnergy(), energy, 1e-10);
+        for (int i = 0; i < numParticles; i++)
+            ASSERT_EQUAL_VEC(state.getForces()[i], forces[i], 1e-10);
+    }
+}
+
+void testExceptionTopologyChanges(Platform& platform) {
+    // Add exceptions, change which particles they involve, and switch them between excluded and computed, then
+    // check that the updated Context matches one created from scratch.
+
+    const int numParticles = 40;
+    const double boxSize = 3.0;
+    NativeNonbondedForce::NonbondedMethod methods[] = {NativeNonbondedForce::NoCutoff, NativeNonbondedForce::PME};
+    for (NativeNonbondedForce::NonbondedMethod method : methods) {
+        System system;
+        system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+        NativeNonbondedForce* force = new NativeNonbondedForce();
+        force->setNonbondedMethod(method);
+        force->setCutoffDistance(1.0);
+        OpenMM_SFMT::SFMT sfmt;
+        init_gen_rand(0, sfmt);
+        vector<Vec3> positions(numParticles);
+        for (int i = 0; i < numParticles; i++) {
+            system.addParticle(1.0);
+            force->addParticle(i%2 == 0 ? 0.5 : -0.5, 0.2, 0.5);
+            positions[i] = Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*boxSize;
+        }
+        for (int i = 0; i < numParticles-1; i += 4)
+            force->addException(i, i+1, 0.0, 1.0, 0.0);
+        force->addException(2, 3, 0.1, 0.2, 0.3);
+        system.addForce(force);
+        VerletIntegrator integrator(0.001);
+        Context context(system, integrator, platform);
+        context.setPositions(positions);
+        context.getState(State::Energy);
+        for (int step = 0; step < 4; step++) {
+            if (step == 0)
+                force->addException(5, 6, 0.2, 0.3, 0.4);
+            else if (step == 1)
+                force->setExceptionParameters(0, 0, 7, 0.0, 1.0, 0.0);
+            else if (step == 2)
+                force->setExceptionParameters(1, 4, 5, -0.1, 0.25, 0.2);
+            else
+                force->setExceptionParameters(force->getNumExceptions()-2, 2, 3, 0.0, 1.0, 0.0);
+            force->updateParametersInContext(context);
+            State state1 = context.getState(State::Forces | State::Energy);
+            VerletIntegrator integrator2(0.001);
+            Context context2(system, integrator2, platform);
+            context2.setPositions(positions);
+            State state2 = context2.getState(State::Forces | State::Energy);
+            ASSERT_EQUAL_TOL(state2.getPotentialEnergy(), state1.getPotentialEnergy(), 1e-10);
+            for (int i = 0; i < numParticles; i++)
+                ASSERT_EQUAL_VEC(state2.getForces()[i], state1.getForces()[i], 1e-10);
+        }
+
+        // An offset for a new global parameter cannot be added, and the failed update must leave the Context
+        // unchanged.
+
+        double energy = context.getState(State::Energy).getPotentialEnergy();
+        force->addGlobalParameter("scale", 1.0);
+        force->addExceptionParameterOffset("scale", force->addException(8, 9, 0.1, 0.2, 0.3), 1.0, 0.0, 0.0);
+        bool threwException = false;
+        try {
+            force->updateParametersInContext(context);
+        }
+        catch (const OpenMMException& ex) {
+            threwException = true;
+        }
+        ASSERT(threwException);
+        ASSERT_EQUAL_TOL(energy, context.getState(State::Energy).getPotentialEnergy(), 1e-10);
+    }
+}
+
+void testRigidWater(Platform& platform) {
+    // Rigid 3- and 4-site water molecules are processed together.  Compare to the same system without constraints,
+    // in which every particle is processed separately.  Changing the charges of one molecule removes it from the
+    // set of water molecules.
+
+    const int gridSize = 8;
+    const int numMolecules = gridSize*gridSize*gridSize;
+    const double spacing = 0.31;
+    const double boxSize = gridSize*spacing;
+    for (int sites = 3; sites <= 4; sites++) {
+        NativeNonbondedForce::NonbondedMethod methods[] = {NativeNonbondedForce::CutoffPeriodic, NativeNonbondedForce::PME};
+        for (NativeNonbondedForce::NonbondedMethod method : methods) {
+            System rigid, flexible;
+            NativeNonbondedForce* force = new NativeNonbondedForce();
+            force->setNonbondedMethod(method);
+            force->setCutoffDistance(0.9);
+            force->setUseSwitchingFunction(true);
+            force->setSwitchingDistance(0.8);
+            vector<Vec3> positions;
+            OpenMM_SFMT::SFMT sfmt;
+            init_gen_rand(0, sfmt);
+            for (int i = 0; i < numMolecules; i++) {
+                int first = positions.size();
+                Vec3 oxygen = Vec3(i%gridSize, (i/gridSize)%gridSize, i/(gridSize*gridSize))*spacing;
+                oxygen += Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*0.05;
+                positions.push_back(oxygen);
+                positions.push_back(oxygen+Vec3(0.09572, 0, 0));
+                positions.push_back(oxygen+Vec3(-0.023999, 0.092663, 0));
+                for (System* system : {&rigid, &flexible}) {
+                    system->addParticle(16.0);
+                    system->addParticle(1.0);
+                    system->addParticle(1.0);
+                }
+                rigid.addConstraint(first, first+1, 0.09572);
+                rigid.addConstraint(first, first+2, 0.09572);
+                rigid.addConstraint(first+1, first+2, 0.15139);
+                if (sites == 3) {
+                    force->addParticle(-0.834, 0.315, 0.636);
+                    force->addParticle(0.417, 1.0, 0.0);
+                    force->addParticle(0.417, 1.0, 0.0);
+                }
+                else {
+                    force->addParticle(0.0, 0.315, 0.649);
+                    force->addParticle(0.52, 1.0, 0.0);
+                    force->addParticle(0.52, 1.0, 0.0);
+                    force->addParticle(-1.04, 1.0, 0.0);
+                    positions.push_back(Vec3());
+                    for (System* system : {&rigid, &flexible}) {
+                        system->addParticle(0.0);
+                        system->setVirtualSite(first+3, new ThreeParticleAverageSite(first, first+1, first+2, 0.786646, 0.106677, 0.106677));
+                    }
+                }
+                for (int j = 0; j < sites; j++)
+                    for (int k = 0; k < j; k++)
+                        force->addException(first+j, first+k, 0.0, 1.0, 0.0);
+            }
+            for (System* system : {&rigid, &flexible})
+                system->setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+            rigid.addForce(force);
+            flexible.addForce(new NativeNonbondedForce(*force));
+            VerletIntegrator integrator1(0.001), integrator2(0.001);
+            Context context1(rigid, integrator1, platform);
+            Context context2(flexible, integrator2, platform);
+            context1.setPositions(positions);
+            context2.setPositions(positions);
+            context1.computeVirtualSites();
+            context2.computeVirtualSites();
+            for (int step = 0; step < 2; step++) {
+                if (step == 1) {
+                    // Change the charges of one molecule, so it no longer matches the others.
+
+                    for (int i = 0; i < 3; i++) {
+                        double charge, sigma, epsilon;
+                        force->getParticleParameters(sites*5+i, charge, sigma, epsilon);
+                        force->setParticleParameters(sites*5+i, 0.5*charge, sigma, epsilon);
+                    }
+                    force->updateParametersInContext(context1);
+                    NativeNonbondedForce& force2 = dynamic_cast<NativeNonbondedForce&>(flexible.getForce(0));
+                    for (int i = 0; i < 3; i++) {
+                        double charge, sigma, epsilon;
+                        force2.getParticleParameters(sites*5+i, charge, sigma, epsilon);
+                        force2.setParticleParameters(sites*5+i, 0.5*charge, sigma, epsilon);
+                    }
+                    force2.updateParametersInContext(context2);
+                }
+                State state1 = context1.getState(State::Forces | State::Energy);
+                State state2 = context2.getState(State::Forces | State::Energy);
+                ASSERT_EQUAL_TOL(state2.getPotentialEnergy(), state1.getPotentialEnergy(), 1e-10);
+                for (int i = 0; i < rigid.getNumParticles(); i++)
+                    ASSERT_EQUAL_VEC(state2.getForces()[i], state1.getForces()[i], 1e-10);
+            }
+        }
+    }
+}
 
 void runPlatformTests() {
+    testMSM(platform);
+    testRandomBatchEwald(platform);
+    testP3M(platform);
+    testFMM(platform);
+    testUSeries(platform);
+    testInnerCutoff(platform);
+    testInnerCutoffPair(platform);
+    testTiledAllPairs(platform);
+    testSlabCorrection(platform);
+    testRepeatedEvaluation(platform);
+    testExceptionTopologyChanges(platform);
+    testRigidWater(platform);
 }
@@ -14,6 +14,7 @@
 %}
 
 %pythoncode %{
+import numpy
 from openmm import unit
 %}
 
@@ -48,6 +49,133 @@ from openmm import unit
     val[5] = unit.Quantity(val[5], unit.kilojoule_per_mole)
 %}
 
+%pythonappend NativeNonbondedPlugin::NativeNonbondedForce::getLJTypeParameters(int index, double& sigma, double& epsilon) const %{
+    val[0] = unit.Quantity(val[0], unit.nanometer)
+    val[1] = unit.Quantity(val[1], unit.kilojoule_per_mole)
+%}
+
+%pythonappend NativeNonbondedPlugin::NativeNonbondedForce::getLJTypePairParameters(int index, int& type1, int& type2,
+                                                            double& sigma, double& epsilon) const %{
+    val[2] = unit.Quantity(val[2], unit.nanometer)
+    val[3] = unit.Quantity(val[3], unit.kilojoule_per_mole)
+%}
+
+/*
+ * Bulk parameter arrays are accepted from any object supporting the buffer protocol, such as a NumPy array,
+ * which is copied without visiting each element as a Python object.  Other sequences are converted element by
+ * element.  Particle indices must be integers, so a floating point buffer is rejected for them.  Arrays are
+ * returned as NumPy arrays, with units added to the parameters.
+*/
+%{
+#include <type_traits>
+
+static bool readArrayItem(PyObject* item, double& value) {
+    value = PyFloat_AsDouble(item);
+    return !PyErr_Occurred();
+}
+
+static bool readArrayItem(PyObject* item, int& value) {
+    value = (int) PyLong_AsLong(item);
+    return !PyErr_Occurred();
+}
+
+template <class T, class S>
+static void copyArrayBuffer(const void* buffer, std::vector<T>& result) {
+    const S* data = (const S*) buffer;
+    for (int i = 0; i < result.size(); i++)
+        result[i] = (T) data[i];
+}
+
+template <class T>
+static bool readArray(PyObject* obj, std::vector<T>& result) {
+    Py_buffer view;
+    if (PyObject_GetBuffer(obj, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) == 0) {
+        const char* format = (view.format == NULL ? "B" : view.format);
+        if (*format == '@' || *format == '=')
+            format++;
+        bool supported = (view.ndim == 1 && format[1] == 0);
+        if (supported && std::is_integral<T>::value && (*format == 'd' || *format == 'f')) {
+            PyBuffer_Release(&view);
+            PyErr_SetString(PyExc_TypeError, "Expected an array of integers for particle indices");
+            return false;
+        }
+        if (supported) {
+            result.resize(view.len/view.itemsize);
+            if (*format == 'd' && view.itemsize == sizeof(double))
+                copyArrayBuffer<T, double>(view.buf, result);
+            else if (*format == 'f' && view.itemsize == sizeof(float))
+                copyArrayBuffer<T, float>(view.buf, result);
+            else if (*format == 'i' && view.itemsize == sizeof(int))
+                copyArrayBuffer<T, int>(view.buf, result);
+            else if (*format == 'l' && view.itemsize == sizeof(long))
+                copyArrayBuffer<T, long>(view.buf, result);
+            else if (*format == 'q' && view.itemsize == sizeof(long long))
+                copyArrayBuffer<T, long long>(view.buf, result);
+            else
+                supported = false;
+        }
+        PyBuffer_Release(&view);
+        if (supported)
+            return true;
+    }
+    PyErr_Clear();
+    PyObject* sequence = PySequence_Fast(obj, "Expected an array or sequence");
+    if (sequence == NULL)
+        return false;
+    Py_ssize_t size = PySequence_Fast_GET_SIZE(sequence);
+    PyObject** items = PySequence_Fast_ITEMS(sequence);
+    result.resize(size);
+    for (Py_ssize_t i = 0; i < size; i++)
+        if (!readArrayItem(items[i], result[i])) {
+            Py_DECREF(sequence);
+            return false;
+        }
+    Py_DECREF(sequence);
+    return true;
+}
+
+template <class T>
+static PyObject* writeArray(const std::vector<T>& values) {
+    return PyByteArray_FromStringAndSize((const char*) values.data(), values.size()*sizeof(T));
+}
+%}
+
+%typemap(in) const std::vector<double>& ARRAY (std::vector<double> temp), const std::vector<int>& ARRAY (std::vector<int> temp) {
+    if (!readArray($input, temp))
+        SWIG_fail;
+    $1 = &temp;
+}
+
+%typemap(typecheck, precedence=SWIG_TYPECHECK_POINTER) const std::vector<double>& ARRAY, const std::vector<int>& ARRAY {
+    $1 = (PyObject_CheckBuffer($input) || PySequence_Check($input)) ? 1 : 0;
+}
+
+%typemap(in, numinputs=0) std::vector<double>& ARRAY_OUTPUT (std::vector<double> temp), std::vector<int>& ARRAY_OUTPUT (std::vector<int> temp) {
+    $1 = &temp;
+}
+
+%typemap(argout) std::vector<double>& ARRAY_OUTPUT, std::vector<int>& ARRAY_OUTPUT {
+    $result = SWIG_Python_AppendOutput($result, writeArray(*$1));
+}
+
+%pythonappend NativeNonbondedPlugin::NativeNonbondedForce::getAllParticleParameters(std::vector<double>& charges,
+                        std::vector<double>& sigmas, std::vector<double>& epsilons) const %{
+    val = tuple(numpy.frombuffer(v, dtype=numpy.float64) for v in val)
+    val = (unit.Quantity(val[0], unit.elementary_charge),
+           unit.Quantity(val[1], unit.nanometer),
+           unit.Quantity(val[2], unit.kilojoule_per_mole))
+%}
+
+%pythonappend NativeNonbondedPlugin::NativeNonbondedForce::getAllExceptionParameters(std::vector<int>& particles1,
+                        std::vector<int>& particles2, std::vector<double>& chargeProds, std::vector<double>& sigmas,
+                        std::vector<double>& epsilons) const %{
+    val = tuple(numpy.frombuffer(v, dtype=(numpy.intc if i < 2 else numpy.float64)) for i, v in enumerate(val))
+    val = (val[0], val[1],
+           unit.Quantity(val[2], unit.elementary_charge**2),
+           unit.Quantity(val[3], unit.nanometer),
+           unit.Quantity(val[4], unit.kilojoule_per_mole))
+%}
+
 /*
  * Convert C++ exceptions to Python exceptions.
 */
@@ -71,7 +199,14 @@ public:
         CutoffPeriodic = 2,
         Ewald = 3,
         PME = 4,
-        LJPME = 5
+        LJPME = 5,
+        MSM = 6,
+        DampedShiftedForce = 7,
+        RandomBatchEwald = 8,
+        P3M = 9,
+        FMM = 10,
+        IPS = 11,
+        USeries = 12
     };
     NativeNonbondedForce();
     int getNumParticles() const;
@@ -87,6 +222,12 @@ public:
     void setUseSwitchingFunction(bool use);
     double getSwitchingDistance() const;
     void setSwitchingDistance(double distance);
+    double getLJCutoffDistance() const;
+    void setLJCutoffDistance(double distance);
+    double getInnerCutoffDistance() const;
+    void setInnerCutoffDistance(double distance);
+    double getInnerSwitchingDistance() const;
+    void setInnerSwitchingDistance(double distance);
     double getReactionFieldDielectric() const;
     void setReactionFieldDielectric(double dielectric);
     double getEwaldErrorTolerance() const;
@@ -117,6 +258,44 @@ public:
     %clear int& ny;
     %clear int& nz;
 
+    double getPMEGridResizeThreshold() const;
+    void setPMEGridResizeThreshold(double threshold);
+    bool getUseSlabCorrection() const;
+    void setUseSlabCorrection(bool use);
+
+    %apply int& OUTPUT {int& numLevels};
+    %apply int& OUTPUT {int& order};
+    void getMSMParameters(int& numLevels, int& order) const;
+    %clear int& numLevels;
+    %clear int& order;
+
+    void setMSMParameters(int numLevels, int order);
+
+    %apply int& OUTPUT {int& numLevels};
+    %apply int& OUTPUT {int& nx};
+    %apply int& OUTPUT {int& ny};
+    %apply int& OUTPUT {int& nz};
+    void getMSMParametersInContext(const Context& context, int& numLevels, int& nx, int& ny, int& nz) const;
+    %clear int& numLevels;
+    %clear int& nx;
+    %clear int& ny;
+    %clear int& nz;
+
+    %apply int& OUTPUT {int& order};
+    %apply int& OUTPUT {int& treeDepth};
+    void getFMMParameters(int& order, int& treeDepth) const;
+    %clear int& order;
+    %clear int& treeDepth;
+
+    void setFMMParameters(int order, int treeDepth);
+
+    double getDSFAlpha() const;
+    void setDSFAlpha(double alpha);
+    int getRBEBatchSize() const;
+    void setRBEBatchSize(int size);
+    int getRandomNumberSeed() const;
+    void setRandomNumberSeed(int seed);
+
     int addParticle(double charge, double sigma, double epsilon);
 
     %apply double& OUTPUT {double& charge};
@@ -144,6 +323,42 @@ public:
 
     void setExceptionParameters(int index, int particle1, int particle2, double chargeProd, double sigma, double epsilon);
     void createExceptionsFromBonds(const std::vector<std::pair<int, int> >& bonds, double coulomb14Scale, double lj14Scale);
+
+    %apply const std::vector<double>& ARRAY {const std::vector<double>& charges};
+    %apply const std::vector<double>& ARRAY {const std::vector<double>& sigmas};
+    %apply const std::vector<double>& ARRAY {const std::vector<double>& epsilons};
+    %apply const std::vector<double>& ARRAY {const std::vector<double>& chargeProds};
+    %apply const std::vector<int>& ARRAY {const std::vector<int>& particles1};
+    %apply const std::vector<int>& ARRAY {const std::vector<int>& particles2};
+    int addParticles(const std::vector<double>& charges, const std::vector<double>& sigmas, const std::vector<double>& epsilons);
+    void setAllParticleParameters(const std::vector<double>& charges, const std::vector<double>& sigmas, const std::vector<double>& epsilons);
+    int addExceptions(const std::vector<int>& particles1, const std::vector<int>& particles2, const std::vector<double>& chargeProds,
+                      const std::vector<double>& sigmas, const std::vector<double>& epsilons, bool replace = false);
+    void setAllExceptionParameters(const std::vector<int>& particles1, const std::vector<int>& particles2, const std::vector<double>& chargeProds,
+                                   const std::vector<double>& sigmas, const std::vector<double>& epsilons);
+    %clear const std::vector<double>& charges;
+    %clear const std::vector<double>& sigmas;
+    %clear const std::vector<double>& epsilons;
+    %clear const std::vector<double>& chargeProds;
+    %clear const std::vector<int>& particles1;
+    %clear const std::vector<int>& particles2;
+
+    %apply std::vector<double>& ARRAY_OUTPUT {std::vector<double>& charges};
+    %apply std::vector<double>& ARRAY_OUTPUT {std::vector<double>& sigmas};
+    %apply std::vector<double>& ARRAY_OUTPUT {std::vector<double>& epsilons};
+    %apply std::vector<double>& ARRAY_OUTPUT {std::vector<double>& chargeProds};
+    %apply std::vector<int>& ARRAY_OUTPUT {std::vector<int>& particles1};
+    %apply std::vector<int>& ARRAY_OUTPUT {std::vector<int>& particles2};
+    void getAllParticleParameters(std::vector<double>& charges, std::vector<double>& sigmas, std::vector<double>& epsilons) const;
+    void getAllExceptionParameters(std::vector<int>& particles1, std::vector<int>& particles2, std::vector<double>& chargeProds,
+                                   std::vector<double>& sigmas, std::vector<double>& epsilons) const;
+    %clear std::vector<double>& charges;
+    %clear std::vector<double>& sigmas;
+    %clear std::vector<double>& epsilons;
+    %clear std::vector<double>& chargeProds;
+    %clear std::vector<int>& particles1;
+    %clear std::vector<int>& particles2;
+
     int addGlobalParameter(const std::string& name, double defaultValue);
     const std::string& getGlobalParameterName(int index) const;
     void setGlobalParameterName(int index, const std::string& name);
@@ -179,13 +394,45 @@ public:
     %clear double& epsilonScale;
 
     void setExceptionParameterOffset(int index, const std::string& parameter, int exceptionIndex, double chargeProdScale, double sigmaScale, double epsilonScale);
+    int getNumLJTypes() const;
+    int getNumLJTypePairs() const;
+    bool getUseLJTypes() const;
+    int addLJType(double sigma, double epsilon);
+
+    %apply double& OUTPUT {double& sigma};
+    %apply double& OUTPUT {double& epsilon};
+    void getLJTypeParameters(int index, double& sigma, double& epsilon) const;
+    %clear double& sigma;
+    %clear double& epsilon;
+
+    void setLJTypeParameters(int index, double sigma, double epsilon);
+    int getParticleLJType(int index) const;
+    void setParticleLJType(int index, int type);
+    int addLJTypePair(int type1, int type2, double sigma, double epsilon);
+
+    %apply int& OUTPUT {int& type1};
+    %apply int& OUTPUT {int& type2};
+    %apply double& OUTPUT {double& sigma};
+    %apply double& OUTPUT {double& epsilon};
+    void getLJTypePairParameters(int index, int& type1, int& type2, double& sigma, double& epsilon) const;
+    %clear int& type1;
+    %clear int& type2;
+    %clear double& sigma;
+    %clear double& epsilon;
+
+    void setLJTypePairParameters(int index, int type1, int type2, double sigma, double epsilon);
     bool getUseDispersionCorrection() const;
     void setUseDispersionCorrection(bool useCorrection);
     int getReciprocalSpaceForceGroup() const;
     void setReciprocalSpaceForceGroup(int group);
+    int getOuterShellForceGroup() const;
+    void setOuterShellForceGroup(int group);
     bool getIncludeDirectSpace() const;
     void setIncludeDirectSpace(bool include);
     void updateParametersInContext(Context& context);
+    %apply std::vector<Vec3>& OUTPUT {std::vector<Vec3>& forces};
+    double computeForcesAndEnergyInContext(Context& context, const std::vector<Vec3>& positions, std::vector<Vec3>& forces) const;
+    %clear std::vector<Vec3>& forces;
     bool usesPeriodicBoundaryConditions() const;
     bool getExceptionsUsePeriodicBoundaryConditions() const;
     void setExceptionsUsePeriodicBoundaryConditions(bool periodic);
@@ -196,3 +196,29 @@ def testLargeSystem(platformName, precision):
         ASSERT_EQUAL_VEC(state.getVelocities()[i], referenceState.getVelocities()[i], tol)
         ASSERT_EQUAL_VEC(state.getForces()[i], referenceState.getForces()[i], tol)
     ASSERT_EQUAL_TOL(state.getPotentialEnergy(), referenceState.getPotentialEnergy(), tol)
+
+
+def testBulkParameters():
+    numParticles = 10
+    charges = np.linspace(-0.5, 0.5, numParticles)
+    sigmas = np.full(numParticles, 0.3)
+    epsilons = np.arange(numParticles, dtype=np.float64)
+    force = plugin.NativeNonbondedForce()
+    ASSERT(force.addParticles(charges, sigmas, epsilons) == 0)
+    ASSERT(force.addExceptions(np.array([0, 2]), np.array([1, 3]), [0.1, 0.2], [0.3, 0.3], [0.5, 0.6]) == 0)
+    force.setAllParticleParameters(2*charges, sigmas, epsilons)
+    q, sig, eps = force.getAllParticleParameters()
+    q = q.value_in_unit(unit.elementary_charge)
+    sig = sig.value_in_unit(unit.nanometer)
+    eps = eps.value_in_unit(unit.kilojoule_per_mole)
+    ASSERT(np.array_equal(q, 2*charges) and np.array_equal(sig, sigmas) and np.array_equal(eps, epsilons))
+    ASSERT_EQUAL_TOL(2*charges[3], force.getParticleParameters(3)[0], 1e-12)
+    p1, p2, chargeProd, sig, eps = force.getAllExceptionParameters()
+    ASSERT(list(p1) == [0, 2] and list(p2) == [1, 3])
+    chargeProd = chargeProd.value_in_unit(unit.elementary_charge**2)
+    eps = eps.value_in_unit(unit.kilojoule_per_mole)
+    ASSERT(np.array_equal(chargeProd, [0.1, 0.2]) and np.array_equal(eps, [0.5, 0.6]))
+    with pytest.raises(TypeError):
+        force.setAllExceptionParameters(np.array([0.0, 2.0]), np.array([1, 3]), [0.1, 0.2], [0.3, 0.3], [0.5, 0.6])
+    with pytest.raises(Exception):
+        force.setAllParticleParameters(charges[1:], sigmas, epsilons)
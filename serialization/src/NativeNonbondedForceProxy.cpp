@@ -43,7 +43,7 @@ NativeNonbondedForceProxy::NativeNonbondedForceProxy() : SerializationProxy("Nat
 }
 
 void NativeNonbondedForceProxy::serialize(const void* object, SerializationNode& node) const {
-    node.setIntProperty("version", 4);
+    node.setIntProperty("version", 13);
     const NativeNonbondedForce& force = *reinterpret_cast<const NativeNonbondedForce*>(object);
     node.setIntProperty("forceGroup", force.getForceGroup());
     node.setStringProperty("name", force.getName());
@@ -69,6 +69,23 @@ void NativeNonbondedForceProxy::serialize(const void* object, SerializationNode&
     node.setIntProperty("ljny", ny);
     node.setIntProperty("ljnz", nz);
     node.setIntProperty("recipForceGroup", force.getReciprocalSpaceForceGroup());
+    node.setDoubleProperty("pmeGridResizeThreshold", force.getPMEGridResizeThreshold());
+    int msmLevels, msmOrder;
+    force.getMSMParameters(msmLevels, msmOrder);
+    node.setIntProperty("msmLevels", msmLevels);
+    node.setIntProperty("msmOrder", msmOrder);
+    node.setDoubleProperty("dsfAlpha", force.getDSFAlpha());
+    node.setIntProperty("rbeBatchSize", force.getRBEBatchSize());
+    node.setIntProperty("randomSeed", force.getRandomNumberSeed());
+    int fmmOrder, fmmTreeDepth;
+    force.getFMMParameters(fmmOrder, fmmTreeDepth);
+    node.setIntProperty("fmmOrder", fmmOrder);
+    node.setIntProperty("fmmTreeDepth", fmmTreeDepth);
+    node.setDoubleProperty("innerCutoff", force.getInnerCutoffDistance());
+    node.setDoubleProperty("ljCutoff", force.getLJCutoffDistance());
+    node.setBoolProperty("useSlabCorrection", force.getUseSlabCorrection());
+    node.setDoubleProperty("innerSwitchingDistance", force.getInnerSwitchingDistance());
+    node.setIntProperty("outerShellForceGroup", force.getOuterShellForceGroup());
     SerializationNode& globalParams = node.createChildNode("GlobalParameters");
     for (int i = 0; i < force.getNumGlobalParameters(); i++)
         globalParams.createChildNode("Parameter").setStringProperty("name", force.getGlobalParameterName(i)).setDoubleProperty("default", force.getGlobalParameterDefaultValue(i));
@@ -88,11 +105,26 @@ void NativeNonbondedForceProxy::serialize(const void* object, SerializationNode&
         force.getExceptionParameterOffset(i, parameter, exception, chargeProdScale, sigmaScale, epsilonScale);
         exceptionOffsets.createChildNode("Offset").setStringProperty("parameter", parameter).setIntProperty("exception", exception).setDoubleProperty("q", chargeProdScale).setDoubleProperty("sig", sigmaScale).setDoubleProperty("eps", epsilonScale);
     }
+    SerializationNode& ljTypes = node.createChildNode("LJTypes");
+    for (int i = 0; i < force.getNumLJTypes(); i++) {
+        double sigma, epsilon;
+        force.getLJTypeParameters(i, sigma, epsilon);
+        ljTypes.createChildNode("Type").setDoubleProperty("sig", sigma).setDoubleProperty("eps", epsilon);
+    }
+    SerializationNode& ljTypePairs = node.createChildNode("LJTypePairs");
+    for (int i = 0; i < force.getNumLJTypePairs(); i++) {
+        int type1, type2;
+        double sigma, epsilon;
+        force.getLJTypePairParameters(i, type1, type2, sigma, epsilon);
+        ljTypePairs.createChildNode("Pair").setIntProperty("t1", type1).setIntProperty("t2", type2).setDoubleProperty("sig", sigma).setDoubleProperty("eps", epsilon);
+    }
     SerializationNode& particles = node.createChildNode("Particles");
     for (int i = 0; i < force.getNumParticles(); i++) {
         double charge, sigma, epsilon;
         force.getParticleParameters(i, charge, sigma, epsilon);
-        particles.createChildNode("Particle").setDoubleProperty("q", charge).setDoubleProperty("sig", sigma).setDoubleProperty("eps", epsilon);
+        SerializationNode& particle = particles.createChildNode("Particle").setDoubleProperty("q", charge).setDoubleProperty("sig", sigma).setDoubleProperty("eps", epsilon);
+        if (force.getParticleLJType(i) != -1)
+            particle.setIntProperty("type", force.getParticleLJType(i));
     }
     SerializationNode& exceptions = node.createChildNode("Exceptions");
     for (int i = 0; i < force.getNumExceptions(); i++) {
@@ -105,7 +137,7 @@ void NativeNonbondedForceProxy::serialize(const void* object, SerializationNode&
 
 void* NativeNonbondedForceProxy::deserialize(const SerializationNode& node) const {
     int version = node.getIntProperty("version");
-    if (version < 1 || version > 4)
+    if (version < 1 || version > 13)
         throw OpenMMException("Unsupported version number");
     NativeNonbondedForce* force = new NativeNonbondedForce();
     try {
@@ -146,9 +178,41 @@ void* NativeNonbondedForceProxy::deserialize(const SerializationNode& node) cons
         }
         if (version >= 4)
             force->setExceptionsUsePeriodicBoundaryConditions(node.getIntProperty("exceptionsUsePeriodic"));
+        if (version >= 5)
+            force->setPMEGridResizeThreshold(node.getDoubleProperty("pmeGridResizeThreshold", 0.0));
+        if (version >= 6)
+            force->setMSMParameters(node.getIntProperty("msmLevels", 0), node.getIntProperty("msmOrder", 6));
+        if (version >= 7)
+            force->setDSFAlpha(node.getDoubleProperty("dsfAlpha", 2.0));
+        if (version >= 8) {
+            force->setRBEBatchSize(node.getIntProperty("rbeBatchSize", 100));
+            force->setRandomNumberSeed(node.getIntProperty("randomSeed", 0));
+        }
+        if (version >= 9)
+            force->setFMMParameters(node.getIntProperty("fmmOrder", 8), node.getIntProperty("fmmTreeDepth", 0));
+        if (version >= 10) {
+            force->setInnerCutoffDistance(node.getDoubleProperty("innerCutoff", 0.0));
+            force->setInnerSwitchingDistance(node.getDoubleProperty("innerSwitchingDistance", 0.0));
+            force->setOuterShellForceGroup(node.getIntProperty("outerShellForceGroup", -1));
+        }
+        if (version >= 11)
+            force->setLJCutoffDistance(node.getDoubleProperty("ljCutoff", 0.0));
+        if (version >= 12)
+            force->setUseSlabCorrection(node.getBoolProperty("useSlabCorrection", false));
+        if (version >= 13) {
+            const SerializationNode& ljTypes = node.getChildNode("LJTypes");
+            for (auto& type : ljTypes.getChildren())
+                force->addLJType(type.getDoubleProperty("sig"), type.getDoubleProperty("eps"));
+            const SerializationNode& ljTypePairs = node.getChildNode("LJTypePairs");
+            for (auto& pair : ljTypePairs.getChildren())
+                force->addLJTypePair(pair.getIntProperty("t1"), pair.getIntProperty("t2"), pair.getDoubleProperty("sig"), pair.getDoubleProperty("eps"));
+        }
         const SerializationNode& particles = node.getChildNode("Particles");
-        for (auto& particle : particles.getChildren())
-            force->addParticle(particle.getDoubleProperty("q"), particle.getDoubleProperty("sig"), particle.getDoubleProperty("eps"));
+        for (auto& particle : particles.getChildren()) {
+            int index = force->addParticle(particle.getDoubleProperty("q"), particle.getDoubleProperty("sig"), particle.getDoubleProperty("eps"));
+            if (version >= 13)
+                force->setParticleLJType(index, particle.getIntProperty("type", -1));
+        }
         const SerializationNode& exceptions = node.getChildNode("Exceptions");
         for (auto& exception : exceptions.getChildren())
             force->addException(exception.getIntProperty("p1"), exception.getIntProperty("p2"), exception.getDoubleProperty("q"), exception.getDoubleProperty("sig"), exception.getDoubleProperty("eps"));
@@ -60,6 +60,17 @@ void testSerialization() {
     double dalpha = 0.8;
     int dnx = 4, dny = 6, dnz = 7;
     force.setLJPMEParameters(dalpha, dnx, dny, dnz);
+    force.setPMEGridResizeThreshold(0.2);
+    force.setMSMParameters(3, 4);
+    force.setDSFAlpha(2.5);
+    force.setRBEBatchSize(50);
+    force.setRandomNumberSeed(12);
+    force.setFMMParameters(6, 3);
+    force.setLJCutoffDistance(1.2);
+    force.setUseSlabCorrection(true);
+    force.setInnerCutoffDistance(0.5);
+    force.setInnerSwitchingDistance(0.4);
+    force.setOuterShellForceGroup(3);
     force.addParticle(1, 0.1, 0.01);
     force.addParticle(0.5, 0.2, 0.02);
     force.addParticle(-0.5, 0.3, 0.03);
@@ -68,6 +79,11 @@ void testSerialization() {
     force.addGlobalParameter("scale1", 1.0);
     force.addGlobalParameter("scale2", 2.0);
     force.addParticleParameterOffset("scale1", 2, 1.5, 2.0, 2.5);
+    force.addLJType(0.25, 0.5);
+    force.addLJType(0.35, 0.8);
+    force.addLJTypePair(0, 1, 0.32, 0.9);
+    force.setParticleLJType(0, 1);
+    force.setParticleLJType(2, 0);
     force.addExceptionParameterOffset("scale2", 1, -0.1, -0.2, -0.3);
 
     // Serialize and then deserialize it.
@@ -95,6 +111,25 @@ void testSerialization() {
     ASSERT_EQUAL(force.getNumParticleParameterOffsets(), force2.getNumParticleParameterOffsets());
     ASSERT_EQUAL(force.getNumExceptionParameterOffsets(), force2.getNumExceptionParameterOffsets());
     ASSERT_EQUAL(force.getIncludeDirectSpace(), force2.getIncludeDirectSpace());
+    ASSERT_EQUAL(force.getPMEGridResizeThreshold(), force2.getPMEGridResizeThreshold());
+    int msmLevels, msmOrder, msmLevels2, msmOrder2;
+    force.getMSMParameters(msmLevels, msmOrder);
+    force2.getMSMParameters(msmLevels2, msmOrder2);
+    ASSERT_EQUAL(msmLevels, msmLevels2);
+    ASSERT_EQUAL(msmOrder, msmOrder2);
+    ASSERT_EQUAL(force.getDSFAlpha(), force2.getDSFAlpha());
+    ASSERT_EQUAL(force.getRBEBatchSize(), force2.getRBEBatchSize());
+    ASSERT_EQUAL(force.getRandomNumberSeed(), force2.getRandomNumberSeed());
+    int fmmOrder1, fmmOrder2, fmmDepth1, fmmDepth2;
+    force.getFMMParameters(fmmOrder1, fmmDepth1);
+    force2.getFMMParameters(fmmOrder2, fmmDepth2);
+    ASSERT_EQUAL(fmmOrder1, fmmOrder2);
+    ASSERT_EQUAL(fmmDepth1, fmmDepth2);
+    ASSERT_EQUAL(force.getLJCutoffDistance(), force2.getLJCutoffDistance());
+    ASSERT_EQUAL(force.getUseSlabCorrection(), force2.getUseSlabCorrection());
+    ASSERT_EQUAL(force.getInnerCutoffDistance(), force2.getInnerCutoffDistance());
+    ASSERT_EQUAL(force.getInnerSwitchingDistance(), force2.getInnerSwitchingDistance());
+    ASSERT_EQUAL(force.getOuterShellForceGroup(), force2.getOuterShellForceGroup());
     double alpha2;
     int nx2, ny2, nz2;
     force2.getPMEParameters(alpha2, nx2, ny2, nz2);
@@ -147,6 +182,26 @@ void testSerialization() {
         ASSERT_EQUAL(charge1, charge2);
         ASSERT_EQUAL(sigma1, sigma2);
         ASSERT_EQUAL(epsilon1, epsilon2);
+        ASSERT_EQUAL(force.getParticleLJType(i), force2.getParticleLJType(i));
+    }
+    ASSERT_EQUAL(force.getNumLJTypes(), force2.getNumLJTypes());
+    for (int i = 0; i < force.getNumLJTypes(); i++) {
+        double sigma1, epsilon1, sigma2, epsilon2;
+        force.getLJTypeParameters(i, sigma1, epsilon1);
+        force2.getLJTypeParameters(i, sigma2, epsilon2);
+        ASSERT_EQUAL(sigma1, sigma2);
+        ASSERT_EQUAL(epsilon1, epsilon2);
+    }
+    ASSERT_EQUAL(force.getNumLJTypePairs(), force2.getNumLJTypePairs());
+    for (int i = 0; i < force.getNumLJTypePairs(); i++) {
+        int a1, a2, b1, b2;
+        double sigma1, epsilon1, sigma2, epsilon2;
+        force.getLJTypePairParameters(i, a1, b1, sigma1, epsilon1);
+        force2.getLJTypePairParameters(i, a2, b2, sigma2, epsilon2);
+        ASSERT_EQUAL(a1, a2);
+        ASSERT_EQUAL(b1, b2);
+        ASSERT_EQUAL(sigma1, sigma2);
+        ASSERT_EQUAL(epsilon1, epsilon2);
     }
     ASSERT_EQUAL(force.getNumExceptions(), force2.getNumExceptions());
     for (int i = 0; i < force.getNumExceptions(); i++) {
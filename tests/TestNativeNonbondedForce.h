@@ -1011,6 +1011,755 @@ void testInstantiateFromNonbondedForce(Platform& platform) {
     const vector<Vec3>& forces2 = state2.getForces();
     for (int i = 0; i < 4; i++)
         ASSERT_EQUAL_VEC(forces1[i], forces2[i], 1e-5);
+
+    // The copied exceptions should be found when looking for duplicates.
+
+    bool threwException = false;
+    try {
+        newForce->addException(3, 0, 0.0, 1.0, 0.0);
+    }
+    catch (const OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+    ASSERT_EQUAL(2, newForce->addException(1, 0, 0.5, 1.0, 1.0, true));
+}
+
+void testPMEGridResize(Platform& platform) {
+    // Create a periodic system of random charges using PME with automatically chosen parameters.
+
+    const int numParticles = 100;
+    const double boxSize = 3.0;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NativeNonbondedForce* force = new NativeNonbondedForce();
+    system.addForce(force);
+    force->setNonbondedMethod(NativeNonbondedForce::PME);
+    force->setCutoffDistance(1.0);
+    force->setPMEGridResizeThreshold(0.1);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        force->addParticle(i%2 == 0 ? 1.0 : -1.0, 0.3, 0.5);
+        positions[i] = Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*boxSize;
+    }
+    VerletIntegrator integrator1(0.001);
+    Context context1(system, integrator1, platform);
+    context1.setPositions(positions);
+    context1.getState(State::Energy);
+    double alpha1, alpha2;
+    int nx1, ny1, nz1, nx2, ny2, nz2;
+    force->getPMEParametersInContext(context1, alpha1, nx1, ny1, nz1);
+
+    // A small change in the volume should leave the grid unchanged.
+
+    double scale = 1.02;
+    context1.setPeriodicBoxVectors(Vec3(scale*boxSize, 0, 0), Vec3(0, scale*boxSize, 0), Vec3(0, 0, scale*boxSize));
+    context1.getState(State::Energy);
+    force->getPMEParametersInContext(context1, alpha2, nx2, ny2, nz2);
+    ASSERT_EQUAL(nx1, nx2);
+    ASSERT_EQUAL(ny1, ny2);
+    ASSERT_EQUAL(nz1, nz2);
+
+    // Expand the box enough to trigger a new grid, and compare to a Context created for the larger box.
+
+    scale = 1.5;
+    vector<Vec3> scaledPositions(numParticles);
+    for (int i = 0; i < numParticles; i++)
+        scaledPositions[i] = positions[i]*scale;
+    context1.setPeriodicBoxVectors(Vec3(scale*boxSize, 0, 0), Vec3(0, scale*boxSize, 0), Vec3(0, 0, scale*boxSize));
+    context1.setPositions(scaledPositions);
+    State state1 = context1.getState(State::Forces | State::Energy);
+    force->getPMEParametersInContext(context1, alpha2, nx2, ny2, nz2);
+    ASSERT(nx2 > nx1);
+    ASSERT(ny2 > ny1);
+    ASSERT(nz2 > nz1);
+    ASSERT_EQUAL_TOL(alpha1, alpha2, 1e-10);
+    system.setDefaultPeriodicBoxVectors(Vec3(scale*boxSize, 0, 0), Vec3(0, scale*boxSize, 0), Vec3(0, 0, scale*boxSize));
+    VerletIntegrator integrator2(0.001);
+    Context context2(system, integrator2, platform);
+    context2.setPositions(scaledPositions);
+    State state2 = context2.getState(State::Forces | State::Energy);
+    double alpha3;
+    int nx3, ny3, nz3;
+    force->getPMEParametersInContext(context2, alpha3, nx3, ny3, nz3);
+    ASSERT_EQUAL(nx3, nx2);
+    ASSERT_EQUAL(ny3, ny2);
+    ASSERT_EQUAL(nz3, nz2);
+    ASSERT_EQUAL_TOL(state2.getPotentialEnergy(), state1.getPotentialEnergy(), 1e-5);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(state2.getForces()[i], state1.getForces()[i], 1e-5);
+
+    // Shrinking the box back should restore the original grid.
+
+    context1.setPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    context1.setPositions(positions);
+    context1.getState(State::Energy);
+    force->getPMEParametersInContext(context1, alpha2, nx2, ny2, nz2);
+    ASSERT_EQUAL(nx1, nx2);
+    ASSERT_EQUAL(ny1, ny2);
+    ASSERT_EQUAL(nz1, nz2);
+}
+
+void testSharedLJPMEGrid(Platform& platform) {
+    // When the Coulomb and dispersion grids have the same dimensions they may share FFTs.  Compare
+    // against the same interactions split into a Coulomb-only force and a dispersion-only force.
+
+    const int numParticles = 50;
+    const double boxSize = 3.0;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NativeNonbondedForce* coulomb = new NativeNonbondedForce();
+    NativeNonbondedForce* dispersion = new NativeNonbondedForce();
+    NativeNonbondedForce* combined = new NativeNonbondedForce();
+    coulomb->setNonbondedMethod(NativeNonbondedForce::PME);
+    coulomb->setPMEParameters(3.0, 24, 25, 26);
+    dispersion->setNonbondedMethod(NativeNonbondedForce::LJPME);
+    dispersion->setPMEParameters(3.0, 20, 20, 20);
+    dispersion->setLJPMEParameters(2.5, 24, 25, 26);
+    combined->setNonbondedMethod(NativeNonbondedForce::LJPME);
+    combined->setPMEParameters(3.0, 24, 25, 26);
+    combined->setLJPMEParameters(2.5, 24, 25, 26);
+    combined->setForceGroup(1);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        double charge = (i%2 == 0 ? 0.5 : -0.5);
+        double sigma = 0.2+0.1*genrand_real2(sfmt);
+        double epsilon = 0.5+0.5*genrand_real2(sfmt);
+        coulomb->addParticle(charge, 1.0, 0.0);
+        dispersion->addParticle(0.0, sigma, epsilon);
+        combined->addParticle(charge, sigma, epsilon);
+        positions[i] = Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*boxSize;
+    }
+    vector<NativeNonbondedForce*> forces = {coulomb, dispersion, combined};
+    for (NativeNonbondedForce* force : forces) {
+        force->setCutoffDistance(1.0);
+        force->setUseDispersionCorrection(false);
+        system.addForce(force);
+    }
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+    State state1 = context.getState(State::Forces | State::Energy, false, 1<<0);
+    State state2 = context.getState(State::Forces | State::Energy, false, 1<<1);
+    ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-5);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1e-5);
+}
+
+void testDampedShiftedForce(Platform& platform) {
+    // Three particles, two of which are excluded from each other.  Compute the expected energy and forces
+    // directly from the DSF pair potential, the correction for the excluded pair, and the self energy.
+
+    const double boxSize = 4.0;
+    const double cutoff = 1.5;
+    const double alpha = 1.8;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NativeNonbondedForce* force = new NativeNonbondedForce();
+    force->setNonbondedMethod(NativeNonbondedForce::DampedShiftedForce);
+    force->setCutoffDistance(cutoff);
+    force->setDSFAlpha(alpha);
+    force->setUseDispersionCorrection(false);
+    vector<double> charges = {1.0, -0.8, 0.5};
+    for (double q : charges) {
+        system.addParticle(1.0);
+        force->addParticle(q, 1.0, 0.0);
+    }
+    force->addException(0, 2, 0.0, 1.0, 0.0);
+    system.addForce(force);
+    vector<Vec3> positions = {Vec3(0, 0, 0), Vec3(0.8, 0, 0), Vec3(0, 0.3, 0)};
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+    State state = context.getState(State::Forces | State::Energy);
+    const double erfcCutoff = erfc(alpha*cutoff);
+    const double forceShift = erfcCutoff/(cutoff*cutoff) + 2*alpha*exp(-alpha*alpha*cutoff*cutoff)/(sqrt(M_PI)*cutoff);
+    const double energyShift = erfcCutoff/cutoff;
+    double expectedEnergy = 0.0;
+    vector<Vec3> expectedForces(3);
+    for (int i = 0; i < 3; i++) {
+        expectedEnergy -= ONE_4PI_EPS0*charges[i]*charges[i]*(0.5*energyShift + alpha/sqrt(M_PI));
+        for (int j = i+1; j < 3; j++) {
+            Vec3 delta = positions[j]-positions[i];
+            double r = sqrt(delta.dot(delta));
+            double prefactor = ONE_4PI_EPS0*charges[i]*charges[j];
+            double energy = prefactor*(erfc(alpha*r)/r - energyShift + forceShift*(r-cutoff));
+            double dEdR = prefactor*(-erfc(alpha*r)/(r*r) - 2*alpha*exp(-alpha*alpha*r*r)/(sqrt(M_PI)*r) + forceShift);
+            if (i == 0 && j == 2) {
+                energy -= prefactor/r;
+                dEdR += prefactor/(r*r);
+            }
+            expectedEnergy += energy;
+            expectedForces[i] += delta*(dEdR/r);
+            expectedForces[j] -= delta*(dEdR/r);
+        }
+    }
+    ASSERT_EQUAL_TOL(expectedEnergy, state.getPotentialEnergy(), 1e-4);
+    for (int i = 0; i < 3; i++)
+        ASSERT_EQUAL_VEC(expectedForces[i], state.getForces()[i], 1e-4);
+
+    // Beyond the cutoff, both the energy and the force of a pair vanish.
+
+    positions[1] = Vec3(1.6, 0, 0);
+    positions[2] = Vec3(3.2, 0, 0);
+    context.setPositions(positions);
+    state = context.getState(State::Forces);
+    ASSERT_EQUAL_VEC(Vec3(0, 0, 0), state.getForces()[0], 1e-4);
+}
+
+void testIPS(Platform& platform) {
+    // Three particles, two of which are excluded from each other.  Compute the expected energy and forces
+    // directly from the IPS pair potentials, the correction for the excluded pair, and the self energy.
+
+    const double boxSize = 4.0;
+    const double cutoff = 1.5;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NativeNonbondedForce* force = new NativeNonbondedForce();
+    force->setNonbondedMethod(NativeNonbondedForce::IPS);
+    force->setCutoffDistance(cutoff);
+    force->setUseSwitchingFunction(true);
+    force->setSwitchingDistance(1.0);
+    vector<double> charges = {1.0, -0.8, 0.5};
+    vector<double> sigmas = {0.3, 0.35, 0.4};
+    vector<double> epsilons = {0.5, 1.0, 0.7};
+    for (int i = 0; i < 3; i++) {
+        system.addParticle(1.0);
+        force->addParticle(charges[i], sigmas[i], epsilons[i]);
+    }
+    force->addException(0, 2, 0.0, 1.0, 0.0);
+    system.addForce(force);
+    vector<Vec3> positions = {Vec3(0, 0, 0), Vec3(0.8, 0, 0), Vec3(0, 0.3, 0)};
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+    State state = context.getState(State::Forces | State::Energy);
+    const double a0 = -35.0/16.0, a1 = 35.0/16.0, a2 = -21.0/16.0, a3 = 5.0/16.0;
+    const double b1 = 9.0/14.0, b2 = -3.0/28.0, b3 = 6.0/7.0, b0 = 1.0+b1+b2+b3;
+    double expectedEnergy = 0.0;
+    vector<Vec3> expectedForces(3);
+    for (int i = 0; i < 3; i++) {
+        expectedEnergy += 0.5*ONE_4PI_EPS0*charges[i]*charges[i]*a0/cutoff;
+        for (int j = i+1; j < 3; j++) {
+            Vec3 delta = positions[j]-positions[i];
+            double r = sqrt(delta.dot(delta));
+            double u = r/cutoff;
+            double prefactor = ONE_4PI_EPS0*charges[i]*charges[j];
+            double energy = prefactor*(a0+a1*u*u+a2*pow(u, 4)+a3*pow(u, 6))/cutoff;
+            double dEdR = prefactor*(2*a1*u+4*a2*pow(u, 3)+6*a3*pow(u, 5))/(cutoff*cutoff);
+            if (i != 0 || j != 2) {
+                double sigma = 0.5*(sigmas[i]+sigmas[j]);
+                double c6 = 4*sqrt(epsilons[i]*epsilons[j])*pow(sigma, 6);
+                energy += prefactor/r + c6*pow(sigma, 6)/pow(r, 12) - c6/pow(r, 6) - c6*(b1*u*u+b2*pow(u, 4)+b3*pow(u, 6)-b0)/pow(cutoff, 6);
+                dEdR += -prefactor/(r*r) - 12*c6*pow(sigma, 6)/pow(r, 13) + 6*c6/pow(r, 7) - c6*(2*b1*u+4*b2*pow(u, 3)+6*b3*pow(u, 5))/pow(cutoff, 7);
+            }
+            expectedEnergy += energy;
+            expectedForces[i] += delta*(dEdR/r);
+            expectedForces[j] -= delta*(dEdR/r);
+        }
+    }
+    ASSERT_EQUAL_TOL(expectedEnergy, state.getPotentialEnergy(), 1e-4);
+    for (int i = 0; i < 3; i++)
+        ASSERT_EQUAL_VEC(expectedForces[i], state.getForces()[i], 1e-4);
+
+    // The Coulomb and dispersion forces go to zero at the cutoff.
+
+    positions[1] = Vec3(cutoff-1e-4, 0, 0);
+    positions[2] = Vec3(0, 2.0, 0);
+    context.setPositions(positions);
+    state = context.getState(State::Forces);
+    ASSERT_EQUAL_VEC(Vec3(0, 0, 0), state.getForces()[1], 1e-3);
+}
+
+void testSeparateCutoffs(Platform& platform) {
+    // A force with separate Coulomb and Lennard-Jones cutoffs should be equivalent to two forces, one containing
+    // only the Coulomb interaction and one containing only the Lennard-Jones interaction, each with its own cutoff.
+
+    const int gridSize = 5;
+    const int numParticles = gridSize*gridSize*gridSize;
+    const double boxSize = 3.0;
+    const double spacing = boxSize/gridSize;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NativeNonbondedForce* combined = new NativeNonbondedForce();
+    NativeNonbondedForce* coulomb = new NativeNonbondedForce();
+    NativeNonbondedForce* lj = new NativeNonbondedForce();
+    coulomb->setForceGroup(1);
+    lj->setForceGroup(1);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        double charge = (i%2 == 0 ? 0.5 : -0.5);
+        combined->addParticle(charge, 0.3, 0.5);
+        coulomb->addParticle(charge, 0.3, 0.0);
+        lj->addParticle(0.0, 0.3, 0.5);
+        Vec3 jitter(genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5);
+        positions[i] = Vec3(i%gridSize, (i/gridSize)%gridSize, i/(gridSize*gridSize))*spacing + jitter*0.2;
+    }
+    for (NativeNonbondedForce* force : {combined, coulomb, lj}) {
+        force->setUseSwitchingFunction(true);
+        force->setSwitchingDistance(0.7);
+        system.addForce(force);
+    }
+    coulomb->setUseDispersionCorrection(false);
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+    NativeNonbondedForce::NonbondedMethod methods[] = {NativeNonbondedForce::CutoffPeriodic, NativeNonbondedForce::PME,
+            NativeNonbondedForce::DampedShiftedForce, NativeNonbondedForce::IPS};
+    for (NativeNonbondedForce::NonbondedMethod method : methods) {
+        for (int longerCutoff = 0; longerCutoff < 2; longerCutoff++) {
+            double coulombCutoff = (longerCutoff == 0 ? 0.8 : 1.2);
+            double ljCutoff = (longerCutoff == 0 ? 1.2 : 0.8);
+            combined->setCutoffDistance(coulombCutoff);
+            combined->setLJCutoffDistance(ljCutoff);
+            coulomb->setCutoffDistance(coulombCutoff);
+            lj->setCutoffDistance(ljCutoff);
+            for (NativeNonbondedForce* force : {combined, coulomb, lj})
+                force->setNonbondedMethod(method);
+            context.reinitialize(true);
+            State state1 = context.getState(State::Forces | State::Energy, false, 1<<0);
+            State state2 = context.getState(State::Forces | State::Energy, false, 1<<1);
+            ASSERT_EQUAL_TOL(state2.getPotentialEnergy(), state1.getPotentialEnergy(), 1e-5);
+            for (int i = 0; i < numParticles; i++)
+                ASSERT_EQUAL_VEC(state2.getForces()[i], state1.getForces()[i], 1e-4);
+        }
+    }
+}
+
+void testBulkParameters(Platform& platform) {
+    // Set parameters through the array methods and check that they produce the same energy as setting them one
+    // at a time.
+
+    const int numParticles = 20;
+    System system;
+    vector<double> charges, sigmas, epsilons, chargeProds, exceptionSigmas, exceptionEpsilons;
+    vector<int> particles1, particles2;
+    vector<Vec3> positions;
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        charges.push_back(i%2 == 0 ? 0.3 : -0.3);
+        sigmas.push_back(0.2+0.01*i);
+        epsilons.push_back(0.5+0.05*i);
+        positions.push_back(Vec3(0.4*(i%4), 0.4*((i/4)%4), 0.4*(i/16)));
+    }
+    for (int i = 0; i < numParticles-1; i += 2) {
+        particles1.push_back(i);
+        particles2.push_back(i+1);
+        chargeProds.push_back(0.1*i);
+        exceptionSigmas.push_back(0.3);
+        exceptionEpsilons.push_back(0.2);
+    }
+    NativeNonbondedForce* bulk = new NativeNonbondedForce();
+    NativeNonbondedForce* single = new NativeNonbondedForce();
+    ASSERT_EQUAL(0, bulk->addParticles(charges, sigmas, epsilons));
+    ASSERT_EQUAL(0, bulk->addExceptions(particles1, particles2, chargeProds, exceptionSigmas, exceptionEpsilons));
+    for (int i = 0; i < numParticles; i++)
+        single->addParticle(charges[i], sigmas[i], epsilons[i]);
+    for (int i = 0; i < particles1.size(); i++)
+        single->addException(particles1[i], particles2[i], chargeProds[i], exceptionSigmas[i], exceptionEpsilons[i]);
+    single->setForceGroup(1);
+    system.addForce(bulk);
+    system.addForce(single);
+    VerletIntegrator integrator(0.01);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+    ASSERT_EQUAL_TOL(context.getState(State::Energy, false, 1<<1).getPotentialEnergy(), context.getState(State::Energy, false, 1<<0).getPotentialEnergy(), 1e-10);
+
+    // Modify the parameters of both forces and update the Context.
+
+    for (int i = 0; i < numParticles; i++) {
+        charges[i] *= 1.5;
+        single->setParticleParameters(i, charges[i], sigmas[i], epsilons[i]);
+    }
+    for (int i = 0; i < particles1.size(); i++) {
+        exceptionEpsilons[i] = 0.1*i;
+        single->setExceptionParameters(i, particles1[i], particles2[i], chargeProds[i], exceptionSigmas[i], exceptionEpsilons[i]);
+    }
+    bulk->setAllParticleParameters(charges, sigmas, epsilons);
+    bulk->setAllExceptionParameters(particles1, particles2, chargeProds, exceptionSigmas, exceptionEpsilons);
+    bulk->updateParametersInContext(context);
+    single->updateParametersInContext(context);
+    ASSERT_EQUAL_TOL(context.getState(State::Energy, false, 1<<1).getPotentialEnergy(), context.getState(State::Energy, false, 1<<0).getPotentialEnergy(), 1e-10);
+
+    // Read them back.
+
+    vector<double> charges2, sigmas2, epsilons2, chargeProds2, exceptionSigmas2, exceptionEpsilons2;
+    vector<int> particles1b, particles2b;
+    bulk->getAllParticleParameters(charges2, sigmas2, epsilons2);
+    bulk->getAllExceptionParameters(particles1b, particles2b, chargeProds2, exceptionSigmas2, exceptionEpsilons2);
+    ASSERT(charges2 == charges && sigmas2 == sigmas && epsilons2 == epsilons);
+    ASSERT(particles1b == particles1 && particles2b == particles2 && chargeProds2 == chargeProds);
+    ASSERT(exceptionSigmas2 == exceptionSigmas && exceptionEpsilons2 == exceptionEpsilons);
+
+    // Arrays of the wrong length and duplicate exceptions should be rejected.
+
+    bool threwException = false;
+    try {
+        bulk->setAllParticleParameters(charges, sigmas, vector<double>(numParticles-1));
+    }
+    catch (const OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+    threwException = false;
+    try {
+        bulk->addExceptions(particles2, particles1, chargeProds, exceptionSigmas, exceptionEpsilons);
+    }
+    catch (const OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+}
+
+void testPartialParameterUpdates(Platform& platform) {
+    // Change a few parameters at a time and check that each of two Contexts ends up with the same energy as a
+    // Context created from scratch.
+
+    const int numParticles = 30;
+    const double boxSize = 3.0;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NativeNonbondedForce* force = new NativeNonbondedForce();
+    force->setNonbondedMethod(NativeNonbondedForce::PME);
+    force->setCutoffDistance(1.0);
+    force->setUseDispersionCorrection(true);
+    vector<Vec3> positions;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        force->addParticle(i%2 == 0 ? 0.5 : -0.5, 0.3, 0.5);
+        positions.push_back(Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*boxSize);
+    }
+    for (int i = 0; i < numParticles-1; i += 3)
+        force->addException(i, i+1, 0.1, 0.3, 0.2);
+    system.addForce(force);
+    VerletIntegrator integrator1(0.01), integrator2(0.01);
+    Context context1(system, integrator1, platform);
+    Context context2(system, integrator2, platform);
+    context1.setPositions(positions);
+    context2.setPositions(positions);
+    for (int step = 0; step < 3; step++) {
+        force->setParticleParameters(2*step, 0.2*step, 0.25, 0.4+step);
+        force->setParticleParameters(2*step+7, -0.3, 0.35, 0.6);
+        force->setExceptionParameters(step+1, 3*(step+1), 3*(step+1)+1, 0.05*step, 0.3, 0.1*step);
+        force->updateParametersInContext(context1);
+        if (step != 1)
+            force->updateParametersInContext(context2);
+        VerletIntegrator integrator(0.01);
+        Context context(system, integrator, platform);
+        context.setPositions(positions);
+        double expected = context.getState(State::Energy).getPotentialEnergy();
+        ASSERT_EQUAL_TOL(expected, context1.getState(State::Energy).getPotentialEnergy(), 1e-5);
+        if (step != 1)
+            ASSERT_EQUAL_TOL(expected, context2.getState(State::Energy).getPotentialEnergy(), 1e-5);
+    }
+}
+
+void testCreateExceptionsFromBonds() {
+    // Build a branched chain and check the exceptions created from its bonds.
+
+    NativeNonbondedForce force;
+    for (int i = 0; i < 7; i++)
+        force.addParticle(0.1*(i+1), 0.2+0.01*i, 0.5+0.1*i);
+    vector<pair<int, int> > bonds;
+    bonds.push_back(pair<int, int>(0, 1));
+    bonds.push_back(pair<int, int>(1, 2));
+    bonds.push_back(pair<int, int>(2, 3));
+    bonds.push_back(pair<int, int>(3, 4));
+    bonds.push_back(pair<int, int>(6, 1));
+    bonds.push_back(pair<int, int>(5, 4));
+    force.createExceptionsFromBonds(bonds, 0.5, 0.25);
+
+    // Pairs separated by at most three bonds, ordered by the second particle and then the first, and whether each
+    // one is a 1-4 interaction.
+
+    int expected[][3] = {{0, 1, 0}, {0, 2, 0}, {1, 2, 0}, {0, 3, 1}, {1, 3, 0}, {2, 3, 0}, {1, 4, 1}, {2, 4, 0}, {3, 4, 0},
+                         {2, 5, 1}, {3, 5, 0}, {4, 5, 0}, {0, 6, 0}, {1, 6, 0}, {2, 6, 0}, {3, 6, 1}};
+    ASSERT_EQUAL(16, force.getNumExceptions());
+    for (int i = 0; i < force.getNumExceptions(); i++) {
+        int particle1, particle2;
+        double chargeProd, sigma, epsilon;
+        force.getExceptionParameters(i, particle1, particle2, chargeProd, sigma, epsilon);
+        ASSERT_EQUAL(expected[i][0], particle1);
+        ASSERT_EQUAL(expected[i][1], particle2);
+        if (expected[i][2]) {
+            ASSERT_EQUAL_TOL(0.5*0.1*(particle1+1)*0.1*(particle2+1), chargeProd, 1e-10);
+            ASSERT_EQUAL_TOL(0.2+0.005*(particle1+particle2), sigma, 1e-10);
+            ASSERT_EQUAL_TOL(0.25*sqrt((0.5+0.1*particle1)*(0.5+0.1*particle2)), epsilon, 1e-10);
+        }
+        else {
+            ASSERT_EQUAL(0.0, chargeProd);
+            ASSERT_EQUAL(0.0, epsilon);
+        }
+    }
+
+    // A second exception for the same pair is rejected whichever order the particles are listed in, unless it
+    // replaces the existing one.
+
+    bool threwException = false;
+    try {
+        force.addException(4, 1, 0.0, 1.0, 0.0);
+    }
+    catch (const OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+    ASSERT_EQUAL(6, force.addException(4, 1, 0.3, 0.4, 0.5, true));
+    ASSERT_EQUAL(16, force.getNumExceptions());
+    ASSERT_EQUAL(16, force.addException(0, 5, 0.3, 0.4, 0.5));
+}
+
+void testInvalidExceptions(Platform& platform) {
+    // Creating a Context should fail if two exceptions involve the same pair of particles, or an exception
+    // involves a particle that does not exist.
+
+    for (int test = 0; test < 2; test++) {
+        System system;
+        NativeNonbondedForce* force = new NativeNonbondedForce();
+        for (int i = 0; i < 3; i++) {
+            system.addParticle(1.0);
+            force->addParticle(0.0, 1.0, 0.0);
+        }
+        force->addException(0, 1, 0.0, 1.0, 0.0);
+        force->addException(1, 2, 0.0, 1.0, 0.0);
+        if (test == 0)
+            force->setExceptionParameters(1, 1, 0, 0.0, 1.0, 0.0);
+        else
+            force->setExceptionParameters(1, 1, 3, 0.0, 1.0, 0.0);
+        system.addForce(force);
+        VerletIntegrator integrator(0.01);
+        bool threwException = false;
+        try {
+            Context context(system, integrator, platform);
+        }
+        catch (const OpenMMException& ex) {
+            threwException = true;
+        }
+        ASSERT(threwException);
+    }
+}
+
+void testDispersionCorrectionOffsets(Platform& platform) {
+    // The dispersion correction should follow the current values of global parameters that offset sigma and
+    // epsilon, as well as changes made with updateParametersInContext().
+
+    const int numParticles = 40;
+    const double boxSize = 3.0;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NativeNonbondedForce* force = new NativeNonbondedForce();
+    force->setNonbondedMethod(NativeNonbondedForce::CutoffPeriodic);
+    force->setCutoffDistance(1.0);
+    force->setUseDispersionCorrection(true);
+    vector<Vec3> positions;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        force->addParticle(0.0, i%3 == 0 ? 0.3 : 0.35, i%2 == 0 ? 0.5 : 0.8);
+        positions.push_back(Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*boxSize);
+    }
+    force->addGlobalParameter("lambda", 0.0);
+    for (int i = 0; i < numParticles; i += 5)
+        force->addParticleParameterOffset("lambda", i, 0.0, 0.05, -0.2);
+    system.addForce(force);
+    VerletIntegrator integrator(0.01);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+    for (int step = 0; step < 3; step++) {
+        double lambda = 0.4*(step+1);
+        context.setParameter("lambda", lambda);
+        if (step == 2) {
+            force->setParticleParameters(1, 0.0, 0.4, 0.3);
+            force->setParticleParameters(5, 0.0, 0.25, 0.7);
+            force->updateParametersInContext(context);
+        }
+        force->setGlobalParameterDefaultValue(0, lambda);
+        VerletIntegrator integrator2(0.01);
+        Context context2(system, integrator2, platform);
+        context2.setPositions(positions);
+        double expected = context2.getState(State::Energy).getPotentialEnergy();
+        ASSERT_EQUAL_TOL(expected, context.getState(State::Energy).getPotentialEnergy(), 1e-5);
+    }
+
+    // Setting a parameter with a nonzero default to 0 before the first evaluation must also be seen by the
+    // correction.
+
+    force->setGlobalParameterDefaultValue(0, 1.0);
+    VerletIntegrator integrator3(0.01);
+    Context context3(system, integrator3, platform);
+    context3.setPositions(positions);
+    context3.setParameter("lambda", 0.0);
+    force->setGlobalParameterDefaultValue(0, 0.0);
+    VerletIntegrator integrator4(0.01);
+    Context context4(system, integrator4, platform);
+    context4.setPositions(positions);
+    double expected = context4.getState(State::Energy).getPotentialEnergy();
+    ASSERT_EQUAL_TOL(expected, context3.getState(State::Energy).getPotentialEnergy(), 1e-5);
+}
+
+void testLJTypes(Platform& platform) {
+    // Assigning atom types without any overrides should give the same result as putting the same parameters on
+    // the particles, including the dispersion correction.
+
+    const int numParticles = 40;
+    const double boxSize = 3.0;
+    const double typeSigma[] = {0.3, 0.35, 0.4};
+    const double typeEpsilon[] = {0.5, 0.8, 0.0};
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NativeNonbondedForce* typed = new NativeNonbondedForce();
+    NativeNonbondedForce* standard = new NativeNonbondedForce();
+    vector<Vec3> positions;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < 3; i++)
+        typed->addLJType(typeSigma[i], typeEpsilon[i]);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        double charge = (i%2 == 0 ? 0.5 : -0.5);
+        typed->addParticle(charge, 1.0, 10.0);
+        typed->setParticleLJType(i, i%3);
+        standard->addParticle(charge, typeSigma[i%3], typeEpsilon[i%3]);
+        positions.push_back(Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*boxSize);
+    }
+    for (int i = 0; i < numParticles-1; i += 4) {
+        typed->addException(i, i+1, 0.1, 0.3, 0.2);
+        standard->addException(i, i+1, 0.1, 0.3, 0.2);
+    }
+    for (NativeNonbondedForce* force : {typed, standard}) {
+        force->setNonbondedMethod(NativeNonbondedForce::PME);
+        force->setCutoffDistance(1.0);
+        force->setUseDispersionCorrection(true);
+    }
+    typed->setForceGroup(1);
+    standard->setForceGroup(2);
+    system.addForce(typed);
+    system.addForce(standard);
+    VerletIntegrator integrator(0.01);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+    State state1 = context.getState(State::Forces | State::Energy, false, 1<<1);
+    State state2 = context.getState(State::Forces | State::Energy, false, 1<<2);
+    ASSERT_EQUAL_TOL(state2.getPotentialEnergy(), state1.getPotentialEnergy(), 1e-5);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(state2.getForces()[i], state1.getForces()[i], 1e-5);
+
+    // An override for a pair of types should be equivalent to adding exceptions for every pair of particles
+    // with those types.
+
+    typed->addLJTypePair(0, 1, 0.45, 1.2);
+    for (int i = 0; i < numParticles; i++)
+        for (int j = 0; j < i; j++)
+            if ((i%3 == 0 && j%3 == 1) || (i%3 == 1 && j%3 == 0)) {
+                if (i%4 == 1 && j == i-1)
+                    continue;
+                standard->addException(j, i, 0.0, 0.45, 1.2);
+            }
+    for (NativeNonbondedForce* force : {typed, standard}) {
+        force->setNonbondedMethod(NativeNonbondedForce::NoCutoff);
+        force->setUseDispersionCorrection(false);
+        for (int i = 0; i < numParticles; i++) {
+            double charge, sigma, epsilon;
+            force->getParticleParameters(i, charge, sigma, epsilon);
+            force->setParticleParameters(i, 0.0, sigma, epsilon);
+        }
+    }
+    context.reinitialize(true);
+    state1 = context.getState(State::Forces | State::Energy, false, 1<<1);
+    state2 = context.getState(State::Forces | State::Energy, false, 1<<2);
+    ASSERT_EQUAL_TOL(state2.getPotentialEnergy(), state1.getPotentialEnergy(), 1e-5);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(state2.getForces()[i], state1.getForces()[i], 1e-5);
+
+    // Changing types and the parameters of a pair in updateParametersInContext() should match a new Context.
+
+    typed->setParticleLJType(3, 1);
+    typed->setParticleLJType(4, 2);
+    typed->setLJTypePairParameters(0, 0, 1, 0.42, 1.0);
+    typed->setLJTypeParameters(2, 0.38, 0.3);
+    typed->updateParametersInContext(context);
+    double energy = context.getState(State::Energy, false, 1<<1).getPotentialEnergy();
+    VerletIntegrator integrator2(0.01);
+    Context context2(system, integrator2, platform);
+    context2.setPositions(positions);
+    ASSERT_EQUAL_TOL(context2.getState(State::Energy, false, 1<<1).getPotentialEnergy(), energy, 1e-5);
+
+    // Particles without a valid type should be rejected.
+
+    typed->setParticleLJType(5, -1);
+    bool threwException = false;
+    try {
+        typed->updateParametersInContext(context);
+    }
+    catch (const OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+}
+
+void testParticleClasses(Platform& platform) {
+    // Mix particles that are charged, have Lennard-Jones parameters, both, or neither, and compare to a
+    // standard NonbondedForce.  A global parameter turns on the charge of some uncharged particles, which
+    // changes the terms they take part in.
+
+    const int numParticles = 60;
+    const double boxSize = 3.0;
+    OpenMM::NonbondedForce* force = new OpenMM::NonbondedForce();
+    vector<Vec3> positions;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        double charge = (i%4 == 0 || i%4 == 1 ? (i%8 < 4 ? 0.4 : -0.4) : 0.0);
+        double epsilon = (i%4 == 0 || i%4 == 2 ? 0.6 : 0.0);
+        force->addParticle(charge, 0.3, epsilon);
+        positions.push_back(Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*boxSize);
+    }
+    for (int i = 0; i < numParticles-1; i += 5)
+        force->addException(i, i+1, 0.0, 1.0, 0.0);
+    force->addGlobalParameter("charge", 0.0);
+    for (int i = 2; i < numParticles; i += 8)
+        force->addParticleParameterOffset("charge", i, 0.5, 0.0, 0.0);
+    force->setCutoffDistance(1.0);
+    force->setSwitchingDistance(0.8);
+    OpenMM::NonbondedForce::NonbondedMethod methods[] = {OpenMM::NonbondedForce::NoCutoff, OpenMM::NonbondedForce::CutoffPeriodic, OpenMM::NonbondedForce::PME};
+    for (OpenMM::NonbondedForce::NonbondedMethod method : methods) {
+        force->setNonbondedMethod(method);
+        force->setUseSwitchingFunction(method != OpenMM::NonbondedForce::NoCutoff);
+        System system1, system2;
+        for (System* system : {&system1, &system2}) {
+            system->setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+            for (int i = 0; i < numParticles; i++)
+                system->addParticle(1.0);
+        }
+        system1.addForce(new OpenMM::NonbondedForce(*force));
+        system2.addForce(new NativeNonbondedForce(*force));
+        VerletIntegrator integrator1(0.001), integrator2(0.001);
+        Context context1(system1, integrator1, platform);
+        Context context2(system2, integrator2, platform);
+        context1.setPositions(positions);
+        context2.setPositions(positions);
+        for (double charge : {0.0, 1.0}) {
+            context1.setParameter("charge", charge);
+            context2.setParameter("charge", charge);
+            State state1 = context1.getState(State::Forces | State::Energy);
+            State state2 = context2.getState(State::Forces | State::Energy);
+            ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-5);
+            for (int i = 0; i < numParticles; i++)
+                ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1e-5);
+        }
+    }
+    delete force;
 }
 
 void runPlatformTests();
@@ -1038,6 +1787,18 @@ int main(int argc, char* argv[]) {
         testEwaldExceptions(platform);
         testDirectAndReciprocal(platform);
         testInstantiateFromNonbondedForce(platform);
+        testPMEGridResize(platform);
+        testSharedLJPMEGrid(platform);
+        testDampedShiftedForce(platform);
+        testIPS(platform);
+        testSeparateCutoffs(platform);
+        testBulkParameters(platform);
+        testPartialParameterUpdates(platform);
+        testCreateExceptionsFromBonds();
+        testInvalidExceptions(platform);
+        testDispersionCorrectionOffsets(platform);
+        testLJTypes(platform);
+        testParticleClasses(platform);
         runPlatformTests();
     }
     catch(const exception& e) {